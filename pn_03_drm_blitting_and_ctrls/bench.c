@@ -0,0 +1,1786 @@
+/*
+ * Microbenchmarks of the CPU image kernels, run with --bench.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "blend.h"
+#include "bluenoise.h"
+#include "convert.h"
+#include "dispatch.h"
+#include "errdiff.h"
+#include "fill.h"
+#include "format.h"
+#include "histogram.h"
+#include "image.h"
+#include "pool.h"
+#include "rotate.h"
+#include "rt.h"
+#include "scale.h"
+#include "wc.h"
+#include "y4conv.h"
+#include "y4lut.h"
+#include "y4pack.h"
+#include "ypack.h"
+
+#define BENCH_WIDTH 1872
+#define BENCH_HEIGHT 1404
+
+int bench_image_alloc(struct bench_image* img, uint32_t width,
+    uint32_t height, uint32_t bpp)
+{
+    img->width = width;
+    img->height = height;
+    img->pitch = ((width * bpp + 7) / 8 + 63) & ~63;
+    img->size = (size_t)img->pitch * height;
+    img->data = (uint8_t*)aligned_alloc(64, img->size);
+    if (!img->data) {
+        printf("bench: out of memory\n");
+        return -ENOMEM;
+    }
+
+    memset(img->data, 0, img->size);
+    return 0;
+}
+
+void bench_image_free(struct bench_image* img)
+{
+    free(img->data);
+    img->data = NULL;
+}
+
+/* xorshift noise over the whole image, the same for the same seed */
+static void bench_image_noise(struct bench_image* img, uint32_t seed)
+{
+    size_t i;
+
+    for (i = 0; i < img->size; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        img->data[i] = seed;
+    }
+}
+
+double bench_run(void (*fn)(void* ctx), void* ctx)
+{
+    uint64_t start, t, best = UINT64_MAX, total = 0;
+
+    /* warm up caches and page tables first */
+    fn(ctx);
+    do {
+        start = rt_now_ns();
+        fn(ctx);
+        t = rt_now_ns() - start;
+        if (t < best)
+            best = t;
+        total += t;
+    } while (total < 200000000ULL);
+
+    return best / 1e9;
+}
+
+/* best time per call on 1, 2, ... threads of the pool */
+static void bench_scaling(const char* name, void (*fn)(void* ctx), void* ctx,
+    double work, const char* unit)
+{
+    unsigned int n, threads = pool_size();
+    double t, t1 = 0;
+
+    printf("%s scaling:", name);
+    for (n = 1; n <= threads; n++) {
+        pool_set_limit(n);
+        t = bench_run(fn, ctx);
+        if (n == 1)
+            t1 = t;
+        printf("%s %u thread%s %.1f %s (%.2fx)", n > 1 ? "," : "", n, n > 1 ? "s" : "",
+            work / t, unit, t1 / t);
+    }
+    printf("\n");
+    pool_set_limit(0);
+}
+
+/*
+ * One check of the kernels of a module: fn(ctx) writes out, which has to
+ * match ref where there is one and pass check(ctx) where there is that.
+ * Timed runs report the work of one call in unit per second.
+ */
+struct bench_case {
+    char label[96];
+    void (*fn)(void* ctx);
+    void* ctx;
+    struct bench_image* out;
+    /* copied to out before a run instead of clearing it, for in place kernels */
+    const struct bench_image* start;
+    const struct bench_image* ref;
+    /* only rows of row_bytes at pitch are compared if row_bytes is set */
+    uint32_t rows;
+    uint32_t row_bytes;
+    uint32_t pitch;
+    int (*check)(void* ctx);
+    int timed;
+    double work;
+    const char* unit;
+};
+
+static void bench_case_init(struct bench_case* bc, void (*fn)(void* ctx), void* ctx,
+    struct bench_image* out, int timed, double work, const char* unit)
+{
+    memset(bc, 0, sizeof(*bc));
+    bc->fn = fn;
+    bc->ctx = ctx;
+    bc->out = out;
+    bc->timed = timed;
+    bc->work = work;
+    bc->unit = unit;
+}
+
+static void bench_case_reset(const struct bench_case* bc)
+{
+    if (bc->start)
+        memcpy(bc->out->data, bc->start->data, bc->out->size);
+    else if (bc->out)
+        memset(bc->out->data, 0, bc->out->size);
+}
+
+static int bench_case_differs(const struct bench_case* bc)
+{
+    uint32_t y;
+
+    if (!bc->row_bytes)
+        return memcmp(bc->ref->data, bc->out->data, bc->out->size) != 0;
+    for (y = 0; y < bc->rows; y++) {
+        if (memcmp(bc->ref->data + (size_t)y * bc->pitch, bc->out->data + (size_t)y * bc->pitch,
+                bc->row_bytes))
+            return 1;
+    }
+    return 0;
+}
+
+/* times the case if asked, then runs it once more on a reset output to check it */
+static void bench_case_run(const struct bench_case* bc, const char* kernel)
+{
+    double t;
+
+    if (bc->timed) {
+        bench_case_reset(bc);
+        t = bench_run(bc->fn, bc->ctx);
+        printf("%s: %-7s %8.2f %s\n", bc->label, kernel, bc->work / t, bc->unit);
+    }
+    bench_case_reset(bc);
+    bc->fn(bc->ctx);
+    if ((bc->ref && bench_case_differs(bc)) || (bc->check && bc->check(bc->ctx)))
+        printf("%s: %s MISMATCH\n", bc->label, kernel);
+}
+
+/* the case on every available kernel from first on */
+template <typename E>
+static void bench_kernels(const struct bench_case* bc, int first, int count,
+    int (*available)(E), const char* (*name)(E), void (*select)(int))
+{
+    int k;
+
+    for (k = first; k < count; k++) {
+        if (!available((E)k))
+            continue;
+        select(k);
+        bench_case_run(bc, name((E)k));
+    }
+    select(-1);
+}
+
+/*
+ * Kernel 0, the scalar or generic loop, writes ref on one thread, every
+ * other kernel has to write the same.
+ */
+template <typename E>
+static void bench_kernels_ref(struct bench_case* bc, struct bench_image* ref, int count,
+    int (*available)(E), const char* (*name)(E), void (*select)(int))
+{
+    pool_set_limit(1);
+    select(0);
+    bc->ref = NULL;
+    bench_case_run(bc, name((E)0));
+    memcpy(ref->data, bc->out->data, ref->size);
+
+    bc->ref = ref;
+    bench_kernels(bc, 1, count, available, name, select);
+    pool_set_limit(0);
+}
+
+struct fill_ctx {
+    struct bench_image* img;
+    uint32_t bpp;
+    uint32_t value;
+};
+
+/* the per-pixel loop draw_rect used before the fill kernels */
+template <uint32_t DRM>
+static void naive_fill(void* arg)
+{
+    struct fill_ctx* c = (struct fill_ctx*)arg;
+    uint32_t i, j;
+
+    for (i = 0; i < c->img->height; i++) {
+        uint8_t* row = c->img->data + (size_t)i * c->img->pitch;
+
+        for (j = 0; j < c->img->width; j++)
+            pixel<DRM>::store(row, j, c->value);
+    }
+}
+
+static void kernel_fill(void* arg)
+{
+    struct fill_ctx* c = (struct fill_ctx*)arg;
+
+    fill_rect(c->img->data, c->img->pitch, c->bpp, 0, 0, c->img->width,
+        c->img->height, c->value);
+}
+
+template <uint32_t DRM>
+static void bench_fill_format(const char* name)
+{
+    struct bench_image ref, img;
+    struct bench_case bc;
+    struct fill_ctx c;
+    size_t saved_nt = fill_nt_threshold;
+    int nt;
+
+    if (bench_image_alloc(&ref, BENCH_WIDTH, BENCH_HEIGHT, pixel<DRM>::bpp)
+        || bench_image_alloc(&img, BENCH_WIDTH, BENCH_HEIGHT, pixel<DRM>::bpp))
+        return;
+
+    c.bpp = pixel<DRM>::bpp;
+    c.value = pixel<DRM>::pack(0xff, 0x12, 0x9a, 0xe4);
+    c.img = &ref;
+    bench_case_init(&bc, naive_fill<DRM>, &c, &ref, 1,
+        BENCH_HEIGHT * ((BENCH_WIDTH * pixel<DRM>::bpp + 7) / 8) / 1e9, "GB/s");
+    snprintf(bc.label, sizeof(bc.label), "fill %s %ux%u", name, BENCH_WIDTH, BENCH_HEIGHT);
+    bench_case_run(&bc, "naive");
+
+    c.img = &img;
+    bc.fn = kernel_fill;
+    bc.out = &img;
+    bc.ref = &ref;
+    for (nt = 0; nt < 2; nt++) {
+        fill_nt_threshold = nt ? 1 : 0;
+        snprintf(bc.label, sizeof(bc.label), "fill %s %ux%u%s", name, BENCH_WIDTH,
+            BENCH_HEIGHT, nt ? " non-temporal" : "");
+        bench_kernels(&bc, 0, NUM_FILL_KERNELS, fill_kernel_available, fill_kernel_name,
+            fill_select_kernel);
+    }
+
+    fill_nt_threshold = saved_nt;
+    if (DRM == DRM_FORMAT_XRGB8888)
+        bench_scaling("fill XRGB32", kernel_fill, &c, bc.work, "GB/s");
+    bench_image_free(&ref);
+    bench_image_free(&img);
+}
+
+static void bench_fill(void)
+{
+    bench_fill_format<DRM_FORMAT_XRGB8888>("XRGB32");
+    bench_fill_format<DRM_FORMAT_RGB888>("RGB24");
+    bench_fill_format<DRM_FORMAT_RGB565>("RGB565");
+    bench_fill_format<DRM_FORMAT_R4>("Y4");
+}
+
+struct y4conv_ctx {
+    struct image dst;
+    struct image src;
+    struct y4conv_params params;
+};
+
+static void kernel_y4conv(void* arg)
+{
+    struct y4conv_ctx* c = (struct y4conv_ctx*)arg;
+
+    y4conv_frame(&c->dst, &c->src, &c->params);
+}
+
+static void bench_to_image(struct image* img, struct bench_image* b,
+    const struct pix_fmt* f)
+{
+    img->data = b->data;
+    img->width = b->width;
+    img->height = b->height;
+    img->pitch = b->pitch;
+    img->fmt = f;
+}
+
+/* the RGA definition without dither: upper 4 bits of the Y400 luma */
+static int check_y4_reference(struct bench_image* ref, const struct image* src,
+    int r, int g, int b)
+{
+    uint32_t cpp = src->fmt->bpp / 8, x, y;
+    struct image dst;
+
+    bench_to_image(&dst, ref, pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4));
+    for (y = 0; y < src->height; y++) {
+        const uint8_t* s = image_row(src, y);
+        const uint8_t* d = image_row(&dst, y);
+
+        for (x = 0; x < src->width; x++, s += cpp) {
+            if ((d[x / 2] >> (x & 1 ? 0 : 4) & 0xf) != rgb_to_luma(s[r], s[g], s[b]) >> 4)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The linear curve has to give what no curve does, the curve of a panel
+ * with crowded dark levels the same on every kernel.
+ */
+static void bench_y4conv_curves(struct bench_case* bc, struct y4conv_ctx* c,
+    struct bench_image* ref, int r, int g, int b)
+{
+    static const uint8_t gray[16] = {
+        0, 4, 9, 15, 22, 31, 42, 55, 70, 88, 108, 131, 157, 187, 220, 255
+    };
+    struct y4_curve linear, panel;
+    int timed = bc->timed;
+
+    y4_curve_linear(&linear);
+    y4_curve_from_levels(&panel, gray);
+
+    c->params.dither = 0;
+    c->params.curve = &linear;
+    bc->timed = 0;
+    snprintf(bc->label, sizeof(bc->label), "y4conv %s %ux%u linear curve", c->src.fmt->name,
+        c->src.width, c->src.height);
+    bench_kernels_ref(bc, ref, NUM_Y4CONV_KERNELS, y4conv_kernel_available, y4conv_kernel_name,
+        y4conv_select_kernel);
+    if (check_y4_reference(ref, &c->src, r, g, b))
+        printf("%s: REFERENCE MISMATCH\n", bc->label);
+
+    c->params.curve = &panel;
+    bc->timed = timed;
+    snprintf(bc->label, sizeof(bc->label), "y4conv %s %ux%u curve", c->src.fmt->name,
+        c->src.width, c->src.height);
+    bench_kernels_ref(bc, ref, NUM_Y4CONV_KERNELS, y4conv_kernel_available, y4conv_kernel_name,
+        y4conv_select_kernel);
+    c->params.curve = NULL;
+}
+
+static void bench_y4conv_format(const struct pix_fmt* f, int r, int g, int b,
+    uint32_t width, uint32_t height, int verbose)
+{
+    struct bench_image src, ref, out;
+    struct bench_case bc;
+    struct y4conv_ctx c;
+    char dither[16];
+    int mode;
+
+    if (bench_image_alloc(&src, width, height, f->bpp)
+        || bench_image_alloc(&ref, width, height, 4)
+        || bench_image_alloc(&out, width, height, 4))
+        return;
+    /* noise, so the dither and all luma levels are exercised */
+    bench_image_noise(&src, 0x12345678);
+
+    bench_to_image(&c.src, &src, f);
+    bench_to_image(&c.dst, &out, pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4));
+    bench_case_init(&bc, kernel_y4conv, &c, &out, verbose, width * height / 1e6, "Mpx/s");
+    for (mode = -1; mode < NUM_Y4_DITHER_MODES; mode++) {
+        c.params.dither = mode >= 0;
+        c.params.dither_mode = (enum y4_dither_mode)(mode >= 0 ? mode : 0);
+        c.params.levels = 16;
+        c.params.curve = NULL;
+
+        if (mode < 0)
+            snprintf(dither, sizeof(dither), "dither off");
+        else
+            snprintf(dither, sizeof(dither), "dither %d", mode);
+        snprintf(bc.label, sizeof(bc.label), "y4conv %s %ux%u %s", f->name, width, height,
+            dither);
+        bench_kernels_ref(&bc, &ref, NUM_Y4CONV_KERNELS, y4conv_kernel_available,
+            y4conv_kernel_name, y4conv_select_kernel);
+        if (mode < 0 && check_y4_reference(&ref, &c.src, r, g, b))
+            printf("%s: REFERENCE MISMATCH\n", bc.label);
+
+        /* the bands on all CPUs have to give the same, only checked */
+        bc.timed = 0;
+        snprintf(bc.label, sizeof(bc.label), "y4conv %s %ux%u %s all CPUs", f->name, width,
+            height, dither);
+        bench_kernels(&bc, 0, NUM_Y4CONV_KERNELS, y4conv_kernel_available, y4conv_kernel_name,
+            y4conv_select_kernel);
+        bc.timed = verbose;
+    }
+
+    bench_y4conv_curves(&bc, &c, &ref, r, g, b);
+
+    if (verbose && f->v4l2 == V4L2_PIX_FMT_RGB24) {
+        c.params.dither = 0;
+        bench_scaling("y4conv RGB24", kernel_y4conv, &c, bc.work, "Mpx/s");
+    }
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+
+static void bench_y4conv(void)
+{
+    const struct {
+        uint32_t v4l2;
+        int r, g, b;
+    } srcs[] = {
+        { V4L2_PIX_FMT_RGB24, 0, 1, 2 },
+        { V4L2_PIX_FMT_XRGB32, 1, 2, 3 },
+        { V4L2_PIX_FMT_ABGR32, 2, 1, 0 },
+        { V4L2_PIX_FMT_GREY, 0, 0, 0 },
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(srcs) / sizeof(srcs[0]); i++) {
+        const struct pix_fmt* f = pix_fmt_by_v4l2(srcs[i].v4l2);
+
+        /* odd sizes exercise the row tails, only checked */
+        bench_y4conv_format(f, srcs[i].r, srcs[i].g, srcs[i].b, 101, 37, 0);
+        bench_y4conv_format(f, srcs[i].r, srcs[i].g, srcs[i].b, BENCH_WIDTH,
+            BENCH_HEIGHT, 1);
+    }
+}
+
+struct y4lut_ctx {
+    struct image img;
+    struct y4_lut lut;
+};
+
+static void kernel_y4lut(void* arg)
+{
+    struct y4lut_ctx* c = (struct y4lut_ctx*)arg;
+
+    y4_lut_apply(&c->img, &c->lut);
+}
+
+static void bench_y4lut(void)
+{
+    struct bench_image src, ref, out;
+    struct bench_case bc;
+    struct y4lut_ctx c;
+    size_t i;
+
+    if (bench_image_alloc(&src, BENCH_WIDTH, BENCH_HEIGHT, 4)
+        || bench_image_alloc(&ref, BENCH_WIDTH, BENCH_HEIGHT, 4)
+        || bench_image_alloc(&out, BENCH_WIDTH, BENCH_HEIGHT, 4))
+        return;
+    bench_image_noise(&src, 0x9e3779b9);
+
+    /* a gamma-like curve, every level maps somewhere else */
+    for (i = 0; i < 16; i++)
+        c.lut.map[i] = 15 - (15 - i) * (15 - i) / 15;
+    for (i = 0; i < src.size; i++)
+        ref.data[i] = c.lut.map[src.data[i] >> 4] << 4 | c.lut.map[src.data[i] & 0xf];
+    /* row padding is not remapped */
+    for (i = 0; i < BENCH_HEIGHT; i++)
+        memcpy(ref.data + i * ref.pitch + BENCH_WIDTH / 2,
+            src.data + i * src.pitch + BENCH_WIDTH / 2, ref.pitch - BENCH_WIDTH / 2);
+
+    bench_to_image(&c.img, &out, pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4));
+    bench_case_init(&bc, kernel_y4lut, &c, &out, 1, BENCH_HEIGHT * BENCH_WIDTH / 2 / 1e9, "GB/s");
+    bc.start = &src;
+    bc.ref = &ref;
+    snprintf(bc.label, sizeof(bc.label), "y4lut %ux%u", BENCH_WIDTH, BENCH_HEIGHT);
+    bench_kernels(&bc, 0, NUM_Y4LUT_KERNELS, y4lut_kernel_available, y4lut_kernel_name,
+        y4lut_select_kernel);
+
+    bench_scaling("y4lut", kernel_y4lut, &c, bc.work, "GB/s");
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+
+struct rotate_ctx {
+    struct image dst;
+    struct image src;
+    int degrees;
+    int hflip;
+    int vflip;
+};
+
+static void kernel_rotate(void* arg)
+{
+    struct rotate_ctx* c = (struct rotate_ctx*)arg;
+
+    rotate_image(&c->dst, &c->src, c->degrees, c->hflip, c->vflip);
+}
+
+static uint32_t get_px(const struct image* img, uint32_t x, uint32_t y)
+{
+    const uint8_t* row = image_row(img, y);
+    uint32_t cpp = img->fmt->bpp / 8, v = 0;
+
+    if (!cpp)
+        return row[x / 2] >> (x & 1 ? 0 : 4) & 0xf;
+    memcpy(&v, row + x * cpp, cpp);
+    return v;
+}
+
+/* mirror, then rotate clockwise, one pixel at a time */
+static int check_rotate(void* arg)
+{
+    struct rotate_ctx* c = (struct rotate_ctx*)arg;
+    uint32_t w = c->src.width, h = c->src.height, x, y, u, v;
+
+    for (y = 0; y < c->dst.height; y++) {
+        for (x = 0; x < c->dst.width; x++) {
+            switch (c->degrees) {
+            case 90:
+                u = y, v = h - 1 - x;
+                break;
+            case 180:
+                u = w - 1 - x, v = h - 1 - y;
+                break;
+            case 270:
+                u = w - 1 - y, v = x;
+                break;
+            default:
+                u = x, v = y;
+                break;
+            }
+            if (c->hflip)
+                u = w - 1 - u;
+            if (c->vflip)
+                v = h - 1 - v;
+            if (get_px(&c->dst, x, y) != get_px(&c->src, u, v))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static void bench_rotate_format(const struct pix_fmt* f, uint32_t width,
+    uint32_t height, int verbose)
+{
+    static const struct {
+        const char* name;
+        int degrees, hflip, vflip;
+    } ops[] = {
+        { "hflip", 0, 1, 0 },
+        { "vflip", 0, 0, 1 },
+        { "90", 90, 0, 0 },
+        { "180", 180, 0, 0 },
+        { "270", 270, 0, 0 },
+        { "90+hflip", 90, 1, 0 },
+        { "270+vflip", 270, 0, 1 },
+    };
+    struct bench_image src, out;
+    struct bench_case bc;
+    struct rotate_ctx c;
+    unsigned int i;
+
+    if (bench_image_alloc(&src, width, height, f->bpp)
+        || bench_image_alloc(&out, height > width ? height : width,
+            height > width ? height : width, f->bpp))
+        return;
+    bench_image_noise(&src, 0x2545f491);
+    bench_to_image(&c.src, &src, f);
+    bench_to_image(&c.dst, &out, f);
+    bench_case_init(&bc, kernel_rotate, &c, &out, verbose, width * height / 1e6, "Mpx/s");
+    bc.check = check_rotate;
+
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        c.degrees = ops[i].degrees;
+        c.hflip = ops[i].hflip;
+        c.vflip = ops[i].vflip;
+        c.dst.width = c.degrees % 180 ? height : width;
+        c.dst.height = c.degrees % 180 ? width : height;
+        c.dst.pitch = ((c.dst.width * f->bpp + 7) / 8 + 63) & ~63;
+
+        snprintf(bc.label, sizeof(bc.label), "rotate %s %ux%u %s", f->name, width, height,
+            ops[i].name);
+        bench_kernels(&bc, 0, NUM_ROTATE_KERNELS, rotate_kernel_available, rotate_kernel_name,
+            rotate_select_kernel);
+    }
+
+    if (verbose && f->bpp == 32) {
+        c.degrees = 90;
+        c.hflip = c.vflip = 0;
+        c.dst.width = height;
+        c.dst.height = width;
+        c.dst.pitch = ((height * 4) + 63) & ~63;
+        bench_scaling("rotate 90 XRGB32", kernel_rotate, &c, bc.work, "Mpx/s");
+    }
+    bench_image_free(&src);
+    bench_image_free(&out);
+}
+
+static void bench_rotate(void)
+{
+    const struct pix_fmt* fmts[] = {
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_GREY),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_XRGB32),
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+        /* odd sizes exercise partial tiles and nibble edges, only checked */
+        bench_rotate_format(fmts[i], 101, 37, 0);
+        /* in the cache the kernels show, a full frame is bound by memory */
+        bench_rotate_format(fmts[i], 256, 256, 1);
+        bench_rotate_format(fmts[i], BENCH_WIDTH, BENCH_HEIGHT, 1);
+    }
+}
+
+struct errdiff_ctx {
+    struct image dst;
+    struct image src;
+    enum errdiff_method method;
+    unsigned int levels;
+};
+
+static void kernel_errdiff(void* arg)
+{
+    struct errdiff_ctx* c = (struct errdiff_ctx*)arg;
+
+    errdiff_frame(&c->dst, &c->src, c->method, c->levels);
+}
+
+/* only the allowed levels, and the same mean gray as the source */
+static int check_errdiff(void* arg)
+{
+    struct errdiff_ctx* c = (struct errdiff_ctx*)arg;
+    uint32_t x, y, v;
+    double in = 0, out = 0;
+
+    for (y = 0; y < c->src.height; y++) {
+        const uint8_t* s = image_row(&c->src, y);
+        const uint8_t* d = image_row(&c->dst, y);
+
+        for (x = 0; x < c->src.width; x++, s += 3) {
+            v = d[x / 2] >> (x & 1 ? 0 : 4) & 0xf;
+            if (v * (c->levels - 1) % 15)
+                return -1;
+            in += rgb_to_luma(s[0], s[1], s[2]);
+            out += v * 17;
+        }
+    }
+    in /= (double)c->src.width * c->src.height;
+    out /= (double)c->src.width * c->src.height;
+    return in - out > 4 || out - in > 4 ? -1 : 0;
+}
+
+static void bench_errdiff_size(uint32_t width, uint32_t height, int verbose)
+{
+    static const unsigned int levels[] = { 16, 4, 2 };
+    struct bench_image src, ref, out;
+    struct bench_case bc;
+    struct errdiff_ctx c;
+    uint32_t x, y;
+    unsigned int l;
+    char threads[16];
+    int m;
+
+    if (bench_image_alloc(&src, width, height, 24)
+        || bench_image_alloc(&ref, width, height, 4)
+        || bench_image_alloc(&out, width, height, 4))
+        return;
+    /* smooth gradients, where diffusion and its artifacts show */
+    for (y = 0; y < height; y++) {
+        uint8_t* p = src.data + (size_t)y * src.pitch;
+
+        for (x = 0; x < width; x++, p += 3) {
+            p[0] = x * 255 / width;
+            p[1] = y * 255 / height;
+            p[2] = (x + y) * 127 / (width + height);
+        }
+    }
+
+    bench_to_image(&c.src, &src, pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24));
+    bench_to_image(&c.dst, &out, pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4));
+    bench_case_init(&bc, kernel_errdiff, &c, &out, verbose, width * height / 1e6, "Mpx/s");
+    snprintf(threads, sizeof(threads), "%u threads", pool_size());
+    for (m = 0; m < NUM_ERRDIFF_METHODS; m++) {
+        for (l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+            c.method = (enum errdiff_method)m;
+            c.levels = levels[l];
+            snprintf(bc.label, sizeof(bc.label), "errdiff %s %u levels %ux%u",
+                errdiff_method_name(c.method), c.levels, width, height);
+
+            bc.ref = NULL;
+            bc.check = check_errdiff;
+            pool_set_limit(1);
+            bench_case_run(&bc, "1 thread");
+            memcpy(ref.data, out.data, out.size);
+
+            /* the wavefront must not change the result */
+            bc.ref = &ref;
+            bc.check = NULL;
+            pool_set_limit(0);
+            bench_case_run(&bc, threads);
+        }
+    }
+
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+
+static void bench_errdiff(void)
+{
+    /* odd sizes exercise the row ends and partial blocks, only checked */
+    bench_errdiff_size(101, 37, 0);
+    bench_errdiff_size(BENCH_WIDTH, BENCH_HEIGHT, 1);
+}
+
+struct bluenoise_ctx {
+    struct image dst;
+    struct image src;
+    unsigned int levels;
+};
+
+static void kernel_bluenoise(void* arg)
+{
+    struct bluenoise_ctx* c = (struct bluenoise_ctx*)arg;
+
+    bluenoise_frame(&c->dst, &c->src, c->levels);
+}
+
+struct copy_ctx {
+    struct bench_image* dst;
+    const struct bench_image* src;
+};
+
+static void kernel_copy(void* arg)
+{
+    struct copy_ctx* c = (struct copy_ctx*)arg;
+
+    memcpy(c->dst->data, c->src->data, c->src->size);
+}
+
+/* only the allowed levels, and the mean gray of the source within a step */
+static int check_bluenoise(void* arg)
+{
+    struct bluenoise_ctx* c = (struct bluenoise_ctx*)arg;
+    uint32_t x, y, v;
+    double in = 0, out = 0;
+
+    for (y = 0; y < c->src.height; y++) {
+        const uint8_t* s = image_row(&c->src, y);
+        const uint8_t* d = image_row(&c->dst, y);
+
+        for (x = 0; x < c->src.width; x++) {
+            v = d[x / 2] >> (x & 1 ? 0 : 4) & 0xf;
+            if (v * (c->levels - 1) % 15)
+                return -1;
+            in += s[x];
+            out += v * 17;
+        }
+    }
+    in /= (double)c->src.width * c->src.height;
+    out /= (double)c->src.width * c->src.height;
+    return in - out > 4 || out - in > 4 ? -1 : 0;
+}
+
+static void bench_bluenoise_size(uint32_t width, uint32_t height, int verbose)
+{
+    static const unsigned int levels[] = { 16, 4, 2 };
+    struct bench_image src, ref, out, copy;
+    struct bench_case bc;
+    struct bluenoise_ctx c;
+    struct copy_ctx cc;
+    uint32_t x, y;
+    unsigned int l, pattern;
+    double t;
+
+    if (bench_image_alloc(&src, width, height, 8)
+        || bench_image_alloc(&ref, width, height, 4)
+        || bench_image_alloc(&out, width, height, 4)
+        || bench_image_alloc(&copy, width, height, 8))
+        return;
+    if (verbose) {
+        /* what a copy of the luma costs, the bound a lookup per pixel aims at */
+        cc.dst = &copy;
+        cc.src = &src;
+        pool_set_limit(1);
+        t = bench_run(kernel_copy, &cc);
+        pool_set_limit(0);
+        printf("bluenoise memcpy of the luma %ux%u: %.2f GB/s\n", width, height,
+            src.size / t / 1e9);
+    }
+
+    bench_to_image(&c.src, &src, pix_fmt_by_v4l2(V4L2_PIX_FMT_GREY));
+    bench_to_image(&c.dst, &out, pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4));
+    bench_case_init(&bc, kernel_bluenoise, &c, &out, verbose, src.size / 1e9, "GB/s");
+    for (pattern = 0; pattern < 2; pattern++) {
+        /* noise for the edge cases, a gradient for the mean gray */
+        bench_image_noise(&src, 0x2545f491);
+        for (y = 0; pattern && y < height; y++) {
+            uint8_t* p = src.data + (size_t)y * src.pitch;
+
+            for (x = 0; x < width; x++)
+                p[x] = x * 255 / (width - 1);
+        }
+        bc.check = pattern ? check_bluenoise : NULL;
+
+        for (l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+            c.levels = levels[l];
+            snprintf(bc.label, sizeof(bc.label), "bluenoise %s %u levels %ux%u",
+                pattern ? "gradient" : "noise", c.levels, width, height);
+            bench_kernels_ref(&bc, &ref, NUM_BLUENOISE_KERNELS, bluenoise_kernel_available,
+                bluenoise_kernel_name, bluenoise_select_kernel);
+        }
+    }
+    if (verbose)
+        bench_scaling("bluenoise GREY 2 levels", kernel_bluenoise, &c,
+            width * height / 1e6, "Mpx/s");
+
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+    bench_image_free(&copy);
+}
+
+static void bench_bluenoise_rgb(void)
+{
+    struct bench_image src, out;
+    struct bench_case bc;
+    struct bluenoise_ctx c;
+
+    if (bench_image_alloc(&src, BENCH_WIDTH, BENCH_HEIGHT, 24)
+        || bench_image_alloc(&out, BENCH_WIDTH, BENCH_HEIGHT, 4))
+        return;
+    memset(src.data, 0x80, src.size);
+    bench_to_image(&c.src, &src, pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24));
+    bench_to_image(&c.dst, &out, pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4));
+    c.levels = 16;
+    bench_case_init(&bc, kernel_bluenoise, &c, &out, 1, BENCH_WIDTH * BENCH_HEIGHT / 1e6,
+        "Mpx/s");
+    snprintf(bc.label, sizeof(bc.label), "bluenoise RGB24 16 levels %ux%u", BENCH_WIDTH,
+        BENCH_HEIGHT);
+    bench_case_run(&bc, "default");
+
+    bench_image_free(&src);
+    bench_image_free(&out);
+}
+
+static void bench_bluenoise(void)
+{
+    /* odd sizes exercise the SIMD tails and nibble edges, only checked */
+    bench_bluenoise_size(101, 37, 0);
+    bench_bluenoise_size(BENCH_WIDTH, BENCH_HEIGHT, 1);
+    bench_bluenoise_rgb();
+}
+
+struct ypack_ctx {
+    struct image dst;
+    struct image src;
+    int dither;
+};
+
+static void kernel_ypack(void* arg)
+{
+    struct ypack_ctx* c = (struct ypack_ctx*)arg;
+
+    ypack_frame(&c->dst, &c->src, c->dither);
+}
+
+static void bench_ypack_size(uint32_t width, uint32_t height, int verbose)
+{
+    struct bench_image src, ref, out;
+    struct bench_case bc;
+    struct ypack_ctx c;
+    unsigned int bpp;
+
+    if (bench_image_alloc(&src, width, height, 8)
+        || bench_image_alloc(&ref, width, height, 2)
+        || bench_image_alloc(&out, width, height, 2))
+        return;
+    /* noise, so both sides of every threshold are taken */
+    bench_image_noise(&src, 0x2545f491);
+
+    bench_to_image(&c.src, &src, pix_fmt_by_v4l2(V4L2_PIX_FMT_GREY));
+    bench_case_init(&bc, kernel_ypack, &c, &out, verbose, width * height / 1e6, "Mpx/s");
+    for (bpp = 1; bpp <= 2; bpp++) {
+        for (c.dither = 0; c.dither <= 1; c.dither++) {
+            bench_to_image(&c.dst, &out, ypack_fmt(bpp));
+            snprintf(bc.label, sizeof(bc.label), "ypack GREY to Y%u %s %ux%u", bpp,
+                c.dither ? "dithered" : "threshold", width, height);
+            bench_kernels_ref(&bc, &ref, NUM_YPACK_KERNELS, ypack_kernel_available,
+                ypack_kernel_name, ypack_select_kernel);
+        }
+    }
+
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+
+/* the post-pass over a Y4 frame, and what it saves on the display side */
+static void bench_ypack_y4(void)
+{
+    struct bench_image src, out;
+    struct bench_case bc;
+    struct ypack_ctx c;
+    unsigned int bpp;
+    uint32_t x;
+
+    if (bench_image_alloc(&src, BENCH_WIDTH, BENCH_HEIGHT, 4)
+        || bench_image_alloc(&out, BENCH_WIDTH, BENCH_HEIGHT, 2))
+        return;
+    for (x = 0; x < src.size; x++)
+        src.data[x] = x * 0x11;
+
+    bench_to_image(&c.src, &src, pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4));
+    bench_case_init(&bc, kernel_ypack, &c, &out, 1, BENCH_WIDTH * BENCH_HEIGHT / 1e6, "Mpx/s");
+    c.dither = 1;
+    for (bpp = 1; bpp <= 2; bpp++) {
+        bench_to_image(&c.dst, &out, ypack_fmt(bpp));
+        c.dst.pitch = ((BENCH_WIDTH * bpp + 7) / 8 + 63) & ~63;
+        snprintf(bc.label, sizeof(bc.label), "ypack Y4 to Y%u dithered %ux%u", bpp, BENCH_WIDTH,
+            BENCH_HEIGHT);
+        bench_case_run(&bc, "default");
+        printf("%s: %zu instead of %zu bytes per frame\n", bc.label,
+            (size_t)c.dst.pitch * BENCH_HEIGHT, src.size);
+    }
+
+    bench_image_free(&src);
+    bench_image_free(&out);
+}
+
+static void bench_ypack(void)
+{
+    /* odd sizes exercise the partial bytes at the row ends, only checked */
+    bench_ypack_size(101, 37, 0);
+    bench_ypack_size(BENCH_WIDTH, BENCH_HEIGHT, 1);
+    bench_ypack_y4();
+}
+
+struct scale_ctx {
+    struct image dst;
+    struct image src;
+};
+
+static void kernel_scale(void* arg)
+{
+    struct scale_ctx* c = (struct scale_ctx*)arg;
+
+    scale_image(&c->dst, &c->src);
+}
+
+/* src to dst size on every kernel, the vector ones against the scalar one */
+static void bench_scale_format(const struct pix_fmt* f, uint32_t sw, uint32_t sh,
+    uint32_t dw, uint32_t dh, int verbose)
+{
+    struct bench_image src, ref, out;
+    struct bench_case bc;
+    struct scale_ctx c;
+    uint32_t y;
+
+    if (bench_image_alloc(&src, sw, sh, f->bpp)
+        || bench_image_alloc(&ref, dw, dh, f->bpp)
+        || bench_image_alloc(&out, dw, dh, f->bpp))
+        return;
+    bench_image_noise(&src, 0x2545f491);
+
+    bench_to_image(&c.src, &src, f);
+    bench_to_image(&c.dst, &out, f);
+    bench_case_init(&bc, kernel_scale, &c, &out, verbose, dw * dh / 1e6, "Mpx/s");
+    snprintf(bc.label, sizeof(bc.label), "scale %s %ux%u to %ux%u", f->name, sw, sh, dw, dh);
+    bench_kernels_ref(&bc, &ref, NUM_SCALE_KERNELS, scale_kernel_available, scale_kernel_name,
+        scale_select_kernel);
+
+    /* the same size has to come out unchanged, but for a last half byte */
+    for (y = 0; sw == dw && sh == dh && y < sh; y++) {
+        if (memcmp(src.data + (size_t)y * src.pitch, ref.data + (size_t)y * ref.pitch,
+                sw * f->bpp / 8)) {
+            printf("%s: NOT AN IDENTITY\n", bc.label);
+            break;
+        }
+    }
+    if (verbose)
+        bench_scaling("scale", kernel_scale, &c, bc.work, "Mpx/s");
+
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+
+static void bench_scale(void)
+{
+    const struct pix_fmt* fmts[] = {
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_GREY),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_XRGB32),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB565),
+        pix_fmt_by_v4l2(V4L2_PIX_FMT_ARGB444),
+    };
+    unsigned int i;
+
+    /* odd sizes and mixed directions, only checked */
+    for (i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+        bench_scale_format(fmts[i], 101, 37, 101, 37, 0);
+        bench_scale_format(fmts[i], 101, 37, 37, 101, 0);
+        bench_scale_format(fmts[i], 101, 37, 13, 5, 0);
+        bench_scale_format(fmts[i], 7, 3, 101, 37, 0);
+        /* whole factors, summed as boxes */
+        bench_scale_format(fmts[i], 99, 36, 33, 12, 0);
+        bench_scale_format(fmts[i], 110, 37, 10, 37, 0);
+    }
+    /* a thumbnail of the panel, and a half size frame brought up to it */
+    bench_scale_format(pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24), BENCH_WIDTH, BENCH_HEIGHT,
+        BENCH_WIDTH / 8, BENCH_HEIGHT / 8, 1);
+    bench_scale_format(pix_fmt_by_v4l2(V4L2_PIX_FMT_XRGB32), BENCH_WIDTH / 2, BENCH_HEIGHT / 2,
+        BENCH_WIDTH, BENCH_HEIGHT, 1);
+}
+
+struct blend_ctx {
+    struct image dst;
+    struct image src;
+    struct bench_image* dst_data;
+    const struct bench_image* start;
+    enum blend_op op;
+    int premultiplied;
+};
+
+static void kernel_blend(void* arg)
+{
+    struct blend_ctx* c = (struct blend_ctx*)arg;
+
+    /* the destination is blended into, start from the same pixels each time */
+    memcpy(c->dst_data->data, c->start->data, c->start->size);
+    blend_frame(&c->dst, &c->src, c->op, c->premultiplied);
+}
+
+static void bench_blend_size(const struct pix_fmt* f, uint32_t width, uint32_t height,
+    int verbose)
+{
+    struct bench_image src, start, ref, out;
+    struct bench_case bc;
+    struct blend_ctx c;
+    uint32_t i;
+    int op;
+
+    if (bench_image_alloc(&src, width, height, 32)
+        || bench_image_alloc(&start, width, height, 32)
+        || bench_image_alloc(&ref, width, height, 32)
+        || bench_image_alloc(&out, width, height, 32))
+        return;
+    /* noise with an eighth of the bytes, alphas among them, 0 or 255 */
+    bench_image_noise(&src, 0x2545f491);
+    bench_image_noise(&start, 0x9e3779b9);
+    for (i = 0; i < src.size; i++) {
+        if ((start.data[i] & 7) == 0)
+            src.data[i] = start.data[i] & 0x80 ? 0xff : 0;
+    }
+
+    bench_to_image(&c.src, &src, f);
+    bench_to_image(&c.dst, &out, f);
+    c.dst_data = &out;
+    c.start = &start;
+    bench_case_init(&bc, kernel_blend, &c, &out, 0, width * height / 1e6, "Mpx/s");
+    for (c.premultiplied = 1; c.premultiplied >= 0; c.premultiplied--) {
+        for (op = 0; op < NUM_BLEND_OPS; op++) {
+            c.op = (enum blend_op)op;
+            /* the common ones are timed, all are checked */
+            bc.timed = verbose && (op == BLEND_SRCOVER || op == BLEND_DSTOVER);
+            snprintf(bc.label, sizeof(bc.label), "blend %s %s %s %ux%u", f->name,
+                blend_op_name(c.op), c.premultiplied ? "premultiplied" : "straight", width,
+                height);
+            bench_kernels_ref(&bc, &ref, NUM_BLEND_KERNELS, blend_kernel_available,
+                blend_kernel_name, blend_select_kernel);
+
+            /* premultiplied SRC and DST are plain copies */
+            for (i = 0; c.premultiplied && (op == BLEND_SRC || op == BLEND_DST) && i < height; i++) {
+                if (memcmp(ref.data + (size_t)i * ref.pitch,
+                        (op == BLEND_SRC ? src.data : start.data) + (size_t)i * src.pitch,
+                        4 * width)) {
+                    printf("%s: BAD OUTPUT\n", bc.label);
+                    break;
+                }
+            }
+        }
+    }
+
+    bench_image_free(&src);
+    bench_image_free(&start);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+
+static void bench_blend(void)
+{
+    bench_blend_size(pix_fmt_by_v4l2(V4L2_PIX_FMT_ARGB32), 101, 37, 0);
+    bench_blend_size(pix_fmt_by_v4l2(V4L2_PIX_FMT_ABGR32), 101, 37, 0);
+    bench_blend_size(pix_fmt_by_v4l2(V4L2_PIX_FMT_ARGB32), BENCH_WIDTH, BENCH_HEIGHT, 1);
+}
+
+struct convert_ctx {
+    struct image dst;
+    struct image src;
+};
+
+static void kernel_convert(void* arg)
+{
+    struct convert_ctx* c = (struct convert_ctx*)arg;
+
+    convert_image(&c->dst, &c->src);
+}
+
+/* planar formats unpadded, as image_from_bo() sees a buffer */
+static void bench_to_frame(struct image* img, struct bench_image* b, const struct pix_fmt* f)
+{
+    bench_to_image(img, b, f);
+    if (f->planes > 1)
+        img->pitch = pix_fmt_row_bytes(f, b->width);
+}
+
+/* a fast path on every kernel against the generic loop of its pair */
+static void bench_convert_pair(uint32_t src_v4l2, uint32_t dst_v4l2, uint32_t width,
+    uint32_t height, int verbose)
+{
+    const struct pix_fmt* sf = pix_fmt_by_v4l2(src_v4l2);
+    const struct pix_fmt* df = pix_fmt_by_v4l2(dst_v4l2);
+    struct bench_image src, ref, out;
+    struct bench_case bc;
+    struct convert_ctx c;
+
+    if (bench_image_alloc(&src, width, height, pix_fmt_frame_bpp(sf))
+        || bench_image_alloc(&ref, width, height, pix_fmt_frame_bpp(df))
+        || bench_image_alloc(&out, width, height, pix_fmt_frame_bpp(df)))
+        return;
+    bench_image_noise(&src, 0x2545f491);
+
+    bench_to_frame(&c.src, &src, sf);
+    bench_to_frame(&c.dst, &out, df);
+    bench_case_init(&bc, kernel_convert, &c, &out, verbose, width * height / 1e6, "Mpx/s");
+    bc.rows = height;
+    bc.row_bytes = pix_fmt_row_bytes(df, width);
+    bc.pitch = c.dst.pitch;
+    snprintf(bc.label, sizeof(bc.label), "convert %s to %s %ux%u", sf->name, df->name, width,
+        height);
+    bench_kernels_ref(&bc, &ref, NUM_CONVERT_KERNELS, convert_kernel_available,
+        convert_kernel_name, convert_select_kernel);
+    if (verbose)
+        bench_scaling(bc.label, kernel_convert, &c, bc.work, "Mpx/s");
+
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+
+/* largest channel error after RGB24 to f and back, -1 for the gray formats */
+static int convert_round_trip_tolerance(const struct pix_fmt* f)
+{
+    unsigned int cpp, chan[3];
+
+    if (!pix_fmt_rgb_layout(f, &cpp, chan))
+        return 0;
+    switch (f->v4l2) {
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_ARGB555:
+        return 7;
+    case V4L2_PIX_FMT_ARGB444:
+        return 15;
+    case V4L2_PIX_FMT_GREY:
+    case V4L2_PIX_FMT_Y4:
+        return -1;
+    }
+    /* limited range quantization and the averaged chroma of a gradient */
+    return 8;
+}
+
+/* a gradient through every format and back, then every pair of formats */
+static void bench_convert_matrix(void)
+{
+    const uint32_t width = 102, height = 38;
+    const struct pix_fmt* rgb24 = pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24);
+    struct bench_image src, back, frames[NUM_PIX_FMTS], out;
+    struct image s, d, m[NUM_PIX_FMTS];
+    unsigned int i, j, pairs = 0;
+    int tol, err;
+    uint32_t x, y;
+
+    if (bench_image_alloc(&src, width, height, 24) || bench_image_alloc(&back, width, height, 24)
+        || bench_image_alloc(&out, width, height, 32))
+        return;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            uint8_t* p = src.data + (size_t)y * src.pitch + 3 * x;
+
+            p[0] = 2 * x;
+            p[1] = 6 * y;
+            p[2] = 255 - 2 * x;
+        }
+    }
+
+    bench_to_image(&s, &src, rgb24);
+    bench_to_image(&d, &back, rgb24);
+    for (i = 0; i < NUM_PIX_FMTS; i++) {
+        if (bench_image_alloc(&frames[i], width, height, pix_fmt_frame_bpp(&pix_fmts[i])))
+            return;
+        bench_to_frame(&m[i], &frames[i], &pix_fmts[i]);
+        convert_image(&m[i], &s);
+        convert_image(&d, &m[i]);
+
+        tol = convert_round_trip_tolerance(&pix_fmts[i]);
+        for (y = 0, err = 0; tol >= 0 && y < height; y++) {
+            for (x = 0; x < 3 * width; x++) {
+                int e = abs(src.data[(size_t)y * src.pitch + x] - back.data[(size_t)y * back.pitch + x]);
+
+                err = e > err ? e : err;
+            }
+        }
+        if (err > tol && tol >= 0)
+            printf("convert RGB24 to %s and back BAD OUTPUT, off by %d\n", pix_fmts[i].name, err);
+    }
+
+    /* the rest is only run, the output of each pair is not checked */
+    for (i = 0; i < NUM_PIX_FMTS; i++) {
+        for (j = 0; j < NUM_PIX_FMTS; j++) {
+            bench_to_frame(&d, &out, &pix_fmts[j]);
+            if (!convert_image(&d, &m[i]))
+                pairs++;
+        }
+    }
+    printf("convert: %u of %zu format pairs converted\n", pairs, NUM_PIX_FMTS * NUM_PIX_FMTS);
+
+    for (i = 0; i < NUM_PIX_FMTS; i++)
+        bench_image_free(&frames[i]);
+    bench_image_free(&src);
+    bench_image_free(&back);
+    bench_image_free(&out);
+}
+
+static void bench_convert(void)
+{
+    bench_convert_matrix();
+    /* odd sizes leave a tail to the generic loop, only checked */
+    bench_convert_pair(V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_XRGB32, 101, 37, 0);
+    bench_convert_pair(V4L2_PIX_FMT_XRGB32, V4L2_PIX_FMT_GREY, 101, 37, 0);
+    bench_convert_pair(V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_XRGB32, 102, 38, 0);
+    bench_convert_pair(V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_XRGB32, BENCH_WIDTH, BENCH_HEIGHT, 1);
+    bench_convert_pair(V4L2_PIX_FMT_XRGB32, V4L2_PIX_FMT_GREY, BENCH_WIDTH, BENCH_HEIGHT, 1);
+    bench_convert_pair(V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_XRGB32, BENCH_WIDTH, BENCH_HEIGHT, 1);
+    /* one of the pairs without a fast path, for comparison */
+    bench_convert_pair(V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_RGB565, BENCH_WIDTH, BENCH_HEIGHT, 1);
+}
+
+struct fill_image_ctx {
+    struct image img;
+    uint32_t argb;
+};
+
+static void kernel_fill_image(void* arg)
+{
+    struct fill_image_ctx* c = (struct fill_image_ctx*)arg;
+
+    fill_image(&c->img, 0, 0, c->img.width, c->img.height, c->argb);
+}
+
+/* a fill of every format against converting a solid ARGB32 frame, then the panel cleared */
+static void bench_fill_image(void)
+{
+    const uint32_t width = 102, height = 38, argb = 0x80c04010;
+    const struct pix_fmt* argb32 = pix_fmt_by_v4l2(V4L2_PIX_FMT_ARGB32);
+    struct bench_image solid, ref, out;
+    struct fill_image_ctx c;
+    struct image s, d;
+    unsigned int i;
+    uint32_t y;
+    double t;
+
+    if (bench_image_alloc(&solid, width, height, 32) || bench_image_alloc(&ref, width, height, 32)
+        || bench_image_alloc(&out, width, height, 32))
+        return;
+    bench_to_image(&s, &solid, argb32);
+    fill_image(&s, 0, 0, width, height, argb);
+    for (i = 0; i < NUM_PIX_FMTS; i++) {
+        bench_to_frame(&d, &ref, &pix_fmts[i]);
+        memset(ref.data, 0, ref.size);
+        convert_image(&d, &s);
+        bench_to_frame(&c.img, &out, &pix_fmts[i]);
+        memset(out.data, 0, out.size);
+        if (fill_image(&c.img, 0, 0, width, height, argb)) {
+            printf("fill %s BAD OUTPUT, not supported\n", pix_fmts[i].name);
+            continue;
+        }
+        for (y = 0; y < height; y++) {
+            /* planar frames are compared as one unpadded block */
+            size_t len = pix_fmts[i].planes > 1 ? pix_fmt_frame_bytes(&pix_fmts[i], width, height)
+                                                : pix_fmt_row_bytes(&pix_fmts[i], width);
+
+            if (memcmp(ref.data + (size_t)y * d.pitch, out.data + (size_t)y * d.pitch, len)) {
+                printf("fill %s BAD OUTPUT, not what convert_image writes\n", pix_fmts[i].name);
+                break;
+            }
+            if (pix_fmts[i].planes > 1)
+                break;
+        }
+    }
+    bench_image_free(&solid);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+
+    if (bench_image_alloc(&out, BENCH_WIDTH, BENCH_HEIGHT, 16))
+        return;
+    c.argb = 0xffffffff;
+    for (i = 0; i < NUM_PIX_FMTS; i++) {
+        if (pix_fmts[i].v4l2 != V4L2_PIX_FMT_Y4 && pix_fmts[i].v4l2 != V4L2_PIX_FMT_NV12)
+            continue;
+        bench_to_frame(&c.img, &out, &pix_fmts[i]);
+        t = bench_run(kernel_fill_image, &c);
+        printf("fill %s %ux%u to white: %.1f usecs\n", pix_fmts[i].name, BENCH_WIDTH,
+            BENCH_HEIGHT, t * 1e6);
+    }
+    bench_image_free(&out);
+}
+
+struct wc_ctx {
+    const struct bench_image* src;
+    struct bench_image* dst;
+};
+
+/* what fillbuffer did: one byte store after the other */
+static void naive_wc_copy(void* arg)
+{
+    struct wc_ctx* c = (struct wc_ctx*)arg;
+    volatile uint8_t* d = c->dst->data;
+    size_t i;
+
+    for (i = 0; i < c->src->size; i++)
+        d[i] = c->src->data[i];
+}
+
+static void kernel_wc_copy(void* arg)
+{
+    struct wc_ctx* c = (struct wc_ctx*)arg;
+
+    wc_copy(c->dst->data, c->src->data, c->src->size);
+}
+
+/*
+ * Ordinary heap memory stands in for the mapping, so this shows what the
+ * kernels cost and that they copy right, not the write-combining penalty
+ * of the naive stores, which only a dumb buffer shows.
+ */
+static void bench_wc(void)
+{
+    struct bench_image src, dst;
+    struct bench_case bc;
+    struct wc_ctx c;
+    uint32_t pitch, y;
+    unsigned int k, off;
+
+    if (bench_image_alloc(&src, BENCH_WIDTH, BENCH_HEIGHT, 24)
+        || bench_image_alloc(&dst, BENCH_WIDTH, BENCH_HEIGHT, 24))
+        return;
+    bench_image_noise(&src, 0x2545f491);
+    c.src = &src;
+    c.dst = &dst;
+
+    /* misaligned starts and odd pitches, only checked */
+    for (k = 0; k < NUM_WC_KERNELS; k++) {
+        if (!wc_kernel_available((enum wc_kernel)k))
+            continue;
+        wc_select_kernel(k);
+        for (off = 0; off < 3; off++) {
+            pitch = 3 * 101 + off * 7;
+            memset(dst.data, 0, dst.size);
+            wc_copy_rows(dst.data + off, pitch, src.data + 2 * off, pitch + 1, 3 * 101 - off, 37);
+            for (y = 0; y < 37; y++) {
+                if (memcmp(dst.data + off + (size_t)y * pitch, src.data + 2 * off + (size_t)y * (pitch + 1),
+                        3 * 101 - off)) {
+                    printf("wc %s copy_rows MISMATCH at offset %u\n", wc_kernel_name((enum wc_kernel)k),
+                        off);
+                    break;
+                }
+            }
+            memset(dst.data, 0, dst.size);
+            wc_copy(dst.data + off, src.data + off, 100000 + off);
+            if (memcmp(dst.data + off, src.data + off, 100000 + off) || dst.data[100000 + 2 * off])
+                printf("wc %s copy MISMATCH at offset %u\n", wc_kernel_name((enum wc_kernel)k), off);
+        }
+    }
+
+    bench_case_init(&bc, naive_wc_copy, &c, &dst, 1, src.size / 1e9, "GB/s");
+    bc.ref = &src;
+    snprintf(bc.label, sizeof(bc.label), "wc copy %ux%u RGB24", BENCH_WIDTH, BENCH_HEIGHT);
+    pool_set_limit(1);
+    bench_case_run(&bc, "naive");
+    bc.fn = kernel_wc_copy;
+    bench_kernels(&bc, 0, NUM_WC_KERNELS, wc_kernel_available, wc_kernel_name, wc_select_kernel);
+    pool_set_limit(0);
+    bench_scaling("wc copy", kernel_wc_copy, &c, bc.work, "GB/s");
+
+    bench_image_free(&src);
+    bench_image_free(&dst);
+}
+
+struct histogram_ctx {
+    struct histogram hist;
+    struct image img;
+    /* of the scalar kernel, over the frame and a region of it */
+    struct histogram ref;
+    struct histogram region;
+};
+
+static void kernel_histogram(void* arg)
+{
+    struct histogram_ctx* c = (struct histogram_ctx*)arg;
+
+    histogram_region(&c->hist, &c->img, 0, 0, c->img.width, c->img.height);
+}
+
+static int check_histogram(void* arg)
+{
+    struct histogram_ctx* c = (struct histogram_ctx*)arg;
+
+    if (memcmp(c->ref.bins, c->hist.bins, sizeof(c->ref.bins)))
+        return -1;
+    histogram_region(&c->hist, &c->img, 3, 5, 1001, 777);
+    return memcmp(c->region.bins, c->hist.bins, sizeof(c->region.bins)) ? -1 : 0;
+}
+
+/* every kernel against the scalar one, on the whole frame and a region */
+static void bench_histogram_format(uint32_t v4l2, int verbose)
+{
+    const struct pix_fmt* f = pix_fmt_by_v4l2(v4l2);
+    struct bench_image b;
+    struct bench_case bc;
+    struct histogram_ctx c;
+
+    if (bench_image_alloc(&b, BENCH_WIDTH, BENCH_HEIGHT, pix_fmt_frame_bpp(f)))
+        return;
+    bench_image_noise(&b, 0x2545f491);
+    bench_to_frame(&c.img, &b, f);
+
+    pool_set_limit(1);
+    histogram_select_kernel(HISTOGRAM_KERNEL_SCALAR);
+    histogram_region(&c.ref, &c.img, 0, 0, c.img.width, c.img.height);
+    histogram_region(&c.region, &c.img, 3, 5, 1001, 777);
+    if (c.ref.count != (uint64_t)BENCH_WIDTH * BENCH_HEIGHT || c.region.count != 1001 * 777)
+        printf("histogram %s BAD count\n", f->name);
+
+    bench_case_init(&bc, kernel_histogram, &c, NULL, verbose, BENCH_WIDTH * BENCH_HEIGHT / 1e6,
+        "Mpx/s");
+    bc.check = check_histogram;
+    snprintf(bc.label, sizeof(bc.label), "histogram %s %ux%u", f->name, BENCH_WIDTH,
+        BENCH_HEIGHT);
+    bench_kernels(&bc, 0, NUM_HISTOGRAM_KERNELS, histogram_kernel_available,
+        histogram_kernel_name, histogram_select_kernel);
+    pool_set_limit(0);
+    if (verbose)
+        bench_scaling(bc.label, kernel_histogram, &c, bc.work, "Mpx/s");
+
+    bench_image_free(&b);
+}
+/*
+ * A gray ramp squeezed into the levels 6 to 9, evenly, so that both modes
+ * spread it over all 16 levels the same way.
+ */
+static void bench_histogram_lut(void)
+{
+    static const uint8_t expect[16] = { 0, 0, 0, 0, 0, 0, 0, 5, 10, 15, 15, 15, 15, 15, 15, 15 };
+    struct bench_image b;
+    struct histogram hist;
+    struct image img;
+    struct y4_lut lut;
+    uint32_t x, y;
+
+    if (bench_image_alloc(&b, BENCH_WIDTH, BENCH_HEIGHT, 8))
+        return;
+    for (y = 0; y < b.height; y++) {
+        for (x = 0; x < b.width; x++)
+            b.data[(size_t)y * b.pitch + x] = 96 + x * 64 / b.width;
+    }
+    bench_to_image(&img, &b, pix_fmt_by_v4l2(V4L2_PIX_FMT_GREY));
+    histogram_region(&hist, &img, 0, 0, img.width, img.height);
+
+    histogram_lut(&hist, HISTOGRAM_AUTO_CONTRAST, &lut);
+    if (memcmp(lut.map, expect, sizeof(expect)))
+        printf("histogram contrast table BAD\n");
+    histogram_lut(&hist, HISTOGRAM_EQUALIZE, &lut);
+    if (memcmp(lut.map, expect, sizeof(expect)))
+        printf("histogram equalize table BAD\n");
+
+    bench_image_free(&b);
+}
+
+static void bench_histogram(void)
+{
+    static const uint32_t formats[] = {
+        V4L2_PIX_FMT_ABGR32, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_Y4,
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+        bench_histogram_format(formats[i], 0);
+    bench_histogram_format(V4L2_PIX_FMT_XRGB32, 1);
+    bench_histogram_format(V4L2_PIX_FMT_RGB24, 1);
+    bench_histogram_lut();
+}
+
+struct y4pack_ctx {
+    struct image dst;
+    struct image src;
+    enum y4_nibble_order order;
+    /* what the naive loop wrote */
+    const struct bench_image* ref;
+};
+
+/* one pixel after the other, the fixup the repacking replaces */
+static void naive_y4pack(void* arg)
+{
+    struct y4pack_ctx* c = (struct y4pack_ctx*)arg;
+    uint32_t x, y;
+    uint8_t v;
+
+    for (y = 0; y < c->src.height; y++) {
+        const uint8_t* s = image_row(&c->src, y);
+        uint8_t* d = image_row(&c->dst, y);
+
+        for (x = 0; x < c->src.width; x++) {
+            v = (s[x / 2] >> (x & 1 ? 0 : 4)) & 0xf;
+            if (x & 1)
+                d[x / 2] = (d[x / 2] & 0x0f) | v << 4;
+            else
+                d[x / 2] = (d[x / 2] & 0xf0) | v;
+        }
+    }
+}
+
+static void kernel_y4pack(void* arg)
+{
+    struct y4pack_ctx* c = (struct y4pack_ctx*)arg;
+
+    y4_repack(&c->dst, c->order, &c->src, Y4_HIGH_FIRST);
+}
+
+/* an odd width leaves the pad nibble of the last byte unchecked */
+static int check_y4pack(void* arg)
+{
+    struct y4pack_ctx* c = (struct y4pack_ctx*)arg;
+    uint32_t width = c->dst.width, y;
+
+    for (y = 0; y < c->dst.height; y++) {
+        const uint8_t* r = c->ref->data + (size_t)y * c->dst.pitch;
+        const uint8_t* d = image_row(&c->dst, y);
+
+        if (memcmp(r, d, width / 2) || (width & 1 && (r[width / 2] & 0x0f) != (d[width / 2] & 0x0f)))
+            return -1;
+    }
+    return 0;
+}
+
+/* low nibble first at another pitch on every kernel against the naive loop */
+static void bench_y4pack_size(uint32_t width, uint32_t height, uint32_t dst_pitch, int verbose)
+{
+    const struct pix_fmt* y4 = pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4);
+    struct bench_image src, ref, out;
+    struct bench_case bc;
+    struct y4pack_ctx c;
+    size_t row = pix_fmt_row_bytes(y4, width);
+    uint32_t y;
+    double t;
+
+    if (bench_image_alloc(&src, width, height, 4)
+        || bench_image_alloc(&ref, dst_pitch * 2, height, 4)
+        || bench_image_alloc(&out, dst_pitch * 2, height, 4))
+        return;
+    bench_image_noise(&src, 0x2545f491);
+    bench_to_image(&c.src, &src, y4);
+    bench_to_image(&c.dst, &ref, y4);
+    c.dst.width = width;
+    c.dst.pitch = dst_pitch;
+    c.order = Y4_LOW_FIRST;
+    c.ref = &ref;
+
+    bench_case_init(&bc, naive_y4pack, &c, &ref, verbose, width * height / 1e6, "Mpx/s");
+    snprintf(bc.label, sizeof(bc.label), "y4pack %ux%u to pitch %u", width, height, dst_pitch);
+    pool_set_limit(1);
+    bench_case_run(&bc, "naive");
+
+    c.dst.data = out.data;
+    bc.fn = kernel_y4pack;
+    bc.out = &out;
+    bc.check = check_y4pack;
+    bench_kernels(&bc, 0, NUM_Y4PACK_KERNELS, y4pack_kernel_available, y4pack_kernel_name,
+        y4pack_select_kernel);
+
+    /* the same order only moves the rows */
+    c.order = Y4_HIGH_FIRST;
+    kernel_y4pack(&c);
+    for (y = 0; y < height; y++) {
+        if (memcmp(src.data + (size_t)y * src.pitch, out.data + (size_t)y * dst_pitch, row)) {
+            printf("%s: copy MISMATCH\n", bc.label);
+            break;
+        }
+    }
+    if (verbose) {
+        t = bench_run(kernel_y4pack, &c);
+        printf("%s: copy    %8.2f Mpx/s\n", bc.label, bc.work / t);
+    }
+    pool_set_limit(0);
+    if (verbose) {
+        c.order = Y4_LOW_FIRST;
+        bench_scaling("y4pack", kernel_y4pack, &c, bc.work, "Mpx/s");
+    }
+
+    bench_image_free(&src);
+    bench_image_free(&ref);
+    bench_image_free(&out);
+}
+static void bench_y4pack(void)
+{
+    /* odd sizes and pitches exercise the row tails, only checked */
+    bench_y4pack_size(101, 37, 61, 0);
+    bench_y4pack_size(1001, 7, 509, 0);
+    bench_y4pack_size(BENCH_WIDTH, BENCH_HEIGHT, 1024, 1);
+}
+
+/*
+ * Jobs of mixed size, from a pen dab to a full frame, routed by the
+ * dispatcher. The CPU jobs are real y4conv conversions; the RGA is a model
+ * of a fixed cost per job and a per pixel cost, with some jitter, since
+ * there is none to run here. The dispatched total is compared with always
+ * picking the engine that is really faster for the size.
+ */
+#define DISPATCH_RGA_FIXED_NS 250000.0
+#define DISPATCH_RGA_PX_NS 0.5
+
+static void bench_dispatch(void)
+{
+    static const uint32_t sizes[][2] = {
+        { 32, 32 }, { 64, 64 }, { 256, 128 }, { 512, 512 }, { BENCH_WIDTH, BENCH_HEIGHT },
+    };
+    const unsigned int n = sizeof(sizes) / sizeof(sizes[0]);
+    const struct pix_fmt* sf = pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24);
+    const struct pix_fmt* df = pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4);
+    double cpu_ns[n], rga_ns[n], total = 0, best = 0, rga_only = 0, cpu_only = 0;
+    struct bench_image src, dst;
+    struct dispatcher d;
+    struct y4conv_ctx c;
+    enum dispatch_engine e;
+    uint32_t i, k, seed = 0x2545f491;
+    uint64_t px, t;
+
+    if (bench_image_alloc(&src, BENCH_WIDTH, BENCH_HEIGHT, 24)
+        || bench_image_alloc(&dst, BENCH_WIDTH, BENCH_HEIGHT, 4))
+        return;
+    bench_image_noise(&src, seed);
+    bench_to_image(&c.src, &src, sf);
+    bench_to_image(&c.dst, &dst, df);
+    memset(&c.params, 0, sizeof(c.params));
+    c.params.levels = 16;
+
+    for (k = 0; k < n; k++) {
+        c.src.width = c.dst.width = sizes[k][0];
+        c.src.height = c.dst.height = sizes[k][1];
+        cpu_ns[k] = bench_run(kernel_y4conv, &c) * 1e9;
+        rga_ns[k] = DISPATCH_RGA_FIXED_NS + DISPATCH_RGA_PX_NS * sizes[k][0] * sizes[k][1];
+        printf("dispatch %ux%u: CPU %9.1f usecs, RGA model %9.1f usecs\n", sizes[k][0],
+            sizes[k][1], cpu_ns[k] / 1e3, rga_ns[k] / 1e3);
+    }
+
+    dispatch_init(&d);
+    for (i = 0; i < 2000; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        // mostly small damage, now and then a full page
+        k = seed % 16 < 10 ? 0 : seed % 16 < 13 ? 1 : seed % 16 < 14 ? 2 : seed % 16 < 15 ? 3 : 4;
+        c.src.width = c.dst.width = sizes[k][0];
+        c.src.height = c.dst.height = sizes[k][1];
+        px = (uint64_t)sizes[k][0] * sizes[k][1];
+
+        e = dispatch_pick(&d, sf, df, 0, px);
+        if (e == DISPATCH_CPU) {
+            t = rt_now_ns();
+            kernel_y4conv(&c);
+            t = rt_now_ns() - t;
+        } else {
+            t = rga_ns[k] * (0.95 + (seed >> 8) % 101 / 1000.0);
+        }
+        dispatch_record(&d, sf, df, 0, px, e, t);
+        total += t;
+        best += cpu_ns[k] < rga_ns[k] ? cpu_ns[k] : rga_ns[k];
+        rga_only += rga_ns[k];
+        cpu_only += cpu_ns[k];
+    }
+    dispatch_report(&d, stdout);
+    printf("dispatch 2000 jobs: %.1f msecs, %.1f best choice, %.1f RGA only, %.1f CPU only%s\n",
+        total / 1e6, best / 1e6, rga_only / 1e6, cpu_only / 1e6,
+        total > 1.25 * best ? " BAD" : "");
+
+    bench_image_free(&src);
+    bench_image_free(&dst);
+}
+
+int run_benchmarks(const char* which)
+{
+    int all = !strcmp(which, "all");
+    int found = 0;
+
+    if (all || !strcmp(which, "fill")) {
+        bench_fill();
+        bench_fill_image();
+        found = 1;
+    }
+    if (all || !strcmp(which, "y4conv")) {
+        bench_y4conv();
+        found = 1;
+    }
+    if (all || !strcmp(which, "y4lut")) {
+        bench_y4lut();
+        found = 1;
+    }
+    if (all || !strcmp(which, "rotate")) {
+        bench_rotate();
+        found = 1;
+    }
+    if (all || !strcmp(which, "errdiff")) {
+        bench_errdiff();
+        found = 1;
+    }
+    if (all || !strcmp(which, "bluenoise")) {
+        bench_bluenoise();
+        found = 1;
+    }
+    if (all || !strcmp(which, "ypack")) {
+        bench_ypack();
+        found = 1;
+    }
+    if (all || !strcmp(which, "scale")) {
+        bench_scale();
+        found = 1;
+    }
+    if (all || !strcmp(which, "blend")) {
+        bench_blend();
+        found = 1;
+    }
+    if (all || !strcmp(which, "convert")) {
+        bench_convert();
+        found = 1;
+    }
+    if (all || !strcmp(which, "wc")) {
+        bench_wc();
+        found = 1;
+    }
+    if (all || !strcmp(which, "histogram")) {
+        bench_histogram();
+        found = 1;
+    }
+    if (all || !strcmp(which, "y4pack")) {
+        bench_y4pack();
+        found = 1;
+    }
+    if (all || !strcmp(which, "dispatch")) {
+        bench_dispatch();
+        found = 1;
+    }
+
+    if (!found) {
+        printf("unknown benchmark %s\n", which);
+        return -EINVAL;
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * Microbenchmarks of the CPU image kernels, run with --bench. They work on
+ * ordinary heap memory and need neither the RGA nor a DRM device.
+ */
+
+#ifndef __BENCH_H_INCLUDED__
+#define __BENCH_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct bench_image {
+	uint8_t *data;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch;
+	size_t size;
+};
+
+/* a cleared image with rows padded to 64 bytes, reports when out of memory */
+int bench_image_alloc(struct bench_image *img, uint32_t width,
+		      uint32_t height, uint32_t bpp);
+void bench_image_free(struct bench_image *img);
+
+/* best time of one call of fn in seconds, repeated for about 0.2 s */
+double bench_run(void (*fn)(void *ctx), void *ctx);
+
+int run_benchmarks(const char *which);
+
+#endif /* __BENCH_H_INCLUDED__ */
@@ -0,0 +1,129 @@
+/*
+ * Stable sp_bo <-> V4L2 buffer index binding for the DMABUF queues.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binding.h"
+#include "bo.h"
+
+void binding_init(struct buf_binding_table* table, uint32_t type)
+{
+    unsigned int i;
+
+    memset(table, 0, sizeof(*table));
+    table->type = type;
+    for (i = 0; i < BINDING_MAX_BUFS; i++) {
+        table->slots[i].fd = -1;
+        table->slots[i].last_fd = -1;
+    }
+}
+
+int binding_bind(struct buf_binding_table* table, unsigned int index,
+    struct sp_bo* bo, int fd, uint32_t length)
+{
+    struct buf_binding* slot;
+    int other;
+
+    if (index >= BINDING_MAX_BUFS)
+        return -EINVAL;
+
+    other = binding_index_of(table, bo);
+    if (other >= 0 && other != (int)index) {
+        printf("bo already bound to index %d, refusing index %u\n", other, index);
+        return -EBUSY;
+    }
+
+    /*
+     * last_fd and the counters survive a rebind on purpose: queueing the new
+     * fd at this index will show up as a re-attachment.
+     */
+    slot = &table->slots[index];
+    slot->bo = bo;
+    slot->fd = fd;
+    slot->length = length;
+
+    if (index >= table->count)
+        table->count = index + 1;
+    return 0;
+}
+
+int binding_index_of(struct buf_binding_table* table, struct sp_bo* bo)
+{
+    unsigned int i;
+
+    for (i = 0; i < table->count; i++) {
+        if (table->slots[i].bo == bo)
+            return i;
+    }
+    return -ENOENT;
+}
+
+int binding_prepare_qbuf(struct buf_binding_table* table, struct sp_bo* bo,
+    struct v4l2_buffer* buf)
+{
+    struct buf_binding* slot;
+    int index;
+
+    index = binding_index_of(table, bo);
+    if (index < 0) {
+        printf("bo %p is not bound to a buffer index\n", (void*)bo);
+        return index;
+    }
+    slot = &table->slots[index];
+
+    memset(buf, 0, sizeof(*buf));
+    buf->type = table->type;
+    buf->memory = V4L2_MEMORY_DMABUF;
+    buf->index = index;
+    buf->m.fd = slot->fd;
+    buf->length = slot->length;
+    if (table->type == V4L2_BUF_TYPE_VIDEO_OUTPUT)
+        buf->bytesused = slot->length;
+
+    if (slot->last_fd >= 0 && slot->last_fd != slot->fd)
+        slot->reattached++;
+    slot->last_fd = slot->fd;
+    slot->queued++;
+
+    return index;
+}
+
+unsigned long binding_reattachments(struct buf_binding_table* table)
+{
+    unsigned long total = 0;
+    unsigned int i;
+
+    for (i = 0; i < table->count; i++)
+        total += table->slots[i].reattached;
+    return total;
+}
+
+void binding_report(struct buf_binding_table* table, const char* name)
+{
+    unsigned int i;
+
+    for (i = 0; i < table->count; i++) {
+        struct buf_binding* slot = &table->slots[i];
+
+        printf("%s[%u]: fd %d, queued %lu, re-attached %lu\n", name, i,
+            slot->fd, slot->queued, slot->reattached);
+    }
+}
+
+void binding_release(struct buf_binding_table* table)
+{
+    unsigned int i;
+
+    for (i = 0; i < table->count; i++) {
+        struct buf_binding* slot = &table->slots[i];
+
+        if (slot->fd >= 0)
+            close(slot->fd);
+        free_sp_bo(slot->bo);
+    }
+    binding_init(table, table->type);
+}
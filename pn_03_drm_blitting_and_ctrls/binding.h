@@ -0,0 +1,49 @@
+/*
+ * Stable sp_bo <-> V4L2 buffer index binding for the DMABUF queues.
+ *
+ * videobuf2 keeps the dma-buf attachment and its IOMMU mapping of a buffer
+ * index alive only as long as the same dma-buf is queued at that index
+ * again. Every sp_bo is therefore pinned to one index for the whole
+ * lifetime of a stream, and any queueing that would still change the
+ * dma-buf behind an index is counted as a re-attachment.
+ */
+
+#ifndef __BINDING_H_INCLUDED__
+#define __BINDING_H_INCLUDED__
+
+#include <stdint.h>
+
+#include <linux/videodev2.h>
+
+#define BINDING_MAX_BUFS 8
+
+struct sp_bo;
+
+struct buf_binding {
+	struct sp_bo *bo;
+	int fd;
+	uint32_t length;
+
+	/* fd that was queued at this index last time, -1 if never queued */
+	int last_fd;
+	unsigned long queued;
+	unsigned long reattached;
+};
+
+struct buf_binding_table {
+	uint32_t type;
+	unsigned int count;
+	struct buf_binding slots[BINDING_MAX_BUFS];
+};
+
+void binding_init(struct buf_binding_table *table, uint32_t type);
+int binding_bind(struct buf_binding_table *table, unsigned int index,
+		 struct sp_bo *bo, int fd, uint32_t length);
+int binding_index_of(struct buf_binding_table *table, struct sp_bo *bo);
+int binding_prepare_qbuf(struct buf_binding_table *table, struct sp_bo *bo,
+			 struct v4l2_buffer *buf);
+unsigned long binding_reattachments(struct buf_binding_table *table);
+void binding_report(struct buf_binding_table *table, const char *name);
+void binding_release(struct buf_binding_table *table);
+
+#endif /* __BINDING_H_INCLUDED__ */
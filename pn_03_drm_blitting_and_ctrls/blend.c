@@ -0,0 +1,625 @@
+/*
+ * Porter-Duff compositing of ARGB32 and ABGR32 images.
+ *
+ * All four channels of a premultiplied pixel are combined alike, alpha
+ * included, as Fa * S + Fb * D saturated to 255. Products with a factor
+ * are rounded as x * f / 255 with (t + (t >> 8)) >> 8, t = x * f + 128,
+ * which is exact for 8 bit values.
+ *
+ * The vector kernels are instantiated per operation and alpha position, so
+ * the factors are picked at compile time and terms with a factor of 0 or 1
+ * cost nothing. Straight alpha is premultiplied before and divided out
+ * again after, which the vector kernels do as well, dividing by alpha as a
+ * multiplication with its reciprocal in 16.16 fixed point.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "blend.h"
+#include "pool.h"
+#include "simd.h"
+
+/* straight alpha pixels premultiplied at a time */
+#define BLEND_CHUNK 64
+
+enum blend_factor {
+    F_ZERO,
+    F_ONE,
+    F_SA,
+    F_DA,
+    F_INV_SA,
+    F_INV_DA,
+};
+
+/* blends pixels [0, n) of a row into dst and returns n, a multiple of 4 */
+typedef uint32_t (*row_fn)(uint8_t* dst, const uint8_t* src, uint32_t width);
+
+static const char* kernel_names[NUM_BLEND_KERNELS] = {
+    "scalar", "sse2", "neon"
+};
+
+static const char* op_names[NUM_BLEND_OPS] = {
+    "src", "srcatop", "srcin", "srcout", "srcover",
+    "dst", "dstatop", "dstin", "dstout", "dstover",
+    "add", "clear"
+};
+
+static const uint8_t op_factors[NUM_BLEND_OPS][2] = {
+    { F_ONE, F_ZERO },    /* SRC */
+    { F_DA, F_INV_SA },   /* SRCATOP */
+    { F_DA, F_ZERO },     /* SRCIN */
+    { F_INV_DA, F_ZERO }, /* SRCOUT */
+    { F_ONE, F_INV_SA },  /* SRCOVER */
+    { F_ZERO, F_ONE },    /* DST */
+    { F_INV_DA, F_SA },   /* DSTATOP */
+    { F_ZERO, F_SA },     /* DSTIN */
+    { F_ZERO, F_INV_SA }, /* DSTOUT */
+    { F_INV_DA, F_ONE },  /* DSTOVER */
+    { F_ONE, F_ONE },     /* ADD */
+    { F_ZERO, F_ZERO },   /* CLEAR */
+};
+
+static int kernel = -1;
+
+/* 255 * 2^16 / a, to divide by alpha again */
+static uint32_t unpremul_scale[256];
+#ifdef HAVE_SSE2
+/* the low word of unpremul_scale[a] four times, then the high one */
+static uint16_t __attribute__((aligned(16))) unpremul_words[256][8];
+
+static void split_scale(uint16_t* words, uint32_t scale)
+{
+    unsigned int c;
+
+    for (c = 0; c < 4; c++) {
+        words[c] = scale;
+        words[4 + c] = scale >> 16;
+    }
+}
+#endif
+
+static inline uint32_t mul255(uint32_t x, uint32_t f)
+{
+    uint32_t t = x * f + 128;
+
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t term(unsigned int f, uint32_t x, uint32_t sa, uint32_t da)
+{
+    switch (f) {
+    case F_ZERO:
+        return 0;
+    case F_ONE:
+        return x;
+    case F_SA:
+        return mul255(x, sa);
+    case F_DA:
+        return mul255(x, da);
+    case F_INV_SA:
+        return mul255(x, 255 - sa);
+    default:
+        return mul255(x, 255 - da);
+    }
+}
+
+/* the reference for every kernel, and the pixels they leave */
+static void blend_tail(uint8_t* d, const uint8_t* s, uint32_t n, unsigned int alpha,
+    enum blend_op op)
+{
+    unsigned int fa = op_factors[op][0], fb = op_factors[op][1], c;
+    uint32_t x, sa, da, v;
+
+    for (x = 0; x < n; x++, d += 4, s += 4) {
+        sa = s[alpha];
+        da = d[alpha];
+        for (c = 0; c < 4; c++) {
+            v = term(fa, s[c], sa, da) + term(fb, d[c], sa, da);
+            d[c] = v > 255 ? 255 : v;
+        }
+    }
+}
+
+#ifdef HAVE_SSE2
+template <int FA, int FB, int A>
+struct blend_sse2 {
+    /* alpha of each pixel in all four of its words */
+    static inline __m128i alpha(__m128i v)
+    {
+        const int m = A * 0x55;
+
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, m), m);
+    }
+
+    static inline __m128i mul255(__m128i x, __m128i f)
+    {
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, f), _mm_set1_epi16(128));
+
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    template <int F>
+    static inline __m128i term(__m128i x, __m128i s, __m128i d)
+    {
+        const __m128i max = _mm_set1_epi16(255);
+
+        switch (F) {
+        case F_ZERO:
+            return _mm_setzero_si128();
+        case F_ONE:
+            return x;
+        case F_SA:
+            return mul255(x, alpha(s));
+        case F_DA:
+            return mul255(x, alpha(d));
+        case F_INV_SA:
+            return mul255(x, _mm_sub_epi16(max, alpha(s)));
+        default:
+            return mul255(x, _mm_sub_epi16(max, alpha(d)));
+        }
+    }
+
+    static inline __m128i blend(__m128i s, __m128i d)
+    {
+        return _mm_add_epi16(term<FA>(s, s, d), term<FB>(d, s, d));
+    }
+
+    static uint32_t row(uint8_t* dst, const uint8_t* src, uint32_t width)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        uint32_t x;
+
+        for (x = 0; x + 4 <= width; x += 4) {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + 4 * x));
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + 4 * x));
+            __m128i lo = blend(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+            __m128i hi = blend(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+
+            _mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_packus_epi16(lo, hi));
+        }
+        return x;
+    }
+};
+#endif
+
+#ifdef HAVE_NEON
+template <int FA, int FB, int A>
+struct blend_neon {
+    /* alpha of each pixel in all four of its bytes */
+    static inline uint8x16_t alpha(uint8x16_t v)
+    {
+        static const uint8_t idx[16] = {
+            A, A, A, A, 4 + A, 4 + A, 4 + A, 4 + A,
+            8 + A, 8 + A, 8 + A, 8 + A, 12 + A, 12 + A, 12 + A, 12 + A
+        };
+
+        return vqtbl1q_u8(v, vld1q_u8(idx));
+    }
+
+    static inline uint8x8_t mul255(uint8x8_t x, uint8x8_t f)
+    {
+        uint16x8_t t = vmull_u8(x, f);
+
+        return vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8);
+    }
+
+    static inline uint8x16_t mul255q(uint8x16_t x, uint8x16_t f)
+    {
+        return vcombine_u8(mul255(vget_low_u8(x), vget_low_u8(f)),
+            mul255(vget_high_u8(x), vget_high_u8(f)));
+    }
+
+    template <int F>
+    static inline uint8x16_t term(uint8x16_t x, uint8x16_t s, uint8x16_t d)
+    {
+        const uint8x16_t max = vdupq_n_u8(255);
+
+        switch (F) {
+        case F_ZERO:
+            return vdupq_n_u8(0);
+        case F_ONE:
+            return x;
+        case F_SA:
+            return mul255q(x, alpha(s));
+        case F_DA:
+            return mul255q(x, alpha(d));
+        case F_INV_SA:
+            return mul255q(x, vsubq_u8(max, alpha(s)));
+        default:
+            return mul255q(x, vsubq_u8(max, alpha(d)));
+        }
+    }
+
+    static uint32_t row(uint8_t* dst, const uint8_t* src, uint32_t width)
+    {
+        uint32_t x;
+
+        for (x = 0; x + 4 <= width; x += 4) {
+            uint8x16_t s = vld1q_u8(src + 4 * x);
+            uint8x16_t d = vld1q_u8(dst + 4 * x);
+
+            vst1q_u8(dst + 4 * x, vqaddq_u8(term<FA>(s, s, d), term<FB>(d, s, d)));
+        }
+        return x;
+    }
+};
+#endif
+
+/*
+ * Straight alpha to premultiplied and back, 4 pixels at a time. Both
+ * return the pixels done and leave the rest to premultiply() and
+ * unpremultiply().
+ */
+typedef uint32_t (*convert_fn)(uint8_t* dst, const uint8_t* src, uint32_t n);
+
+#ifdef HAVE_SSE2
+template <int A>
+struct convert_sse2 {
+    /* alpha and the rounded product do not depend on the operation */
+    typedef blend_sse2<F_ONE, F_ZERO, A> K;
+
+    static inline __m128i alpha_mask()
+    {
+        return _mm_set_epi16(A == 3 ? -1 : 0, 0, 0, A ? 0 : -1, A == 3 ? -1 : 0, 0, 0, A ? 0 : -1);
+    }
+
+    static inline __m128i premultiply(__m128i v)
+    {
+        const __m128i mask = alpha_mask();
+
+        return _mm_or_si128(_mm_and_si128(mask, v), _mm_andnot_si128(mask, K::mul255(v, K::alpha(v))));
+    }
+
+    static uint32_t to_premul(uint8_t* dst, const uint8_t* src, uint32_t n)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        uint32_t x;
+
+        for (x = 0; x + 4 <= n; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + 4 * x));
+
+            v = _mm_packus_epi16(premultiply(_mm_unpacklo_epi8(v, zero)),
+                premultiply(_mm_unpackhi_epi8(v, zero)));
+            _mm_storeu_si128((__m128i*)(dst + 4 * x), v);
+        }
+        return x;
+    }
+
+    /*
+     * (c * scale + 32768) >> 16 of two pixels, with scale split into words
+     * h:l as c * h + ((((c << 8) * l) >> 16) + 128 >> 8), exact in 16 bits
+     */
+    static inline __m128i unpremultiply(__m128i c, const uint8_t* p)
+    {
+        const __m128i mask = alpha_mask();
+        __m128i s0 = _mm_load_si128((const __m128i*)unpremul_words[p[A]]);
+        __m128i s1 = _mm_load_si128((const __m128i*)unpremul_words[p[4 + A]]);
+        /* alpha itself is taken times 1 */
+        __m128i l = _mm_andnot_si128(mask, _mm_unpacklo_epi64(s0, s1));
+        __m128i h = _mm_or_si128(_mm_andnot_si128(mask, _mm_unpackhi_epi64(s0, s1)),
+            _mm_and_si128(mask, _mm_set1_epi16(1)));
+        __m128i t = _mm_mulhi_epu16(_mm_slli_epi16(c, 8), l);
+
+        c = _mm_add_epi16(_mm_mullo_epi16(c, h), _mm_srli_epi16(_mm_add_epi16(t, _mm_set1_epi16(128)), 8));
+        /* min(c, 255) of unsigned words, packus would take them as signed */
+        return _mm_sub_epi16(c, _mm_subs_epu16(c, _mm_set1_epi16(255)));
+    }
+
+    static uint32_t to_straight(uint8_t* dst, const uint8_t* src, uint32_t n)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        uint32_t x;
+
+        for (x = 0; x + 4 <= n; x += 4) {
+            const uint8_t* p = src + 4 * x;
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+
+            v = _mm_packus_epi16(unpremultiply(_mm_unpacklo_epi8(v, zero), p),
+                unpremultiply(_mm_unpackhi_epi8(v, zero), p + 8));
+            _mm_storeu_si128((__m128i*)(dst + 4 * x), v);
+        }
+        return x;
+    }
+};
+#endif
+
+#ifdef HAVE_NEON
+template <int A>
+struct convert_neon {
+    typedef blend_neon<F_ONE, F_ZERO, A> K;
+
+    static inline uint8x16_t alpha_mask()
+    {
+        static const uint8_t m[16] = {
+            A == 0 ? 0xff : 0, 0, 0, A == 3 ? 0xff : 0, A == 0 ? 0xff : 0, 0, 0, A == 3 ? 0xff : 0,
+            A == 0 ? 0xff : 0, 0, 0, A == 3 ? 0xff : 0, A == 0 ? 0xff : 0, 0, 0, A == 3 ? 0xff : 0
+        };
+
+        return vld1q_u8(m);
+    }
+
+    static uint32_t to_premul(uint8_t* dst, const uint8_t* src, uint32_t n)
+    {
+        const uint8x16_t mask = alpha_mask();
+        uint32_t x;
+
+        for (x = 0; x + 4 <= n; x += 4) {
+            uint8x16_t v = vld1q_u8(src + 4 * x);
+
+            vst1q_u8(dst + 4 * x, vbslq_u8(mask, v, K::mul255q(v, K::alpha(v))));
+        }
+        return x;
+    }
+
+    /* the four channels of pixel p, in 32 bits, times its scale */
+    static inline uint16x4_t unpremultiply(uint16x4_t c, const uint8_t* p)
+    {
+        /* alpha itself is taken times 1 */
+        uint32x4_t scale = vsetq_lane_u32(1 << 16, vdupq_n_u32(unpremul_scale[p[A]]), A);
+
+        return vqmovn_u32(vshrq_n_u32(vmlaq_u32(vdupq_n_u32(32768), vmovl_u16(c), scale), 16));
+    }
+
+    static uint32_t to_straight(uint8_t* dst, const uint8_t* src, uint32_t n)
+    {
+        uint32_t x;
+
+        for (x = 0; x + 4 <= n; x += 4) {
+            const uint8_t* p = src + 4 * x;
+            uint8x16_t v = vld1q_u8(p);
+            uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+
+            lo = vcombine_u16(unpremultiply(vget_low_u16(lo), p), unpremultiply(vget_high_u16(lo), p + 4));
+            hi = vcombine_u16(unpremultiply(vget_low_u16(hi), p + 8),
+                unpremultiply(vget_high_u16(hi), p + 12));
+            vst1q_u8(dst + 4 * x, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+        }
+        return x;
+    }
+};
+#endif
+
+/* the instance of a kernel for an operation */
+template <template <int, int, int> class K, int A>
+static row_fn row_for(enum blend_op op)
+{
+    switch (op) {
+    case BLEND_SRC:
+        return K<F_ONE, F_ZERO, A>::row;
+    case BLEND_SRCATOP:
+        return K<F_DA, F_INV_SA, A>::row;
+    case BLEND_SRCIN:
+        return K<F_DA, F_ZERO, A>::row;
+    case BLEND_SRCOUT:
+        return K<F_INV_DA, F_ZERO, A>::row;
+    case BLEND_SRCOVER:
+        return K<F_ONE, F_INV_SA, A>::row;
+    case BLEND_DST:
+        return K<F_ZERO, F_ONE, A>::row;
+    case BLEND_DSTATOP:
+        return K<F_INV_DA, F_SA, A>::row;
+    case BLEND_DSTIN:
+        return K<F_ZERO, F_SA, A>::row;
+    case BLEND_DSTOUT:
+        return K<F_ZERO, F_INV_SA, A>::row;
+    case BLEND_DSTOVER:
+        return K<F_INV_DA, F_ONE, A>::row;
+    case BLEND_ADD:
+        return K<F_ONE, F_ONE, A>::row;
+    default:
+        return K<F_ZERO, F_ZERO, A>::row;
+    }
+}
+
+static row_fn kernel_row(int k, enum blend_op op, unsigned int alpha)
+{
+    switch (k) {
+#ifdef HAVE_SSE2
+    case BLEND_KERNEL_SSE2:
+        return alpha ? row_for<blend_sse2, 3>(op) : row_for<blend_sse2, 0>(op);
+#endif
+#ifdef HAVE_NEON
+    case BLEND_KERNEL_NEON:
+        return alpha ? row_for<blend_neon, 3>(op) : row_for<blend_neon, 0>(op);
+#endif
+    }
+    /* blend_tail() does the whole row */
+    return NULL;
+}
+
+static void kernel_convert(int k, unsigned int alpha, convert_fn* premul, convert_fn* unpremul)
+{
+    *premul = NULL;
+    *unpremul = NULL;
+    switch (k) {
+#ifdef HAVE_SSE2
+    case BLEND_KERNEL_SSE2:
+        *premul = alpha ? convert_sse2<3>::to_premul : convert_sse2<0>::to_premul;
+        *unpremul = alpha ? convert_sse2<3>::to_straight : convert_sse2<0>::to_straight;
+        break;
+#endif
+#ifdef HAVE_NEON
+    case BLEND_KERNEL_NEON:
+        *premul = alpha ? convert_neon<3>::to_premul : convert_neon<0>::to_premul;
+        *unpremul = alpha ? convert_neon<3>::to_straight : convert_neon<0>::to_straight;
+        break;
+#endif
+    }
+}
+
+int blend_kernel_available(enum blend_kernel k)
+{
+    switch (k) {
+    case BLEND_KERNEL_SCALAR:
+        return 1;
+#ifdef HAVE_SSE2
+    case BLEND_KERNEL_SSE2:
+        return 1;
+#endif
+#ifdef HAVE_NEON
+    case BLEND_KERNEL_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+const char* blend_kernel_name(enum blend_kernel k)
+{
+    return kernel_names[k];
+}
+
+void blend_select_kernel(int k)
+{
+    kernel = simd_pick_kernel(k, NUM_BLEND_KERNELS, blend_kernel_available);
+}
+
+const char* blend_op_name(enum blend_op op)
+{
+    return op_names[op];
+}
+
+int blend_op_by_name(const char* name)
+{
+    int op;
+
+    for (op = 0; op < NUM_BLEND_OPS; op++) {
+        if (!strcmp(name, op_names[op]))
+            return op;
+    }
+    return -1;
+}
+
+enum blend_op blend_op_swap(enum blend_op op)
+{
+    /* the source operations are followed by their destination twins */
+    if (op <= BLEND_SRCOVER)
+        return (enum blend_op)(op + BLEND_DST);
+    if (op <= BLEND_DSTOVER)
+        return (enum blend_op)(op - BLEND_DST);
+    return op;
+}
+
+int blend_supported(const struct pix_fmt* f)
+{
+    return f->v4l2 == V4L2_PIX_FMT_ARGB32 || f->v4l2 == V4L2_PIX_FMT_ABGR32;
+}
+
+struct blend_job {
+    const struct image* dst;
+    const struct image* src;
+    uint32_t width;
+    enum blend_op op;
+    /* byte of alpha in a pixel */
+    unsigned int alpha;
+    int premultiplied;
+    row_fn row;
+    convert_fn premul;
+    convert_fn unpremul;
+};
+
+static void premultiply(uint8_t* dst, const uint8_t* src, uint32_t n, unsigned int alpha)
+{
+    unsigned int c;
+    uint32_t x;
+
+    for (x = 0; x < n; x++, dst += 4, src += 4) {
+        for (c = 0; c < 4; c++)
+            dst[c] = c == alpha ? src[c] : mul255(src[c], src[alpha]);
+    }
+}
+
+static void unpremultiply(uint8_t* dst, const uint8_t* src, uint32_t n, unsigned int alpha)
+{
+    unsigned int c;
+    uint32_t x, v, scale;
+
+    for (x = 0; x < n; x++, dst += 4, src += 4) {
+        scale = unpremul_scale[src[alpha]];
+        for (c = 0; c < 4; c++) {
+            v = c == alpha ? src[c] : (src[c] * scale + 32768) >> 16;
+            dst[c] = v > 255 ? 255 : v;
+        }
+    }
+}
+
+static void premultiply_row(const struct blend_job* job, uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    uint32_t x = job->premul ? job->premul(d, s, n) : 0;
+
+    premultiply(d + 4 * x, s + 4 * x, n - x, job->alpha);
+}
+
+static void unpremultiply_row(const struct blend_job* job, uint8_t* d, const uint8_t* s,
+    uint32_t n)
+{
+    uint32_t x = job->unpremul ? job->unpremul(d, s, n) : 0;
+
+    unpremultiply(d + 4 * x, s + 4 * x, n - x, job->alpha);
+}
+
+static void blend_row(const struct blend_job* job, uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    uint32_t x = job->row ? job->row(d, s, n) : 0;
+
+    blend_tail(d + 4 * x, s + 4 * x, n - x, job->alpha, job->op);
+}
+
+static void blend_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct blend_job* job = (struct blend_job*)arg;
+    uint8_t __attribute__((aligned(16))) ts[4 * BLEND_CHUNK], td[4 * BLEND_CHUNK];
+    uint32_t x, y, n;
+
+    for (y = y0; y < y1; y++) {
+        uint8_t* d = image_row(job->dst, y);
+        const uint8_t* s = image_row(job->src, y);
+
+        if (job->premultiplied) {
+            blend_row(job, d, s, job->width);
+            continue;
+        }
+        for (x = 0; x < job->width; x += n) {
+            n = job->width - x < BLEND_CHUNK ? job->width - x : BLEND_CHUNK;
+            premultiply_row(job, ts, s + 4 * x, n);
+            premultiply_row(job, td, d + 4 * x, n);
+            blend_row(job, td, ts, n);
+            unpremultiply_row(job, d + 4 * x, td, n);
+        }
+    }
+}
+
+int blend_frame(const struct image* dst, const struct image* src,
+    enum blend_op op, int premultiplied)
+{
+    struct blend_job job;
+    uint32_t height, a;
+
+    if (dst->fmt != src->fmt || !blend_supported(src->fmt) || op >= NUM_BLEND_OPS)
+        return -EINVAL;
+    if (kernel < 0)
+        blend_select_kernel(-1);
+    if (!unpremul_scale[1]) {
+        for (a = 1; a < 256; a++) {
+            unpremul_scale[a] = ((255 << 16) + a / 2) / a;
+#ifdef HAVE_SSE2
+            split_scale(unpremul_words[a], unpremul_scale[a]);
+#endif
+        }
+    }
+
+    job.dst = dst;
+    job.src = src;
+    job.op = op;
+    job.alpha = src->fmt->v4l2 == V4L2_PIX_FMT_ABGR32 ? 3 : 0;
+    job.premultiplied = premultiplied;
+    job.row = kernel_row(kernel, op, job.alpha);
+    kernel_convert(kernel, job.alpha, &job.premul, &job.unpremul);
+    job.width = src->width < dst->width ? src->width : dst->width;
+    height = src->height < dst->height ? src->height : dst->height;
+
+    parallel_for(height, 16, blend_band, &job);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Porter-Duff compositing of 32 bpp ARGB images, the operations of
+ * V4L2_CID_BLEND on the CPU.
+ *
+ * blend_frame() replaces every destination pixel D with op(S, D) for the
+ * source pixel S, Fa * S + Fb * D on premultiplied colors with the
+ * factors of the operation below. Straight alpha images are premultiplied
+ * on the way in and divided again on the way out.
+ *
+ *   op        Fa        Fb         op        Fa        Fb
+ *   SRC       1         0          DST       0         1
+ *   SRCATOP   Da        1 - Sa     DSTATOP   1 - Da    Sa
+ *   SRCIN     Da        0          DSTIN     0         Sa
+ *   SRCOUT    1 - Da    0          DSTOUT    0         1 - Sa
+ *   SRCOVER   1         1 - Sa     DSTOVER   1 - Da    1
+ *   ADD       1         1          CLEAR     0         0
+ *
+ * Both images are ARGB32 or both ABGR32, what the RGA blends.
+ */
+
+#ifndef __BLEND_H_INCLUDED__
+#define __BLEND_H_INCLUDED__
+
+#include "image.h"
+
+/* in the order and with the values of enum v4l2_blend_mode */
+enum blend_op {
+	BLEND_SRC,
+	BLEND_SRCATOP,
+	BLEND_SRCIN,
+	BLEND_SRCOUT,
+	BLEND_SRCOVER,
+	BLEND_DST,
+	BLEND_DSTATOP,
+	BLEND_DSTIN,
+	BLEND_DSTOUT,
+	BLEND_DSTOVER,
+	BLEND_ADD,
+	BLEND_CLEAR,
+	NUM_BLEND_OPS
+};
+
+enum blend_kernel {
+	BLEND_KERNEL_SCALAR,
+	BLEND_KERNEL_SSE2,
+	BLEND_KERNEL_NEON,
+	NUM_BLEND_KERNELS
+};
+
+int blend_kernel_available(enum blend_kernel kernel);
+const char *blend_kernel_name(enum blend_kernel kernel);
+void blend_select_kernel(int kernel);
+
+/* "src", "srcatop", ... as in the table, lower case */
+const char *blend_op_name(enum blend_op op);
+int blend_op_by_name(const char *name);
+/* the operation with source and destination swapped, op(S, D) = swap(op)(D, S) */
+enum blend_op blend_op_swap(enum blend_op op);
+
+int blend_supported(const struct pix_fmt *f);
+int blend_frame(const struct image *dst, const struct image *src,
+		enum blend_op op, int premultiplied);
+
+#endif /* __BLEND_H_INCLUDED__ */
@@ -0,0 +1,753 @@
+/*
+ * Ordered dithering of 8 bit luma with a blue noise threshold texture.
+ *
+ * A pixel of luma y becomes level (y * (levels - 1) + t) / 255 with the
+ * threshold t of its position in the texture, 0..254 with every value
+ * used 16 times. Since y is whole, that is the same as (y + u) / d with
+ * the offset u = t / (levels - 1) and the step d = 255 / (levels - 1),
+ * and as u < d, y + u can saturate at 255 without changing the level.
+ * The vector kernels thus stay in bytes: a saturating add of the offset,
+ * then compares against the steps instead of a division.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "bluenoise.h"
+#include "pool.h"
+#include "simd.h"
+
+/* pixels of an RGB row converted to luma at a time */
+#define BLUENOISE_CHUNK 256
+
+/* converts pixels [0, n) of a row and returns n, a multiple of 16 */
+typedef uint32_t (*row_fn)(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* u, unsigned int levels);
+
+static const char* kernel_names[NUM_BLUENOISE_KERNELS] = {
+    "scalar", "sse2", "avx2", "neon"
+};
+
+/*
+ * 64x64 void-and-cluster texture (Ulichney 1993: Gaussian energy filter of
+ * sigma 1.5 on the torus, 10% initial pattern from a fixed seed), ranks
+ * 0..4095 scaled to 0..254.
+ */
+static const uint8_t __attribute__((aligned(64))) tex[BLUENOISE_SIZE][BLUENOISE_SIZE] = {
+    {
+        254,  88, 123,   6, 180,  93, 203,  66, 226, 162, 208,  92, 231, 128,  43, 145,
+         21, 171, 118, 187, 251, 100, 175,  69, 226,  84, 167,  13, 122, 162,  26,  59,
+        190,  40, 235, 124, 181, 247, 153, 189, 215,  35,  69, 208, 231,  25, 183, 235,
+        116, 162,   2, 124,  36, 238,  62, 161,  31,  69, 226, 180,  63, 241, 185,  11,
+    },
+    {
+        196,  28, 224, 152, 215,  49, 251, 116,  34,  57, 135,   4, 185,  25, 104, 207,
+         57, 242,  91,  32,  54, 142,  23, 239,  30, 139,  55, 247,  76, 209,  94, 244,
+        120,  82, 198,  56,  90,   5,  51, 121,  78, 148, 179,  16, 113,  82, 142,  11,
+         49,  76, 191, 222,  95, 138,  20, 200, 103, 151, 122,  42, 204, 127,  76, 103,
+    },
+    {
+         48, 177,  60, 107,  76, 166,  11, 148, 177, 239,  80, 221, 152,  69, 235, 161,
+         79, 134, 197, 165, 229, 117, 192,  94, 159, 202, 107, 182, 136,  50, 150,   1,
+        214, 153,  13, 166, 136, 231, 161, 207,  11, 251,  49, 136, 194, 245,  60, 217,
+        152, 241,  28, 145,  49, 174, 116, 224,  49, 240,  22, 160,  97,  16, 220, 153,
+    },
+    {
+        209, 119, 245,  17, 199, 132,  86, 218, 103,  25, 199, 107,  48, 123, 194,   8,
+        219,  45,  15, 104,  72,   8, 218,  59, 121,   3, 222,  40,  16, 236, 111, 180,
+         37, 104, 250,  74, 209, 109,  32,  88, 171, 105, 223,  72, 162,  37, 129, 198,
+         96, 122, 178,  85, 203, 244,   5,  77, 170,  90, 209,  71, 247, 171,  35, 137,
+    },
+    {
+          2,  81, 169, 146,  31, 237,  46, 192,  70, 128, 160,  16, 246, 172,  35,  96,
+        117, 157, 238, 210, 148, 178,  41, 168, 250,  79, 149,  98, 194, 165,  80, 227,
+         67, 132, 184,  46,  18, 178,  65, 237, 131,  22, 200,  95,   0, 108, 175,  15,
+         67,  40, 213,  18,  64, 103, 150, 192, 134,  10, 184, 141,  54, 115, 228,  67,
+    },
+    {
+        241, 103,  42, 222,  65, 116, 171,   1, 248,  42, 183,  62, 211,  84, 144, 243,
+        177,  64,  86,  33, 122, 243,  90, 134,  26, 213,  52, 232, 126,  57,  20, 145,
+        199,  23, 234,  97, 151, 224, 118, 185,  43, 154,  61, 181, 237, 211,  85, 253,
+        156, 228, 106, 164, 126, 225,  31,  57, 253,  40, 105, 230,  13, 198,  91, 180,
+    },
+    {
+        124, 213, 135, 181,  92, 208, 151, 100, 142, 207,  95, 139, 114,   5, 200,  53,
+         22, 205, 142, 187,  58,  14, 202,  64, 190, 102, 175,  29,  85, 254, 209, 114,
+         48, 171,  79, 213, 130,  57,   2,  78, 208, 244, 111,  32, 127,  50, 143,  30,
+        189, 132,   3, 248,  45, 174, 199,  92, 118, 213, 152,  79, 127,  43, 161,  28,
+    },
+    {
+        195,  21,  72,  10, 253,  26,  57, 230,  19,  74, 238,  24, 219, 163,  77, 129,
+        232, 112,   0, 219, 102, 163, 228, 115, 156,  11, 133, 205, 158,   4, 179,  94,
+        241, 120,   7, 162,  36, 252, 194, 140,  97,  13, 145, 217, 165,  75, 205, 114,
+         48,  70, 206,  89, 142,  73,  22, 234, 164,  66,  25, 172, 207, 250, 142,  58,
+    },
+    {
+         85, 148, 232, 163, 128, 196,  82, 178, 116, 165,  37, 187,  58, 254,  39, 185,
+         91, 158,  47, 251,  77, 140,  23,  46, 221,  74, 244,  60, 105, 141,  72,  35,
+        150, 218,  63, 203, 107,  84, 166,  28, 232, 175,  65,  90,   8, 233,  24, 175,
+        225, 100, 168,  32, 188, 221, 105, 138,   0, 191, 241,  51,  96,   5, 107, 235,
+    },
+    {
+         39, 186,  99,  55, 109,  40, 137, 217,  49, 205, 127, 150, 105,  85, 138,  10,
+        214,  66, 174, 132,  35, 184, 236,  89, 195, 122,  32, 187, 222,  45, 235, 187,
+         16,  86, 135, 181,  15, 128, 216,  68, 116,  46, 193, 250, 117, 188,  95, 151,
+          9, 134, 241,  60, 119,  11, 159,  54, 209,  88, 115, 141, 187,  72, 211, 170,
+    },
+    {
+        119, 224,   5, 204, 239, 173,  12, 245, 104,   4,  77, 232,  16, 203, 167, 235,
+        108,  26, 197, 116, 209,  67, 111, 171,   4, 147,  95, 164,  15, 126, 204, 111,
+        166, 248,  43, 225,  59, 240,  40, 154, 205, 133,  22, 156,  41, 140,  59, 248,
+         80, 184,  23, 150, 233, 199,  82, 248, 123,  38, 180,  15, 231,  41, 131,  23,
+    },
+    {
+         61,  81, 141,  31,  71, 148,  95,  66, 154, 188, 218,  51, 176, 120,  33,  56,
+        152, 246,  85,   6, 240,  19, 151,  53, 252, 210,  55, 240,  76, 155,  90,  60,
+         31, 196, 118,  96, 146, 173, 106,   6,  85, 239,  99, 209,  77, 221,  27, 204,
+        123,  52, 212,  77, 102,  46, 179,  27, 149, 226,  75, 155, 109, 201, 160, 245,
+    },
+    {
+        208, 164, 182, 122, 223, 189,  22, 209, 125,  36,  91, 137, 241,  70, 211,  96,
+        188, 133,  48, 160,  95, 178, 220,  80, 126,  20, 113, 182,  36, 212,   9, 239,
+        143,  75,   2, 210,  26,  79, 198, 229, 185,  58, 167,   2, 125, 175, 100, 155,
+         36, 236, 111, 164,  19, 137, 229, 106,  62, 197,  24, 243,  52,  82,   8, 100,
+    },
+    {
+         46,  15, 251,  90,  44, 108, 238,  50, 176, 252, 163,  28, 110,   5, 148, 228,
+         13,  72, 222, 201, 122,  41, 138,  29, 200, 169,  86, 226, 136, 110, 162, 185,
+        123, 230, 155, 179, 249,  49, 134,  21, 120,  33, 141, 226,  65, 245,  14, 195,
+         86, 172,   3, 194, 254,  71, 169,   5, 220, 132,  94, 175, 122, 223, 193, 134,
+    },
+    {
+        227, 113,  65, 214,   3, 163, 140,  84, 111,  12,  69, 214, 188, 170,  82, 124,
+         39, 181, 104,  25,  63, 231, 189, 103, 234,  42, 149,   0,  61, 219,  48,  23,
+         97,  54,  33,  88, 113, 204, 163,  73, 176, 253,  82, 193,  43, 115, 144,  54,
+        216, 130,  66, 143,  42, 121, 210,  87, 159,  39, 191,  10, 145,  33,  64, 157,
+    },
+    {
+         24, 191, 151, 130, 180,  59, 197,  26, 233, 202, 143,  99,  44, 244,  55, 199,
+        237, 137, 154, 253, 171,  87,  14,  58, 143,  73, 191, 246,  99, 195,  84, 253,
+        200, 166, 223, 137,  64,  13, 234, 101,  48, 207, 110,  21, 159, 186,  74, 231,
+         29, 101, 242, 204,  95,  28, 186,  52, 112, 247,  66, 215, 105, 250, 173,  90,
+    },
+    {
+        239,  50,  82,  32, 244,  97, 219,  76, 124, 159,  56, 227, 133,  19, 155, 102,
+         21,  84,  53,   1, 128, 213, 152, 248, 119, 216,  27, 124, 164,  13, 127, 148,
+         68, 115,   7, 186, 242, 152,  36, 194, 130,   9, 149, 215,  91, 239,   9, 124,
+        153, 183,  16,  58, 155, 238, 138, 228,  14, 129, 168,  86,  50, 201,   1, 125,
+    },
+    {
+        100, 212, 162, 199, 116,  16, 149,  41, 190,   0,  91,  30, 196, 116, 216,  65,
+        168, 223, 186, 206,  73, 107,  40, 166,   6,  96, 179,  70,  40, 227, 178,  20,
+        234,  38, 213,  81,  45, 125,  91, 224, 160,  75, 243,  58,  36, 106, 166, 206,
+         82,  48, 225, 168, 109,   7,  67, 175,  83, 198,  26, 226, 156, 133,  74, 182,
+    },
+    {
+         29, 136,   8,  68, 231,  52, 176, 250, 104, 215, 169, 246,  75, 177,   4, 249,
+        125,  43, 113, 144,  29, 234, 188,  81, 203,  52, 240, 153, 204, 106,  51,  80,
+        189, 131, 101, 156, 178, 207,   0,  60, 182,  30, 119, 191, 133, 222,  61,  33,
+        249, 113, 136,  79, 218, 192, 120,  34, 213, 144,  47, 115,  17, 237,  42, 221,
+    },
+    {
+         63, 254, 174, 104, 145, 211, 129,  70,  32, 138,  63, 112, 152,  51,  94, 142,
+        198,  14,  92, 246, 160,  58, 131,  20, 226, 111, 136,  10,  86, 244, 143, 217,
+        158,  59, 240,  17,  70, 110, 249, 141, 103, 233,  88, 171,   4, 148, 197,  96,
+        172,   0, 202,  26,  45,  91, 252, 162, 104,  70, 241, 194,  92, 171, 109, 153,
+    },
+    {
+         88, 121,  46, 193,  27,  87,   6, 158, 185, 236,  14, 206,  25, 237, 187,  34,
+         75, 228, 172,  67,   7, 218,  96, 175, 146,  33, 198,  60, 177,  30, 118,   2,
+         95,  29, 201, 140, 229,  29, 164,  44, 200,  16, 211,  49, 252,  78,  21, 120,
+        227,  68, 150, 240, 177, 134,  17,  56, 229,   3, 164, 135,  54, 210,   9, 190,
+    },
+    {
+         23, 206, 225,  76, 163, 241, 118, 223,  96,  47, 125, 181,  84, 134, 108, 214,
+        152, 117,  46, 192, 106, 200,  37, 250,  68,  92, 235, 125, 215, 160,  71, 195,
+        248, 168, 116,  52, 188,  89, 218, 123,  78, 154, 131,  69, 113, 162, 237, 138,
+         50, 195,  87, 119,  59, 214, 151, 204, 128, 180,  82,  20, 250,  78, 128, 236,
+    },
+    {
+        160, 100,   5, 126,  39, 203,  57,  21, 199,  74, 154, 230,  39, 220,   7,  57,
+        175,  18, 235, 128, 154,  75, 123, 161,   2, 189, 154,  17, 102,  48, 227, 134,
+         40,  82, 220,  10, 128, 172,  65,   6, 245, 180,  29, 228, 190,  37,  91, 182,
+         12, 161,  33, 221,   6, 107,  77,  29,  95,  42, 220, 107, 185,  36, 148,  53,
+    },
+    {
+         72, 180, 139, 248, 184,  92, 146, 175, 113, 250,   9, 101, 171,  70, 147, 254,
+         97, 208,  85,  30, 244,  15, 220,  50, 210, 118,  40,  75, 253, 184,  19, 106,
+        179,  64, 154, 105, 254,  38, 144, 195,  95,  47, 104, 143,  10, 220,  60, 212,
+        111, 249,  97, 138, 167, 245, 190, 157, 242, 197, 144,  59, 158, 214, 111, 198,
+    },
+    {
+         39, 227,  26,  64, 111,  12, 237,  66,  34, 167, 140,  57, 203, 114, 191,  33,
+        131,  65, 189, 167,  56, 140, 179, 104,  83, 242, 173, 205, 141,  89, 152, 207,
+          6, 238, 192,  26, 204,  75, 224,  23, 158, 231, 198,  74, 172, 126, 152,  25,
+         75, 204,  48, 183,  72,  21,  49, 125,  64,  12, 119, 235,  25,  94,   0, 244,
+    },
+    {
+        121,  92, 147, 219, 160,  44, 211, 132, 227,  80, 213,  29, 244,  14,  81, 165,
+        227,   1, 145, 102, 205,  81, 230,  21, 137,  60,   9, 110,  53,  28, 233,  60,
+        118, 140,  92,  53, 134, 102, 176, 117,  62, 132,  20, 244,  51,  99, 233, 175,
+        123, 145,   9, 231, 121, 213,  98, 230, 177,  89,  38, 169,  73, 223, 138, 172,
+    },
+    {
+         17, 206,  51, 187,  81, 118, 192,  96,   1, 185, 119,  90, 157, 125, 233,  53,
+        109, 212,  45, 240,  12, 118,  42, 194, 167, 218, 151, 226, 193, 126, 175,  85,
+        215,  38, 172, 229, 158,   7, 242,  42, 217,  81, 185, 112, 207,   1,  83,  41,
+        242,  64, 197,  86,  32, 163, 140,   3, 207, 148, 253, 200, 129, 183,  55,  79,
+    },
+    {
+        157, 252, 107,   4, 239,  25, 166,  53, 154,  40, 234,  62, 179,  36, 197, 146,
+         22, 181, 121,  73, 177, 143, 252,  69, 108,  35,  93,  24,  80, 243,  43, 159,
+         13, 246,  77,  19, 211,  65,  89, 200, 164,  11, 146,  35, 159, 133, 189, 217,
+         21, 158, 108, 176, 251,  61, 193,  44,  76, 113,  18,  97,  44,  11, 231, 195,
+    },
+    {
+         41, 127,  71, 172, 137, 221,  68, 251, 108, 205, 133,  11, 105, 219,  69,  98,
+        250,  82, 158, 232,  32,  94, 159,   3, 202, 130, 248, 185, 138,   0, 114, 197,
+         98, 149, 191, 110, 125, 183, 149,  27, 121, 247,  91, 224,  66, 252,  52, 115,
+         91, 208,  45, 136,  13, 115,  93, 241, 171, 222,  60, 163, 216, 115, 148,  99,
+    },
+    {
+        234, 182,  29, 204,  47,  89, 128, 196,  16,  73, 165, 243, 188, 140,   4, 172,
+         43, 201,  11,  58, 212, 192,  54, 220,  83, 170,  47,  66, 164, 213,  72, 231,
+         48, 130,  62,  30, 251,  46, 230, 105,  61, 190,  48, 174, 106,  14, 169, 141,
+        184,   6, 224,  77, 199, 228, 146,  17, 130,  32, 191, 137,  83, 247,  66,  19,
+    },
+    {
+        139,  84, 223, 112, 150,  10, 180,  37, 148, 225,  94,  28,  47,  85, 236, 118,
+        220, 135, 104, 151, 124,  19, 112, 139, 238,  20, 117, 224, 102,  34, 143, 176,
+         22, 224, 204, 174,  86, 139,   4, 170, 221, 141,   8, 124, 210,  79, 230,  35,
+         67, 246, 101, 157,  56,  33, 166,  69, 200, 102, 243,   2, 180,  33, 164, 207,
+    },
+    {
+         53,  11, 157,  62, 248, 207, 101, 234, 120,  56, 192, 124, 157, 206,  59, 159,
+         26,  68, 188, 226,  77, 246, 182,  34,  67, 188, 149,  12, 202,  55, 247, 108,
+         85, 156,  11, 101, 222,  71, 194,  94,  32,  78, 240, 194,  31, 156,  97, 200,
+        122, 147,  27, 181, 127, 216,  88, 233,  49, 157,  78, 121,  55, 196,  92, 117,
+    },
+    {
+        171, 242, 196,  95,  22, 167,  51,  79, 173,  24, 218,  71, 252, 106,  18, 194,
+         90, 248,  40,   7, 169,  47,  93, 161, 210,  99, 232,  85, 173, 122,   7, 192,
+         63, 242, 123,  50, 153,  22, 237, 119, 207, 163,  99,  63, 138, 245,  19, 173,
+         53, 211,  84, 238,  12, 108, 186,   5, 125, 210,  24, 221, 146, 238,  17, 224,
+    },
+    {
+        101,  73, 126,  38, 142, 114, 219,   3, 245,  99, 146,   9, 181,  39, 135, 217,
+        114, 174, 147,  99, 208, 134, 223,   6, 123,  52,  31, 134, 237,  76, 159, 216,
+        135,  38, 169, 208, 111, 179,  39, 147,  54,  20, 228, 180,  44, 112,  73, 227,
+          4, 111, 168,  43, 201,  58, 143, 250,  97, 182,  44, 172, 106,  67, 132,  41,
+    },
+    {
+        191,   1, 215, 178, 237,  67, 193, 132, 158, 202,  49, 127,  89, 228, 153,  75,
+         50,  16, 235,  56, 117,  28, 191,  79, 252, 155, 201,  64,  23, 186,  46,  93,
+         17, 232,  76,   2, 246,  62, 202,  87, 254, 135, 115,   2, 154, 219, 192, 132,
+        160, 253,  70, 137, 227,  81, 162,  38,  71, 138, 235,  82,   8, 183, 216, 152,
+    },
+    {
+        247, 139,  51,  87,  15, 154,  41,  89,  29,  72, 234, 161, 205,  62,   0, 241,
+        191, 132, 201,  74, 156, 243,  58, 144,  18, 183, 103, 222, 145, 110, 251, 153,
+        199, 103, 183, 143,  91, 130, 159,   8, 173,  70, 214, 187,  66,  91,  24,  50,
+         97,  34, 188,  18, 118, 176,  23, 197, 222,  13, 114, 158, 254,  50,  87,  27,
+    },
+    {
+         69, 108, 165, 225, 187, 104, 253, 208, 121, 180,  14, 107,  30, 184, 122, 165,
+         88,  30, 105, 218,   3, 178,  91, 113, 229,  45,  83, 170,   1, 203,  32,  68,
+        129,  51, 225,  35, 214,  20, 236, 110, 221,  29,  96,  39, 249, 124, 176, 230,
+        206, 149,  87, 213,  54, 246,  92, 122, 151,  58, 189,  34, 133, 196, 120, 173,
+    },
+    {
+         41, 197,  22, 124,  61, 137,   8, 165,  59, 240, 138, 221,  76, 249,  99,  44,
+        226, 147, 181,  45, 129, 232,  36, 203, 163, 131,  27, 243,  60, 124,  87, 217,
+        177,  21, 162, 118,  58, 193,  78,  43, 127, 196, 143, 165, 201,  15, 146,  75,
+        115,   8, 241, 157, 103,   0, 207,  44, 239, 101, 214,  72, 227,  96,  13, 235,
+    },
+    {
+        157, 218,  76, 243,  34, 195,  80, 217, 111,  38,  90, 170,  49, 148,  18, 205,
+         68,  11, 253,  94, 169,  76, 147,  13,  70, 213, 108, 142, 189, 229, 160,   9,
+        241, 105,  74, 250, 170,  98, 147, 185,  62, 244,  12,  78, 109,  56, 240,  37,
+        192,  63, 123,  34, 186, 129, 159,  74, 177,  28, 145,   3, 160,  59, 211, 131,
+    },
+    {
+        102,   4, 142,  93, 158, 233,  48, 146,  22, 186, 212,   8, 200, 127, 232, 174,
+        136, 196, 117,  64,  24, 210, 105, 184, 250,  52, 179,  75,  18,  41, 112, 141,
+         57, 195, 150,   7, 205,  30, 232,   4, 166, 105,  47, 228, 133, 207, 168,  98,
+        135, 234, 173,  79, 229,  57, 221,  15, 113, 206,  86, 241, 114, 183,  31,  81,
+    },
+    {
+        251,  45, 179, 205,  14, 115, 182,  93, 249, 131,  63, 114, 160,  81,  56, 110,
+         85,  36, 221, 152, 191, 239,  38, 125,  94,   7, 149, 236,  97, 211, 174,  79,
+        209,  37, 126,  88,  53, 135, 113, 212,  88, 149, 216, 174,  31,  83,  10, 223,
+         24,  52, 210,  10, 145,  97, 193, 139, 252,  39, 129, 173,  46, 223, 146, 193,
+    },
+    {
+        167, 121, 228,  56, 133,  71, 220,   1, 163,  75, 226,  43, 246,  29, 214,   7,
+        244, 167,  54, 101,   5, 135,  61, 226, 170, 217,  37, 201, 127,  55, 254,  25,
+        101, 236, 165, 218, 183, 239,  70,  41, 197,  21, 123,  65, 246, 155, 116, 183,
+        144,  90, 160, 113, 246,  27,  47,  85, 166,  62, 196,  18,  79, 104,   8,  63,
+    },
+    {
+         28,  73, 104,  23, 248, 170,  37, 110, 201,  26, 151, 192,  95, 177, 119, 151,
+        192,  23, 122, 231, 177,  87, 162,  18,  80, 134, 109,  65, 165,   7, 144, 190,
+        121,  10,  69,  31,  99,  13, 174, 139, 252,  77, 190,   0,  98, 195,  37,  70,
+        254, 196,  35,  66, 203, 178, 121, 225,   5, 107, 229, 150, 248, 199, 130, 235,
+    },
+    {
+        216, 142, 198, 158,  84, 194, 144,  59, 238, 124,  86,   5, 135, 231,  70,  41,
+         90, 140, 208,  76,  43, 246, 112, 202,  51, 185, 246,  26, 194, 232,  93,  63,
+        224, 172, 136, 249, 154, 120, 216,  26, 109,  49, 153, 233, 136,  54, 214, 127,
+          6, 107, 227, 130,  14, 153,  70, 199, 142, 181,  73,  34, 120,  54, 157,  92,
+    },
+    {
+        176,   9, 225,  43, 119,  12, 232,  93, 178,  39, 165, 218,  61,  19, 162, 201,
+        224,  60, 181,  14, 150, 212,  30, 143, 230,   0,  91, 151,  77, 118,  31, 156,
+         48, 207,  89,  44, 202,  78,  55, 160, 229, 182,  86, 210,  25, 168, 239,  88,
+        163,  56, 173,  83, 239, 101,  30, 247,  53,  23, 216,  96, 186,  16, 208,  41,
+    },
+    {
+         66, 129,  94, 184,  63, 215, 131,  19, 208,  71, 254, 112, 198,  99, 242, 128,
+          1, 108, 251,  95, 126,  63, 189,  98,  72, 175, 122, 224,  49, 215, 183, 246,
+        109,  17, 186, 114,   2, 233, 188,  93,  10, 131,  35, 117,  68, 108,  16, 143,
+        190,  27, 209, 147,  44, 215, 168, 115,  86, 159, 132, 239, 168,  85, 242, 113,
+    },
+    {
+        193, 253,  27, 235, 149,  88,  50, 160, 106, 141,  14, 181,  45, 148,  34,  75,
+        172,  48, 154,  27, 233, 168,  10, 243, 132,  36, 202,  15, 164, 101,   4, 131,
+         75, 151, 238,  65, 167, 127,  33, 143, 219,  61, 248, 173, 193, 229,  47, 205,
+         69, 245, 114,   1, 189,  59, 135,   9, 211, 190,  42,   2,  62, 143,  33, 153,
+    },
+    {
+         82,  48, 168, 111,   2, 175, 245, 191,  30, 234,  58, 156,  83, 215, 117, 186,
+        236, 137, 212, 194,  72, 109,  50, 157, 219,  61, 106, 252, 139,  68, 208, 169,
+         24, 220,  38, 139, 215,  98, 245,  72, 192, 156,  96,   5, 137,  84, 159, 125,
+        100,  40, 138,  78, 225,  94, 181, 233,  68,  99, 119, 224, 195, 105, 227,   6,
+    },
+    {
+        120, 217, 141,  69, 205,  38, 117,  74, 213,  92, 129, 203,   5, 247,  22,  58,
+         94,  14,  84,  42, 130, 178, 210,  89,  18, 144, 184,  79,  29, 228,  46,  90,
+        195, 104, 179,  86,  18,  51, 176,  13, 114,  30, 206,  55, 218,  30, 250,  11,
+        213, 175, 233, 163,  25, 122,  38, 151,  18, 254, 166,  78, 131,  49, 174, 206,
+    },
+    {
+        162,  16,  95, 187, 226,  98, 139,   8, 152, 178,  39, 230, 100, 166, 133, 201,
+        225, 121, 184, 222,   3, 249,  34, 121, 196, 241,  47, 168, 123, 191, 150, 242,
+         33, 126,  57, 253, 205, 155, 123, 212,  87, 242, 125, 162, 106,  67, 182, 144,
+         83,  20,  62,  98, 200, 248,  76, 204, 127,  56,  31, 212,  12, 243,  92,  67,
+    },
+    {
+        230,  39, 247,  54,  24, 158, 233,  64, 250,  20, 115,  69, 187,  47,  80, 156,
+         38, 167,  63, 150,  99, 139,  77, 164,  65, 100,   3, 234,  93,  20, 111,  66,
+        141, 226,   5, 147, 106,  35, 235,  60, 150,  45, 179,  15, 230, 199, 112,  53,
+        236, 119, 186,  43, 142,  10, 166, 102, 220, 176, 146, 106, 183, 155,  23, 138,
+    },
+    {
+        196, 109, 171, 126,  87, 182,  47, 190, 126,  83, 200, 147,  26, 237, 109,   7,
+        253, 104,  20, 234,  53, 199, 230,  22, 219, 130, 153, 204,  54, 223, 179,  12,
+        206, 169,  82, 196,  67, 185,  92, 198,   1, 220,  74, 139,  88,  40, 169,   3,
+        203, 153, 221, 110, 236,  60, 190,  46,  23,  85, 239,  69,  43, 202, 116,  55,
+    },
+    {
+          0,  79, 210, 150,  11, 216, 110,  17, 219, 169,  53, 222, 128, 171, 208, 143,
+         74, 215, 188,  87, 170,  12, 111, 178,  45, 189,  31,  77, 127, 161,  83, 247,
+        100,  43, 117, 237,  15, 140,  27, 164, 120, 103, 188, 252,  25, 151, 240, 130,
+         93,  34,  73,  15, 161,  83, 133, 245, 120, 194,  17, 134, 226,  83, 251, 179,
+    },
+    {
+        146, 236,  30,  66, 244, 136,  76, 159,  97,  31, 243,   2,  90,  58,  22, 180,
+         52, 136, 116,  31, 247, 133,  61, 145,  89, 229, 108, 251,   9, 201,  34, 136,
+         61, 190,  28, 161, 212, 110, 249,  65, 231,  32,  57, 124, 211, 102,  71, 187,
+         55, 249, 175, 128, 196, 218,   4, 157,  65, 223, 163, 112,   7, 149,  34,  98,
+    },
+    {
+         61, 118, 190, 103, 170,  35, 193, 238,  61, 135, 107, 154, 193, 120, 241,  97,
+        229,  10, 161, 210,  46,  98, 193, 240,   6, 161,  62, 177, 144,  52, 113, 218,
+        156, 232, 132,  55,  78, 178,  44, 131, 176, 209, 156,   6, 172,  47, 223,  19,
+        139, 102, 213,  25,  94,  44, 112, 180,  32,  98,  52, 187, 208,  64, 169, 217,
+    },
+    {
+        198,  42, 159,   7, 225,  56, 120,   5, 212, 177, 203,  67,  39, 217,  78, 156,
+         37, 202,  63,  84, 142, 221,  25,  77, 202, 125,  28, 215,  80, 237, 184,  22,
+         88,   3, 101, 245, 144,   7, 222,  81,  15,  97,  69, 232,  84, 202, 114, 163,
+        232,  31, 154,  61, 229, 145, 242,  80, 212, 148, 249,  27,  89, 240, 127,  21,
+    },
+    {
+         81, 133, 249,  88, 130, 207,  93, 149,  42,  80,  13, 247, 174, 139,  14, 194,
+        108, 129, 243, 183,   2, 169, 116, 155,  39, 225, 101, 135,  19,  98, 147,  72,
+        199, 167, 214,  36, 192,  95, 202, 150, 239, 117, 191, 134,  37, 147,   9,  66,
+        191,  84, 201, 119, 169,  16,  57, 198,  21, 126,  71, 176, 140,  46, 107, 234,
+    },
+    {
+        180,  15, 214,  68, 187,  18, 165, 253, 114, 223, 128,  91,  26, 105,  56, 251,
+         71, 170,  27, 102, 233,  68,  49, 254,  84, 181,  51, 197, 168, 220,  37, 249,
+        128,  50, 115,  71, 170, 125,  59,  33, 173,  50,  18, 243, 103, 182, 249, 131,
+         41, 111,   0, 254,  77, 189, 136, 107, 164, 225,   2, 116, 222, 193,   8, 152,
+    },
+    {
+        225,  55, 110, 148,  45, 234,  71,  31, 185,  57, 168, 146, 206, 227, 186, 149,
+          6, 211,  52, 152, 124, 214, 185, 129,   9, 141, 243,  73,   0, 122,  63, 174,
+         12, 231, 142,  17, 228,  25, 254, 102, 137, 222, 155,  59, 211,  28,  80, 217,
+        173, 236, 141,  45, 100, 219,  37, 237,  89,  51, 195,  81,  33, 165,  67,  94,
+    },
+    {
+         36, 164, 203,  27, 176, 106, 140, 204,  90,  16, 238,  44,  72, 123,  35,  89,
+        117, 228,  82, 197,  37,  92,  19, 205,  96, 161,  32, 112, 231, 153, 203, 105,
+         79, 182,  93, 197, 155,  86, 207, 182,   1,  80, 204,  93, 126, 167,  51, 100,
+         17,  71, 209, 181, 156,   8,  74, 174,  19, 132, 242, 158, 102, 251, 206, 123,
+    },
+    {
+        240,  73, 127, 247,  87, 214,   3, 121, 155, 215, 109, 184,   0, 159, 238, 177,
+         24, 137, 166,  10, 236, 145,  64, 171, 230,  54, 211, 187,  89,  47,  24, 221,
+        149,  32, 247,  60, 113,  44, 129,  70, 235, 115,  35, 177,  20, 229, 145, 199,
+        158, 120,  24,  59, 129, 244, 116, 206, 150, 216,  65,  13, 134,  53,  21, 146,
+    },
+    {
+          1,  98, 183,  17,  62, 161,  51, 242,  35,  62, 136,  83, 222, 100,  54, 209,
+         67, 245, 101,  57, 179, 112, 245,  28, 117,  78, 132,  20, 173, 252, 131, 186,
+         52, 119, 209,   4, 176, 238,  15, 161,  47, 198, 142, 250,  74, 110,   4, 244,
+         87, 189, 230,  90, 216,  42, 188,  56,  96,  36, 119, 186, 212, 172,  78, 189,
+    },
+    {
+        217,  41, 206, 147, 110, 227, 184,  81, 198, 174, 248,  29, 197, 141,  12, 114,
+        155,  40, 201, 129, 219,  42,  86, 157, 200,   6, 240, 147,  64, 109,  81,   8,
+        237,  73, 162, 137,  79, 200, 140, 223,  87, 170,   9,  55, 188, 216, 133,  64,
+         28,  45, 140, 165,  17, 107, 145,  11, 252, 166,  80, 236,  40,  95, 228, 112,
+    },
+    {
+        135, 167,  68, 238,  38, 130,  19, 144, 100,  12, 118,  50, 167,  73, 253, 190,
+         88, 223,  14,  74, 153,   1, 210, 128,  46, 184, 100, 217,  38, 195, 224, 138,
+        171, 103,  21, 219,  36, 103,  63,  23, 109, 239, 130,  99, 155,  42,  93, 170,
+        209, 103, 251,  68, 203, 178,  83, 220, 126, 195,   3, 108, 144,  24, 157,  55,
+    },
+};
+
+/* min(y + u, 255) / d, written with a constant divisor */
+static inline unsigned int level(unsigned int y, unsigned int u, unsigned int levels)
+{
+    unsigned int v = y + u;
+
+    return (v < 255 ? v : 255) * (levels - 1) / 255;
+}
+
+/* any pixels from x on, x even */
+static void row_tail(uint8_t* dst, const uint8_t* luma, uint32_t x, uint32_t width,
+    const uint8_t* u, unsigned int levels)
+{
+    unsigned int scale = 15 / (levels - 1), q0, q1;
+
+    for (; x + 2 <= width; x += 2) {
+        q0 = level(luma[x], u[x % BLUENOISE_SIZE], levels);
+        q1 = level(luma[x + 1], u[(x + 1) % BLUENOISE_SIZE], levels);
+        dst[x / 2] = q0 * scale << 4 | q1 * scale;
+    }
+    if (x < width) {
+        q0 = level(luma[x], u[x % BLUENOISE_SIZE], levels);
+        dst[x / 2] = (dst[x / 2] & 0x0f) | q0 * scale << 4;
+    }
+}
+
+#ifdef HAVE_SSE2
+/* level of v = min(y + u, 255) times 15 / (levels - 1), in bytes */
+template <unsigned int L>
+static inline __m128i level_epi8(__m128i v)
+{
+    const __m128i ones = _mm_set1_epi8(-1);
+
+    if (L == 16) {
+        /* v = 16h + l = 17h + l - h, so v / 17 is h less one if l < h */
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        __m128i h = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i l = _mm_and_si128(v, nibble);
+
+        return _mm_add_epi8(h, _mm_cmpgt_epi8(h, l));
+    }
+    if (L == 4) {
+        const __m128i five = _mm_set1_epi8(5);
+        __m128i q = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(85)), v), five);
+
+        q = _mm_add_epi8(q, _mm_and_si128(
+                                _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8((char)170)), v), five));
+        return _mm_add_epi8(q, _mm_and_si128(_mm_cmpeq_epi8(v, ones), five));
+    }
+    return _mm_and_si128(_mm_cmpeq_epi8(v, ones), _mm_set1_epi8(15));
+}
+
+template <unsigned int L>
+static uint32_t row_sse2_levels(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* u)
+{
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i v = _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(luma + x)),
+            _mm_load_si128((const __m128i*)(u + x % BLUENOISE_SIZE)));
+        /* pixel 2i in the low byte of word i, 2i + 1 in the high byte */
+        __m128i w = level_epi8<L>(v);
+
+        w = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(w, 4), _mm_srli_epi16(w, 8)), low);
+        _mm_storel_epi64((__m128i*)(dst + x / 2), _mm_packus_epi16(w, w));
+    }
+    return x;
+}
+
+static uint32_t row_sse2(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* u, unsigned int levels)
+{
+    if (levels == 16)
+        return row_sse2_levels<16>(dst, luma, width, u);
+    if (levels == 4)
+        return row_sse2_levels<4>(dst, luma, width, u);
+    return row_sse2_levels<2>(dst, luma, width, u);
+}
+#endif
+
+#ifdef HAVE_AVX2
+template <unsigned int L>
+TARGET_AVX2 static inline __m256i level_avx2(__m256i v)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+
+    if (L == 16) {
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        __m256i h = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i l = _mm256_and_si256(v, nibble);
+
+        return _mm256_add_epi8(h, _mm256_cmpgt_epi8(h, l));
+    }
+    if (L == 4) {
+        const __m256i five = _mm256_set1_epi8(5);
+        __m256i q = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(85)), v), five);
+
+        q = _mm256_add_epi8(q, _mm256_and_si256(
+                                   _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8((char)170)), v),
+                                   five));
+        return _mm256_add_epi8(q, _mm256_and_si256(_mm256_cmpeq_epi8(v, ones), five));
+    }
+    return _mm256_and_si256(_mm256_cmpeq_epi8(v, ones), _mm256_set1_epi8(15));
+}
+
+/* packs the levels of 32 pixels to 16 bytes in both 128 bit lanes */
+TARGET_AVX2 static inline __m256i pack_avx2(__m256i w0, __m256i w1)
+{
+    const __m256i low = _mm256_set1_epi16(0x00ff);
+
+    /* pixel 2i in the low byte of word i, 2i + 1 in the high byte */
+    w0 = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(w0, 4), _mm256_srli_epi16(w0, 8)), low);
+    w1 = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(w1, 4), _mm256_srli_epi16(w1, 8)), low);
+    /* the pack works per 128 bit lane, the permute puts the quarters back in order */
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(w0, w1), 0xd8);
+}
+
+template <unsigned int L>
+TARGET_AVX2 static uint32_t row_avx2_levels(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* u)
+{
+    uint32_t x;
+
+    for (x = 0; x + 64 <= width; x += 64) {
+        __m256i v0 = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(luma + x)),
+            _mm256_load_si256((const __m256i*)u));
+        __m256i v1 = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(luma + x + 32)),
+            _mm256_load_si256((const __m256i*)(u + 32)));
+
+        _mm256_storeu_si256((__m256i*)(dst + x / 2), pack_avx2(level_avx2<L>(v0), level_avx2<L>(v1)));
+    }
+    if (x + 32 <= width) {
+        __m256i v = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(luma + x)),
+            _mm256_load_si256((const __m256i*)u));
+
+        v = pack_avx2(level_avx2<L>(v), _mm256_setzero_si256());
+        _mm_storeu_si128((__m128i*)(dst + x / 2), _mm256_castsi256_si128(v));
+        x += 32;
+    }
+    return x;
+}
+
+TARGET_AVX2 static uint32_t row_avx2(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* u, unsigned int levels)
+{
+    if (levels == 16)
+        return row_avx2_levels<16>(dst, luma, width, u);
+    if (levels == 4)
+        return row_avx2_levels<4>(dst, luma, width, u);
+    return row_avx2_levels<2>(dst, luma, width, u);
+}
+#endif
+
+#ifdef HAVE_NEON
+template <unsigned int L>
+static inline uint8x16_t level_u8(uint8x16_t v)
+{
+    if (L == 16) {
+        uint8x16_t h = vshrq_n_u8(v, 4);
+
+        return vaddq_u8(h, vcgtq_u8(h, vandq_u8(v, vdupq_n_u8(0x0f))));
+    }
+    if (L == 4) {
+        const uint8x16_t five = vdupq_n_u8(5);
+        uint8x16_t q = vandq_u8(vcgeq_u8(v, vdupq_n_u8(85)), five);
+
+        q = vaddq_u8(q, vandq_u8(vcgeq_u8(v, vdupq_n_u8(170)), five));
+        return vaddq_u8(q, vandq_u8(vceqq_u8(v, vdupq_n_u8(255)), five));
+    }
+    return vandq_u8(vceqq_u8(v, vdupq_n_u8(255)), vdupq_n_u8(15));
+}
+
+template <unsigned int L>
+static uint32_t row_neon_levels(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* u)
+{
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x16_t v = vqaddq_u8(vld1q_u8(luma + x), vld1q_u8(u + x % BLUENOISE_SIZE));
+        /* pixel 2i in the low byte of word i, 2i + 1 in the high byte */
+        uint16x8_t w = vreinterpretq_u16_u8(level_u8<L>(v));
+
+        vst1_u8(dst + x / 2, vmovn_u16(vorrq_u16(vshlq_n_u16(w, 4), vshrq_n_u16(w, 8))));
+    }
+    return x;
+}
+
+static uint32_t row_neon(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* u, unsigned int levels)
+{
+    if (levels == 16)
+        return row_neon_levels<16>(dst, luma, width, u);
+    if (levels == 4)
+        return row_neon_levels<4>(dst, luma, width, u);
+    return row_neon_levels<2>(dst, luma, width, u);
+}
+#endif
+
+/* NULL leaves the whole row to row_tail() */
+static row_fn row_kernels[NUM_BLUENOISE_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    row_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_AVX2
+    row_avx2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    row_neon,
+#else
+    NULL,
+#endif
+};
+
+/* index into the table, -1 until the first frame picks the best one */
+static int selected = -1;
+
+int bluenoise_kernel_available(enum bluenoise_kernel kernel)
+{
+    if (kernel < 0 || kernel >= NUM_BLUENOISE_KERNELS
+        || (kernel != BLUENOISE_KERNEL_SCALAR && !row_kernels[kernel]))
+        return 0;
+#ifdef HAVE_AVX2
+    if (kernel == BLUENOISE_KERNEL_AVX2)
+        return cpu_has_avx2();
+#endif
+    return 1;
+}
+
+const char* bluenoise_kernel_name(enum bluenoise_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void bluenoise_select_kernel(int kernel)
+{
+    selected = simd_pick_kernel(kernel, NUM_BLUENOISE_KERNELS, bluenoise_kernel_available);
+}
+
+const uint8_t* bluenoise_row(uint32_t y)
+{
+    return tex[y % BLUENOISE_SIZE];
+}
+
+int bluenoise_supported(const struct pix_fmt* src)
+{
+    unsigned int cpp, chan[3];
+
+    return src->bpp == 8 || !pix_fmt_rgb_layout(src, &cpp, chan);
+}
+
+struct bluenoise_job {
+    const struct image* dst;
+    const struct image* src;
+    uint32_t width;
+    unsigned int levels;
+    /* 0 for a luma plane */
+    unsigned int cpp;
+    unsigned int chan[3];
+    /* the texture as offsets t / (levels - 1) */
+    uint8_t __attribute__((aligned(64))) offset[BLUENOISE_SIZE][BLUENOISE_SIZE];
+};
+
+static void quantize(uint8_t* d, const uint8_t* luma, uint32_t width,
+    const uint8_t* u, unsigned int levels)
+{
+    row_fn row = row_kernels[selected];
+    uint32_t x = row ? row(d, luma, width, u, levels) : 0;
+
+    row_tail(d, luma, x, width, u, levels);
+}
+
+static void bluenoise_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct bluenoise_job* job = (struct bluenoise_job*)arg;
+    uint8_t luma[BLUENOISE_CHUNK];
+    uint32_t x, y, i, n;
+
+    for (y = y0; y < y1; y++) {
+        const uint8_t* s = image_row(job->src, y);
+        uint8_t* d = image_row(job->dst, y);
+        const uint8_t* u = job->offset[y % BLUENOISE_SIZE];
+
+        if (!job->cpp) {
+            quantize(d, s, job->width, u, job->levels);
+            continue;
+        }
+        /* chunks are a multiple of the texture size, so u lines up */
+        for (x = 0; x < job->width; x += BLUENOISE_CHUNK) {
+            n = job->width - x < BLUENOISE_CHUNK ? job->width - x : BLUENOISE_CHUNK;
+            for (i = 0; i < n; i++, s += job->cpp)
+                luma[i] = rgb_to_luma(s[job->chan[0]], s[job->chan[1]], s[job->chan[2]]);
+            quantize(d + x / 2, luma, n, u, job->levels);
+        }
+    }
+}
+
+int bluenoise_frame(const struct image* dst, const struct image* src,
+    unsigned int levels)
+{
+    struct bluenoise_job job;
+    uint32_t height, x, y;
+
+    memset(&job, 0, sizeof(job));
+    if (dst->fmt->v4l2 != V4L2_PIX_FMT_Y4 || !bluenoise_supported(src->fmt)
+        || (levels != 16 && levels != 4 && levels != 2))
+        return -EINVAL;
+    if (src->fmt->bpp != 8)
+        pix_fmt_rgb_layout(src->fmt, &job.cpp, job.chan);
+    if (selected < 0)
+        bluenoise_select_kernel(-1);
+
+    job.dst = dst;
+    job.src = src;
+    job.levels = levels;
+    job.width = src->width < dst->width ? src->width : dst->width;
+    height = src->height < dst->height ? src->height : dst->height;
+    for (y = 0; y < BLUENOISE_SIZE; y++)
+        for (x = 0; x < BLUENOISE_SIZE; x++)
+            job.offset[y][x] = tex[y][x] / (levels - 1);
+
+    parallel_for(height, 16, bluenoise_band, &job);
+    return 0;
+}
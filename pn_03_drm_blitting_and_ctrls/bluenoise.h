@@ -0,0 +1,47 @@
+/*
+ * Ordered dithering of 8 bit luma to 16, 4 or 2 gray levels with a blue
+ * noise threshold texture, written as Y4.
+ *
+ * Unlike the 4x4 Bayer matrix of the RGA dither down, blue noise has no
+ * low frequency structure, so flat areas turn into an even grain instead of
+ * a cross hatch. Every pixel is still decided on its own, from a threshold
+ * lookup and a few byte compares, so on a luma plane the vector kernels
+ * run at roughly half to the full speed of a copy and it can run per frame
+ * for fast refresh content. It is the CPU only dither mode
+ * Y4_DITHER_BLUE_NOISE of y4conv_frame().
+ *
+ * Sources are the RGB formats y4conv_frame() reads, whose luma is computed
+ * first, or the 8 bit luma plane of the YUV formats, which is used as is.
+ */
+
+#ifndef __BLUENOISE_H_INCLUDED__
+#define __BLUENOISE_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "image.h"
+
+/* edge of the square threshold texture, tiled over the frame */
+#define BLUENOISE_SIZE 64
+
+enum bluenoise_kernel {
+	BLUENOISE_KERNEL_SCALAR,
+	BLUENOISE_KERNEL_SSE2,
+	BLUENOISE_KERNEL_AVX2,
+	BLUENOISE_KERNEL_NEON,
+	NUM_BLUENOISE_KERNELS
+};
+
+int bluenoise_kernel_available(enum bluenoise_kernel kernel);
+const char *bluenoise_kernel_name(enum bluenoise_kernel kernel);
+void bluenoise_select_kernel(int kernel);
+
+/* threshold row y of the texture, 0..254 and 16 byte aligned */
+const uint8_t *bluenoise_row(uint32_t y);
+
+int bluenoise_supported(const struct pix_fmt *src);
+/* levels is 16, 4 or 2 */
+int bluenoise_frame(const struct image *dst, const struct image *src,
+		    unsigned int levels);
+
+#endif /* __BLUENOISE_H_INCLUDED__ */
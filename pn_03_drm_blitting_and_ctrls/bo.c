@@ -29,40 +29,78 @@
 
 #include "bo.h"
 #include "dev.h"
+#include "fill.h"
+#include "format.h"
+#include "memtrack.h"
+#include "rt.h"
+#include "wc.h"
+
+static int prefault_maps;
+
+void set_sp_bo_prefault(int enable)
+{
+    prefault_maps = enable;
+}
 
 void fill_bo(struct sp_bo* bo, uint8_t a, uint8_t r, uint8_t g, uint8_t b)
 {
     draw_rect(bo, 0, 0, bo->width, bo->height, a, r, g, b);
 }
 
+template <uint32_t DRM>
+static void draw_rect_px(struct sp_bo* bo, uint32_t x, uint32_t y, uint32_t xmax,
+    uint32_t ymax, uint8_t a, uint8_t r, uint8_t g, uint8_t b)
+{
+    fill_rect(bo->map_addr, bo->pitch, pixel<DRM>::bpp, x, y, xmax - x,
+        ymax - y, pixel<DRM>::pack(a, r, g, b));
+}
+
 void draw_rect(struct sp_bo* bo, uint32_t x, uint32_t y, uint32_t width,
     uint32_t height, uint8_t a, uint8_t r, uint8_t g, uint8_t b)
 {
-    uint32_t i, j, xmax = x + width, ymax = y + height;
+    uint32_t xmax = x + width, ymax = y + height;
 
     if (xmax > bo->width)
         xmax = bo->width;
     if (ymax > bo->height)
         ymax = bo->height;
+    if (x >= xmax || y >= ymax)
+        return;
 
-    for (i = y; i < ymax; i++) {
-        uint8_t* row = (uint8_t*)bo->map_addr + i * bo->pitch;
-
-        for (j = x; j < xmax; j++) {
-            uint8_t* pixel = row + j * 4;
-
-            if (bo->format == DRM_FORMAT_ARGB8888 || bo->format == DRM_FORMAT_XRGB8888) {
-                pixel[0] = b;
-                pixel[1] = g;
-                pixel[2] = r;
-                pixel[3] = a;
-            } else if (bo->format == DRM_FORMAT_RGBA8888) {
-                pixel[0] = r;
-                pixel[1] = g;
-                pixel[2] = b;
-                pixel[3] = a;
-            }
-        }
+    switch (bo->format) {
+    case DRM_FORMAT_ARGB8888:
+        draw_rect_px<DRM_FORMAT_ARGB8888>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_XRGB8888:
+        draw_rect_px<DRM_FORMAT_XRGB8888>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_RGBA8888:
+        draw_rect_px<DRM_FORMAT_RGBA8888>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_BGRA8888:
+        draw_rect_px<DRM_FORMAT_BGRA8888>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_BGRX8888:
+        draw_rect_px<DRM_FORMAT_BGRX8888>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_RGB888:
+        draw_rect_px<DRM_FORMAT_RGB888>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_RGB565:
+        draw_rect_px<DRM_FORMAT_RGB565>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_ARGB1555:
+        draw_rect_px<DRM_FORMAT_ARGB1555>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_ARGB4444:
+        draw_rect_px<DRM_FORMAT_ARGB4444>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    case DRM_FORMAT_R4:
+        draw_rect_px<DRM_FORMAT_R4>(bo, x, y, xmax, ymax, a, r, g, b);
+        break;
+    default:
+        printf("draw_rect: unsupported format %.4s\n", (char*)&bo->format);
+        break;
     }
 }
 
@@ -107,21 +145,34 @@ static int map_sp_bo(struct sp_bo* bo)
         return ret;
     }
 
-    bo->map_addr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED,
-        bo->dev->fd, md.offset);
+    bo->map_addr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | (prefault_maps ? MAP_POPULATE : 0), bo->dev->fd, md.offset);
     if (bo->map_addr == MAP_FAILED) {
         printf("failed to map bo ret=%d\n", -errno);
         return -errno;
     }
+
+    /* MAP_POPULATE is only a hint for device mappings, touch every page */
+    if (prefault_maps)
+        rt_prefault(bo->map_addr, bo->size);
     return 0;
 }
 
 struct sp_bo* create_sp_bo(struct sp_dev* dev, uint32_t width, uint32_t height,
-    uint32_t depth, uint32_t bpp, uint32_t format, uint32_t flags)
+    uint32_t depth, uint32_t bpp, uint32_t format, uint32_t flags,
+    uint32_t role)
+{
+    return create_sp_bo_pitched(dev, width, height, 0, depth, bpp, format, flags, role);
+}
+
+struct sp_bo* create_sp_bo_pitched(struct sp_dev* dev, uint32_t width, uint32_t height,
+    uint32_t pitch, uint32_t depth, uint32_t bpp, uint32_t format, uint32_t flags,
+    uint32_t role)
 {
     int ret;
     struct drm_mode_create_dumb cd;
     struct sp_bo* bo;
+    size_t expected;
 
     memset(&cd, 0, sizeof(cd));
 
@@ -130,10 +181,19 @@ struct sp_bo* create_sp_bo(struct sp_dev* dev, uint32_t width, uint32_t height,
         return NULL;
 
     cd.height = height;
-    cd.width = width;
+    /* wide enough for the rows at the asked pitch, the driver may pad more */
+    cd.width = pitch && pitch * 8 / bpp > width ? pitch * 8 / bpp : width;
     cd.bpp = bpp;
     cd.flags = flags;
 
+    /* refuse before the CMA is taken, the padded size is accounted below */
+    expected = ((size_t)cd.width * bpp + 7) / 8 * height;
+    if (expected > memtrack_available()) {
+        printf("dumb buffer of %zu KiB exceeds the memory budget (%zu KiB left)\n",
+            expected / 1024, memtrack_available() / 1024);
+        goto err;
+    }
+
     ret = drmIoctl(dev->fd, DRM_IOCTL_MODE_CREATE_DUMB, &cd);
     if (ret) {
         printf("failed to create sp_bo %d\n", ret);
@@ -149,8 +209,14 @@ struct sp_bo* create_sp_bo(struct sp_dev* dev, uint32_t width, uint32_t height,
     bo->flags = flags;
 
     bo->handle = cd.handle;
-    bo->pitch = cd.pitch;
+    bo->pitch = pitch ? pitch : cd.pitch;
     bo->size = cd.size;
+    bo->role = role;
+
+    ret = memtrack_reserve((enum mem_role)role, MEM_BACKEND_DUMB, bo->size);
+    if (ret)
+        goto err;
+    bo->accounted = 1;
 
     ret = add_fb_sp_bo(bo, format);
     if (ret) {
@@ -195,5 +261,9 @@ void free_sp_bo(struct sp_bo* bo)
             printf("Failed to destroy buffer ret=%d\n", ret);
     }
 
+    if (bo->accounted)
+        memtrack_release((enum mem_role)bo->role, MEM_BACKEND_DUMB, bo->size);
+
+    wc_shadow_free(bo);
     free(bo);
 }
\ No newline at end of file
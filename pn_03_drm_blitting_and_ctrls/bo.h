@@ -37,11 +37,24 @@ struct sp_bo {
 	void *map_addr;
 	uint32_t pitch;
 	uint32_t size;
+
+	/* enum mem_role, and whether size is counted in the memory tracker */
+	uint32_t role;
+	int accounted;
+
+	/* cached copy of the mapping for the CPU passes, see wc.h */
+	uint8_t *shadow;
+	int shadow_current;
 };
 
 int add_fb_sp_bo(struct sp_bo *bo, uint32_t format);
 struct sp_bo* create_sp_bo(struct sp_dev *dev, uint32_t width, uint32_t height,
-			   uint32_t depth, uint32_t bpp, uint32_t format, uint32_t flags);
+			   uint32_t depth, uint32_t bpp, uint32_t format, uint32_t flags,
+			   uint32_t role);
+/* rows pitch bytes apart instead of what the driver picks, 0 for that */
+struct sp_bo* create_sp_bo_pitched(struct sp_dev *dev, uint32_t width, uint32_t height,
+				   uint32_t pitch, uint32_t depth, uint32_t bpp,
+				   uint32_t format, uint32_t flags, uint32_t role);
 
 void fill_bo(struct sp_bo *bo, uint8_t a, uint8_t r, uint8_t g, uint8_t b);
 void draw_rect(struct sp_bo *bo, uint32_t x, uint32_t y, uint32_t width,
@@ -49,4 +62,7 @@ void draw_rect(struct sp_bo *bo, uint32_t x, uint32_t y, uint32_t width,
 
 void free_sp_bo(struct sp_bo *bo);
 
+/* prefault all future mappings, used by the real-time profile */
+void set_sp_bo_prefault(int enable);
+
 #endif /* __BO_H_INCLUDED__ */ 
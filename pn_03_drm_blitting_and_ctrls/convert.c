@@ -0,0 +1,579 @@
+/*
+ * Format conversion on the CPU.
+ *
+ * A format is described by a traits struct with load(), which reads pixel
+ * x of a row as ARGB, and store() and store2(), which write one pixel or
+ * an even/odd pair of them. convert_span<S, D>() is instantiated for every
+ * pair of the table, so the compiler inlines both sides into one loop per
+ * pair. Pairs are always written from an even x, which lets Y4 write whole
+ * bytes and the 4:2:x formats average the chroma of the pair.
+ *
+ * The fast paths convert the start of a row [0, n) of their pair, the
+ * generic loop finishes it.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "convert.h"
+#include "pool.h"
+#include "simd.h"
+
+struct argb {
+    uint8_t a, r, g, b;
+};
+
+/* one row of every plane; chroma is set on the rows that write chroma */
+struct conv_row {
+    uint8_t* p[3];
+    int chroma;
+};
+
+/* converts pixels [0, n) of a row and returns n, a multiple of 2 */
+typedef uint32_t (*fast_fn)(const struct conv_row* d, const struct conv_row* s,
+    uint32_t width);
+
+struct convert_job;
+typedef void (*rows_fn)(const struct convert_job* job, uint32_t y0, uint32_t y1);
+
+struct convert_job {
+    const struct image* dst;
+    const struct image* src;
+    uint32_t width;
+    rows_fn rows;
+    fast_fn fast;
+};
+
+static const char* kernel_names[NUM_CONVERT_KERNELS] = {
+    "generic", "scalar", "sse2", "neon"
+};
+
+static enum convert_kernel kernel = NUM_CONVERT_KERNELS;
+
+/*
+ * Planes are stored back to back: the chroma rows of NV12, NV16 and NV61
+ * are as long as the luma rows, those of YUV420 and YUV422P half as long.
+ */
+static void image_rows(const struct image* img, uint32_t y, struct conv_row* r)
+{
+    const struct pix_fmt* f = img->fmt;
+    uint32_t cpitch;
+
+    r->p[0] = image_row(img, y);
+    r->chroma = y % f->vsub == 0;
+    if (f->planes == 1)
+        return;
+
+    cpitch = f->planes == 3 ? img->pitch / f->hsub : img->pitch;
+    r->p[1] = img->data + (size_t)img->pitch * img->height + (size_t)(y / f->vsub) * cpitch;
+    r->p[2] = r->p[1] + (size_t)cpitch * (img->height / f->vsub);
+}
+
+static inline uint8_t clamp8(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* BT.601 limited range, 8 bit fixed point */
+static inline struct argb yuv_to_argb(int y, int u, int v)
+{
+    int c = 298 * (y - 16) + 128, d = u - 128, e = v - 128;
+    struct argb p = {
+        255,
+        clamp8((c + 409 * e) >> 8),
+        clamp8((c - 100 * d - 208 * e) >> 8),
+        clamp8((c + 516 * d) >> 8),
+    };
+
+    return p;
+}
+
+static inline uint8_t argb_to_y(struct argb p)
+{
+    uint8_t y, u, v;
+
+    rgb_to_yuv(p.r, p.g, p.b, &y, &u, &v);
+    return y;
+}
+
+/* rgb_to_yuv() of the sum of 1 << (shift - 8) pixels */
+static inline uint8_t chroma_u(int r, int g, int b, int shift)
+{
+    return ((-38 * r - 74 * g + 112 * b + (1 << (shift - 1))) >> shift) + 128;
+}
+
+static inline uint8_t chroma_v(int r, int g, int b, int shift)
+{
+    return ((112 * r - 94 * g - 18 * b + (1 << (shift - 1))) >> shift) + 128;
+}
+
+static inline struct argb gray(uint8_t g)
+{
+    struct argb p = { 255, g, g, g };
+
+    return p;
+}
+
+/* 24 and 32 bpp in V4L2 byte order, r, g and b at byte R, G and B */
+template <unsigned int CPP, int R, int G, int B, bool ALPHA>
+struct rgb_traits {
+    /* the remaining byte of the 32 bpp formats */
+    static constexpr int A = 6 - R - G - B;
+
+    static inline struct argb load(const struct conv_row& s, uint32_t x)
+    {
+        const uint8_t* p = s.p[0] + x * CPP;
+        struct argb c = { ALPHA ? p[A] : (uint8_t)255, p[R], p[G], p[B] };
+
+        return c;
+    }
+    static inline void store(const struct conv_row& d, uint32_t x, struct argb c)
+    {
+        uint8_t* p = d.p[0] + x * CPP;
+
+        p[R] = c.r;
+        p[G] = c.g;
+        p[B] = c.b;
+        if (CPP == 4)
+            p[A] = ALPHA ? c.a : 255;
+    }
+    static inline void store2(const struct conv_row& d, uint32_t x, struct argb c0, struct argb c1)
+    {
+        store(d, x, c0);
+        store(d, x + 1, c1);
+    }
+};
+
+/* the 16 bpp formats, written with the truncating pack of format.h */
+template <uint32_t DRM, int AB, int RB, int GB, int BB>
+struct rgb16_traits {
+    template <int BITS>
+    static inline uint8_t expand(uint32_t v)
+    {
+        v &= (1 << BITS) - 1;
+        return BITS == 1 ? -v : (v << (8 - BITS)) | (v >> (BITS > 4 ? 2 * BITS - 8 : 0));
+    }
+    static inline struct argb load(const struct conv_row& s, uint32_t x)
+    {
+        uint32_t v = ((const uint16_t*)s.p[0])[x];
+        struct argb c = {
+            AB ? expand<AB ? AB : 8>(v >> (RB + GB + BB)) : (uint8_t)255,
+            expand<RB>(v >> (GB + BB)),
+            expand<GB>(v >> BB),
+            expand<BB>(v),
+        };
+
+        return c;
+    }
+    static inline void store(const struct conv_row& d, uint32_t x, struct argb c)
+    {
+        pixel<DRM>::store(d.p[0], x, pixel<DRM>::pack(c.a, c.r, c.g, c.b));
+    }
+    static inline void store2(const struct conv_row& d, uint32_t x, struct argb c0, struct argb c1)
+    {
+        store(d, x, c0);
+        store(d, x + 1, c1);
+    }
+};
+
+struct grey_traits {
+    static inline struct argb load(const struct conv_row& s, uint32_t x)
+    {
+        return gray(s.p[0][x]);
+    }
+    static inline void store(const struct conv_row& d, uint32_t x, struct argb c)
+    {
+        d.p[0][x] = rgb_to_luma(c.r, c.g, c.b);
+    }
+    static inline void store2(const struct conv_row& d, uint32_t x, struct argb c0, struct argb c1)
+    {
+        store(d, x, c0);
+        store(d, x + 1, c1);
+    }
+};
+
+struct y4_traits {
+    static inline struct argb load(const struct conv_row& s, uint32_t x)
+    {
+        return gray(((s.p[0][x / 2] >> (x & 1 ? 0 : 4)) & 0xf) * 17);
+    }
+    static inline void store(const struct conv_row& d, uint32_t x, struct argb c)
+    {
+        pixel<DRM_FORMAT_R4>::store(d.p[0], x, pixel<DRM_FORMAT_R4>::pack(c.a, c.r, c.g, c.b));
+    }
+    static inline void store2(const struct conv_row& d, uint32_t x, struct argb c0, struct argb c1)
+    {
+        d.p[0][x / 2] = (rgb_to_luma(c0.r, c0.g, c0.b) & 0xf0) | rgb_to_luma(c1.r, c1.g, c1.b) >> 4;
+    }
+};
+
+/* semiplanar with u first (SWAP 0) or v first, or planar with 3 planes */
+template <unsigned int PLANES, unsigned int SWAP>
+struct yuv_traits {
+    static inline struct argb load(const struct conv_row& s, uint32_t x)
+    {
+        uint32_t c = x / 2;
+
+        if (PLANES == 2)
+            return yuv_to_argb(s.p[0][x], s.p[1][2 * c + SWAP], s.p[1][2 * c + 1 - SWAP]);
+        return yuv_to_argb(s.p[0][x], s.p[1][c], s.p[2][c]);
+    }
+    static inline void put_chroma(const struct conv_row& d, uint32_t c, uint8_t u, uint8_t v)
+    {
+        if (PLANES == 2) {
+            d.p[1][2 * c + SWAP] = u;
+            d.p[1][2 * c + 1 - SWAP] = v;
+        } else {
+            d.p[1][c] = u;
+            d.p[2][c] = v;
+        }
+    }
+    static inline void store(const struct conv_row& d, uint32_t x, struct argb c)
+    {
+        uint8_t u, v;
+
+        rgb_to_yuv(c.r, c.g, c.b, &d.p[0][x], &u, &v);
+        if (d.chroma && !(x & 1))
+            put_chroma(d, x / 2, u, v);
+    }
+    static inline void store2(const struct conv_row& d, uint32_t x, struct argb c0, struct argb c1)
+    {
+        int r = c0.r + c1.r, g = c0.g + c1.g, b = c0.b + c1.b;
+
+        d.p[0][x] = argb_to_y(c0);
+        d.p[0][x + 1] = argb_to_y(c1);
+        if (d.chroma)
+            put_chroma(d, x / 2, chroma_u(r, g, b, 9), chroma_v(r, g, b, 9));
+    }
+};
+
+typedef yuv_traits<2, 0> nv12_traits;
+typedef yuv_traits<2, 1> nv61_traits;
+typedef yuv_traits<3, 0> yuv_planar_traits;
+typedef rgb_traits<4, 1, 2, 3, true> argb32_traits;
+typedef rgb_traits<4, 1, 2, 3, false> xrgb32_traits;
+typedef rgb_traits<4, 2, 1, 0, true> abgr32_traits;
+typedef rgb_traits<4, 2, 1, 0, false> xbgr32_traits;
+typedef rgb_traits<3, 0, 1, 2, false> rgb24_traits;
+typedef rgb16_traits<DRM_FORMAT_RGB565, 0, 5, 6, 5> rgb565_traits;
+typedef rgb16_traits<DRM_FORMAT_ARGB1555, 1, 5, 5, 5> argb555_traits;
+typedef rgb16_traits<DRM_FORMAT_ARGB4444, 4, 4, 4, 4> argb444_traits;
+
+/* every format of the table and GREY, the subsampling is in image_rows() */
+#define CONVERT_FORMATS(X)                         \
+    X(V4L2_PIX_FMT_NV12, nv12_traits)              \
+    X(V4L2_PIX_FMT_NV16, nv12_traits)              \
+    X(V4L2_PIX_FMT_NV61, nv61_traits)              \
+    X(V4L2_PIX_FMT_YUV420, yuv_planar_traits)      \
+    X(V4L2_PIX_FMT_YUV422P, yuv_planar_traits)     \
+    X(V4L2_PIX_FMT_ARGB32, argb32_traits)          \
+    X(V4L2_PIX_FMT_XRGB32, xrgb32_traits)          \
+    X(V4L2_PIX_FMT_ABGR32, abgr32_traits)          \
+    X(V4L2_PIX_FMT_XBGR32, xbgr32_traits)          \
+    X(V4L2_PIX_FMT_RGB24, rgb24_traits)            \
+    X(V4L2_PIX_FMT_RGB565, rgb565_traits)          \
+    X(V4L2_PIX_FMT_ARGB555, argb555_traits)        \
+    X(V4L2_PIX_FMT_ARGB444, argb444_traits)        \
+    X(V4L2_PIX_FMT_GREY, grey_traits)              \
+    X(V4L2_PIX_FMT_Y4, y4_traits)
+
+/* pixels [x, width) of a row, x even */
+template <class S, class D>
+static inline void convert_span(const struct conv_row& d, const struct conv_row& s,
+    uint32_t x, uint32_t width)
+{
+    for (; x + 2 <= width; x += 2)
+        D::store2(d, x, S::load(s, x), S::load(s, x + 1));
+    if (x < width)
+        D::store(d, x, S::load(s, x));
+}
+
+template <class S, class D>
+static void convert_rows(const struct convert_job* job, uint32_t y0, uint32_t y1)
+{
+    struct conv_row s, d;
+    uint32_t x, y;
+
+    for (y = y0; y < y1; y++) {
+        image_rows(job->src, y, &s);
+        image_rows(job->dst, y, &d);
+        x = job->fast ? job->fast(&d, &s, job->width) : 0;
+        convert_span<S, D>(d, s, x, job->width);
+    }
+}
+
+template <class S>
+static rows_fn rows_from(uint32_t dst)
+{
+#define DST_CASE(v4l2, traits) \
+    case v4l2:                 \
+        return convert_rows<S, traits>;
+
+    switch (dst) {
+        CONVERT_FORMATS(DST_CASE)
+    }
+#undef DST_CASE
+    return NULL;
+}
+
+static rows_fn rows_for(uint32_t src, uint32_t dst)
+{
+#define SRC_CASE(v4l2, traits) \
+    case v4l2:                 \
+        return rows_from<traits>(dst);
+
+    switch (src) {
+        CONVERT_FORMATS(SRC_CASE)
+    }
+#undef SRC_CASE
+    return NULL;
+}
+
+/* the same format, all planes copied row by row */
+static void copy_rows(const struct convert_job* job, uint32_t y0, uint32_t y1)
+{
+    const struct pix_fmt* f = job->src->fmt;
+    uint32_t cw = (job->width + f->hsub - 1) / f->hsub, y;
+    size_t chroma = f->planes == 2 ? 2 * cw : cw;
+    struct conv_row s, d;
+    unsigned int i;
+
+    for (y = y0; y < y1; y++) {
+        image_rows(job->src, y, &s);
+        image_rows(job->dst, y, &d);
+        memcpy(d.p[0], s.p[0], pix_fmt_row_bytes(f, job->width));
+        for (i = 1; d.chroma && i < f->planes; i++)
+            memcpy(d.p[i], s.p[i], chroma);
+    }
+}
+
+/* 4 pixels from 3 little endian words: r0 g0 b0 r1, g1 b1 r2 g2, b2 r3 g3 b3 */
+static uint32_t rgb24_xrgb32_scalar(const struct conv_row* d, const struct conv_row* s,
+    uint32_t width)
+{
+    const uint8_t* src = s->p[0];
+    uint32_t* dst = (uint32_t*)d->p[0];
+    uint32_t x, w[3];
+
+    for (x = 0; x + 4 <= width; x += 4, src += 12, dst += 4) {
+        memcpy(w, src, sizeof(w));
+        dst[0] = 0xff | w[0] << 8;
+        dst[1] = 0xff | (w[0] >> 24) << 8 | w[1] << 16;
+        dst[2] = 0xff | (w[1] >> 16) << 8 | w[2] << 24;
+        dst[3] = 0xff | (w[2] & 0xffffff00);
+    }
+    return x;
+}
+
+/* a chroma pair is worked out once for both pixels */
+static uint32_t nv12_xrgb32_scalar(const struct conv_row* d, const struct conv_row* s,
+    uint32_t width)
+{
+    const uint8_t* luma = s->p[0];
+    const uint8_t* uv = s->p[1];
+    uint8_t* dst = d->p[0];
+    uint32_t x;
+    int i, c, dr, dg, db;
+
+    for (x = 0; x + 2 <= width; x += 2, uv += 2) {
+        dr = 409 * (uv[1] - 128);
+        dg = -100 * (uv[0] - 128) - 208 * (uv[1] - 128);
+        db = 516 * (uv[0] - 128);
+        for (i = 0; i < 2; i++, dst += 4) {
+            c = 298 * (luma[x + i] - 16) + 128;
+            dst[0] = 255;
+            dst[1] = clamp8((c + dr) >> 8);
+            dst[2] = clamp8((c + dg) >> 8);
+            dst[3] = clamp8((c + db) >> 8);
+        }
+    }
+    return x;
+}
+
+#ifdef HAVE_SSE2
+/* the weighted r, g and b of 4 XRGB32 pixels, in 32 bit lanes */
+static inline __m128i luma_sum4(__m128i v, __m128i weights)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+
+    /* x * 0 + r * 77, g * 150 + b * 29 per pixel, added up in lanes 0 and 2 */
+    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi64(lo, hi), _mm_set1_epi32(128)), 8);
+}
+
+static uint32_t xrgb32_grey_sse2(const struct conv_row* d, const struct conv_row* s,
+    uint32_t width)
+{
+    const __m128i weights = _mm_setr_epi16(0, 77, 150, 29, 0, 77, 150, 29);
+    const uint8_t* src = s->p[0];
+    uint8_t* dst = d->p[0];
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        const __m128i* p = (const __m128i*)(src + 4 * x);
+        __m128i a = luma_sum4(_mm_loadu_si128(p), weights);
+        __m128i b = luma_sum4(_mm_loadu_si128(p + 1), weights);
+        __m128i c = luma_sum4(_mm_loadu_si128(p + 2), weights);
+        __m128i e = luma_sum4(_mm_loadu_si128(p + 3), weights);
+
+        _mm_storeu_si128((__m128i*)(dst + x),
+            _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, e)));
+    }
+    return x;
+}
+#endif
+
+#ifdef HAVE_NEON
+static uint32_t rgb24_xrgb32_neon(const struct conv_row* d, const struct conv_row* s,
+    uint32_t width)
+{
+    const uint8_t* src = s->p[0];
+    uint8_t* dst = d->p[0];
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x16x3_t rgb = vld3q_u8(src + 3 * x);
+        uint8x16x4_t xrgb;
+
+        xrgb.val[0] = vdupq_n_u8(255);
+        xrgb.val[1] = rgb.val[0];
+        xrgb.val[2] = rgb.val[1];
+        xrgb.val[3] = rgb.val[2];
+        vst4q_u8(dst + 4 * x, xrgb);
+    }
+    return x;
+}
+
+static inline uint8x8_t luma_u8(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    uint16x8_t sum = vmull_u8(r, vdup_n_u8(77));
+
+    sum = vmlal_u8(sum, g, vdup_n_u8(150));
+    sum = vmlal_u8(sum, b, vdup_n_u8(29));
+    return vrshrn_n_u16(sum, 8);
+}
+
+static uint32_t xrgb32_grey_neon(const struct conv_row* d, const struct conv_row* s,
+    uint32_t width)
+{
+    const uint8_t* src = s->p[0];
+    uint8_t* dst = d->p[0];
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x16x4_t v = vld4q_u8(src + 4 * x);
+
+        vst1_u8(dst + x, luma_u8(vget_low_u8(v.val[1]), vget_low_u8(v.val[2]),
+                             vget_low_u8(v.val[3])));
+        vst1_u8(dst + x + 8, luma_u8(vget_high_u8(v.val[1]), vget_high_u8(v.val[2]),
+                                 vget_high_u8(v.val[3])));
+    }
+    return x;
+}
+#endif
+
+struct fast_path {
+    uint32_t src;
+    uint32_t dst;
+    /* per kernel but the generic one, NULL where the pair loop is as good */
+    fast_fn fn[NUM_CONVERT_KERNELS - 1];
+};
+
+#ifdef HAVE_SSE2
+#define SSE2_OR(fn, fallback) fn
+#else
+#define SSE2_OR(fn, fallback) fallback
+#endif
+#ifdef HAVE_NEON
+#define NEON_OR(fn, fallback) fn
+#else
+#define NEON_OR(fn, fallback) fallback
+#endif
+
+static const struct fast_path fast_paths[] = {
+    { V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_XRGB32,
+        { rgb24_xrgb32_scalar, rgb24_xrgb32_scalar,
+            NEON_OR(rgb24_xrgb32_neon, rgb24_xrgb32_scalar) } },
+    { V4L2_PIX_FMT_XRGB32, V4L2_PIX_FMT_GREY,
+        { NULL, SSE2_OR(xrgb32_grey_sse2, NULL), NEON_OR(xrgb32_grey_neon, NULL) } },
+    { V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_XRGB32,
+        { nv12_xrgb32_scalar, nv12_xrgb32_scalar, nv12_xrgb32_scalar } },
+};
+
+int convert_kernel_available(enum convert_kernel k)
+{
+    switch (k) {
+    case CONVERT_KERNEL_GENERIC:
+    case CONVERT_KERNEL_SCALAR:
+        return 1;
+#ifdef HAVE_SSE2
+    case CONVERT_KERNEL_SSE2:
+        return 1;
+#endif
+#ifdef HAVE_NEON
+    case CONVERT_KERNEL_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+const char* convert_kernel_name(enum convert_kernel k)
+{
+    return kernel_names[k];
+}
+
+void convert_select_kernel(int k)
+{
+    kernel = (enum convert_kernel)simd_pick_kernel(k, NUM_CONVERT_KERNELS, convert_kernel_available);
+}
+
+int convert_supported(const struct pix_fmt* f)
+{
+    return f->v4l2 && rows_for(f->v4l2, f->v4l2) != NULL;
+}
+
+static void convert_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    const struct convert_job* job = (const struct convert_job*)arg;
+
+    job->rows(job, y0, y1);
+}
+
+int convert_image(const struct image* dst, const struct image* src)
+{
+    struct convert_job job;
+    uint32_t height;
+    size_t i;
+
+    if (!convert_supported(dst->fmt) || !convert_supported(src->fmt))
+        return -EINVAL;
+    if (kernel == NUM_CONVERT_KERNELS)
+        convert_select_kernel(-1);
+
+    job.dst = dst;
+    job.src = src;
+    job.width = src->width < dst->width ? src->width : dst->width;
+    height = src->height < dst->height ? src->height : dst->height;
+    job.fast = NULL;
+    if (src->fmt->v4l2 == dst->fmt->v4l2) {
+        job.rows = copy_rows;
+    } else {
+        job.rows = rows_for(src->fmt->v4l2, dst->fmt->v4l2);
+        for (i = 0; kernel != CONVERT_KERNEL_GENERIC
+             && i < sizeof(fast_paths) / sizeof(fast_paths[0]);
+             i++) {
+            if (fast_paths[i].src == src->fmt->v4l2 && fast_paths[i].dst == dst->fmt->v4l2)
+                job.fast = fast_paths[i].fn[kernel - 1];
+        }
+    }
+
+    parallel_for(height, 16, convert_band, &job);
+    return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * Conversion between any two formats of the table on the CPU, what the
+ * RGA does between its source and destination formats.
+ *
+ * Every pair of formats gets its own inner loop, instantiated from the
+ * traits of the source and destination format, that reads a pixel of the
+ * source and writes it to the destination without an intermediate row.
+ * RGB24 to XRGB32, XRGB32 to GREY and NV12 to XRGB32 have hand written
+ * fast paths on top.
+ *
+ * YUV is BT.601 limited range. Subsampled chroma is the average of the
+ * horizontal pair of pixels on the first row of each vertical pair; gray
+ * and Y4 are the Y400 luma of rgb_to_luma().
+ */
+
+#ifndef __CONVERT_H_INCLUDED__
+#define __CONVERT_H_INCLUDED__
+
+#include "image.h"
+
+enum convert_kernel {
+	/* the per pair loops only, the reference for the fast paths */
+	CONVERT_KERNEL_GENERIC,
+	CONVERT_KERNEL_SCALAR,
+	CONVERT_KERNEL_SSE2,
+	CONVERT_KERNEL_NEON,
+	NUM_CONVERT_KERNELS
+};
+
+int convert_kernel_available(enum convert_kernel kernel);
+const char *convert_kernel_name(enum convert_kernel kernel);
+void convert_select_kernel(int kernel);
+
+int convert_supported(const struct pix_fmt *f);
+/* the overlapping part of src into dst; src and dst must not overlap */
+int convert_image(const struct image *dst, const struct image *src);
+
+#endif /* __CONVERT_H_INCLUDED__ */
@@ -0,0 +1,166 @@
+/*
+ * Size based routing of conversion jobs between the RGA and the CPU.
+ */
+
+#include <string.h>
+
+#include "dispatch.h"
+
+/* weight of the older jobs in the fits per new job, about the last 32 count */
+#define DISPATCH_DECAY (1.0 - 1.0 / 32)
+/* share of the predicted work that probing the slower engine may cost */
+#define DISPATCH_PROBE_SHARE (1.0 / 16)
+
+static const char* engine_names[NUM_DISPATCH_ENGINES] = { "RGA", "CPU" };
+
+const char* dispatch_engine_name(enum dispatch_engine engine)
+{
+    return engine < NUM_DISPATCH_ENGINES ? engine_names[engine] : "?";
+}
+
+void dispatch_init(struct dispatcher* d)
+{
+    memset(d, 0, sizeof(*d));
+}
+
+static struct dispatch_class* find_class(struct dispatcher* d, const struct pix_fmt* src,
+    const struct pix_fmt* dst, int rotate)
+{
+    struct dispatch_class* c;
+    unsigned int i;
+
+    for (i = 0; i < d->count; i++) {
+        c = &d->classes[i];
+        if (c->src == src && c->dst == dst && c->rotate == rotate)
+            return c;
+    }
+    if (d->count == DISPATCH_MAX_CLASSES)
+        return NULL;
+    c = &d->classes[d->count++];
+    c->src = src;
+    c->dst = dst;
+    c->rotate = rotate;
+    return c;
+}
+
+/*
+ * fixed + per_px * pixels through the samples. Jobs of a single size do not
+ * tell the two apart, then all of it counts per pixel until other sizes
+ * come along; an engine that looks too cheap that way gets jobs and with
+ * them the samples that correct it.
+ */
+static void solve(const struct dispatch_fit* fit, double* fixed, double* per_px)
+{
+    double mx = fit->sx / fit->n, my = fit->sy / fit->n;
+    double var = fit->sxx / fit->n - mx * mx;
+    double cov = fit->sxy / fit->n - mx * my;
+
+    *fixed = 0;
+    *per_px = mx > 0 ? my / mx : 0;
+    if (var <= mx * mx * 1e-4)
+        return;
+    if (cov / var >= 0 && my - cov / var * mx >= 0) {
+        *per_px = cov / var;
+        *fixed = my - *per_px * mx;
+    } else if (cov / var < 0) {
+        /* bigger jobs took less time: noise, a constant is the best guess */
+        *per_px = 0;
+        *fixed = my;
+    }
+}
+
+double dispatch_predict(const struct dispatch_fit* fit, uint64_t pixels)
+{
+    double fixed, per_px;
+
+    if (fit->n <= 0)
+        return 0;
+    solve(fit, &fixed, &per_px);
+    return fixed + per_px * pixels;
+}
+
+enum dispatch_engine dispatch_pick(struct dispatcher* d, const struct pix_fmt* src,
+    const struct pix_fmt* dst, int rotate, uint64_t pixels)
+{
+    struct dispatch_class* c = find_class(d, src, dst, rotate);
+    enum dispatch_engine best, other;
+    double t_rga, t_cpu, t_best, t_other;
+    int probe = 0;
+
+    if (!c)
+        return DISPATCH_RGA;
+    c->jobs++;
+
+    if (c->fit[DISPATCH_RGA].n <= 0 || c->fit[DISPATCH_CPU].n <= 0) {
+        /* one job each before there is anything to compare */
+        best = c->fit[DISPATCH_RGA].n <= 0 ? DISPATCH_RGA : DISPATCH_CPU;
+        probe = 1;
+    } else {
+        t_rga = dispatch_predict(&c->fit[DISPATCH_RGA], pixels);
+        t_cpu = dispatch_predict(&c->fit[DISPATCH_CPU], pixels);
+        best = t_cpu < t_rga ? DISPATCH_CPU : DISPATCH_RGA;
+        other = best == DISPATCH_CPU ? DISPATCH_RGA : DISPATCH_CPU;
+        t_best = best == DISPATCH_CPU ? t_cpu : t_rga;
+        t_other = best == DISPATCH_CPU ? t_rga : t_cpu;
+        // a fit can go stale, a slower engine costs the probe only
+        c->credit += t_best * DISPATCH_PROBE_SHARE;
+        if (c->credit >= t_other - t_best) {
+            c->credit = 0;
+            best = other;
+            probe = 1;
+        }
+    }
+
+    c->fit[best].jobs++;
+    c->fit[best].probes += probe;
+    return best;
+}
+
+void dispatch_record(struct dispatcher* d, const struct pix_fmt* src,
+    const struct pix_fmt* dst, int rotate, uint64_t pixels, enum dispatch_engine engine,
+    uint64_t ns)
+{
+    struct dispatch_class* c = find_class(d, src, dst, rotate);
+    struct dispatch_fit* fit;
+    double x = pixels, y = ns;
+
+    if (!c || engine >= NUM_DISPATCH_ENGINES)
+        return;
+    fit = &c->fit[engine];
+    fit->n = fit->n * DISPATCH_DECAY + 1;
+    fit->sx = fit->sx * DISPATCH_DECAY + x;
+    fit->sy = fit->sy * DISPATCH_DECAY + y;
+    fit->sxx = fit->sxx * DISPATCH_DECAY + x * x;
+    fit->sxy = fit->sxy * DISPATCH_DECAY + x * y;
+}
+
+void dispatch_report(const struct dispatcher* d, FILE* fp)
+{
+    const struct dispatch_class* c;
+    double fixed[NUM_DISPATCH_ENGINES], per_px[NUM_DISPATCH_ENGINES];
+    unsigned int i, e, small, large;
+
+    for (i = 0; i < d->count; i++) {
+        c = &d->classes[i];
+        fprintf(fp, "dispatch %s to %s, rotate %d: %lu jobs\n", c->src->name, c->dst->name,
+            c->rotate, c->jobs);
+        for (e = 0; e < NUM_DISPATCH_ENGINES; e++) {
+            fixed[e] = per_px[e] = 0;
+            if (c->fit[e].n > 0)
+                solve(&c->fit[e], &fixed[e], &per_px[e]);
+            fprintf(fp, "  %s: %lu jobs, %lu probes, %.1f usecs + %.3f nsecs/px\n",
+                engine_names[e], c->fit[e].jobs, c->fit[e].probes, fixed[e] / 1e3, per_px[e]);
+        }
+        if (c->fit[DISPATCH_RGA].n <= 0 || c->fit[DISPATCH_CPU].n <= 0)
+            continue;
+        // the lines cross where the engine with less fixed cost stops winning
+        small = fixed[DISPATCH_CPU] <= fixed[DISPATCH_RGA] ? DISPATCH_CPU : DISPATCH_RGA;
+        large = small == DISPATCH_CPU ? DISPATCH_RGA : DISPATCH_CPU;
+        if (per_px[small] > per_px[large])
+            fprintf(fp, "  %s below %.0f px, %s above\n", engine_names[small],
+                (fixed[large] - fixed[small]) / (per_px[small] - per_px[large]),
+                engine_names[large]);
+        else
+            fprintf(fp, "  %s at every size\n", engine_names[small]);
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Routing conversion jobs to the RGA or the CPU by their size.
+ *
+ * A job through the RGA pays a fixed price for QBUF, the interrupt and
+ * DQBUF before its first pixel, the CPU hardly any, but converts each pixel
+ * slower. The time of every job is fed back, and per job class, the pair
+ * of formats and the rotation, each engine gets a least squares fit of
+ * time = fixed + per_px * pixels over its recent jobs. A job goes to the
+ * engine the fits predict to be faster; now and then the other engine gets
+ * one to keep its fit current.
+ */
+
+#ifndef __DISPATCH_H_INCLUDED__
+#define __DISPATCH_H_INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "format.h"
+
+enum dispatch_engine {
+	DISPATCH_RGA,
+	DISPATCH_CPU,
+	NUM_DISPATCH_ENGINES
+};
+
+/* decayed sums of the recent jobs of one engine, x in pixels, y in ns */
+struct dispatch_fit {
+	double n;
+	double sx;
+	double sy;
+	double sxx;
+	double sxy;
+	/* jobs routed here, probes among them */
+	unsigned long jobs;
+	unsigned long probes;
+};
+
+struct dispatch_class {
+	const struct pix_fmt *src;
+	const struct pix_fmt *dst;
+	int rotate;
+	unsigned long jobs;
+	/* ns of predicted work the next probe of the slower engine may cost */
+	double credit;
+	struct dispatch_fit fit[NUM_DISPATCH_ENGINES];
+};
+
+#define DISPATCH_MAX_CLASSES 16
+
+struct dispatcher {
+	unsigned int count;
+	struct dispatch_class classes[DISPATCH_MAX_CLASSES];
+};
+
+const char *dispatch_engine_name(enum dispatch_engine engine);
+
+void dispatch_init(struct dispatcher *d);
+/* the engine for a job of pixels from src to dst, rotated by rotate degrees */
+enum dispatch_engine dispatch_pick(struct dispatcher *d, const struct pix_fmt *src,
+				   const struct pix_fmt *dst, int rotate,
+				   uint64_t pixels);
+/* the job took ns on the engine dispatch_pick() gave it to */
+void dispatch_record(struct dispatcher *d, const struct pix_fmt *src,
+		     const struct pix_fmt *dst, int rotate, uint64_t pixels,
+		     enum dispatch_engine engine, uint64_t ns);
+/* predicted ns for a job of pixels, 0 while the engine has no samples */
+double dispatch_predict(const struct dispatch_fit *fit, uint64_t pixels);
+/* jobs per engine, the fits and the size below which the CPU wins */
+void dispatch_report(const struct dispatcher *d, FILE *fp);
+
+#endif /* __DISPATCH_H_INCLUDED__ */
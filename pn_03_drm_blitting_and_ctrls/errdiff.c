@@ -0,0 +1,224 @@
+/*
+ * Error diffusion of the luma of an RGB frame to 16, 4 or 2 gray levels.
+ *
+ * A row can only be quantized where the rows above have handed on all of
+ * their error, so rows are processed as a diagonal wavefront: each thread
+ * takes the next row and follows the row above it at a distance of at
+ * least one block, waiting on the block count that row publishes.
+ *
+ * Errors are kept in 1/16 luma steps in a ring of int16 rows, one per
+ * thread that can be inside a row plus the two rows below the last one.
+ * A row clears its entries as it reads them, so a slot is zero again by
+ * the time it comes round to a new row.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errdiff.h"
+#include "pool.h"
+
+/* distance kept to the row above, at least the 2 pixels errors reach */
+#define ERRDIFF_BLOCK 128
+/* entries left and right of a row that errors of the edge pixels go to */
+#define ERRDIFF_PAD 2
+
+/* white in the 1/16 steps of the errors */
+#define ERRDIFF_WHITE (255 * 16)
+
+static const char* method_names[NUM_ERRDIFF_METHODS] = {
+    "fs", "atkinson", "sierra-lite"
+};
+
+struct errdiff_job;
+typedef void (*diffuse_fn)(struct errdiff_job* job, uint32_t y);
+
+struct errdiff_job {
+    const struct image* dst;
+    const struct image* src;
+    uint32_t width, height;
+    unsigned int cpp;
+    unsigned int chan[3];
+    unsigned int levels;
+    /* Y4 value of each level */
+    uint8_t y4[16];
+    diffuse_fn row;
+    uint32_t blocks;
+    uint32_t next_row;
+    unsigned int ring;
+    int16_t* err;
+    size_t err_pitch;
+    /* row y publishes y * (blocks + 1) + blocks done in slot y % ring */
+    uint64_t* progress;
+};
+
+const char* errdiff_method_name(enum errdiff_method method)
+{
+    return method_names[method];
+}
+
+int errdiff_method_by_name(const char* name)
+{
+    int m;
+
+    for (m = 0; m < NUM_ERRDIFF_METHODS; m++) {
+        if (!strcmp(name, method_names[m]))
+            return m;
+    }
+    return -1;
+}
+
+int errdiff_supported(const struct pix_fmt* src)
+{
+    unsigned int cpp, chan[3];
+
+    return !pix_fmt_rgb_layout(src, &cpp, chan);
+}
+
+static inline int16_t* err_row(const struct errdiff_job* job, uint32_t y)
+{
+    return job->err + (y % job->ring) * job->err_pitch + ERRDIFF_PAD;
+}
+
+static void wait_for_row(const struct errdiff_job* job, uint32_t y, uint32_t blocks)
+{
+    uint64_t want = (uint64_t)y * (job->blocks + 1) + blocks;
+    unsigned int spins = 0;
+
+    while (__atomic_load_n(&job->progress[y % job->ring], __ATOMIC_ACQUIRE) < want) {
+        if (++spins > 64)
+            sched_yield();
+    }
+}
+
+template <enum errdiff_method M>
+static void diffuse_row(struct errdiff_job* job, uint32_t y)
+{
+    const uint8_t* s = image_row(job->src, y);
+    uint8_t* d = image_row(job->dst, y);
+    int16_t* cur = err_row(job, y);
+    int16_t* below = err_row(job, y + 1);
+    int16_t* below2 = err_row(job, y + 2);
+    const int32_t steps = job->levels - 1;
+    const int32_t step = ERRDIFF_WHITE / steps;
+    int32_t right = 0, right2 = 0, v, e, q;
+    uint32_t b, x, x1, hi = 0;
+    int16_t* bl;
+
+    for (b = 0; b < job->blocks; b++) {
+        if (y > 0)
+            wait_for_row(job, y - 1, b + 2 < job->blocks ? b + 2 : job->blocks);
+
+        x1 = (b + 1) * ERRDIFF_BLOCK < job->width ? (b + 1) * ERRDIFF_BLOCK : job->width;
+        for (x = b * ERRDIFF_BLOCK; x < x1; x++, s += job->cpp) {
+            v = rgb_to_luma(s[job->chan[0]], s[job->chan[1]], s[job->chan[2]]) * 16
+                + cur[x] + right;
+            cur[x] = 0;
+            right = right2;
+            right2 = 0;
+
+            if (v < 0)
+                v = 0;
+            else if (v > ERRDIFF_WHITE)
+                v = ERRDIFF_WHITE;
+            q = (v * steps + ERRDIFF_WHITE / 2) / ERRDIFF_WHITE;
+            e = v - q * step;
+            bl = below + x;
+
+            switch (M) {
+            case ERRDIFF_FLOYD_STEINBERG:
+                right += e * 7 >> 4;
+                bl[-1] += e * 3 >> 4;
+                bl[0] += e * 5 >> 4;
+                bl[1] += e >> 4;
+                break;
+            case ERRDIFF_ATKINSON:
+                /* only 6/8 of the error, which keeps highlights clean */
+                e >>= 3;
+                right += e;
+                right2 += e;
+                bl[-1] += e;
+                bl[0] += e;
+                bl[1] += e;
+                below2[x] += e;
+                break;
+            default:
+                right += e >> 1;
+                bl[-1] += e >> 2;
+                bl[0] += e >> 2;
+                break;
+            }
+
+            if (x & 1)
+                d[x / 2] = hi << 4 | job->y4[q];
+            else
+                hi = job->y4[q];
+        }
+        __atomic_store_n(&job->progress[y % job->ring],
+            (uint64_t)y * (job->blocks + 1) + b + 1, __ATOMIC_RELEASE);
+    }
+    if (job->width & 1)
+        d[job->width / 2] = (d[job->width / 2] & 0x0f) | hi << 4;
+}
+
+static void diffuse_rows(void* arg)
+{
+    struct errdiff_job* job = (struct errdiff_job*)arg;
+    uint32_t y;
+
+    /* rows are taken in order, so the one above is always being worked on */
+    while ((y = __atomic_fetch_add(&job->next_row, 1, __ATOMIC_RELAXED)) < job->height)
+        job->row(job, y);
+}
+
+int errdiff_frame(const struct image* dst, const struct image* src,
+    enum errdiff_method method, unsigned int levels)
+{
+    struct errdiff_job job;
+    unsigned int i, threads = pool_size();
+
+    memset(&job, 0, sizeof(job));
+    if (dst->fmt->v4l2 != V4L2_PIX_FMT_Y4 || method >= NUM_ERRDIFF_METHODS
+        || (levels != 16 && levels != 4 && levels != 2)
+        || pix_fmt_rgb_layout(src->fmt, &job.cpp, job.chan))
+        return -EINVAL;
+
+    switch (method) {
+    case ERRDIFF_FLOYD_STEINBERG:
+        job.row = diffuse_row<ERRDIFF_FLOYD_STEINBERG>;
+        break;
+    case ERRDIFF_ATKINSON:
+        job.row = diffuse_row<ERRDIFF_ATKINSON>;
+        break;
+    default:
+        job.row = diffuse_row<ERRDIFF_SIERRA_LITE>;
+        break;
+    }
+
+    job.dst = dst;
+    job.src = src;
+    job.width = src->width < dst->width ? src->width : dst->width;
+    job.height = src->height < dst->height ? src->height : dst->height;
+    job.levels = levels;
+    for (i = 0; i < levels; i++)
+        job.y4[i] = i * 15 / (levels - 1);
+    job.blocks = (job.width + ERRDIFF_BLOCK - 1) / ERRDIFF_BLOCK;
+
+    job.ring = threads + 2;
+    job.err_pitch = job.width + 2 * ERRDIFF_PAD;
+    job.err = (int16_t*)calloc(job.ring, job.err_pitch * sizeof(*job.err));
+    job.progress = (uint64_t*)calloc(job.ring, sizeof(*job.progress));
+    if (!job.err || !job.progress) {
+        free(job.err);
+        free(job.progress);
+        return -ENOMEM;
+    }
+
+    pool_run_all(diffuse_rows, &job);
+
+    free(job.err);
+    free(job.progress);
+    return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Error diffusion of the luma of an RGB frame to 16, 4 or 2 gray levels,
+ * written as Y4.
+ *
+ * The dither down of the RGA is ordered and leaves a visible pattern on
+ * photos. Error diffusion quantizes one pixel after the other and hands the
+ * rounding error on to the neighbours not quantized yet. With 4 or 2 levels
+ * only the Y4 values 0, 5, 10, 15 or 0, 15 are used, what the fast
+ * waveforms of the panel can show.
+ *
+ * Sources are the formats y4conv_frame() reads. There is no RGA
+ * counterpart, this always runs on the CPU.
+ */
+
+#ifndef __ERRDIFF_H_INCLUDED__
+#define __ERRDIFF_H_INCLUDED__
+
+#include "image.h"
+
+enum errdiff_method {
+	ERRDIFF_FLOYD_STEINBERG,
+	ERRDIFF_ATKINSON,
+	ERRDIFF_SIERRA_LITE,
+	NUM_ERRDIFF_METHODS
+};
+
+const char *errdiff_method_name(enum errdiff_method method);
+/* "fs", "atkinson" or "sierra-lite", -1 for anything else */
+int errdiff_method_by_name(const char *name);
+
+int errdiff_supported(const struct pix_fmt *src);
+/* levels is 16, 4 or 2 */
+int errdiff_frame(const struct image *dst, const struct image *src,
+		  enum errdiff_method method, unsigned int levels);
+
+#endif /* __ERRDIFF_H_INCLUDED__ */
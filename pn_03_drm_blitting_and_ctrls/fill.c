@@ -0,0 +1,397 @@
+/*
+ * Solid fill kernels for packed formats of 4, 8, 16, 24 and 32 bpp.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fill.h"
+#include "pool.h"
+#include "simd.h"
+
+/*
+ * Common multiple of the 1, 2, 3 and 4 bytes per pixel and of the 16 and 32
+ * byte vectors: a pattern of this length can be stored with whole vectors
+ * whatever the format is. The extra bytes allow starting it at any phase.
+ */
+#define PATTERN_BYTES 96
+#define PATTERN_SLACK 64
+
+/* smallest share of a fill worth handing to another thread */
+#define FILL_BAND_BYTES (64 << 10)
+
+typedef void (*span_fn)(uint8_t* dst, size_t len, const uint8_t* pat, int nt);
+
+size_t fill_nt_threshold = 1 << 20;
+
+static const char* kernel_names[NUM_FILL_KERNELS] = {
+    "scalar", "sse2", "avx2", "neon"
+};
+
+static void build_pattern(uint8_t* pat, uint32_t bpp, uint32_t value)
+{
+    unsigned int cpp = bpp / 8;
+    unsigned int i;
+
+    if (bpp == 4) {
+        value = (value & 0xf) | (value & 0xf) << 4;
+        cpp = 1;
+    }
+    for (i = 0; i < PATTERN_BYTES + PATTERN_SLACK; i++)
+        pat[i] = value >> (8 * (i % cpp));
+}
+
+static void span_scalar(uint8_t* d, size_t len, const uint8_t* pat, int)
+{
+    while (len >= PATTERN_BYTES) {
+        memcpy(d, pat, PATTERN_BYTES);
+        d += PATTERN_BYTES;
+        len -= PATTERN_BYTES;
+    }
+    memcpy(d, pat, len);
+}
+
+#ifdef HAVE_SSE2
+static void span_sse2(uint8_t* d, size_t len, const uint8_t* pat, int nt)
+{
+    size_t head = -(uintptr_t)d & 15;
+    __m128i v[6];
+    int k;
+
+    if (head > len)
+        head = len;
+    memcpy(d, pat, head);
+    d += head;
+    len -= head;
+    pat += head;
+
+    for (k = 0; k < 6; k++)
+        v[k] = _mm_loadu_si128((const __m128i*)(pat + 16 * k));
+
+    if (nt) {
+        for (; len >= PATTERN_BYTES; len -= PATTERN_BYTES, d += PATTERN_BYTES) {
+            for (k = 0; k < 6; k++)
+                _mm_stream_si128((__m128i*)(d + 16 * k), v[k]);
+        }
+        _mm_sfence();
+    } else {
+        for (; len >= PATTERN_BYTES; len -= PATTERN_BYTES, d += PATTERN_BYTES) {
+            for (k = 0; k < 6; k++)
+                _mm_store_si128((__m128i*)(d + 16 * k), v[k]);
+        }
+    }
+
+    for (k = 0; len >= 16; k++, len -= 16, d += 16)
+        _mm_store_si128((__m128i*)d, v[k]);
+    memcpy(d, pat + 16 * k, len);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 static void span_avx2(uint8_t* d, size_t len, const uint8_t* pat, int nt)
+{
+    size_t head = -(uintptr_t)d & 31;
+    __m256i v[3];
+    int k;
+
+    if (head > len)
+        head = len;
+    memcpy(d, pat, head);
+    d += head;
+    len -= head;
+    pat += head;
+
+    for (k = 0; k < 3; k++)
+        v[k] = _mm256_loadu_si256((const __m256i*)(pat + 32 * k));
+
+    if (nt) {
+        for (; len >= PATTERN_BYTES; len -= PATTERN_BYTES, d += PATTERN_BYTES) {
+            for (k = 0; k < 3; k++)
+                _mm256_stream_si256((__m256i*)(d + 32 * k), v[k]);
+        }
+        _mm_sfence();
+    } else {
+        for (; len >= PATTERN_BYTES; len -= PATTERN_BYTES, d += PATTERN_BYTES) {
+            for (k = 0; k < 3; k++)
+                _mm256_store_si256((__m256i*)(d + 32 * k), v[k]);
+        }
+    }
+
+    for (k = 0; len >= 32; k++, len -= 32, d += 32)
+        _mm256_store_si256((__m256i*)d, v[k]);
+    memcpy(d, pat + 32 * k, len);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void span_neon(uint8_t* d, size_t len, const uint8_t* pat, int nt)
+{
+    size_t head = -(uintptr_t)d & 15;
+    uint8x16_t v[6];
+    int k;
+
+    if (head > len)
+        head = len;
+    memcpy(d, pat, head);
+    d += head;
+    len -= head;
+    pat += head;
+
+    for (k = 0; k < 6; k++)
+        v[k] = vld1q_u8(pat + 16 * k);
+
+#ifdef __aarch64__
+    if (nt) {
+        for (; len >= PATTERN_BYTES; len -= PATTERN_BYTES, d += PATTERN_BYTES) {
+            for (k = 0; k < 6; k += 2)
+                asm volatile("stnp %q0, %q1, [%2]"
+                             :
+                             : "w"(v[k]), "w"(v[k + 1]), "r"(d + 16 * k)
+                             : "memory");
+        }
+    }
+#endif
+    for (; len >= PATTERN_BYTES; len -= PATTERN_BYTES, d += PATTERN_BYTES) {
+        for (k = 0; k < 6; k++)
+            vst1q_u8(d + 16 * k, v[k]);
+    }
+
+    for (k = 0; len >= 16; k++, len -= 16, d += 16)
+        vst1q_u8(d, v[k]);
+    memcpy(d, pat + 16 * k, len);
+}
+#endif
+
+static span_fn span_kernels[NUM_FILL_KERNELS] = {
+    span_scalar,
+#ifdef HAVE_SSE2
+    span_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_AVX2
+    span_avx2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    span_neon,
+#else
+    NULL,
+#endif
+};
+
+static span_fn span = NULL;
+
+int fill_kernel_available(enum fill_kernel kernel)
+{
+    if (kernel < 0 || kernel >= NUM_FILL_KERNELS || !span_kernels[kernel])
+        return 0;
+#ifdef HAVE_AVX2
+    if (kernel == FILL_KERNEL_AVX2)
+        return cpu_has_avx2();
+#endif
+    return 1;
+}
+
+const char* fill_kernel_name(enum fill_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void fill_select_kernel(int kernel)
+{
+    span = span_kernels[simd_pick_kernel(kernel, NUM_FILL_KERNELS, fill_kernel_available)];
+}
+
+static inline void store_nibble(uint8_t* row, uint32_t x, uint32_t v)
+{
+    uint8_t* p = row + x / 2;
+
+    if (x & 1)
+        *p = (*p & 0xf0) | v;
+    else
+        *p = (*p & 0x0f) | (v << 4);
+}
+
+struct fill_job {
+    uint8_t pat[PATTERN_BYTES + PATTERN_SLACK];
+    uint8_t* base;
+    uint32_t pitch;
+    uint32_t bpp;
+    uint32_t x, w, x0;
+    uint32_t value;
+    size_t len;
+    int nt;
+};
+
+static void fill_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct fill_job* job = (struct fill_job*)arg;
+    uint8_t* row = job->base + (size_t)y0 * job->pitch;
+    uint32_t i, x = job->x, w = job->w;
+
+    for (i = y0; i < y1; i++, row += job->pitch) {
+        if (job->bpp == 4) {
+            uint8_t* start = row - job->x0 / 2;
+
+            if (x & 1)
+                store_nibble(start, x, job->value & 0xf);
+            if ((x + w) & 1 && x + w - 1 >= job->x0)
+                store_nibble(start, x + w - 1, job->value & 0xf);
+        }
+        span(row, job->len, job->pat, job->nt);
+    }
+}
+
+void fill_rect(void* base, uint32_t pitch, uint32_t bpp, uint32_t x,
+    uint32_t y, uint32_t w, uint32_t h, uint32_t value)
+{
+    struct fill_job job;
+    uint32_t x0 = x, x1 = x + w;
+
+    if (!w || !h)
+        return;
+    if (!span)
+        fill_select_kernel(-1);
+
+    build_pattern(job.pat, bpp, value);
+    job.base = (uint8_t*)base + (size_t)y * pitch;
+    job.pitch = pitch;
+    job.bpp = bpp;
+    job.x = x;
+    job.w = w;
+    job.value = value;
+
+    if (bpp == 4) {
+        /* odd edge pixels share their byte with a neighbour */
+        x0 = (x + 1) & ~1;
+        x1 = (x + w) & ~1;
+        if (x1 < x0)
+            x1 = x0;
+        job.len = (x1 - x0) / 2;
+        job.base += x0 / 2;
+    } else {
+        job.len = (size_t)w * (bpp / 8);
+        job.base += (size_t)x * (bpp / 8);
+    }
+    job.x0 = x0;
+
+    job.nt = fill_nt_threshold && job.len * h >= fill_nt_threshold;
+
+    parallel_for(h, FILL_BAND_BYTES / (job.len + 1) + 1, fill_band, &job);
+}
+
+struct span_job {
+    uint8_t pat[PATTERN_BYTES + PATTERN_SLACK];
+    uint8_t* dst;
+    size_t len;
+    int nt;
+};
+
+/* chunks start at multiples of the pattern length, so it lines up */
+#define SPAN_CHUNK (PATTERN_BYTES * 1024)
+
+static void span_band(void* arg, uint32_t c0, uint32_t c1)
+{
+    struct span_job* job = (struct span_job*)arg;
+    size_t start = (size_t)c0 * SPAN_CHUNK;
+    size_t end = (size_t)c1 * SPAN_CHUNK;
+
+    if (end > job->len)
+        end = job->len;
+    span(job->dst + start, end - start, job->pat, job->nt);
+}
+
+void fill_span(uint8_t* dst, size_t len, uint32_t bpp, uint32_t value)
+{
+    struct span_job job;
+
+    if (!span)
+        fill_select_kernel(-1);
+
+    build_pattern(job.pat, bpp, value);
+    job.dst = dst;
+    job.len = len;
+    job.nt = fill_nt_threshold && len >= fill_nt_threshold;
+    parallel_for((len + SPAN_CHUNK - 1) / SPAN_CHUNK, 1, span_band, &job);
+}
+
+/* the pixel value of the packed formats in V4L2 byte order, -EINVAL for others */
+static int packed_value(const struct pix_fmt* f, uint8_t a, uint8_t r, uint8_t g,
+    uint8_t b, uint32_t* value)
+{
+    unsigned int cpp, chan[3];
+
+    if (!pix_fmt_rgb_layout(f, &cpp, chan)) {
+        /* the fourth byte is alpha, or padding written opaque as convert_image() does */
+        if (f->v4l2 == V4L2_PIX_FMT_XRGB32 || f->v4l2 == V4L2_PIX_FMT_XBGR32)
+            a = 0xff;
+        *value = (uint32_t)r << 8 * chan[0] | (uint32_t)g << 8 * chan[1]
+            | (uint32_t)b << 8 * chan[2];
+        if (cpp == 4)
+            *value |= (uint32_t)a << 8 * (6 - chan[0] - chan[1] - chan[2]);
+        return 0;
+    }
+
+    switch (f->v4l2) {
+    case V4L2_PIX_FMT_RGB565:
+        *value = pixel<DRM_FORMAT_RGB565>::pack(a, r, g, b);
+        return 0;
+    case V4L2_PIX_FMT_ARGB555:
+        *value = pixel<DRM_FORMAT_ARGB1555>::pack(a, r, g, b);
+        return 0;
+    case V4L2_PIX_FMT_ARGB444:
+        *value = pixel<DRM_FORMAT_ARGB4444>::pack(a, r, g, b);
+        return 0;
+    case V4L2_PIX_FMT_GREY:
+        *value = rgb_to_luma(r, g, b);
+        return 0;
+    case V4L2_PIX_FMT_Y4:
+        *value = pixel<DRM_FORMAT_R4>::pack(a, r, g, b);
+        return 0;
+    }
+    return -EINVAL;
+}
+
+int fill_image(const struct image* img, uint32_t x, uint32_t y, uint32_t w,
+    uint32_t h, uint32_t argb)
+{
+    const struct pix_fmt* f = img->fmt;
+    uint8_t a = argb >> 24, r = argb >> 16, g = argb >> 8, b = argb;
+    uint8_t luma, u, v;
+    uint32_t value, cpitch, cx, cy, cw, ch;
+    uint8_t* chroma;
+
+    if (x >= img->width || y >= img->height)
+        return 0;
+    w = w < img->width - x ? w : img->width - x;
+    h = h < img->height - y ? h : img->height - y;
+
+    if (f->planes == 1) {
+        if (packed_value(f, a, r, g, b, &value))
+            return -EINVAL;
+        fill_rect(img->data, img->pitch, f->bpp, x, y, w, h, value);
+        return 0;
+    }
+
+    /* planes back to back, chroma rows as long as the luma rows or half */
+    rgb_to_yuv(r, g, b, &luma, &u, &v);
+    fill_rect(img->data, img->pitch, 8, x, y, w, h, luma);
+
+    cx = x / f->hsub;
+    cy = y / f->vsub;
+    cw = (x + w + f->hsub - 1) / f->hsub - cx;
+    ch = (y + h + f->vsub - 1) / f->vsub - cy;
+    chroma = img->data + (size_t)img->pitch * img->height;
+    if (f->planes == 2) {
+        value = f->v4l2 == V4L2_PIX_FMT_NV61 ? v | u << 8 : u | v << 8;
+        fill_rect(chroma, img->pitch, 16, cx, cy, cw, ch, value);
+        return 0;
+    }
+    cpitch = img->pitch / f->hsub;
+    fill_rect(chroma, cpitch, 8, cx, cy, cw, ch, u);
+    fill_rect(chroma + (size_t)cpitch * (img->height / f->vsub), cpitch, 8, cx, cy, cw, ch, v);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Solid fill kernels for packed formats of 4, 8, 16, 24 and 32 bpp.
+ *
+ * A row pattern is built once per call and written with wide (optionally
+ * non-temporal) stores, so the per-pixel format dispatch of the old
+ * draw_rect loop is gone from the inner loop.
+ */
+
+#ifndef __FILL_H_INCLUDED__
+#define __FILL_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+enum fill_kernel {
+	FILL_KERNEL_SCALAR,
+	FILL_KERNEL_SSE2,
+	FILL_KERNEL_AVX2,
+	FILL_KERNEL_NEON,
+	NUM_FILL_KERNELS
+};
+
+/* use non-temporal stores for spans of at least this many bytes, 0 = never */
+extern size_t fill_nt_threshold;
+
+int fill_kernel_available(enum fill_kernel kernel);
+const char *fill_kernel_name(enum fill_kernel kernel);
+void fill_select_kernel(int kernel);
+
+/*
+ * Fill a w x h rectangle at (x, y) of a packed image with one pixel value,
+ * as returned by pixel<>::pack() for the format.
+ */
+void fill_rect(void *base, uint32_t pitch, uint32_t bpp, uint32_t x,
+	       uint32_t y, uint32_t w, uint32_t h, uint32_t value);
+
+/* fill len bytes with a pattern that repeats every bpp / 8 bytes */
+void fill_span(uint8_t *dst, size_t len, uint32_t bpp, uint32_t value);
+
+/*
+ * Fill a w x h rectangle at (x, y) of an image of any format of the table
+ * with a 0xAARRGGBB color, clipped to the image. The YUV formats get the
+ * color in every plane, rounded out to whole chroma samples; the gray
+ * formats get its luma. -EINVAL for formats it cannot write.
+ */
+int fill_image(const struct image *img, uint32_t x, uint32_t y, uint32_t w,
+	       uint32_t h, uint32_t argb);
+
+static inline int fill_image_gray(const struct image *img, uint32_t x,
+				  uint32_t y, uint32_t w, uint32_t h,
+				  uint8_t gray)
+{
+	return fill_image(img, x, y, w, h, 0xff000000 | gray * 0x010101);
+}
+
+#endif /* __FILL_H_INCLUDED__ */
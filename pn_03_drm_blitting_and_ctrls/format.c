@@ -0,0 +1,63 @@
+/*
+ * Pixel format descriptors shared by the V4L2 and DRM sides.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "format.h"
+
+int pix_fmt_validate(const struct pix_fmt* f, size_t width, size_t height,
+    size_t length)
+{
+    if (width % f->align || height % f->align) {
+        printf("%s: %zux%zu is not a multiple of %u\n", f->name, width, height,
+            f->align);
+        return -EINVAL;
+    }
+
+    if (length < pix_fmt_frame_bytes(f, width, height)) {
+        printf("%s: buffer of %zu bytes is too small for %zux%zu (%zu bytes)\n",
+            f->name, length, width, height, pix_fmt_frame_bytes(f, width, height));
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int pix_fmt_rgb_layout(const struct pix_fmt* f, unsigned int* cpp,
+    unsigned int chan[3])
+{
+    switch (f->v4l2) {
+    case V4L2_PIX_FMT_RGB24:
+        *cpp = 3;
+        chan[0] = 0;
+        chan[1] = 1;
+        chan[2] = 2;
+        return 0;
+    case V4L2_PIX_FMT_XRGB32:
+    case V4L2_PIX_FMT_ARGB32:
+        *cpp = 4;
+        chan[0] = 1;
+        chan[1] = 2;
+        chan[2] = 3;
+        return 0;
+    case V4L2_PIX_FMT_XBGR32:
+    case V4L2_PIX_FMT_ABGR32:
+        *cpp = 4;
+        chan[0] = 2;
+        chan[1] = 1;
+        chan[2] = 0;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+void pix_fmt_print_list(FILE* fp)
+{
+    size_t i;
+
+    fprintf(fp, "Formats for --src-fmt and --dst-fmt:\n");
+    for (i = 0; i < NUM_PIX_FMTS; i++)
+        fprintf(fp, "  %2zu = %-8s (%u bpp)\n", i, pix_fmts[i].name,
+            pix_fmt_frame_bpp(&pix_fmts[i]));
+}
@@ -0,0 +1,218 @@
+/*
+ * Pixel format descriptors shared by the V4L2 and DRM sides.
+ *
+ * The table is indexed by the number given to --src-fmt/--dst-fmt. All
+ * lookups are constexpr, so per-pixel kernels can be specialized on a
+ * format at compile time instead of branching on it in the inner loop.
+ */
+
+#ifndef __FORMAT_H_INCLUDED__
+#define __FORMAT_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <drm_fourcc.h>
+#include <linux/videodev2.h>
+
+struct pix_fmt {
+	const char *name;
+	uint32_t v4l2;
+	uint32_t drm;
+	/* number of planes stored back to back in one buffer */
+	uint8_t planes;
+	/* bits per pixel of plane 0, 4 for the packed Y4/R4 format */
+	uint8_t bpp;
+	/* chroma subsampling of planes 1 and 2 */
+	uint8_t hsub;
+	uint8_t vsub;
+	/* width and height have to be a multiple of this */
+	uint8_t align;
+};
+
+static constexpr struct pix_fmt pix_fmts[] = {
+	{ "NV12",     V4L2_PIX_FMT_NV12,    DRM_FORMAT_NV12,     2,  8, 2, 2, 2 }, // 0
+	{ "ARGB32",   V4L2_PIX_FMT_ARGB32,  DRM_FORMAT_ARGB8888, 1, 32, 1, 1, 1 }, // 1
+	{ "RGB24",    V4L2_PIX_FMT_RGB24,   DRM_FORMAT_RGB888,   1, 24, 1, 1, 1 }, // 2
+	{ "RGB565",   V4L2_PIX_FMT_RGB565,  DRM_FORMAT_RGB565,   1, 16, 1, 1, 1 }, // 3
+	{ "YUV420",   V4L2_PIX_FMT_YUV420,  DRM_FORMAT_YUV420,   3,  8, 2, 2, 2 }, // 4
+	{ "XRGB32",   V4L2_PIX_FMT_XRGB32,  DRM_FORMAT_XRGB8888, 1, 32, 1, 1, 1 }, // 5
+	{ "ABGR32",   V4L2_PIX_FMT_ABGR32,  DRM_FORMAT_BGRA8888, 1, 32, 1, 1, 1 }, // 6
+	{ "XBGR32",   V4L2_PIX_FMT_XBGR32,  DRM_FORMAT_BGRX8888, 1, 32, 1, 1, 1 }, // 7
+	{ "ARGB555",  V4L2_PIX_FMT_ARGB555, DRM_FORMAT_ARGB1555, 1, 16, 1, 1, 1 }, // 8
+	{ "ARGB444",  V4L2_PIX_FMT_ARGB444, DRM_FORMAT_ARGB4444, 1, 16, 1, 1, 1 }, // 9
+	{ "NV61",     V4L2_PIX_FMT_NV61,    DRM_FORMAT_NV61,     2,  8, 2, 1, 2 }, // 10
+	{ "NV16",     V4L2_PIX_FMT_NV16,    DRM_FORMAT_NV16,     2,  8, 2, 1, 2 }, // 11
+	{ "YUV422P",  V4L2_PIX_FMT_YUV422P, DRM_FORMAT_YUV422,   3,  8, 2, 1, 2 }, // 12
+	{ "Y4",       V4L2_PIX_FMT_Y4,      DRM_FORMAT_R4,       1,  4, 1, 1, 2 }, // 13
+	{ "GREY",     V4L2_PIX_FMT_GREY,    DRM_FORMAT_R8,       1,  8, 1, 1, 1 }, // 14
+};
+
+#define NUM_PIX_FMTS (sizeof(pix_fmts) / sizeof(pix_fmts[0]))
+
+static constexpr const struct pix_fmt *pix_fmt_by_index(int index)
+{
+	return (index >= 0 && index < (int)NUM_PIX_FMTS) ? &pix_fmts[index] : NULL;
+}
+
+static constexpr const struct pix_fmt *pix_fmt_by_v4l2(uint32_t v4l2)
+{
+	for (size_t i = 0; i < NUM_PIX_FMTS; i++) {
+		if (pix_fmts[i].v4l2 == v4l2)
+			return &pix_fmts[i];
+	}
+	return NULL;
+}
+
+static constexpr const struct pix_fmt *pix_fmt_by_drm(uint32_t drm)
+{
+	for (size_t i = 0; i < NUM_PIX_FMTS; i++) {
+		if (pix_fmts[i].drm == drm)
+			return &pix_fmts[i];
+	}
+	return NULL;
+}
+
+/* average bits per pixel over all planes, what a dumb buffer is sized by */
+static constexpr unsigned int pix_fmt_frame_bpp(const struct pix_fmt *f)
+{
+	return f->bpp + (f->planes > 1 ? 2 * 8 / (f->hsub * f->vsub) : 0);
+}
+
+/* bytes of one unpadded row of plane 0 */
+static constexpr size_t pix_fmt_row_bytes(const struct pix_fmt *f, size_t width)
+{
+	return (width * f->bpp + 7) / 8;
+}
+
+/* bytes of an unpadded frame of all planes */
+static constexpr size_t pix_fmt_frame_bytes(const struct pix_fmt *f,
+					    size_t width, size_t height)
+{
+	return (width * height * pix_fmt_frame_bpp(f) + 7) / 8;
+}
+
+/*
+ * 1 and 2 bpp gray for the fast waveforms of the panel, pixel 0 in the
+ * high bits as DRM_FORMAT_R1/R2 specify. V4L2 has no fourcc for them and
+ * the RGA cannot write them, so they are not in the table above and only
+ * the CPU produces them, see ypack.h.
+ */
+static constexpr struct pix_fmt pix_fmt_y1 = { "Y1", 0, DRM_FORMAT_R1, 1, 1, 1, 1, 1 };
+static constexpr struct pix_fmt pix_fmt_y2 = { "Y2", 0, DRM_FORMAT_R2, 1, 2, 1, 1, 1 };
+
+int pix_fmt_validate(const struct pix_fmt *f, size_t width, size_t height,
+		     size_t length);
+void pix_fmt_print_list(FILE *fp);
+
+/*
+ * Bytes per pixel and byte offsets of r, g and b in the V4L2 byte order of
+ * the packed RGB formats the CPU kernels read, -EINVAL for the others.
+ */
+int pix_fmt_rgb_layout(const struct pix_fmt *f, unsigned int *cpp,
+		       unsigned int chan[3]);
+
+/* Y400 luma weights (BT.601, 8 bit fixed point) used by the RGA */
+static inline uint8_t rgb_to_luma(uint8_t r, uint8_t g, uint8_t b)
+{
+	return (77 * r + 150 * g + 29 * b + 128) >> 8;
+}
+
+/* BT.601 limited range (8 bit fixed point) of the YUV formats */
+static inline void rgb_to_yuv(uint8_t r, uint8_t g, uint8_t b, uint8_t *y,
+			      uint8_t *u, uint8_t *v)
+{
+	*y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	*u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+	*v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+/*
+ * Compile-time pixel traits of the packed formats. pack() turns a color
+ * into the pixel value stored in memory, store() writes pixel x of a row.
+ * Sub-byte formats store two (R4) pixels per byte, pixel 0 in the high
+ * nibble as DRM_FORMAT_R4 "[7:0] R0:R1" specifies.
+ */
+template <uint32_t DRM>
+struct pixel;
+
+template <uint32_t DRM, int B0, int B1, int B2, int B3>
+struct pixel_32bpp {
+	static constexpr unsigned int bpp = 32;
+
+	/* byte n in memory holds channel Bn, 0 = a, 1 = r, 2 = g, 3 = b */
+	static inline uint32_t pack(uint8_t a, uint8_t r, uint8_t g, uint8_t b)
+	{
+		const uint8_t c[4] = { a, r, g, b };
+		return c[B0] | (c[B1] << 8) | (c[B2] << 16) | ((uint32_t)c[B3] << 24);
+	}
+	static inline void store(uint8_t *row, uint32_t x, uint32_t v)
+	{
+		((uint32_t *)row)[x] = v;
+	}
+};
+
+template <> struct pixel<DRM_FORMAT_ARGB8888> : pixel_32bpp<DRM_FORMAT_ARGB8888, 3, 2, 1, 0> {};
+template <> struct pixel<DRM_FORMAT_XRGB8888> : pixel_32bpp<DRM_FORMAT_XRGB8888, 3, 2, 1, 0> {};
+template <> struct pixel<DRM_FORMAT_RGBA8888> : pixel_32bpp<DRM_FORMAT_RGBA8888, 0, 3, 2, 1> {};
+template <> struct pixel<DRM_FORMAT_BGRA8888> : pixel_32bpp<DRM_FORMAT_BGRA8888, 0, 1, 2, 3> {};
+template <> struct pixel<DRM_FORMAT_BGRX8888> : pixel_32bpp<DRM_FORMAT_BGRX8888, 0, 1, 2, 3> {};
+
+template <>
+struct pixel<DRM_FORMAT_RGB888> {
+	static constexpr unsigned int bpp = 24;
+
+	static inline uint32_t pack(uint8_t, uint8_t r, uint8_t g, uint8_t b)
+	{
+		return b | (g << 8) | (r << 16);
+	}
+	static inline void store(uint8_t *row, uint32_t x, uint32_t v)
+	{
+		row[x * 3 + 0] = v;
+		row[x * 3 + 1] = v >> 8;
+		row[x * 3 + 2] = v >> 16;
+	}
+};
+
+template <uint32_t DRM, int AB, int RB, int GB, int BB>
+struct pixel_16bpp {
+	static constexpr unsigned int bpp = 16;
+
+	static inline uint32_t pack(uint8_t a, uint8_t r, uint8_t g, uint8_t b)
+	{
+		return ((AB ? (a >> (8 - AB)) : 0) << (RB + GB + BB))
+			| ((r >> (8 - RB)) << (GB + BB))
+			| ((g >> (8 - GB)) << BB)
+			| (b >> (8 - BB));
+	}
+	static inline void store(uint8_t *row, uint32_t x, uint32_t v)
+	{
+		((uint16_t *)row)[x] = v;
+	}
+};
+
+template <> struct pixel<DRM_FORMAT_RGB565> : pixel_16bpp<DRM_FORMAT_RGB565, 0, 5, 6, 5> {};
+template <> struct pixel<DRM_FORMAT_ARGB1555> : pixel_16bpp<DRM_FORMAT_ARGB1555, 1, 5, 5, 5> {};
+template <> struct pixel<DRM_FORMAT_ARGB4444> : pixel_16bpp<DRM_FORMAT_ARGB4444, 4, 4, 4, 4> {};
+
+template <>
+struct pixel<DRM_FORMAT_R4> {
+	static constexpr unsigned int bpp = 4;
+
+	static inline uint32_t pack(uint8_t, uint8_t r, uint8_t g, uint8_t b)
+	{
+		return rgb_to_luma(r, g, b) >> 4;
+	}
+	static inline void store(uint8_t *row, uint32_t x, uint32_t v)
+	{
+		uint8_t *p = row + x / 2;
+
+		if (x & 1)
+			*p = (*p & 0xf0) | v;
+		else
+			*p = (*p & 0x0f) | (v << 4);
+	}
+};
+
+#endif /* __FORMAT_H_INCLUDED__ */
@@ -0,0 +1,322 @@
+/*
+ * Luma histograms over the pool.
+ *
+ * Every band counts into its own histograms on the stack, four of them
+ * used round robin so consecutive pixels of the same luma do not wait on
+ * each other's increment, and adds them to the shared one once at the
+ * end. The vector kernels compute the luma of RGB pixels, the counting
+ * itself is scalar.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "pool.h"
+#include "simd.h"
+
+/* pixels of a row converted to luma at a time */
+#define HISTOGRAM_CHUNK 256
+
+/* the luma of pixels [0, n) of an RGB row, returns n */
+typedef uint32_t (*luma_fn)(uint8_t* luma, const uint8_t* src, uint32_t width,
+    unsigned int cpp, const unsigned int chan[3]);
+
+static const char* kernel_names[NUM_HISTOGRAM_KERNELS] = {
+    "scalar", "sse2", "neon"
+};
+
+static const char* mode_names[NUM_HISTOGRAM_MODES] = {
+    "contrast", "equalize"
+};
+
+#ifdef HAVE_SSE2
+/* the weighted channels of 4 pixels, in 32 bit lanes */
+static inline __m128i luma_sum4(__m128i v, __m128i weights)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+
+    /* bytes 0 + 1 and 2 + 3 of each pixel, added up in lanes 0 and 2 */
+    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi64(lo, hi), _mm_set1_epi32(128)), 8);
+}
+
+/* 32 bpp only, the weights are placed where the channels are */
+static uint32_t luma_sse2(uint8_t* luma, const uint8_t* src, uint32_t width,
+    unsigned int cpp, const unsigned int chan[3])
+{
+    int16_t w[8] = { 0 };
+    __m128i weights;
+    uint32_t x;
+
+    if (cpp != 4)
+        return 0;
+    w[chan[0]] = w[chan[0] + 4] = 77;
+    w[chan[1]] = w[chan[1] + 4] = 150;
+    w[chan[2]] = w[chan[2] + 4] = 29;
+    weights = _mm_loadu_si128((const __m128i*)w);
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        const __m128i* p = (const __m128i*)(src + 4 * x);
+        __m128i a = luma_sum4(_mm_loadu_si128(p), weights);
+        __m128i b = luma_sum4(_mm_loadu_si128(p + 1), weights);
+        __m128i c = luma_sum4(_mm_loadu_si128(p + 2), weights);
+        __m128i e = luma_sum4(_mm_loadu_si128(p + 3), weights);
+
+        _mm_storeu_si128((__m128i*)(luma + x),
+            _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, e)));
+    }
+    return x;
+}
+#endif
+
+#ifdef HAVE_NEON
+static inline uint8x8_t luma_u8(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    uint16x8_t sum = vmull_u8(r, vdup_n_u8(77));
+
+    sum = vmlal_u8(sum, g, vdup_n_u8(150));
+    sum = vmlal_u8(sum, b, vdup_n_u8(29));
+    return vrshrn_n_u16(sum, 8);
+}
+
+static uint32_t luma_neon(uint8_t* luma, const uint8_t* src, uint32_t width,
+    unsigned int cpp, const unsigned int chan[3])
+{
+    uint8x16_t r, g, b;
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        if (cpp == 4) {
+            uint8x16x4_t v = vld4q_u8(src + 4 * x);
+
+            r = v.val[chan[0]];
+            g = v.val[chan[1]];
+            b = v.val[chan[2]];
+        } else {
+            uint8x16x3_t v = vld3q_u8(src + 3 * x);
+
+            r = v.val[chan[0]];
+            g = v.val[chan[1]];
+            b = v.val[chan[2]];
+        }
+        vst1_u8(luma + x, luma_u8(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b)));
+        vst1_u8(luma + x + 8, luma_u8(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b)));
+    }
+    return x;
+}
+#endif
+
+/* NULL leaves the whole chunk to the scalar loop */
+static luma_fn luma_kernels[NUM_HISTOGRAM_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    luma_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    luma_neon,
+#else
+    NULL,
+#endif
+};
+
+/* index into the table, -1 until the first frame picks the best one */
+static int selected = -1;
+
+int histogram_kernel_available(enum histogram_kernel kernel)
+{
+    return kernel >= 0 && kernel < NUM_HISTOGRAM_KERNELS
+        && (kernel == HISTOGRAM_KERNEL_SCALAR || luma_kernels[kernel]);
+}
+
+const char* histogram_kernel_name(enum histogram_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void histogram_select_kernel(int kernel)
+{
+    selected = simd_pick_kernel(kernel, NUM_HISTOGRAM_KERNELS, histogram_kernel_available);
+}
+
+const char* histogram_mode_name(enum histogram_mode mode)
+{
+    return mode_names[mode];
+}
+
+int histogram_mode_by_name(const char* name)
+{
+    int i;
+
+    for (i = 0; i < NUM_HISTOGRAM_MODES; i++) {
+        if (!strcmp(name, mode_names[i]))
+            return i;
+    }
+    return -EINVAL;
+}
+
+enum histogram_source {
+    HISTOGRAM_LUMA,
+    HISTOGRAM_Y4,
+    HISTOGRAM_RGB,
+};
+
+struct histogram_job {
+    const struct image* img;
+    uint32_t x, y, w;
+    enum histogram_source source;
+    unsigned int cpp;
+    unsigned int chan[3];
+    uint32_t bins[256];
+};
+
+static inline void count(uint32_t sub[4][256], const uint8_t* l, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        sub[0][l[i]]++;
+        sub[1][l[i + 1]]++;
+        sub[2][l[i + 2]]++;
+        sub[3][l[i + 3]]++;
+    }
+    for (; i < n; i++)
+        sub[0][l[i]]++;
+}
+
+static void histogram_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct histogram_job* job = (struct histogram_job*)arg;
+    const luma_fn to_luma = luma_kernels[selected];
+    uint32_t sub[4][256];
+    uint8_t luma[HISTOGRAM_CHUNK];
+    uint32_t x, y, i, n, v;
+
+    memset(sub, 0, sizeof(sub));
+    for (y = y0; y < y1; y++) {
+        const uint8_t* row = image_row(job->img, job->y + y);
+
+        for (x = job->x; x < job->x + job->w; x += n) {
+            n = job->x + job->w - x < HISTOGRAM_CHUNK ? job->x + job->w - x : HISTOGRAM_CHUNK;
+            switch (job->source) {
+            case HISTOGRAM_LUMA:
+                count(sub, row + x, n);
+                continue;
+            case HISTOGRAM_Y4:
+                for (i = 0; i < n; i++)
+                    luma[i] = ((row[(x + i) / 2] >> ((x + i) & 1 ? 0 : 4)) & 0xf) * 17;
+                break;
+            case HISTOGRAM_RGB: {
+                const uint8_t* s = row + x * job->cpp;
+
+                i = to_luma ? to_luma(luma, s, n, job->cpp, job->chan) : 0;
+                for (s += i * job->cpp; i < n; i++, s += job->cpp)
+                    luma[i] = rgb_to_luma(s[job->chan[0]], s[job->chan[1]], s[job->chan[2]]);
+                break;
+            }
+            }
+            count(sub, luma, n);
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+        v = sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+        if (v)
+            __atomic_fetch_add(&job->bins[i], v, __ATOMIC_RELAXED);
+    }
+}
+
+int histogram_region(struct histogram* hist, const struct image* img,
+    uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    const struct pix_fmt* f = img->fmt;
+    struct histogram_job job;
+    unsigned int i, full;
+
+    memset(hist, 0, sizeof(*hist));
+    memset(&job, 0, sizeof(job));
+    if (f->v4l2 == V4L2_PIX_FMT_Y4)
+        job.source = HISTOGRAM_Y4;
+    else if (!pix_fmt_rgb_layout(f, &job.cpp, job.chan))
+        job.source = HISTOGRAM_RGB;
+    else if (f->bpp == 8)
+        job.source = HISTOGRAM_LUMA;
+    else
+        return -EINVAL;
+    if (x >= img->width || y >= img->height)
+        return 0;
+    if (selected < 0)
+        histogram_select_kernel(-1);
+
+    job.img = img;
+    job.x = x;
+    job.y = y;
+    job.w = w < img->width - x ? w : img->width - x;
+    h = h < img->height - y ? h : img->height - y;
+    parallel_for(h, 64, histogram_band, &job);
+
+    /* the Y plane of the YUV formats is limited range, 16 to 235 */
+    for (i = 0; i < 256; i++) {
+        full = i;
+        if (f->planes > 1)
+            full = i <= 16 ? 0 : i >= 235 ? 255 : ((i - 16) * 255 + 109) / 219;
+        hist->bins[full] += job.bins[i];
+    }
+    hist->count = (uint64_t)job.w * h;
+    return 0;
+}
+
+/*
+ * The levels are those of the conversion without dither, the upper 4 bits
+ * of the luma. Auto-contrast maps the levels of the darkest and brightest
+ * 0.5 % of the pixels to black and white and the ones between linearly,
+ * equalization maps each level to the share of pixels at or below it.
+ */
+void histogram_lut(const struct histogram* hist, enum histogram_mode mode,
+    struct y4_lut* lut)
+{
+    uint64_t levels[16] = { 0 }, cut, sum, first;
+    unsigned int i, lo, hi;
+
+    y4_lut_identity(lut);
+    if (!hist->count)
+        return;
+    for (i = 0; i < 256; i++)
+        levels[i >> 4] += hist->bins[i];
+
+    if (mode == HISTOGRAM_EQUALIZE) {
+        for (i = 0; !levels[i]; i++)
+            ;
+        first = levels[i];
+        if (first == hist->count)
+            return;
+        for (i = 0, sum = 0; i < 16; i++) {
+            sum += levels[i];
+            lut->map[i] = sum <= first ? 0 : ((sum - first) * 30 + hist->count - first) / (2 * (hist->count - first));
+        }
+        return;
+    }
+
+    cut = hist->count / 200;
+    for (lo = 0, sum = levels[0]; lo < 15 && sum <= cut; sum += levels[++lo])
+        ;
+    for (hi = 15, sum = levels[15]; hi > 0 && sum <= cut; sum += levels[--hi])
+        ;
+    if (hi <= lo)
+        return;
+    for (i = 0; i < 16; i++) {
+        if (i <= lo)
+            lut->map[i] = 0;
+        else if (i >= hi)
+            lut->map[i] = 15;
+        else
+            lut->map[i] = ((i - lo) * 30 + hi - lo) / (2 * (hi - lo));
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Luma histograms of source frames and the Y4MAP tables derived from them.
+ *
+ * Y4 output of low contrast content only uses a few of the 16 levels.
+ * histogram_lut() spreads the levels a frame actually uses over all of
+ * them, either linearly between two percentiles (auto-contrast) or by
+ * their share of the pixels (equalization). The table is what
+ * y4_lut_apply() and the RGA Y4MAP controls take.
+ */
+
+#ifndef __HISTOGRAM_H_INCLUDED__
+#define __HISTOGRAM_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "image.h"
+#include "y4lut.h"
+
+struct histogram {
+	/* pixels per full range luma value */
+	uint32_t bins[256];
+	uint64_t count;
+};
+
+enum histogram_kernel {
+	HISTOGRAM_KERNEL_SCALAR,
+	HISTOGRAM_KERNEL_SSE2,
+	HISTOGRAM_KERNEL_NEON,
+	NUM_HISTOGRAM_KERNELS
+};
+
+int histogram_kernel_available(enum histogram_kernel kernel);
+const char *histogram_kernel_name(enum histogram_kernel kernel);
+void histogram_select_kernel(int kernel);
+
+enum histogram_mode {
+	HISTOGRAM_AUTO_CONTRAST,
+	HISTOGRAM_EQUALIZE,
+	NUM_HISTOGRAM_MODES
+};
+
+const char *histogram_mode_name(enum histogram_mode mode);
+int histogram_mode_by_name(const char *name);
+
+/*
+ * The luma of a w x h rectangle at (x, y), a damaged region or the whole
+ * frame, of an RGB, gray, Y4 or YUV image. YUV luma is taken from the Y
+ * plane and stretched to full range.
+ */
+int histogram_region(struct histogram *hist, const struct image *img,
+		     uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+void histogram_lut(const struct histogram *hist, enum histogram_mode mode,
+		   struct y4_lut *lut);
+
+#endif /* __HISTOGRAM_H_INCLUDED__ */
@@ -0,0 +1,39 @@
+/*
+ * A CPU view of a packed or planar image, the common argument of the
+ * software image kernels.
+ */
+
+#ifndef __IMAGE_H_INCLUDED__
+#define __IMAGE_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "bo.h"
+#include "format.h"
+
+struct image {
+	uint8_t *data;
+	uint32_t width;
+	uint32_t height;
+	/* bytes per row of plane 0 */
+	uint32_t pitch;
+	const struct pix_fmt *fmt;
+};
+
+static inline void image_from_bo(struct image *img, struct sp_bo *bo,
+				 const struct pix_fmt *fmt)
+{
+	img->data = (uint8_t *)bo->map_addr;
+	img->width = bo->width;
+	img->height = bo->height;
+	/* planar buffers are laid out unpadded, as add_fb_sp_bo() hands them on */
+	img->pitch = fmt->planes > 1 ? pix_fmt_row_bytes(fmt, bo->width) : bo->pitch;
+	img->fmt = fmt;
+}
+
+static inline uint8_t *image_row(const struct image *img, uint32_t y)
+{
+	return img->data + (size_t)y * img->pitch;
+}
+
+#endif /* __IMAGE_H_INCLUDED__ */
@@ -0,0 +1,93 @@
+/*
+ * Accounting of the memory the tool holds, by role and by backend, with an
+ * optional budget that allocations are checked against.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memtrack.h"
+
+static const char* role_names[NUM_MEM_ROLES] = {
+    "other", "src", "dst", "scanout", "staging"
+};
+
+static const char* backend_names[NUM_MEM_BACKENDS] = {
+    "dumb", "heap"
+};
+
+struct mem_counter {
+    size_t current;
+    size_t peak;
+};
+
+static struct mem_counter by_role[NUM_MEM_ROLES];
+static struct mem_counter by_backend[NUM_MEM_BACKENDS];
+static struct mem_counter total;
+
+/* 0 means unlimited */
+static size_t budget;
+
+static void counter_add(struct mem_counter* c, size_t bytes)
+{
+    c->current += bytes;
+    if (c->current > c->peak)
+        c->peak = c->current;
+}
+
+void memtrack_set_budget(size_t bytes)
+{
+    budget = bytes;
+}
+
+size_t memtrack_available(void)
+{
+    if (!budget)
+        return SIZE_MAX;
+    return budget > total.current ? budget - total.current : 0;
+}
+
+int memtrack_reserve(enum mem_role role, enum mem_backend backend, size_t bytes)
+{
+    if (bytes > memtrack_available()) {
+        printf("%s %s allocation of %zu KiB exceeds the memory budget (%zu of %zu KiB used)\n",
+            role_names[role], backend_names[backend], bytes / 1024,
+            total.current / 1024, budget / 1024);
+        return -ENOMEM;
+    }
+
+    counter_add(&by_role[role], bytes);
+    counter_add(&by_backend[backend], bytes);
+    counter_add(&total, bytes);
+    return 0;
+}
+
+void memtrack_release(enum mem_role role, enum mem_backend backend, size_t bytes)
+{
+    by_role[role].current -= bytes;
+    by_backend[backend].current -= bytes;
+    total.current -= bytes;
+}
+
+void memtrack_report(FILE* fp)
+{
+    int i;
+
+    fprintf(fp, "memory: %zu KiB held, %zu KiB peak", total.current / 1024,
+        total.peak / 1024);
+    if (budget)
+        fprintf(fp, ", budget %zu KiB", budget / 1024);
+    fprintf(fp, "\n");
+
+    for (i = 0; i < NUM_MEM_ROLES; i++) {
+        if (by_role[i].peak)
+            fprintf(fp, "  %-8s %8zu KiB held, %8zu KiB peak\n", role_names[i],
+                by_role[i].current / 1024, by_role[i].peak / 1024);
+    }
+    for (i = 0; i < NUM_MEM_BACKENDS; i++) {
+        if (by_backend[i].peak)
+            fprintf(fp, "  %-8s %8zu KiB held, %8zu KiB peak\n", backend_names[i],
+                by_backend[i].current / 1024, by_backend[i].peak / 1024);
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * Accounting of the memory the tool holds, by role and by backend, with an
+ * optional budget that allocations are checked against.
+ */
+
+#ifndef __MEMTRACK_H_INCLUDED__
+#define __MEMTRACK_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum mem_role {
+	MEM_ROLE_OTHER,
+	MEM_ROLE_SRC,
+	MEM_ROLE_DST,
+	MEM_ROLE_SCANOUT,
+	MEM_ROLE_STAGING,
+	NUM_MEM_ROLES
+};
+
+enum mem_backend {
+	/* DRM dumb buffers, CMA on the Pinenote */
+	MEM_BACKEND_DUMB,
+	/* ordinary process memory */
+	MEM_BACKEND_HEAP,
+	NUM_MEM_BACKENDS
+};
+
+void memtrack_set_budget(size_t bytes);
+size_t memtrack_available(void);
+int memtrack_reserve(enum mem_role role, enum mem_backend backend, size_t bytes);
+void memtrack_release(enum mem_role role, enum mem_backend backend, size_t bytes);
+void memtrack_report(FILE *fp);
+
+#endif /* __MEMTRACK_H_INCLUDED__ */
@@ -25,6 +25,7 @@
 #include "modeset.h"
 #include "bo.h"
 #include "dev.h"
+#include "memtrack.h"
 
 int initialize_screens(struct sp_dev *dev) {
 	int ret, i, j;
@@ -110,7 +111,8 @@ int initialize_screens(struct sp_dev *dev) {
 
 		/* XXX: Hardcoding the format here... :| */
 		cr->scanout = create_sp_bo(dev, m->hdisplay, m->vdisplay,
-					   24, 32, DRM_FORMAT_XRGB8888, 0);
+					   24, 32, DRM_FORMAT_XRGB8888, 0,
+					   MEM_ROLE_SCANOUT);
 		if (!cr->scanout) {
 			printf("failed to create new scanout bo\n");
 			continue;
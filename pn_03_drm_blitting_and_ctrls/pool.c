@@ -0,0 +1,239 @@
+/*
+ * Persistent worker threads for the CPU image kernels.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "rt.h"
+
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    /* held by the thread running a parallel_for() */
+    pthread_mutex_t dispatch;
+    pthread_t threads[POOL_MAX_THREADS];
+    unsigned int workers;
+    unsigned int limit;
+    int pin;
+    int started;
+    int quit;
+    unsigned long generation;
+
+    /*
+     * The current job. It is only replaced while no worker is active, a
+     * worker joins a generation under the lock if there is a slot left.
+     */
+    pool_band_fn fn;
+    void* ctx;
+    uint32_t rows;
+    unsigned int bands;
+    unsigned int next;
+    unsigned int slots;
+    unsigned int active;
+};
+
+static struct pool pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static __thread int in_pool;
+
+static void run_bands(void)
+{
+    unsigned int b;
+
+    while ((b = __atomic_fetch_add(&pool.next, 1, __ATOMIC_RELAXED)) < pool.bands)
+        pool.fn(pool.ctx, (uint64_t)pool.rows * b / pool.bands,
+            (uint64_t)pool.rows * (b + 1) / pool.bands);
+}
+
+static void init_locks(void)
+{
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pthread_mutex_init(&pool.dispatch, NULL);
+}
+
+static void* worker(void* arg)
+{
+    unsigned int n = (uintptr_t)arg;
+    unsigned long seen = 0;
+    struct sched_param param;
+    cpu_set_t set;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN), i;
+
+    in_pool = 1;
+
+    /* don't inherit the pinning of the conversion thread */
+    CPU_ZERO(&set);
+    for (i = 0; i < cpus; i++) {
+        if (!pool.pin || i == (long)(n + 1) % cpus)
+            CPU_SET(i, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+
+    /* workers run at the priority of the frame they are working on */
+    if (rt_profile.prio > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rt_profile.prio;
+        sched_setscheduler(0, SCHED_FIFO, &param);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.quit && (pool.generation == seen || !pool.slots)) {
+            seen = pool.generation;
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        if (pool.quit) {
+            pthread_mutex_unlock(&pool.lock);
+            return NULL;
+        }
+        seen = pool.generation;
+        pool.slots--;
+        pool.active++;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_bands();
+
+        pthread_mutex_lock(&pool.lock);
+        if (!--pool.active)
+            pthread_cond_signal(&pool.done);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+int pool_init(unsigned int threads, int pin)
+{
+    long cpus;
+    unsigned int i;
+
+    pthread_once(&pool_once, init_locks);
+    if (pool.started)
+        pool_shutdown();
+
+    if (!threads) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    if (threads > POOL_MAX_THREADS)
+        threads = POOL_MAX_THREADS;
+
+    pool.pin = pin;
+    pool.quit = 0;
+    pool.workers = 0;
+    pool.started = 1;
+    for (i = 0; i + 1 < threads; i++) {
+        if (pthread_create(&pool.threads[i], NULL, worker, (void*)(uintptr_t)i)) {
+            printf("thread pool: started %u of %u threads\n", i + 1, threads);
+            break;
+        }
+        pool.workers++;
+    }
+    return 0;
+}
+
+void pool_shutdown(void)
+{
+    unsigned int i;
+
+    if (!pool.started)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = 1;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < pool.workers; i++)
+        pthread_join(pool.threads[i], NULL);
+    pool.workers = 0;
+    pool.started = 0;
+}
+
+unsigned int pool_size(void)
+{
+    if (!pool.started)
+        pool_init(0, 0);
+    return pool.workers + 1;
+}
+
+void pool_set_limit(unsigned int threads)
+{
+    pool.limit = threads;
+}
+
+void parallel_for(uint32_t rows, uint32_t min_rows, pool_band_fn fn, void* ctx)
+{
+    unsigned int threads = pool_size(), bands;
+
+    if (pool.limit && pool.limit < threads)
+        threads = pool.limit;
+    if (!min_rows)
+        min_rows = 1;
+
+    /* a few bands per thread evens out bands of different cost */
+    bands = rows / min_rows;
+    if (bands > 4 * threads)
+        bands = 4 * threads;
+
+    if (threads < 2 || bands < 2 || in_pool || pthread_mutex_trylock(&pool.dispatch)) {
+        if (rows)
+            fn(ctx, 0, rows);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.rows = rows;
+    pool.bands = bands;
+    pool.next = 0;
+    pool.slots = threads - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    in_pool = 1;
+    run_bands();
+    in_pool = 0;
+
+    /* all bands are taken, wait for those still running */
+    pthread_mutex_lock(&pool.lock);
+    pool.slots = 0;
+    while (pool.active)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.dispatch);
+}
+
+struct run_all {
+    void (*fn)(void* ctx);
+    void* ctx;
+};
+
+static void run_all_band(void* arg, uint32_t, uint32_t)
+{
+    struct run_all* all = (struct run_all*)arg;
+
+    all->fn(all->ctx);
+}
+
+void pool_run_all(void (*fn)(void* ctx), void* ctx)
+{
+    struct run_all all = { fn, ctx };
+    unsigned int threads = pool_size();
+
+    if (pool.limit && pool.limit < threads)
+        threads = pool.limit;
+    /* one band per thread */
+    parallel_for(threads, 1, run_all_band, &all);
+}
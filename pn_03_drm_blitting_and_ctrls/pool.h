@@ -0,0 +1,38 @@
+/*
+ * Persistent worker threads for the CPU image kernels.
+ *
+ * parallel_for() splits rows [0, rows) into bands and runs them on the
+ * workers and the calling thread, returning once all are done. The pool is
+ * started on first use with one thread per online CPU unless pool_init()
+ * was called before. Calls from inside a band, or while another thread is
+ * running a parallel_for(), run inline on the calling thread.
+ */
+
+#ifndef __POOL_H_INCLUDED__
+#define __POOL_H_INCLUDED__
+
+#include <stdint.h>
+
+#define POOL_MAX_THREADS 16
+
+typedef void (*pool_band_fn)(void *ctx, uint32_t y0, uint32_t y1);
+
+/* threads including the caller, 0 = online CPUs; pin worker n to CPU n */
+int pool_init(unsigned int threads, int pin);
+void pool_shutdown(void);
+
+/* threads taking part in a parallel_for(), the caller included */
+unsigned int pool_size(void);
+/* use at most this many of them, 0 = all; for scaling measurements */
+void pool_set_limit(unsigned int threads);
+
+/* bands are at least min_rows high, except for a shorter last one */
+void parallel_for(uint32_t rows, uint32_t min_rows, pool_band_fn fn, void *ctx);
+
+/*
+ * fn(ctx) once on each thread a parallel_for() would use, the caller
+ * included, for work the calls share out among themselves.
+ */
+void pool_run_all(void (*fn)(void *ctx), void *ctx);
+
+#endif /* __POOL_H_INCLUDED__ */
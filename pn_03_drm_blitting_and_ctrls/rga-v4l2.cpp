@@ -11,10 +11,12 @@
 
 #include <asm/types.h>
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <malloc.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,10 +30,32 @@
 #include <linux/stddef.h>
 #include <linux/videodev2.h>
 
+#include "bench.h"
+#include "binding.h"
+#include "blend.h"
 #include "bo.h"
+#include "convert.h"
+#include "dispatch.h"
 #include "dev.h"
+#include "errdiff.h"
+#include "fill.h"
+#include "format.h"
+#include "histogram.h"
+#include "image.h"
+#include "memtrack.h"
 
 #include "modeset.h"
+#include "pool.h"
+#include "rotate.h"
+#include "rt.h"
+#include "scale.h"
+#include "shmring.h"
+#include "split.h"
+#include "wc.h"
+#include "y4conv.h"
+#include "y4lut.h"
+#include "y4pack.h"
+#include "ypack.h"
 
 /* operation values */
 #define V4L2_CID_BLEND			(V4L2_CID_IMAGE_PROC_CLASS_BASE + 4)
@@ -64,15 +88,39 @@ struct ioctl_values ioctl_control;
 
 #define NUM_BUFS 1
 
+// number of buffers cycled through per queue, each pinned to its own index
+static unsigned int num_bufs = NUM_BUFS;
 static char* mem2mem_dev_name = NULL;
+// "rga", "cpu" or "auto": the RGA, falling back to the CPU without one
+static const char* backend = "auto";
+static int cpu_backend = 0;
 
 static int hflip = 0;
 static int vflip = 0;
 static int rotate = 0;
+// rotate and flips are done on the CPU, always so on the CPU backend
+static int cpu_transform = 0;
 static int fill_color = 0;
+// enum v4l2_blend_mode of --overlay
 static int op = 0;
+// composite a UI overlay into every frame as op(frame, overlay)
+static int overlay = 0;
+// the RGA took V4L2_CID_BLEND, so frames it converts are blended by it
+static int rga_blend = 0;
+// the RGA converts the top of each frame while the CPU converts the rest
+static int split = 0;
+static struct split_tuner split_tuner;
+static uint32_t split_selected = 0;
+// each frame goes to the engine the dispatcher expects to finish it first
+static int dispatch = 0;
+static struct dispatcher dispatcher;
+static int dispatched_cpu = 0;
 static int num_frames = 1;
 static int display = 1;
+static int interactive = 1;
+static unsigned int pool_threads = 0;
+static int pool_pin = 0;
+static const char* bench_name = NULL;
 
 static size_t SRC_WIDTH = 1872;
 static size_t SRC_HEIGHT = 1404;
@@ -90,62 +138,285 @@ static size_t DST_CROP_Y = 0;
 static size_t DST_CROP_W = 0;
 static size_t DST_CROP_H = 0;
 
-static int src_format = V4L2_PIX_FMT_RGB24;
-// static int dst_format = V4L2_PIX_FMT_XRGB32;
-static int dst_format = V4L2_PIX_FMT_Y4;
+static const struct pix_fmt* src_fmt = pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24);
+// static const struct pix_fmt* dst_fmt = pix_fmt_by_v4l2(V4L2_PIX_FMT_XRGB32);
+static const struct pix_fmt* dst_fmt = pix_fmt_by_v4l2(V4L2_PIX_FMT_Y4);
 
 static struct timespec start, end;
 static unsigned long long time_consumed;
-static int mem2mem_fd;
+static struct rt_latency frame_latency;
+static int mem2mem_fd = -1;
+
+static struct buf_binding_table src_bind, dst_bind;
+
+// Y4MAP gray level remapping, applied by the RGA or with --lut-cpu on the CPU
+static const char* lut_path = NULL;
+static int lut_cpu = 0;
+static int lut_active = 0;
+static struct y4_lut y4map;
+// quantization to the measured gray of the panel levels instead of linear
+static const char* curve_path = NULL;
+static int curve_active = 0;
+static struct y4_curve curve;
+// enum histogram_mode the table follows each source frame with, -1 = off
+static int auto_contrast = -1;
+
+// error diffusion instead of the dither down, always done on the CPU
+static int diffusion = -1;
+static unsigned int gray_levels = 16;
+
+// 1 or 2 bpp output for the fast waveforms, displayed instead of the frame
+static const struct pix_fmt* fast_fmt = NULL;
+// packed frames alternate, so the one on screen is not written to
+static struct sp_bo* fast_bos[2];
+
+// Y4 the way the display controller reads it, repacked from the converted
+// frame: enum y4_nibble_order and bytes per row, 0 = as allocated
+static int scanout_order = Y4_HIGH_FIRST;
+static uint32_t scanout_pitch = 0;
+static struct sp_bo* scanout_bos[2];
+
+// heap buffers of the CPU passes, grown on demand
+struct cpu_staging {
+    uint8_t* data;
+    size_t size;
+};
+
+// copy of the converted frame the CPU rotates from
+static struct cpu_staging transform_staging;
+// the source scaled to the destination size, for the CPU conversions
+static struct cpu_staging scale_staging;
+// the --overlay image, straight alpha in the source format
+static struct cpu_staging overlay_staging;
+static struct image overlay_img;
 
-static void *p_src_buf[NUM_BUFS], *p_dst_buf[NUM_BUFS];
-static int src_buf_fd[NUM_BUFS], dst_buf_fd[NUM_BUFS];
-static struct sp_bo *src_buf_bo[NUM_BUFS], *dst_buf_bo[NUM_BUFS];
-static size_t src_buf_size[NUM_BUFS], dst_buf_size[NUM_BUFS];
-static unsigned int num_src_bufs = 0, num_dst_bufs = 0;
+static const char* shm_sink_path = NULL;
+static struct shm_ring_producer shm_sink;
 
 static struct sp_dev* dev_sp;
 static struct sp_plane** plane_sp;
 static struct sp_crtc* test_crtc_sp;
 static struct sp_plane* test_plane_sp;
 
-static unsigned int get_drm_format(unsigned int v4l2_format)
-{
-    switch (v4l2_format) {
-    case V4L2_PIX_FMT_NV12: //0
-        return DRM_FORMAT_NV12;
-    case V4L2_PIX_FMT_ARGB32: //1
-        return DRM_FORMAT_ARGB8888;
-    case V4L2_PIX_FMT_RGB24: //2
-        return DRM_FORMAT_RGB888;
-    case V4L2_PIX_FMT_RGB565: //3
-        return DRM_FORMAT_RGB565;
-    case V4L2_PIX_FMT_YUV420: //4
-        return DRM_FORMAT_YUV420;
-    case V4L2_PIX_FMT_XRGB32: //5
-        return DRM_FORMAT_XRGB8888;
-    case V4L2_PIX_FMT_ABGR32: //6
-        return DRM_FORMAT_BGRA8888;
-    case V4L2_PIX_FMT_XBGR32: //7
-        return DRM_FORMAT_BGRX8888;
-    case V4L2_PIX_FMT_ARGB555: //8
-        return DRM_FORMAT_ARGB1555;
-    case V4L2_PIX_FMT_ARGB444: //9
-        return DRM_FORMAT_ARGB4444;
-    case V4L2_PIX_FMT_NV61: // 10
-        return DRM_FORMAT_NV61;
-    case V4L2_PIX_FMT_NV16: //11
-        return DRM_FORMAT_NV16;
-    case V4L2_PIX_FMT_YUV422P: //12
-        return DRM_FORMAT_YUV422;
-    case V4L2_PIX_FMT_Y4: // 13
-        return DRM_FORMAT_R4;
-    }
-    return DRM_FORMAT_NV12;
-}
-void fillbuffer(unsigned int v4l2_format, struct sp_bo* bo, unsigned int frame_counter)
-{
-    if (v4l2_format == V4L2_PIX_FMT_RGB24) {
+// raw frame files are read once, later frames are copied from memory
+static struct {
+    char* path;
+    uint8_t* data;
+    size_t size;
+    // the RGB24 frame converted to the source format, once per file
+    const struct pix_fmt* fmt;
+    uint8_t* converted;
+} frame_cache;
+
+struct copy_job {
+    const uint8_t* src;
+    uint8_t* dst;
+    size_t src_pitch;
+    size_t dst_pitch;
+    size_t row_bytes;
+    size_t total;
+};
+
+static void copy_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct copy_job* job = (struct copy_job*)arg;
+    size_t n;
+    uint32_t y;
+
+    for (y = y0; y < y1; y++) {
+        n = job->total - y * job->src_pitch;
+        memcpy(job->dst + y * job->dst_pitch, job->src + y * job->src_pitch,
+            n < job->row_bytes ? n : job->row_bytes);
+    }
+}
+
+static int load_frame_file(const char* path, size_t size)
+{
+    FILE* src_file;
+    uint8_t* data;
+
+    if (frame_cache.data && !strcmp(frame_cache.path, path) && frame_cache.size >= size)
+        return 0;
+
+    src_file = fopen(path, "rb");
+    if (!src_file) {
+        printf("failed to open %s\n", path);
+        return -errno;
+    }
+    data = (uint8_t*)malloc(size);
+    if (!data) {
+        fclose(src_file);
+        return -ENOMEM;
+    }
+    if (fread(data, 1, size, src_file) != size) {
+        fclose(src_file);
+        free(data);
+        return -EIO;
+    }
+    fclose(src_file);
+
+    free(frame_cache.data);
+    free(frame_cache.path);
+    free(frame_cache.converted);
+    frame_cache.converted = NULL;
+    frame_cache.fmt = NULL;
+    frame_cache.data = data;
+    frame_cache.size = size;
+    frame_cache.path = strdup(path);
+    return 0;
+}
+
+/*
+ * Where a source frame is written: the cached shadow of the bo, which the
+ * CPU passes read it from and which is pushed to the mapping in bursts, or
+ * the mapping itself when there is no memory for a shadow.
+ */
+static uint8_t* source_target(struct sp_bo* bo)
+{
+    uint8_t* shadow = wc_shadow(bo);
+
+    return shadow ? shadow : (uint8_t*)bo->map_addr;
+}
+
+static void source_written(struct sp_bo* bo)
+{
+    if (bo->shadow)
+        wc_shadow_push(bo);
+}
+
+/* copy an unpadded frame into the bo, honouring the bo pitch */
+static void copy_frame(const uint8_t* data, const struct pix_fmt* f, struct sp_bo* bo)
+{
+    size_t frame_bytes = pix_fmt_frame_bytes(f, bo->width, bo->height);
+    struct copy_job job;
+
+    job.src = data;
+    job.dst = source_target(bo);
+    job.total = frame_bytes;
+    job.row_bytes = pix_fmt_row_bytes(f, bo->width);
+    if (bo->pitch == job.row_bytes || f->planes > 1) {
+        // one run, cut into pieces for the threads
+        job.row_bytes = 64 << 10;
+        job.src_pitch = job.dst_pitch = job.row_bytes;
+        parallel_for((frame_bytes + job.row_bytes - 1) / job.row_bytes, 1, copy_band, &job);
+    } else {
+        job.src_pitch = job.row_bytes;
+        job.dst_pitch = bo->pitch;
+        parallel_for(bo->height, 16, copy_band, &job);
+    }
+    source_written(bo);
+}
+
+/* copy a raw frame file into the bo */
+static int read_frame_file(const char* path, const struct pix_fmt* f, struct sp_bo* bo)
+{
+    int ret;
+
+    ret = load_frame_file(path, pix_fmt_frame_bytes(f, bo->width, bo->height));
+    if (ret == -EIO)
+        printf("%s is shorter than a %ux%u %s frame\n", path, bo->width,
+            bo->height, f->name);
+    if (ret)
+        return ret;
+
+    copy_frame(frame_cache.data, f, bo);
+    return 0;
+}
+
+/*
+ * The RGB24 frame file in any other format the CPU converts to. For a
+ * GREY source that is the RGB to Y8 pre-pass, after which the RGA reads a
+ * third of the bytes; it is done once per file and later frames copy the
+ * result like a raw file.
+ */
+static int read_frame_file_converted(const char* path, const struct pix_fmt* f,
+    struct sp_bo* bo)
+{
+    const struct pix_fmt* rgb24 = pix_fmt_by_v4l2(V4L2_PIX_FMT_RGB24);
+    struct image src, dst;
+    int ret;
+
+    ret = load_frame_file(path, pix_fmt_frame_bytes(rgb24, bo->width, bo->height));
+    if (ret)
+        return ret;
+
+    if (frame_cache.fmt != f) {
+        dst.data = (uint8_t*)malloc(pix_fmt_frame_bytes(f, bo->width, bo->height));
+        if (!dst.data)
+            return -ENOMEM;
+        dst.width = src.width = bo->width;
+        dst.height = src.height = bo->height;
+        dst.pitch = pix_fmt_row_bytes(f, bo->width);
+        dst.fmt = f;
+        src.data = frame_cache.data;
+        src.pitch = pix_fmt_row_bytes(rgb24, bo->width);
+        src.fmt = rgb24;
+        ret = convert_image(&dst, &src);
+        if (ret) {
+            free(dst.data);
+            return ret;
+        }
+        free(frame_cache.converted);
+        frame_cache.converted = dst.data;
+        frame_cache.fmt = f;
+    }
+
+    copy_frame(frame_cache.converted, f, bo);
+    return 0;
+}
+
+struct expand_job {
+    const uint8_t* src;
+    uint8_t* dst;
+    struct sp_bo* bo;
+    unsigned int chan[3];
+    unsigned int alpha;
+};
+
+/* RGB24 rows to a 32 bpp format, opaque */
+static void expand_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct expand_job* job = (struct expand_job*)arg;
+    uint32_t x, y;
+
+    for (y = y0; y < y1; y++) {
+        const uint8_t* s = job->src + (size_t)y * job->bo->width * 3;
+        uint8_t* d = job->dst + (size_t)y * job->bo->pitch;
+
+        for (x = 0; x < job->bo->width; x++, s += 3, d += 4) {
+            d[job->chan[0]] = s[0];
+            d[job->chan[1]] = s[1];
+            d[job->chan[2]] = s[2];
+            d[job->alpha] = 0xff;
+        }
+    }
+}
+
+/* the RGB24 frame file in a 32 bpp RGB format */
+static int read_frame_file_rgb32(const char* path, const struct pix_fmt* f, struct sp_bo* bo)
+{
+    struct expand_job job;
+    unsigned int cpp;
+    int ret;
+
+    if (pix_fmt_rgb_layout(f, &cpp, job.chan) || cpp != 4)
+        return -EINVAL;
+    ret = load_frame_file(path, (size_t)bo->width * bo->height * 3);
+    if (ret)
+        return ret;
+
+    job.src = frame_cache.data;
+    job.dst = source_target(bo);
+    job.bo = bo;
+    job.alpha = 6 - job.chan[0] - job.chan[1] - job.chan[2];
+    parallel_for(bo->height, 16, expand_band, &job);
+    source_written(bo);
+    return 0;
+}
+
+void fillbuffer(const struct pix_fmt* f, struct sp_bo* bo, unsigned int frame_counter)
+{
+    if (f->v4l2 == V4L2_PIX_FMT_RGB24) {
         uint8_t* buf = (uint8_t*)bo->map_addr;
         int i, j;
 
@@ -173,31 +444,26 @@ void fillbuffer(unsigned int v4l2_format, struct sp_bo* bo, unsigned int frame_c
 			}
 		}
 		if(1){
-			FILE * src_file;
-			src_file = fopen("spheres_rgb.bin", "rb");
-			fread(buf, sizeof(uint8_t), 1872 * 1404 * 3, src_file);
-			fclose(src_file);
+			read_frame_file("spheres_rgb.bin", f, bo);
 		}
+	} else if (f->bpp == 32 && f->planes == 1) {
+		// refreshed every frame, --overlay composites into it
+		read_frame_file_rgb32("spheres_rgb.bin", f, bo);
+	} else if (convert_supported(f)) {
+		read_frame_file_converted("spheres_rgb.bin", f, bo);
 	} else {
 		printf("no filling for this format\n");
 	}
 }
 
-void fillbuffer2(unsigned int v4l2_format, struct sp_bo* bo)
+/* destinations start out translucent blue, whatever their format */
+void fillbuffer2(const struct pix_fmt* f, struct sp_bo* bo)
 {
-    if (v4l2_format == V4L2_PIX_FMT_ARGB32) {
-        uint32_t* buf = (uint32_t*)bo->map_addr;
-        int i, j;
-
-        for (j = 0; j < bo->height; j += 1) {
+    struct image img;
 
-            for (i = 0; i < bo->width / 2; i += 1) {
-                *(buf++) = 0x550000ff;
-            }
-        }
-	} else {
-		printf("no filling for this format\n");
-	}
+    image_from_bo(&img, bo, f);
+    if (fill_image(&img, 0, 0, img.width, img.height, 0x550000ff))
+        printf("no filling for this format\n");
 }
 
 int get_v4l2_control_old(const char *name){
@@ -220,8 +486,62 @@ int get_v4l2_control_old(const char *name){
 	return control_id;
 }
 
+/* set a control on the RGA, the CPU backend reads ioctl_control instead */
+static int set_control(uint32_t id, int32_t value)
+{
+    struct v4l2_control ctrl;
+    int ret;
+
+    if (cpu_backend)
+        return 0;
+
+    ctrl.id = id;
+    ctrl.value = value;
+    ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
+    if (!ret)
+        printf("ioctl succeeded\n");
+    else
+        printf("ioctl error: %i\n", ret);
+    return ret;
+}
+
+/* rotation and flips go to the RGA until it refuses one, then to the CPU */
+static void set_transform(uint32_t id, int32_t value)
+{
+    if (cpu_transform || !set_control(id, value))
+        return;
+
+    printf("rotating and flipping on the CPU from now on\n");
+    cpu_transform = 1;
+    set_control(V4L2_CID_HFLIP, 0);
+    set_control(V4L2_CID_VFLIP, 0);
+    set_control(V4L2_CID_ROTATE, 0);
+}
+
+/* the table for a frame quantized linearly, with the curve folded in if asked */
+static void frame_lut(struct y4_lut* lut, int with_curve)
+{
+    if (lut_active)
+        *lut = y4map;
+    else
+        y4_lut_identity(lut);
+    if (with_curve)
+        y4_curve_fold(&curve, lut);
+}
 
-static void init_mem2mem_dev()
+/* hand the Y4MAP table to the RGA, which quantizes linearly */
+static void program_lut()
+{
+    struct y4_lut lut;
+
+    frame_lut(&lut, curve_active);
+    y4_lut_to_regs(&lut, &ioctl_control.lut0, &ioctl_control.lut1);
+    printf("Y4MAP LUT0 0x%08x LUT1 0x%08x\n", ioctl_control.lut0, ioctl_control.lut1);
+    set_control(get_v4l2_control_old("Set Y4MAP LUT0"), ioctl_control.lut0);
+    set_control(get_v4l2_control_old("Set Y4MAP LUT1"), ioctl_control.lut1);
+}
+
+static int init_mem2mem_dev()
 {
     struct v4l2_capability cap;
     struct v4l2_format fmt;
@@ -233,34 +553,52 @@ static void init_mem2mem_dev()
     if (mem2mem_fd < 0) {
         fprintf(stderr, "%s:%d: ", __func__, __LINE__);
         perror("open");
-        return;
+        return -errno;
     }
 
     if (hflip != 0) {
         ctrl.id = V4L2_CID_HFLIP;
         ctrl.value = 1;
         ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-        if (ret != 0)
+        if (ret != 0) {
             fprintf(stderr, "%s:%d: Set HFLIP failed\n",
                 __func__, __LINE__);
+            cpu_transform = 1;
+        }
     }
 
     if (vflip != 0) {
         ctrl.id = V4L2_CID_VFLIP;
         ctrl.value = 1;
         ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-        if (ret != 0)
+        if (ret != 0) {
             fprintf(stderr, "%s:%d: Set VFLIP failed\n",
                 __func__, __LINE__);
+            cpu_transform = 1;
+        }
     }
 
     if (rotate != 0) {
         ctrl.id = V4L2_CID_ROTATE;
         ctrl.value = rotate;
         ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-        if (ret != 0)
+        if (ret != 0) {
             fprintf(stderr, "%s:%d: Set ROTATE failed\n",
                 __func__, __LINE__);
+            cpu_transform = 1;
+        }
+    }
+
+    if (cpu_transform) {
+        // what the RGA did accept would be applied twice
+        printf("rotating and flipping on the CPU instead\n");
+        ctrl.value = 0;
+        ctrl.id = V4L2_CID_HFLIP;
+        ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
+        ctrl.id = V4L2_CID_VFLIP;
+        ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
+        ctrl.id = V4L2_CID_ROTATE;
+        ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
     }
 
     if (fill_color != 0) {
@@ -286,19 +624,25 @@ static void init_mem2mem_dev()
 		fprintf(stderr, "%s:%d: Set Fill Color failed\n",
 			__func__, __LINE__);
 
-#if 0
-    ctrl.id = V4L2_CID_BLEND;
-    ctrl.value = op;
-    ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-    if (ret != 0)
-        fprintf(stderr, "%s:%d: Set OP failed\n",
-            __func__, __LINE__);
-#endif
+	if ((lut_active || curve_active) && !lut_cpu)
+		program_lut();
+
+    // the RGA blends the source into what the capture buffer holds
+    if (overlay && src_fmt == dst_fmt && blend_supported(dst_fmt)) {
+        ctrl.id = V4L2_CID_BLEND;
+        ctrl.value = op;
+        ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
+        if (ret != 0)
+            fprintf(stderr, "%s:%d: Set OP failed, blending on the CPU\n",
+                __func__, __LINE__);
+        else
+            rga_blend = 1;
+    }
     ret = ioctl(mem2mem_fd, VIDIOC_QUERYCAP, &cap);
     if (ret != 0) {
         fprintf(stderr, "%s:%d: ", __func__, __LINE__);
         perror("ioctl");
-        return;
+        return -errno;
     }
 
     if (!(cap.capabilities & V4L2_CAP_VIDEO_M2M)) {
@@ -314,7 +658,7 @@ static void init_mem2mem_dev()
     fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
     fmt.fmt.pix.width = SRC_WIDTH;
     fmt.fmt.pix.height = SRC_HEIGHT;
-    fmt.fmt.pix.pixelformat = src_format;
+    fmt.fmt.pix.pixelformat = src_fmt->v4l2;
     fmt.fmt.pix.field = V4L2_FIELD_ANY;
 
 	printf("stride 1: %i\n", fmt.fmt.pix.bytesperline);
@@ -322,26 +666,483 @@ static void init_mem2mem_dev()
     if (ret != 0) {
         fprintf(stderr, "%s:%d: ", __func__, __LINE__);
         perror("ioctl");
-        return;
+        return -errno;
     }
 	printf("stride 2: %i\n", fmt.fmt.pix.bytesperline);
+    // S_FMT picks another format for one the driver lacks, GREY on older ones
+    if (fmt.fmt.pix.pixelformat != src_fmt->v4l2) {
+        fprintf(stderr, "the RGA does not take %s sources\n", src_fmt->name);
+        return -EINVAL;
+    }
 
     /* Set format for capture */
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     fmt.fmt.pix.width = DST_WIDTH;
     fmt.fmt.pix.height = DST_HEIGHT;
-    fmt.fmt.pix.pixelformat = dst_format;
+    fmt.fmt.pix.pixelformat = dst_fmt->v4l2;
     fmt.fmt.pix.field = V4L2_FIELD_ANY;
 
     ret = ioctl(mem2mem_fd, VIDIOC_S_FMT, &fmt);
     if (ret != 0) {
         fprintf(stderr, "%s:%d: ", __func__, __LINE__);
         perror("ioctl");
-        return;
+        return -errno;
     }
 	printf("stride 3: %i\n", fmt.fmt.pix.bytesperline);
+    if (fmt.fmt.pix.pixelformat != dst_fmt->v4l2) {
+        fprintf(stderr, "the RGA does not write %s\n", dst_fmt->name);
+        return -EINVAL;
+    }
 
     printf("crop was replaced by selection \n");
+    return 0;
+}
+
+/* queue one src/dst pair on the RGA and wait for the dst buffer to come back */
+static int rga_convert(struct sp_bo* src_bo, struct sp_bo* dst_bo, struct v4l2_buffer* done)
+{
+    struct v4l2_buffer buf;
+    int ret;
+
+    ret = binding_prepare_qbuf(&src_bind, src_bo, &buf);
+    if (ret < 0)
+        return ret;
+    ret = ioctl(mem2mem_fd, VIDIOC_QBUF, &buf);
+    if (ret != 0) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+
+    ret = binding_prepare_qbuf(&dst_bind, dst_bo, &buf);
+    if (ret < 0)
+        return ret;
+    ret = ioctl(mem2mem_fd, VIDIOC_QBUF, &buf);
+    if (ret != 0) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+
+    memset(&(buf), 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_DMABUF;
+    ret = ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf);
+    printf("Dequeued source buffer, index: %d\n", buf.index);
+
+    memset(done, 0, sizeof(*done));
+    done->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    done->memory = V4L2_MEMORY_DMABUF;
+    ret = ioctl(mem2mem_fd, VIDIOC_DQBUF, done);
+    if (ret != 0) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    printf("Dequeued dst buffer, index: %d\n", done->index);
+    return 0;
+}
+
+static int staging_reserve(struct cpu_staging* staging, size_t size)
+{
+    if (staging->size >= size)
+        return 0;
+    if (memtrack_reserve(MEM_ROLE_STAGING, MEM_BACKEND_HEAP, size))
+        return -ENOMEM;
+    free(staging->data);
+    memtrack_release(MEM_ROLE_STAGING, MEM_BACKEND_HEAP, staging->size);
+    staging->data = (uint8_t*)malloc(size);
+    staging->size = staging->data ? size : 0;
+    if (!staging->data) {
+        memtrack_release(MEM_ROLE_STAGING, MEM_BACKEND_HEAP, size);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* a CPU view of a bo, on its shadow brought up to date where there is one */
+static void cpu_image(struct image* img, struct sp_bo* bo, const struct pix_fmt* f)
+{
+    image_from_bo(img, bo, f);
+    if (wc_shadow_pull(bo))
+        img->data = bo->shadow;
+}
+
+/* a CPU view of a bo the caller overwrites, pushed to the mapping afterwards */
+static void cpu_output_image(struct image* img, struct sp_bo* bo, const struct pix_fmt* f)
+{
+    image_from_bo(img, bo, f);
+    if (wc_shadow(bo)) {
+        img->data = bo->shadow;
+        bo->shadow_current = 1;
+    }
+}
+
+/* a source of another size than the destination, scaled to it on the CPU */
+static int scale_to_dst(struct image* src, uint32_t width, uint32_t height)
+{
+    struct image scaled;
+    int ret;
+
+    if ((src->width == width && src->height == height) || !scale_supported(src->fmt))
+        return 0;
+    scaled = *src;
+    scaled.width = width;
+    scaled.height = height;
+    scaled.pitch = (pix_fmt_row_bytes(src->fmt, width) + 63) & ~63;
+    if (staging_reserve(&scale_staging, (size_t)scaled.pitch * height))
+        return -ENOMEM;
+    scaled.data = scale_staging.data;
+
+    ret = scale_image(&scaled, src);
+    if (!ret)
+        *src = scaled;
+    return ret;
+}
+
+/*
+ * error diffusion and the blue noise dither mode exist on the CPU only,
+ * --dispatch sends it the frames it is faster at
+ */
+static int convert_on_cpu()
+{
+    return cpu_backend || dispatched_cpu || diffusion >= 0
+        || (ioctl_control.dither_down_enable
+            && ioctl_control.dither_down_mode == Y4_DITHER_BLUE_NOISE);
+}
+
+/* whether cpu_convert() quantizes with the curve itself, in y4conv_frame() */
+static int curve_in_conversion()
+{
+    return curve_active && convert_on_cpu() && diffusion < 0
+        && !(ioctl_control.dither_down_enable
+            && ioctl_control.dither_down_mode == Y4_DITHER_BLUE_NOISE)
+        && y4conv_supported(src_fmt);
+}
+
+/* the same conversion in software, with the dither settings of the controls */
+static int cpu_convert(struct sp_bo* src_bo, struct sp_bo* dst_bo, struct v4l2_buffer* done)
+{
+    struct image src, dst;
+    struct y4conv_params params;
+    int ret;
+
+    cpu_image(&src, src_bo, src_fmt);
+    cpu_output_image(&dst, dst_bo, dst_fmt);
+    ret = scale_to_dst(&src, dst.width, dst.height);
+    if (ret) {
+        printf("CPU scaling failed: %s\n", strerror(-ret));
+        return ret;
+    }
+    params.dither = ioctl_control.dither_down_enable;
+    params.dither_mode = (enum y4_dither_mode)ioctl_control.dither_down_mode;
+    params.levels = gray_levels;
+    params.curve = curve_active ? &curve : NULL;
+
+    if (diffusion >= 0)
+        ret = errdiff_frame(&dst, &src, (enum errdiff_method)diffusion, gray_levels);
+    else if (dst_fmt->v4l2 == V4L2_PIX_FMT_Y4 && y4conv_supported(src_fmt))
+        ret = y4conv_frame(&dst, &src, &params);
+    else
+        ret = convert_image(&dst, &src);
+    if (ret) {
+        printf("CPU conversion failed: %s\n", strerror(-ret));
+        return ret;
+    }
+    // what a smaller, unscaled source leaves uncovered gets the background color
+    if (src.width < dst.width)
+        fill_image(&dst, src.width, 0, dst.width - src.width, dst.height, fill_color);
+    if (src.height < dst.height)
+        fill_image(&dst, 0, src.height, src.width, dst.height - src.height, fill_color);
+
+    memset(done, 0, sizeof(*done));
+    done->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    done->index = binding_index_of(&dst_bind, dst_bo);
+    done->bytesused = pix_fmt_frame_bytes(dst_fmt, dst_bo->width, dst_bo->height);
+    return 0;
+}
+
+static void overlay_rect(uint32_t x0, uint32_t y0, uint32_t width, uint32_t height,
+    uint8_t gray, uint8_t alpha)
+{
+    unsigned int a = overlay_img.fmt->v4l2 == V4L2_PIX_FMT_ABGR32 ? 3 : 0;
+    uint32_t x, y;
+
+    for (y = y0; y < y0 + height && y < overlay_img.height; y++) {
+        uint8_t* p = image_row(&overlay_img, y) + x0 * 4;
+
+        for (x = x0; x < x0 + width && x < overlay_img.width; x++, p += 4) {
+            memset(p, gray, 4);
+            p[a] = alpha;
+        }
+    }
+}
+
+/* a status bar and a translucent dialog with an opaque button */
+static int make_overlay()
+{
+    uint32_t w = SRC_WIDTH, h = SRC_HEIGHT;
+
+    overlay_img.fmt = src_fmt;
+    overlay_img.width = w;
+    overlay_img.height = h;
+    overlay_img.pitch = w * 4;
+    if (staging_reserve(&overlay_staging, (size_t)overlay_img.pitch * h))
+        return -ENOMEM;
+    overlay_img.data = overlay_staging.data;
+    memset(overlay_img.data, 0, (size_t)overlay_img.pitch * h);
+
+    overlay_rect(0, 0, w, h / 16, 0x20, 0xc0);
+    overlay_rect(w / 4, h / 3, w / 2, h / 3, 0xf0, 0x80);
+    overlay_rect(w / 2 - w / 16, 2 * h / 3 - h / 10, w / 8, h / 16, 0x00, 0xff);
+    return 0;
+}
+
+/* the frame goes through the RGA, which blends it as the control asked */
+static int blend_on_rga()
+{
+    return rga_blend && !convert_on_cpu();
+}
+
+/*
+ * op(frame, overlay) for this frame: the RGA reads the overlay from the
+ * capture buffer it blends into, the CPU composites into the source.
+ */
+static int blend_overlay(struct sp_bo* src_bo, struct sp_bo* dst_bo)
+{
+    struct image frame, dst;
+    int ret;
+
+    if (blend_on_rga()) {
+        image_from_bo(&dst, dst_bo, dst_fmt);
+        wc_copy_rows(dst.data, dst.pitch, overlay_img.data, overlay_img.pitch,
+            4 * (dst.width < overlay_img.width ? dst.width : overlay_img.width),
+            dst.height < overlay_img.height ? dst.height : overlay_img.height);
+        wc_shadow_invalidate(dst_bo);
+        return 0;
+    }
+
+    cpu_image(&frame, src_bo, src_fmt);
+    ret = blend_frame(&frame, &overlay_img, blend_op_swap((enum blend_op)op), 0);
+    if (ret)
+        printf("blending the overlay failed: %s\n", strerror(-ret));
+    else
+        wc_shadow_push(src_bo);
+    return ret;
+}
+
+/* follow the table to the luma of the source crop, reprogrammed when it changes */
+static void auto_contrast_lut(struct sp_bo* src_bo)
+{
+    struct histogram hist;
+    struct image img;
+    struct y4_lut lut;
+    uint64_t t = rt_now_ns();
+
+    cpu_image(&img, src_bo, src_fmt);
+    if (histogram_region(&hist, &img, SRC_CROP_X, SRC_CROP_Y,
+            SRC_CROP_W ? SRC_CROP_W : img.width, SRC_CROP_H ? SRC_CROP_H : img.height))
+        return;
+    histogram_lut(&hist, (enum histogram_mode)auto_contrast, &lut);
+    if (lut_active && !memcmp(lut.map, y4map.map, sizeof(lut.map)))
+        return;
+
+    y4map = lut;
+    lut_active = 1;
+    printf("%s table from the histogram in %.3f msecs\n",
+        histogram_mode_name((enum histogram_mode)auto_contrast), (rt_now_ns() - t) / 1e6);
+    if (lut_cpu || cpu_backend)
+        y4_lut_to_regs(&y4map, &ioctl_control.lut0, &ioctl_control.lut1);
+    else
+        program_lut();
+}
+
+/* nothing but the display reads the Y4 frame, so the CPU packs the source */
+static int fast_from_source()
+{
+    return fast_fmt && cpu_backend && diffusion < 0 && !lut_active && auto_contrast < 0
+        && !curve_active && !shm_sink_path
+        && !(rotate || hflip || vflip) && ypack_supported(src_fmt);
+}
+
+/* Y1 or Y2 from a source or converted frame, dithered while dither down is on */
+static int fast_pack(struct sp_bo* from, const struct pix_fmt* fmt, struct sp_bo* to)
+{
+    struct image src, dst;
+    int ret;
+
+    cpu_image(&src, from, fmt);
+    cpu_output_image(&dst, to, fast_fmt);
+    ret = scale_to_dst(&src, dst.width, dst.height);
+    if (!ret)
+        ret = ypack_frame(&dst, &src, ioctl_control.dither_down_enable);
+    if (ret)
+        printf("packing to %s failed: %s\n", fast_fmt->name, strerror(-ret));
+    else
+        wc_shadow_push(to);
+    return ret;
+}
+
+/* restrict the RGA to rows [0, rows) of the source and destination */
+static int split_select(uint32_t rows)
+{
+    struct v4l2_selection sel;
+
+    if (rows == split_selected)
+        return 0;
+    memset(&sel, 0, sizeof(sel));
+    sel.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    sel.target = V4L2_SEL_TGT_CROP;
+    sel.r.width = SRC_WIDTH;
+    sel.r.height = rows;
+    if (ioctl(mem2mem_fd, VIDIOC_S_SELECTION, &sel)) {
+        perror("VIDIOC_S_SELECTION crop");
+        return -errno;
+    }
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_COMPOSE;
+    sel.r.width = DST_WIDTH;
+    sel.r.height = rows;
+    if (ioctl(mem2mem_fd, VIDIOC_S_SELECTION, &sel)) {
+        perror("VIDIOC_S_SELECTION compose");
+        return -errno;
+    }
+    split_selected = rows;
+    return 0;
+}
+
+/*
+ * The RGA converts the top rows while the CPU converts the rest into the
+ * shadow, in bands, checking between them whether the RGA is done to time
+ * it. The CPU rows are copied to the mapping below what the RGA wrote.
+ */
+static int split_convert(struct sp_bo* src_bo, struct sp_bo* dst_bo, struct v4l2_buffer* done)
+{
+    const uint32_t band = 64;
+    struct pollfd pfd = { mem2mem_fd, POLLIN, 0 };
+    uint32_t rows = split_tuner.rga_rows, y, n;
+    uint64_t start, rga_ns = 0, cpu_ns;
+    struct image src, dst, s, d;
+    struct y4conv_params params;
+    struct v4l2_buffer buf;
+    struct y4_lut lut;
+    uint32_t type;
+    int ret;
+
+    ret = split_select(rows);
+    if (ret)
+        return ret;
+    cpu_image(&src, src_bo, src_fmt);
+    cpu_output_image(&dst, dst_bo, dst_fmt);
+    params.dither = ioctl_control.dither_down_enable;
+    params.dither_mode = (enum y4_dither_mode)ioctl_control.dither_down_mode;
+    params.levels = gray_levels;
+    // the same quantization as the RGA half: linear, remapped by its table
+    params.curve = NULL;
+
+    start = rt_now_ns();
+    ret = binding_prepare_qbuf(&src_bind, src_bo, &buf);
+    if (ret < 0)
+        return ret;
+    if (ioctl(mem2mem_fd, VIDIOC_QBUF, &buf)) {
+        perror("VIDIOC_QBUF");
+        return -errno;
+    }
+    ret = binding_prepare_qbuf(&dst_bind, dst_bo, &buf);
+    if (ret >= 0 && ioctl(mem2mem_fd, VIDIOC_QBUF, &buf)) {
+        perror("VIDIOC_QBUF");
+        ret = -errno;
+    }
+    if (ret < 0) {
+        // without a destination the source is never done, stopping returns it
+        type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        ioctl(mem2mem_fd, VIDIOC_STREAMOFF, &type);
+        return ret;
+    }
+
+    // bands start at multiples of 4 rows, so the dither lines up
+    ret = 0;
+    for (y = rows; y < dst.height; y += n) {
+        n = dst.height - y < band ? dst.height - y : band;
+        s = src;
+        s.data = image_row(&src, y);
+        s.height = n;
+        d = dst;
+        d.data = image_row(&dst, y);
+        d.height = n;
+        ret = y4conv_frame(&d, &s, &params);
+        if (ret) {
+            printf("CPU conversion failed: %s\n", strerror(-ret));
+            break;
+        }
+        if ((lut_active || curve_active) && !lut_cpu) {
+            frame_lut(&lut, curve_active);
+            y4_lut_apply(&d, &lut);
+        }
+        if (!rga_ns && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+            rga_ns = rt_now_ns() - start;
+    }
+    cpu_ns = rt_now_ns() - start;
+    // the shadow now holds only the CPU rows, the RGA wrote the mapping
+    if (!ret && dst.data != dst_bo->map_addr)
+        wc_copy_rows((uint8_t*)dst_bo->map_addr + (size_t)rows * dst.pitch, dst.pitch,
+            image_row(&dst, rows), dst.pitch, pix_fmt_row_bytes(dst_fmt, dst.width),
+            dst.height - rows);
+    wc_shadow_invalidate(dst_bo);
+
+    // the RGA half is waited for even when the CPU half failed
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_DMABUF;
+    if (ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf)) {
+        perror("VIDIOC_DQBUF");
+        return -errno;
+    }
+    memset(done, 0, sizeof(*done));
+    done->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    done->memory = V4L2_MEMORY_DMABUF;
+    if (ioctl(mem2mem_fd, VIDIOC_DQBUF, done)) {
+        perror("VIDIOC_DQBUF");
+        return -errno;
+    }
+    if (ret)
+        return ret;
+    if (!rga_ns)
+        rga_ns = rt_now_ns() - start;
+
+    split_update(&split_tuner, rga_ns, cpu_ns, rt_now_ns() - start);
+    return 0;
+}
+
+/* the converted frame in the nibble order and pitch of the controller */
+static int scanout_repack(struct sp_bo* from, struct sp_bo* to)
+{
+    struct image src, dst;
+    int ret;
+
+    cpu_image(&src, from, dst_fmt);
+    // whole vector stores, so straight into the mapping
+    image_from_bo(&dst, to, dst_fmt);
+    ret = y4_repack(&dst, (enum y4_nibble_order)scanout_order, &src, Y4_HIGH_FIRST);
+    if (ret)
+        printf("repacking for scanout failed: %s\n", strerror(-ret));
+    return ret;
+}
+
+/* rotate and flip a converted frame in place, by way of a copy of it */
+static int cpu_transform_frame(struct sp_bo* bo)
+{
+    struct image src, dst;
+    size_t size = (size_t)bo->pitch * bo->height;
+
+    if (staging_reserve(&transform_staging, size))
+        return -ENOMEM;
+
+    cpu_image(&dst, bo, dst_fmt);
+    src = dst;
+    src.data = transform_staging.data;
+    memcpy(src.data, dst.data, size);
+    return rotate_image(&dst, &src, rotate, hflip, vflip);
 }
 
 static void process_mem2mem_frame()
@@ -349,55 +1150,105 @@ static void process_mem2mem_frame()
     struct v4l2_buffer buf;
     int ret, i;
 	int frame_counter = 0;
-	unsigned int modifier_key;
+	unsigned int modifier_key = 0;
+	struct sp_bo *src_bo, *dst_bo, *fast_bo = NULL, *scanout_bo = NULL;
+	uint64_t frame_start, job_start = 0;
+	enum dispatch_engine job = DISPATCH_RGA;
+	int cpu_wrote = 0;
 	printf("process_mem2mem_frame\n");
 
+	// no-op unless --rt-prio or --rt-cpu were given
+	rt_enter_thread();
+
     i = num_frames;
     //while (i--) {
-    while (1) {
+    while (modifier_key != 'q' && modifier_key != (unsigned int)EOF) {
         clock_gettime(CLOCK_MONOTONIC, &start);
+        frame_start = rt_now_ns();
 
-        memset(&(buf), 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        buf.bytesused = src_buf_size[0];
-        buf.index = 0;
-        buf.m.fd = src_buf_fd[0];
-        ret = ioctl(mem2mem_fd, VIDIOC_QBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
+        src_bo = src_bind.slots[frame_counter % src_bind.count].bo;
+        dst_bo = dst_bind.slots[frame_counter % dst_bind.count].bo;
+        if (fast_fmt)
+            fast_bo = fast_bos[frame_counter % 2];
+        if (scanout_bos[0])
+            scanout_bo = scanout_bos[frame_counter % 2];
+
+        if (overlay && blend_overlay(src_bo, dst_bo))
             return;
+
+        // of the frame as composited, before it is converted with the table
+        if (auto_contrast >= 0)
+            auto_contrast_lut(src_bo);
+
+        // frames the CPU has to convert anyway are not dispatched
+        dispatched_cpu = 0;
+        if (dispatch && !convert_on_cpu()) {
+            job = dispatch_pick(&dispatcher, src_fmt, dst_fmt, rotate,
+                (uint64_t)DST_WIDTH * DST_HEIGHT);
+            dispatched_cpu = job == DISPATCH_CPU;
+            job_start = rt_now_ns();
         }
 
-        memset(&(buf), 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        buf.index = 0;
-        buf.m.fd = dst_buf_fd[0];
-        ret = ioctl(mem2mem_fd, VIDIOC_QBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
+        if (fast_from_source()) {
+            ret = fast_pack(src_bo, src_fmt, fast_bo);
+        } else if (convert_on_cpu()) {
+            ret = cpu_convert(src_bo, dst_bo, &buf);
+            cpu_wrote = 1;
+        } else if (split) {
+            ret = split_convert(src_bo, dst_bo, &buf);
+        } else {
+            ret = rga_convert(src_bo, dst_bo, &buf);
+            if (!ret)
+                wc_shadow_invalidate(dst_bind.slots[buf.index].bo);
+        }
+        if (ret)
             return;
+
+        // frames converted on the CPU did not go through the RGA rotation either
+        if ((cpu_transform || convert_on_cpu()) && (rotate || hflip || vflip)) {
+            ret = cpu_transform_frame(dst_bind.slots[buf.index].bo);
+            if (ret)
+                printf("CPU rotation failed: %s\n", strerror(-ret));
+            cpu_wrote = 1;
         }
 
-        memset(&(buf), 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        ret = ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf);
-        printf("Dequeued source buffer, index: %d\n", buf.index);
+        // whatever the RGA did not remap, the curve too unless quantized with it
+        if ((lut_active || (curve_active && !curve_in_conversion()))
+            && (convert_on_cpu() || lut_cpu)) {
+            struct image img;
+            struct y4_lut lut;
 
-        memset(&(buf), 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        ret = ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
+            frame_lut(&lut, curve_active && !curve_in_conversion());
+            cpu_image(&img, dst_bind.slots[buf.index].bo, dst_fmt);
+            y4_lut_apply(&img, &lut);
+            cpu_wrote = 1;
+        }
+
+        // the CPU passes worked on the shadow, the display reads the mapping
+        if (cpu_wrote) {
+            wc_shadow_push(dst_bind.slots[buf.index].bo);
+            cpu_wrote = 0;
+        }
+
+        // up to the frame in the mapping, where either engine leaves it
+        if (job_start) {
+            dispatch_record(&dispatcher, src_fmt, dst_fmt, rotate,
+                (uint64_t)DST_WIDTH * DST_HEIGHT, job, rt_now_ns() - job_start);
+            job_start = 0;
+        }
+
+        // otherwise packed as a post-pass over what the RGA or CPU wrote
+        if (fast_fmt && !fast_from_source()
+            && fast_pack(dst_bind.slots[buf.index].bo, dst_fmt, fast_bo))
+            return;
+
+        if (scanout_bo && scanout_repack(dst_bind.slots[buf.index].bo, scanout_bo))
             return;
+
+        if (shm_sink_path) {
+            shm_ring_accept(&shm_sink);
+            shm_ring_publish(&shm_sink, buf.index, buf.bytesused);
         }
-        printf("Dequeued dst buffer, index: %d\n", buf.index);
 
         clock_gettime(CLOCK_MONOTONIC, &end);
 
@@ -405,36 +1256,49 @@ static void process_mem2mem_frame()
         time_consumed += (end.tv_nsec - start.tv_nsec);
         time_consumed /= 1000;
 
-        printf("*[RGA]* : used %f msecs\n", time_consumed * 1.0 / 1000);
+        printf("*[%s]* : used %f msecs\n", convert_on_cpu() ? "CPU" : split ? "RGA+CPU" : "RGA",
+            time_consumed * 1.0 / 1000);
 
         if (display == 1) {
-            test_plane_sp->bo = dst_buf_bo[buf.index];
+            test_plane_sp->bo = fast_fmt ? fast_bo
+                : scanout_bo ? scanout_bo : dst_bind.slots[buf.index].bo;
             set_sp_plane(dev_sp, test_plane_sp, test_crtc_sp, 0, 0);
 
             if (0) {
-                unsigned int *addr = (unsigned int *)test_plane_sp->bo->map_addr;
+                // read through the shadow, the mapping is uncached
+                unsigned int *addr = (unsigned int *)wc_shadow_pull(test_plane_sp->bo);
                 printf("dump buffer : %x %x %x \n", addr[0], addr[1], addr[2]);
                 usleep(1000 * 1000);
                 printf("dump buffer2 : %x %x %x \n", addr[0], addr[1], addr[2]);
             }
         }
-		// modify the buffer
-        fillbuffer(src_format, src_buf_bo[0], frame_counter);
-
+		rt_latency_add(&frame_latency, rt_now_ns() - frame_start);
 		frame_counter++;
+
+		// modify the buffer queued next
+        fillbuffer(src_fmt, src_bind.slots[frame_counter % src_bind.count].bo, frame_counter);
+
+		if (!interactive) {
+			if (frame_counter >= i)
+				break;
+			continue;
+		}
+
 		printf("Press a control key\n");
 		printf("r: rotate by 90 degrees and back\n");
 		printf("v: enable/disable VFLIP\n");
 		printf("h: enable/disable HFLIP\n");
 		printf("d: enable/disable dither down (make sure to change dither mode with m to see visual changes\n");
-		printf("m: cycle through dither modes\n");
-		printf("l: modify the y4map lut0/1 (defunct)\n");
+		printf("m: cycle through dither modes, the last one is blue noise on the CPU\n");
+		printf("e: cycle through error diffusion off, fs, atkinson and sierra-lite\n");
+		printf("l: reload the y4map lut0/1 from --lut-file, or toggle an inverting one\n");
+		printf("s: print buffer binding, latency and memory statistics\n");
+		printf("q: quit\n");
 		printf("\n");
 		printf("Input: ");
 		modifier_key = getchar();
 		while (	modifier_key == '\n')
 			modifier_key = getchar();
-		struct v4l2_control ctrl;
 		switch(modifier_key){
 			case 'r':
 				printf("Rotating\n");
@@ -442,92 +1306,88 @@ static void process_mem2mem_frame()
 					rotate = 90;
 				else
 					rotate = 0;
-				ctrl.id = V4L2_CID_ROTATE;
-				ctrl.value = rotate;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-				if (!ret)
-					printf("ioctl succeeded\n");
-				else
-					printf("ioctl error: %i\n", ret);
+				set_transform(V4L2_CID_ROTATE, rotate);
 				break;
 			case 'v':
 				printf("V4L2_CID_VFLIP\n");
 				vflip = !vflip;
-				ctrl.id = V4L2_CID_VFLIP;
-				ctrl.value = vflip;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-				if (!ret)
-					printf("ioctl succeeded\n");
-				else
-					printf("ioctl error: %i\n", ret);
+				set_transform(V4L2_CID_VFLIP, vflip);
 				break;
 			case 'h':
 				printf("V4L2_CID_HFLIP\n");
 				hflip = !hflip;
-				ctrl.id = V4L2_CID_HFLIP;
-				ctrl.value = hflip;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-				if (!ret)
-					printf("ioctl succeeded\n");
-				else
-					printf("ioctl error: %i\n", ret);
+				set_transform(V4L2_CID_HFLIP, hflip);
 				break;
 			case 'd':
 				printf("Dither down (old value: %u)\n", ioctl_control.dither_down_enable);
 				ioctl_control.dither_down_enable = !ioctl_control.dither_down_enable;
 				printf("            (new value: %u)\n", ioctl_control.dither_down_enable);
-				ctrl.id = get_v4l2_control_old("Enable dither down");
-				ctrl.value = ioctl_control.dither_down_enable;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-				if (!ret)
-					printf("ioctl succeeded\n");
-				else
-					printf("ioctl error: %i\n", ret);
+				set_control(get_v4l2_control_old("Enable dither down"),
+					    ioctl_control.dither_down_enable);
 				break;
 			case 'm':
 				// first disable dithering
-				ctrl.id = get_v4l2_control_old("Enable dither down");
-				ctrl.value = 0;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
+				set_control(get_v4l2_control_old("Enable dither down"), 0);
 
 				printf("Dither down mode (old value: %u)\n", ioctl_control.dither_down_mode);
-				ioctl_control.dither_down_mode = (ioctl_control.dither_down_mode + 1) % 4;
+				// the RGA modes, then blue noise
+				ioctl_control.dither_down_mode = (ioctl_control.dither_down_mode + 1) % (NUM_Y4_DITHER_MODES + 1);
 				printf("            (new value: %u)\n", ioctl_control.dither_down_mode);
-				ctrl.id = get_v4l2_control_old("Dither down mode");
-				ctrl.value = ioctl_control.dither_down_mode;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-				if (!ret)
-					printf("ioctl succeeded\n");
-				else
-					printf("ioctl error: %i\n", ret);
+				if (ioctl_control.dither_down_mode == Y4_DITHER_BLUE_NOISE) {
+					printf("blue noise, dithered on the CPU\n");
+					break;
+				}
+				set_control(get_v4l2_control_old("Dither down mode"),
+					    ioctl_control.dither_down_mode);
 
 				// potentially reenable dithering
-				ctrl.id = get_v4l2_control_old("Enable dither down");
-				ctrl.value = ioctl_control.dither_down_enable;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
+				set_control(get_v4l2_control_old("Enable dither down"),
+					    ioctl_control.dither_down_enable);
+				break;
+			case 'e':
+				if (!errdiff_supported(src_fmt) || dst_fmt->v4l2 != V4L2_PIX_FMT_Y4) {
+					printf("error diffusion needs an RGB source and Y4 output\n");
+					break;
+				}
+				diffusion = diffusion + 1 < NUM_ERRDIFF_METHODS ? diffusion + 1 : -1;
+				printf("Error diffusion: %s\n",
+					diffusion >= 0 ? errdiff_method_name((enum errdiff_method)diffusion) : "off");
 				break;
 			case 'l':
-				printf("Change lut0/1\n");
-				/* ctrl.id = get_v4l2_control_old("Set Y4MAP LUT0"); */
-				/* ctrl.value = ioctl_control.lut0 = 0x89abcdef; */
-    			/* ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl); */
-				/* if (!ret) */
-				/* 	printf("ioctl succeeded\n"); */
-				/* else */
-				/* 	printf("ioctl error: %i\n", ret); */
-
-				// lut1
-				ctrl.id = get_v4l2_control_old("Set Y4MAP LUT1");
-				ctrl.value = ioctl_control.lut0 = 0x1234567;
-    			ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-				if (!ret)
-					printf("ioctl succeeded\n");
+				// re-read the file so curves can be edited while running
+				if (curve_path) {
+					printf("Reloading %s\n", curve_path);
+					y4_curve_load(&curve, curve_path);
+				}
+				if (lut_path) {
+					printf("Reloading %s\n", lut_path);
+					y4_lut_load(&y4map, lut_path);
+				} else {
+					printf("Toggling an inverting lut0/1\n");
+					// the registers hold the curve as well, so go by the table
+					if (y4map.map[0] == 15)
+						y4_lut_identity(&y4map);
+					else
+						y4_lut_from_regs(&y4map, 0x89abcdef, 0x01234567);
+				}
+				lut_active = 1;
+				if (lut_cpu)
+					y4_lut_to_regs(&y4map, &ioctl_control.lut0, &ioctl_control.lut1);
 				else
-					printf("ioctl error: %i\n", ret);
+					program_lut();
+				break;
+			case 's':
+				binding_report(&src_bind, "src");
+				binding_report(&dst_bind, "dst");
+				rt_latency_report(&frame_latency);
+				if (split)
+					split_report(&split_tuner, DST_WIDTH);
+				if (dispatch)
+					dispatch_report(&dispatcher, stdout);
+				memtrack_report(stdout);
 				break;
 
 		}
-		modifier_key = 0;
     }
 
     printf("press <ENTER> to exit test application\n");
@@ -535,126 +1395,281 @@ static void process_mem2mem_frame()
 }
 
 
-static void start_mem2mem()
+/* REQBUFS on one queue, returns the number of buffers granted */
+static int request_buffers(uint32_t type, unsigned int count)
 {
-    int ret, i;
-    struct v4l2_buffer buf;
     struct v4l2_requestbuffers reqbuf;
-    enum v4l2_buf_type type;
+    int ret;
 
-    init_mem2mem_dev();
+    if (cpu_backend)
+        return count;
 
-    memset(&(buf), 0, sizeof(buf));
-    reqbuf.count = 1;
-    reqbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    memset(&reqbuf, 0, sizeof(reqbuf));
+    reqbuf.count = count;
+    reqbuf.type = type;
     reqbuf.memory = V4L2_MEMORY_DMABUF;
     ret = ioctl(mem2mem_fd, VIDIOC_REQBUFS, &reqbuf);
     if (ret != 0) {
         fprintf(stderr, "%s:%d: ", __func__, __LINE__);
         perror("ioctl");
-        return;
+        return -errno;
     }
-    num_src_bufs = reqbuf.count;
-    printf("Got %d src buffers\n", num_src_bufs);
+    return reqbuf.count;
+}
 
-    reqbuf.count = NUM_BUFS;
-    reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(mem2mem_fd, VIDIOC_REQBUFS, &reqbuf);
+/* length the driver wants for a buffer, the plain frame size on the CPU */
+static int buffer_length(uint32_t type, unsigned int index, const struct pix_fmt* f,
+    size_t width, size_t height, uint32_t* length)
+{
+    struct v4l2_buffer buf;
+    int ret;
+
+    if (cpu_backend) {
+        *length = pix_fmt_frame_bytes(f, width, height);
+        return 0;
+    }
+
+    memset(&(buf), 0, sizeof(buf));
+    buf.type = type;
+    buf.memory = V4L2_MEMORY_DMABUF;
+    buf.index = index;
+    ret = ioctl(mem2mem_fd, VIDIOC_QUERYBUF, &buf);
     if (ret != 0) {
         fprintf(stderr, "%s:%d: ", __func__, __LINE__);
         perror("ioctl");
-        return;
+        return -errno;
     }
-    num_dst_bufs = reqbuf.count;
-    printf("Got %d dst buffers\n", num_dst_bufs);
+    *length = buf.length;
+    return 0;
+}
 
-    for (i = 0; i < num_src_bufs; ++i) {
-        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        buf.index = i;
-        ret = ioctl(mem2mem_fd, VIDIOC_QUERYBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
+static int stream(unsigned long request, uint32_t type)
+{
+    int ret;
+
+    if (cpu_backend)
+        return 0;
+
+    ret = ioctl(mem2mem_fd, request, &type);
+    if (ret != 0) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    return 0;
+}
+
+static void start_mem2mem()
+{
+    int ret, i, fd;
+    int num_src_bufs, num_dst_bufs;
+    uint32_t length;
+    size_t frame_bytes, fixed_bytes, budget;
+
+    cpu_backend = !strcmp(backend, "cpu");
+    if (!cpu_backend) {
+        ret = init_mem2mem_dev();
+        if (ret && strcmp(backend, "auto"))
             return;
+        if (ret) {
+            printf("no usable RGA at %s, converting on the CPU\n", mem2mem_dev_name);
+            if (mem2mem_fd >= 0)
+                close(mem2mem_fd);
+            mem2mem_fd = -1;
+            cpu_backend = 1;
         }
+    }
+    if (cpu_backend && (!convert_supported(src_fmt) || !convert_supported(dst_fmt))) {
+        printf("the CPU backend cannot convert %s to %s\n", src_fmt->name, dst_fmt->name);
+        exit(EXIT_FAILURE);
+    }
+    if (overlay && (!blend_supported(src_fmt) || make_overlay())) {
+        printf("--overlay needs an ARGB32 or ABGR32 source\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fast_fmt && !ypack_supported(dst_fmt)) {
+        printf("%s output needs a gray, Y4 or RGB destination format\n", fast_fmt->name);
+        exit(EXIT_FAILURE);
+    }
+    if (diffusion >= 0 && (!errdiff_supported(src_fmt) || dst_fmt->v4l2 != V4L2_PIX_FMT_Y4)) {
+        printf("error diffusion needs an RGB24, XRGB32 or XBGR32 source and Y4 output\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((scanout_order != Y4_HIGH_FIRST || scanout_pitch)
+        && (dst_fmt->v4l2 != V4L2_PIX_FMT_Y4 || fast_fmt
+            || (scanout_pitch && scanout_pitch < pix_fmt_row_bytes(dst_fmt, DST_WIDTH)))) {
+        printf("--y4-order and --y4-pitch need Y4 output, without --fast-bpp, and a pitch\n"
+               "of at least %zu bytes\n", pix_fmt_row_bytes(dst_fmt, DST_WIDTH));
+        exit(EXIT_FAILURE);
+    }
+    if ((auto_contrast >= 0 || curve_active) && dst_fmt->v4l2 != V4L2_PIX_FMT_Y4) {
+        printf("--auto-contrast and --curve-file need Y4 output\n");
+        exit(EXIT_FAILURE);
+    }
+    if (split && (cpu_backend || dst_fmt->v4l2 != V4L2_PIX_FMT_Y4 || !y4conv_supported(src_fmt)
+            || SRC_WIDTH != DST_WIDTH || SRC_HEIGHT != DST_HEIGHT || SRC_HEIGHT < 8
+            || rotate || hflip || vflip || diffusion >= 0 || overlay
+            || SRC_CROP_W || SRC_CROP_H || DST_CROP_W || DST_CROP_H)) {
+        printf("--split needs the RGA, an RGB or GREY source and Y4 output of the same\n"
+               "size, without rotation, flips, crops, diffusion or --overlay\n");
+        exit(EXIT_FAILURE);
+    }
+    if (split)
+        split_init(&split_tuner, DST_HEIGHT, 4);
+    if (dispatch && (cpu_backend || split || overlay
+            || !convert_supported(src_fmt) || !convert_supported(dst_fmt) || rotate % 90
+            || ((SRC_WIDTH != DST_WIDTH || SRC_HEIGHT != DST_HEIGHT) && !scale_supported(src_fmt))
+            || SRC_CROP_W || SRC_CROP_H || DST_CROP_W || DST_CROP_H)) {
+        printf("--dispatch needs the RGA and a conversion the CPU can do as well, rotated\n"
+               "by a multiple of 90 degrees, without crops, --split or --overlay\n");
+        exit(EXIT_FAILURE);
+    }
+    if (dispatch)
+        dispatch_init(&dispatcher);
+    if (cpu_backend)
+        cpu_transform = 1;
+    if (cpu_transform && rotate % 90) {
+        printf("the CPU rotates by 0, 90, 180 or 270 degrees only\n");
+        exit(EXIT_FAILURE);
+    }
+
+    binding_init(&src_bind, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+    binding_init(&dst_bind, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+
+    // the packed and repacked frames are needed whatever the depth, so they come first
+    fixed_bytes = 0;
+    if (fast_fmt)
+        fixed_bytes += 2 * pix_fmt_frame_bytes(fast_fmt, DST_WIDTH, DST_HEIGHT);
+    if (scanout_order != Y4_HIGH_FIRST || scanout_pitch)
+        fixed_bytes += 2 * (scanout_pitch ? (size_t)scanout_pitch * DST_HEIGHT
+                                          : pix_fmt_frame_bytes(dst_fmt, DST_WIDTH, DST_HEIGHT));
+
+    // degrade to a shallower pipeline instead of failing on a tight budget
+    frame_bytes = pix_fmt_frame_bytes(src_fmt, SRC_WIDTH, SRC_HEIGHT)
+        + pix_fmt_frame_bytes(dst_fmt, DST_WIDTH, DST_HEIGHT);
+    if (memtrack_available() < fixed_bytes + frame_bytes) {
+        printf("memory budget too small for a single frame\n");
+        memtrack_report(stdout);
+        exit(-1);
+    }
+    budget = memtrack_available() - fixed_bytes;
+    if (budget / frame_bytes < num_bufs) {
+        printf("memory budget: reducing pipeline depth from %u to %zu\n",
+            num_bufs, budget / frame_bytes);
+        num_bufs = budget / frame_bytes;
+    }
 
-        src_buf_size[i] = buf.length;
+    num_src_bufs = request_buffers(V4L2_BUF_TYPE_VIDEO_OUTPUT, num_bufs);
+    if (num_src_bufs < 0)
+        return;
+    if (num_src_bufs > BINDING_MAX_BUFS)
+        num_src_bufs = BINDING_MAX_BUFS;
+    printf("Got %d src buffers\n", num_src_bufs);
 
+    num_dst_bufs = request_buffers(V4L2_BUF_TYPE_VIDEO_CAPTURE, num_bufs);
+    if (num_dst_bufs < 0)
+        return;
+    if (num_dst_bufs > BINDING_MAX_BUFS)
+        num_dst_bufs = BINDING_MAX_BUFS;
+    printf("Got %d dst buffers\n", num_dst_bufs);
+
+    for (i = 0; i < num_src_bufs; ++i) {
+        if (buffer_length(V4L2_BUF_TYPE_VIDEO_OUTPUT, i, src_fmt, SRC_WIDTH, SRC_HEIGHT, &length))
+            return;
+
+        if (pix_fmt_validate(src_fmt, SRC_WIDTH, SRC_HEIGHT, length))
+            return;
         struct sp_bo* bo
-            = create_sp_bo(dev_sp, SRC_WIDTH, SRC_HEIGHT, 0, buf.length * 8 / (SRC_WIDTH * SRC_HEIGHT), get_drm_format(src_format), 0);
-        if (!bo) {
+            = create_sp_bo(dev_sp, SRC_WIDTH, SRC_HEIGHT, 0, pix_fmt_frame_bpp(src_fmt), src_fmt->drm, 0,
+                MEM_ROLE_SRC);
+        if (!bo && i > 0) {
+            printf("allocation failed, continuing with %d of %u src buffers\n", i, num_src_bufs);
+            break;
+        }
+        if (!bo || bo->size < length) {
             printf("Failed to create gem buf\n");
             exit(-1);
         }
 
-        drmPrimeHandleToFD(dev_sp->fd, bo->handle, 0, &src_buf_fd[i]);
-        src_buf_bo[i] = bo;
-        fillbuffer(src_format, src_buf_bo[i], 0);
+        drmPrimeHandleToFD(dev_sp->fd, bo->handle, 0, &fd);
+        binding_bind(&src_bind, i, bo, fd, length);
+        fillbuffer(src_fmt, bo, 0);
     }
 
     for (i = 0; i < num_dst_bufs; ++i) {
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        buf.index = i;
-        ret = ioctl(mem2mem_fd, VIDIOC_QUERYBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
+        if (buffer_length(V4L2_BUF_TYPE_VIDEO_CAPTURE, i, dst_fmt, DST_WIDTH, DST_HEIGHT, &length))
             return;
-        }
-		printf("DST BUFFER LENGTH: %u\n", buf.length);
+		printf("DST BUFFER LENGTH: %u\n", length);
 
-        dst_buf_size[i] = buf.length;
+        if (pix_fmt_validate(dst_fmt, DST_WIDTH, DST_HEIGHT, length))
+            return;
         struct sp_bo* bo
-            = create_sp_bo(dev_sp, DST_WIDTH, DST_HEIGHT, 0, buf.length * 8 / (DST_WIDTH * DST_HEIGHT), get_drm_format(dst_format), 0);
-        if (!bo) {
+            = create_sp_bo(dev_sp, DST_WIDTH, DST_HEIGHT, 0, pix_fmt_frame_bpp(dst_fmt), dst_fmt->drm, 0,
+                MEM_ROLE_DST);
+        if (!bo && i > 0) {
+            printf("allocation failed, continuing with %d of %u dst buffers\n", i, num_dst_bufs);
+            break;
+        }
+        if (!bo || bo->size < length) {
             printf("Failed to create gem buf\n");
             exit(-1);
         }
 
-        drmPrimeHandleToFD(dev_sp->fd, bo->handle, 0, &dst_buf_fd[i]);
-        dst_buf_bo[i] = bo;
-        fillbuffer2(dst_format, bo);
+        drmPrimeHandleToFD(dev_sp->fd, bo->handle, 0, &fd);
+        binding_bind(&dst_bind, i, bo, fd, length);
+        fillbuffer2(dst_fmt, bo);
     }
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMON, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+    for (i = 0; fast_fmt && i < 2; i++) {
+        fast_bos[i] = create_sp_bo(dev_sp, DST_WIDTH, DST_HEIGHT, 0, fast_fmt->bpp, fast_fmt->drm, 0,
+            MEM_ROLE_SCANOUT);
+        if (!fast_bos[i]) {
+            printf("Failed to create %s buffer\n", fast_fmt->name);
+            exit(-1);
+        }
     }
 
-    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMON, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+    // only when the controller wants what the RGA does not write
+    for (i = 0; (scanout_order != Y4_HIGH_FIRST || scanout_pitch) && i < 2; i++) {
+        scanout_bos[i] = create_sp_bo_pitched(dev_sp, DST_WIDTH, DST_HEIGHT, scanout_pitch, 0,
+            dst_fmt->bpp, dst_fmt->drm, 0, MEM_ROLE_SCANOUT);
+        if (!scanout_bos[i]) {
+            printf("Failed to create %s scanout buffer\n", dst_fmt->name);
+            exit(-1);
+        }
     }
 
-    process_mem2mem_frame();
+    if (shm_sink_path && shm_ring_create(&shm_sink, shm_sink_path, &dst_bind))
+        shm_sink_path = NULL;
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMOFF, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
+    if (stream(VIDIOC_STREAMON, V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        || stream(VIDIOC_STREAMON, V4L2_BUF_TYPE_VIDEO_OUTPUT))
         return;
+
+    process_mem2mem_frame();
+
+    binding_report(&src_bind, "src");
+    binding_report(&dst_bind, "dst");
+    printf("re-attachments: src %lu, dst %lu\n",
+        binding_reattachments(&src_bind), binding_reattachments(&dst_bind));
+    rt_latency_report(&frame_latency);
+    if (split)
+        split_report(&split_tuner, DST_WIDTH);
+    if (dispatch)
+        dispatch_report(&dispatcher, stdout);
+    memtrack_report(stdout);
+
+    if (shm_sink_path) {
+        printf("output ring: %lu consumers attached\n", shm_sink.consumers);
+        shm_ring_destroy(&shm_sink);
     }
 
-    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMOFF, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
+    if (stream(VIDIOC_STREAMOFF, V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        || stream(VIDIOC_STREAMOFF, V4L2_BUF_TYPE_VIDEO_OUTPUT))
         return;
-    }
 
-    close(mem2mem_fd);
+    if (mem2mem_fd >= 0)
+        close(mem2mem_fd);
 }
 
 void init_drm_context()
@@ -685,7 +1700,7 @@ void init_drm_context()
         test_crtc_sp = &dev_sp->crtcs[0];
         for (i = 0; i < test_crtc_sp->num_planes; i++) {
             plane_sp[i] = get_sp_plane(dev_sp, test_crtc_sp);
-            if (is_supported_format(plane_sp[i], get_drm_format(dst_format)))
+            if (is_supported_format(plane_sp[i], fast_fmt ? fast_fmt->drm : dst_fmt->drm))
                 test_plane_sp = plane_sp[i];
 			else
 				printf("NOT is_supported\n");
@@ -704,29 +1719,58 @@ static void usage(FILE* fp, int argc, char** argv)
         "Options:\n"
         "--device                   mem2mem device name [/dev/video0]\n"
         "--hel                      Print this message\n"
-        "--src-fmt                  Source video format, 0 = NV12, 1 = ARGB32, 2 = RGB888\n"
+        "--src-fmt                  Source video format, see below [2 = RGB24]\n"
         "--src-width                Source video width\n"
         "--src-height               Source video height\n"
         "--src-crop-x               Source video crop X offset [0]\n"
         "--src-crop-y               Source video crop Y offset [0]\n"
         "--src-crop-width           Source video crop width [width]\n"
         "--src-crop-height          Source video crop height [height]\n"
-        "--dst-fmt                  Destination video format, 0 = NV12, 1 = ARGB32, 2 = RGB888\n"
+        "--dst-fmt                  Destination video format, see below [13 = Y4]\n"
         "--dst-width                Destination video width\n"
         "--dst-height               Destination video height\n"
         "--dst-crop-x               Destination video crop X offset [0]\n"
         "--dst-crop-y               Destination video crop Y offset [0]\n"
         "--dst-crop-width           Destination video crop width [width]\n"
         "--dst-crop-height          Destination video crop height [height]\n"
-        "--op                       Transform operations\n"
-        "--fill-color               Solid fill color\n"
+        "--op                       Blend operation of --overlay, src, srcatop, srcin, srcout, srcover,\n"
+        "                           dst, dstatop, dstin, dstout, dstover, add, clear or 0-11 [src]\n"
+        "--overlay                  Composite a UI overlay into the frames as op(frame, overlay) [0]\n"
+        "--fill-color               Background color in hex AARRGGBB, also used by the CPU backend\n"
         "--rotate                   Rotate\n"
         "--hflip                    Horizontal Mirror\n"
         "--vflip                    Vertical Mirror\n"
         "--num-frames               Number of frames to process [100]\n"
         "--display                  Display\n"
+        "--num-bufs                 Buffers per queue, each bound to a fixed index [1]\n"
+        "--interactive              Wait for a control key after each frame [1]\n"
+        "--rt                       Real-time profile: prefault and mlock all buffers\n"
+        "--rt-prio                  SCHED_FIFO priority of the conversion thread [0 = off]\n"
+        "--rt-cpu                   Pin the conversion thread to this CPU [-1 = off]\n"
+        "--rt-budget                Frame latency budget in usecs, overruns are counted\n"
+        "--shm-sink                 Publish converted frames on this unix socket\n"
+        "--mem-budget               Limit for all buffers in MiB, reduces --num-bufs to fit\n"
+        "--bench                    Run CPU kernel benchmarks and exit [all, fill, y4conv, y4lut, rotate, errdiff, bluenoise, ypack, scale, blend, convert, wc, histogram,\n"
+        "                           y4pack, dispatch]\n"
+        "--backend                  Conversion backend: rga, cpu or auto [auto]\n"
+        "--threads                  Threads for the CPU image kernels [0 = online CPUs]\n"
+        "--pin-threads              Pin the worker threads to one CPU each [0]\n"
+        "--lut-file                 Y4MAP table: 16 gray levels 0-15 to map 0..15 to\n"
+        "--lut-cpu                  Apply the Y4MAP table on the CPU instead of the RGA [0]\n"
+        "--curve-file               Measured gray of the 16 panel levels, 0-255, to quantize the luma to\n"
+        "--auto-contrast            Y4MAP table from the histogram of each frame: contrast or equalize [off]\n"
+        "--diffusion                Error diffusion on the CPU: fs, atkinson or sierra-lite [off]\n"
+        "--gray-levels              Gray levels of error diffusion and blue noise: 16, 4 or 2 [16]\n"
+        "--split                    Convert the top of each frame on the RGA and the rest on the CPU at\n"
+        "                           the same time, split by the measured speed of both [0]\n"
+        "--dispatch                 Convert each frame on the RGA or the CPU, whichever the timing of\n"
+        "                           the frames before predicts to be faster [0]\n"
+        "--y4-order                 Nibble order of the displayed Y4 frame: high (DRM R4) or low [high]\n"
+        "--y4-pitch                 Bytes per row of the displayed Y4 frame [0 = as allocated]\n"
+        "--fast-bpp                 Display 1 or 2 bpp gray for the fast waveforms, dithered with dither down [0 = off]\n"
         "",
         argv[0]);
+    pix_fmt_print_list(fp);
 }
 
 static const struct option long_options[] = {
@@ -753,12 +1797,35 @@ static const struct option long_options[] = {
     { "vflip", required_argument, NULL, 0 },
     { "num-frames", required_argument, NULL, 0 },
     { "display", required_argument, NULL, 0 },
+    { "num-bufs", required_argument, NULL, 0 },
+    { "interactive", required_argument, NULL, 0 },
+    { "rt", no_argument, NULL, 0 },
+    { "rt-prio", required_argument, NULL, 0 },
+    { "rt-cpu", required_argument, NULL, 0 },
+    { "rt-budget", required_argument, NULL, 0 },
+    { "shm-sink", required_argument, NULL, 0 },
+    { "mem-budget", required_argument, NULL, 0 },
+    { "bench", required_argument, NULL, 0 },
+    { "backend", required_argument, NULL, 0 },
+    { "lut-file", required_argument, NULL, 0 },
+    { "lut-cpu", required_argument, NULL, 0 },
+    { "threads", required_argument, NULL, 0 },
+    { "pin-threads", required_argument, NULL, 0 },
+    { "diffusion", required_argument, NULL, 0 },
+    { "gray-levels", required_argument, NULL, 0 },
+    { "fast-bpp", required_argument, NULL, 0 },
+    { "overlay", required_argument, NULL, 0 },
+    { "auto-contrast", required_argument, NULL, 0 },
+    { "curve-file", required_argument, NULL, 0 },
+    { "y4-order", required_argument, NULL, 0 },
+    { "y4-pitch", required_argument, NULL, 0 },
+    { "split", required_argument, NULL, 0 },
+    { "dispatch", required_argument, NULL, 0 },
     { 0, 0, 0, 0 }
 };
 
 int main(int argc, char** argv)
 {
-    int i;
     mem2mem_dev_name = (char*)"/dev/video0";
 
     for (;;) {
@@ -780,35 +1847,11 @@ int main(int argc, char** argv)
             exit(EXIT_SUCCESS);
 
         case 2:
-            c = atoi(optarg);
-            if (c == 0) {
-                src_format = V4L2_PIX_FMT_NV12;
-            } else if (c == 1) {
-                src_format = V4L2_PIX_FMT_ARGB32;
-            } else if (c == 2) {
-                src_format = V4L2_PIX_FMT_RGB24;
-            } else if (c == 3) {
-                src_format = V4L2_PIX_FMT_RGB565;
-            } else if (c == 4) {
-                src_format = V4L2_PIX_FMT_YUV420;
-            } else if (c == 5) {
-                src_format = V4L2_PIX_FMT_XRGB32;
-            } else if (c == 6) {
-                src_format = V4L2_PIX_FMT_ABGR32;
-            } else if (c == 7) {
-                src_format = V4L2_PIX_FMT_XBGR32;
-            } else if (c == 8) {
-                src_format = V4L2_PIX_FMT_ARGB555;
-            } else if (c == 9) {
-                src_format = V4L2_PIX_FMT_ARGB444;
-            } else if (c == 10) {
-                src_format = V4L2_PIX_FMT_NV61;
-            } else if (c == 11) {
-                src_format = V4L2_PIX_FMT_NV16;
-            } else if (c == 12) {
-                src_format = V4L2_PIX_FMT_YUV422P;
-            } else if (c == 13) {
-                src_format = V4L2_PIX_FMT_Y4;
+            src_fmt = pix_fmt_by_index(atoi(optarg));
+            if (!src_fmt) {
+                fprintf(stderr, "unknown --src-fmt %s\n", optarg);
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
             }
             break;
         case 3:
@@ -830,35 +1873,11 @@ int main(int argc, char** argv)
             SRC_CROP_H = atoi(optarg);
             break;
         case 9:
-            c = atoi(optarg);
-            if (c == 0) {
-                dst_format = V4L2_PIX_FMT_NV12;
-            } else if (c == 1) {
-                dst_format = V4L2_PIX_FMT_ARGB32;
-            } else if (c == 2) {
-                dst_format = V4L2_PIX_FMT_RGB24;
-            } else if (c == 3) {
-                dst_format = V4L2_PIX_FMT_RGB565;
-            } else if (c == 4) {
-                dst_format = V4L2_PIX_FMT_YUV420;
-            } else if (c == 5) {
-                dst_format = V4L2_PIX_FMT_XRGB32;
-            } else if (c == 6) {
-                dst_format = V4L2_PIX_FMT_ABGR32;
-            } else if (c == 7) {
-                dst_format = V4L2_PIX_FMT_XBGR32;
-            } else if (c == 8) {
-                dst_format = V4L2_PIX_FMT_ARGB555;
-            } else if (c == 9) {
-                dst_format = V4L2_PIX_FMT_ARGB444;
-            } else if (c == 10) {
-                dst_format = V4L2_PIX_FMT_NV61;
-            } else if (c == 11) {
-                dst_format = V4L2_PIX_FMT_NV16;
-            } else if (c == 12) {
-                dst_format = V4L2_PIX_FMT_YUV422P;
-            } else if (c == 13) {
-                src_format = V4L2_PIX_FMT_Y4;
+            dst_fmt = pix_fmt_by_index(atoi(optarg));
+            if (!dst_fmt) {
+                fprintf(stderr, "unknown --dst-fmt %s\n", optarg);
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
             }
             break;
         case 10:
@@ -880,7 +1899,11 @@ int main(int argc, char** argv)
             DST_CROP_H = atoi(optarg);
             break;
         case 16:
-            op = atoi(optarg);
+            op = isdigit((unsigned char)optarg[0]) ? atoi(optarg) : blend_op_by_name(optarg);
+            if (op < 0 || op >= NUM_BLEND_OPS) {
+                fprintf(stderr, "unknown --op %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
             break;
         case 17:
             sscanf(optarg, "%x", &fill_color);
@@ -900,31 +1923,151 @@ int main(int argc, char** argv)
         case 22:
             display = atoi(optarg);
             break;
+        case 23:
+            num_bufs = atoi(optarg);
+            if (num_bufs < 1)
+                num_bufs = 1;
+            if (num_bufs > BINDING_MAX_BUFS)
+                num_bufs = BINDING_MAX_BUFS;
+            break;
+        case 24:
+            interactive = atoi(optarg);
+            break;
+        case 25:
+            rt_profile.enabled = 1;
+            break;
+        case 26:
+            rt_profile.prio = atoi(optarg);
+            break;
+        case 27:
+            rt_profile.cpu = atoi(optarg);
+            break;
+        case 28:
+            rt_profile.budget_us = atoi(optarg);
+            break;
+        case 29:
+            shm_sink_path = optarg;
+            break;
+        case 30:
+            memtrack_set_budget((size_t)atoi(optarg) << 20);
+            break;
+        case 31:
+            bench_name = optarg;
+            break;
+        case 32:
+            backend = optarg;
+            if (strcmp(backend, "rga") && strcmp(backend, "cpu") && strcmp(backend, "auto")) {
+                fprintf(stderr, "unknown --backend %s\n", optarg);
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 33:
+            lut_path = optarg;
+            if (y4_lut_load(&y4map, lut_path))
+                exit(EXIT_FAILURE);
+            lut_active = 1;
+            break;
+        case 34:
+            lut_cpu = atoi(optarg);
+            break;
+        case 35:
+            pool_threads = atoi(optarg);
+            break;
+        case 36:
+            pool_pin = atoi(optarg);
+            break;
+        case 37:
+            diffusion = errdiff_method_by_name(optarg);
+            if (diffusion < 0) {
+                fprintf(stderr, "unknown --diffusion %s\n", optarg);
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 38:
+            gray_levels = atoi(optarg);
+            if (gray_levels != 16 && gray_levels != 4 && gray_levels != 2) {
+                fprintf(stderr, "--gray-levels is 16, 4 or 2\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 39:
+            fast_fmt = ypack_fmt(atoi(optarg));
+            if (!fast_fmt && atoi(optarg)) {
+                fprintf(stderr, "--fast-bpp is 1 or 2\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 40:
+            overlay = atoi(optarg);
+            break;
+        case 41:
+            auto_contrast = histogram_mode_by_name(optarg);
+            if (auto_contrast < 0) {
+                fprintf(stderr, "unknown --auto-contrast %s\n", optarg);
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 42:
+            curve_path = optarg;
+            if (y4_curve_load(&curve, curve_path))
+                exit(EXIT_FAILURE);
+            curve_active = 1;
+            break;
+        case 43:
+            scanout_order = y4_nibble_order_by_name(optarg);
+            if (scanout_order < 0) {
+                fprintf(stderr, "unknown --y4-order %s\n", optarg);
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 44:
+            scanout_pitch = atoi(optarg);
+            break;
+        case 45:
+            split = atoi(optarg);
+            break;
+        case 46:
+            dispatch = atoi(optarg);
+            break;
         default:
             usage(stderr, argc, argv);
             exit(EXIT_FAILURE);
         }
     }
 
+    pool_init(pool_threads, pool_pin);
+    if (bench_name)
+        exit(run_benchmarks(bench_name) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+    if (rt_profile.enabled) {
+        // lock before any buffer is created so all of them are covered
+        set_sp_bo_prefault(1);
+        rt_lock_memory();
+    }
+
 	printf("drm\n");
     init_drm_context();
 
 	printf("drm 2\n");
     start_mem2mem();
 
-    for (i = 0; i < num_src_bufs; ++i) {
-        close(src_buf_fd[i]);
-        free_sp_bo(src_buf_bo[i]);
-    }
-
-    for (i = 0; i < num_dst_bufs; ++i) {
-        close(dst_buf_fd[i]);
-        free_sp_bo(dst_buf_bo[i]);
+    binding_release(&src_bind);
+    binding_release(&dst_bind);
+    for (unsigned int i = 0; i < 2; i++) {
+        if (fast_bos[i])
+            free_sp_bo(fast_bos[i]);
+        if (scanout_bos[i])
+            free_sp_bo(scanout_bos[i]);
     }
 
     if (display)
         test_plane_sp->bo = NULL;
     destroy_sp_dev(dev_sp);
+    pool_shutdown();
 
     return 0;
 }
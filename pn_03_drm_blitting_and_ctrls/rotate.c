@@ -0,0 +1,578 @@
+/*
+ * Rotation by multiples of 90 degrees and mirroring on the CPU.
+ *
+ * Every one of the eight cases is a walk over the source: destination pixel
+ * (x, y) comes from source pixel (sx0 + x * ax + y * bx, sy0 + x * ay +
+ * y * by), where either ay and bx are 0 (a row copy, maybe reversed) or ax
+ * and by are (a transpose). Mirrors only change signs, which turn into
+ * negative pitches, so a single transpose kernel covers all four rotations
+ * with flips.
+ *
+ * The destination is walked in square tiles small enough that the source
+ * lines a transposed tile touches stay in the cache until all of their
+ * pixels are used. Within a tile 8x8 bytes or 4x4 words are transposed in
+ * registers; 24 bit pixels are widened to words for it on x86 and split
+ * into three planes of bytes with vld3 on NEON. Y4 tiles are unpacked to one byte per pixel, transformed and
+ * packed again.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "pool.h"
+#include "rotate.h"
+#include "simd.h"
+
+/* tile edge in pixels, a 64x64 tile of 32 bpp is 16 KiB */
+#define ROTATE_TILE 64
+
+struct rotate_ops {
+    /* out[r][c] = in[c][r] for an 8x8 block of bytes */
+    void (*transpose8)(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp);
+    /* the same for a 4x4 block of 32 bit pixels */
+    void (*transpose32)(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp);
+    /* and an 8x8 block of 24 bit pixels, NULL to go pixel by pixel */
+    void (*transpose24)(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp);
+    /* d[i] = s[n - 1 - i] */
+    void (*reverse8)(uint8_t* d, const uint8_t* s, uint32_t n);
+    void (*reverse32)(uint8_t* d, const uint8_t* s, uint32_t n);
+};
+
+static const char* kernel_names[NUM_ROTATE_KERNELS] = {
+    "scalar", "sse2", "neon"
+};
+
+static inline void copy_px(uint8_t* d, const uint8_t* s, uint32_t cpp)
+{
+    switch (cpp) {
+    case 1:
+        *d = *s;
+        break;
+    case 3:
+        memcpy(d, s, 3);
+        break;
+    default:
+        memcpy(d, s, 4);
+        break;
+    }
+}
+
+/* any block, element by element */
+static void transpose_px(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp,
+    uint32_t cpp, uint32_t w, uint32_t h)
+{
+    uint32_t r, c;
+
+    for (r = 0; r < h; r++, d += dp) {
+        for (c = 0; c < w; c++)
+            copy_px(d + c * cpp, s + c * sp + r * cpp, cpp);
+    }
+}
+
+static void reverse_px(uint8_t* d, const uint8_t* s, uint32_t cpp, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+        copy_px(d + i * cpp, s + (n - 1 - i) * cpp, cpp);
+}
+
+static void transpose8_scalar(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp)
+{
+    transpose_px(d, dp, s, sp, 1, 8, 8);
+}
+
+static void transpose32_scalar(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp)
+{
+    transpose_px(d, dp, s, sp, 4, 4, 4);
+}
+
+static void reverse8_scalar(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    reverse_px(d, s, 1, n);
+}
+
+static void reverse32_scalar(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    reverse_px(d, s, 4, n);
+}
+
+#ifdef HAVE_SSE2
+static void transpose8_sse2(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp)
+{
+    __m128i a0, a1, a2, a3, b0, b1, b2, b3, c[4];
+    int k;
+
+    a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)s),
+        _mm_loadl_epi64((const __m128i*)(s + sp)));
+    a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s + 2 * sp)),
+        _mm_loadl_epi64((const __m128i*)(s + 3 * sp)));
+    a2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s + 4 * sp)),
+        _mm_loadl_epi64((const __m128i*)(s + 5 * sp)));
+    a3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s + 6 * sp)),
+        _mm_loadl_epi64((const __m128i*)(s + 7 * sp)));
+
+    /* columns 0-3 and 4-7 of rows 0-3 and 4-7 */
+    b0 = _mm_unpacklo_epi16(a0, a1);
+    b1 = _mm_unpackhi_epi16(a0, a1);
+    b2 = _mm_unpacklo_epi16(a2, a3);
+    b3 = _mm_unpackhi_epi16(a2, a3);
+
+    /* two complete columns each */
+    c[0] = _mm_unpacklo_epi32(b0, b2);
+    c[1] = _mm_unpackhi_epi32(b0, b2);
+    c[2] = _mm_unpacklo_epi32(b1, b3);
+    c[3] = _mm_unpackhi_epi32(b1, b3);
+
+    for (k = 0; k < 4; k++, d += 2 * dp) {
+        _mm_storel_epi64((__m128i*)d, c[k]);
+        _mm_storel_epi64((__m128i*)(d + dp), _mm_unpackhi_epi64(c[k], c[k]));
+    }
+}
+
+static void transpose32_sse2(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp)
+{
+    __m128i r0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i r1 = _mm_loadu_si128((const __m128i*)(s + sp));
+    __m128i r2 = _mm_loadu_si128((const __m128i*)(s + 2 * sp));
+    __m128i r3 = _mm_loadu_si128((const __m128i*)(s + 3 * sp));
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+    _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i*)(d + dp), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i*)(d + 2 * dp), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i*)(d + 3 * dp), _mm_unpackhi_epi64(t2, t3));
+}
+
+/* a row of 4 pixels of 24 bits, 12 bytes and not more: it may end the buffer */
+TARGET_SSSE3 static inline __m128i load24_ssse3(const uint8_t* s, __m128i widen)
+{
+    uint32_t w;
+
+    memcpy(&w, s + 8, 4);
+    return _mm_shuffle_epi8(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)s),
+        _mm_cvtsi32_si128(w)), widen);
+}
+
+TARGET_SSSE3 static inline void store24_ssse3(uint8_t* d, __m128i v, __m128i narrow)
+{
+    uint32_t w;
+
+    v = _mm_shuffle_epi8(v, narrow);
+    _mm_storel_epi64((__m128i*)d, v);
+    w = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    memcpy(d + 8, &w, 4);
+}
+
+/* 4x4 of 24 bit pixels: each row widened to words, transposed, narrowed again */
+TARGET_SSSE3 static inline void transpose24x4_ssse3(uint8_t* d, ptrdiff_t dp,
+    const uint8_t* s, ptrdiff_t sp)
+{
+    const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i narrow = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m128i r0 = load24_ssse3(s, widen);
+    __m128i r1 = load24_ssse3(s + sp, widen);
+    __m128i r2 = load24_ssse3(s + 2 * sp, widen);
+    __m128i r3 = load24_ssse3(s + 3 * sp, widen);
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+    store24_ssse3(d, _mm_unpacklo_epi64(t0, t1), narrow);
+    store24_ssse3(d + dp, _mm_unpackhi_epi64(t0, t1), narrow);
+    store24_ssse3(d + 2 * dp, _mm_unpacklo_epi64(t2, t3), narrow);
+    store24_ssse3(d + 3 * dp, _mm_unpackhi_epi64(t2, t3), narrow);
+}
+
+TARGET_SSSE3 static void transpose24_ssse3(uint8_t* d, ptrdiff_t dp, const uint8_t* s,
+    ptrdiff_t sp)
+{
+    transpose24x4_ssse3(d, dp, s, sp);
+    transpose24x4_ssse3(d + 12, dp, s + 4 * sp, sp);
+    transpose24x4_ssse3(d + 4 * dp, dp, s + 12, sp);
+    transpose24x4_ssse3(d + 4 * dp + 12, dp, s + 4 * sp + 12, sp);
+}
+
+static void reverse8_sse2(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + n - 16 - i));
+
+        /* dwords, then the words in them, then the bytes in those */
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i*)(d + i), v);
+    }
+    reverse_px(d + i, s, 1, n - i);
+}
+
+static void reverse32_sse2(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + (n - 4 - i) * 4));
+
+        _mm_storeu_si128((__m128i*)(d + i * 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+    reverse_px(d + i * 4, s, 4, n - i);
+}
+#endif
+
+#ifdef HAVE_NEON
+/* r[k] becomes column k of the 8x8 bytes */
+static inline void transpose8x8_neon(uint8x8_t* r)
+{
+    uint8x8x2_t t0 = vtrn_u8(r[0], r[1]);
+    uint8x8x2_t t1 = vtrn_u8(r[2], r[3]);
+    uint8x8x2_t t2 = vtrn_u8(r[4], r[5]);
+    uint8x8x2_t t3 = vtrn_u8(r[6], r[7]);
+    uint16x4x2_t u0 = vtrn_u16(vreinterpret_u16_u8(t0.val[0]), vreinterpret_u16_u8(t1.val[0]));
+    uint16x4x2_t u1 = vtrn_u16(vreinterpret_u16_u8(t0.val[1]), vreinterpret_u16_u8(t1.val[1]));
+    uint16x4x2_t u2 = vtrn_u16(vreinterpret_u16_u8(t2.val[0]), vreinterpret_u16_u8(t3.val[0]));
+    uint16x4x2_t u3 = vtrn_u16(vreinterpret_u16_u8(t2.val[1]), vreinterpret_u16_u8(t3.val[1]));
+    /* columns n and n + 4 */
+    uint32x2x2_t v0 = vtrn_u32(vreinterpret_u32_u16(u0.val[0]), vreinterpret_u32_u16(u2.val[0]));
+    uint32x2x2_t v1 = vtrn_u32(vreinterpret_u32_u16(u1.val[0]), vreinterpret_u32_u16(u3.val[0]));
+    uint32x2x2_t v2 = vtrn_u32(vreinterpret_u32_u16(u0.val[1]), vreinterpret_u32_u16(u2.val[1]));
+    uint32x2x2_t v3 = vtrn_u32(vreinterpret_u32_u16(u1.val[1]), vreinterpret_u32_u16(u3.val[1]));
+
+    r[0] = vreinterpret_u8_u32(v0.val[0]);
+    r[1] = vreinterpret_u8_u32(v1.val[0]);
+    r[2] = vreinterpret_u8_u32(v2.val[0]);
+    r[3] = vreinterpret_u8_u32(v3.val[0]);
+    r[4] = vreinterpret_u8_u32(v0.val[1]);
+    r[5] = vreinterpret_u8_u32(v1.val[1]);
+    r[6] = vreinterpret_u8_u32(v2.val[1]);
+    r[7] = vreinterpret_u8_u32(v3.val[1]);
+}
+
+static void transpose8_neon(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp)
+{
+    uint8x8_t r[8];
+    int k;
+
+    for (k = 0; k < 8; k++)
+        r[k] = vld1_u8(s + k * sp);
+    transpose8x8_neon(r);
+    for (k = 0; k < 8; k++)
+        vst1_u8(d + k * dp, r[k]);
+}
+
+/* the three bytes of the pixels as planes, each transposed on its own */
+static void transpose24_neon(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp)
+{
+    uint8x8x3_t px[8];
+    uint8x8_t r[8];
+    int k, c;
+
+    for (k = 0; k < 8; k++)
+        px[k] = vld3_u8(s + k * sp);
+    for (c = 0; c < 3; c++) {
+        for (k = 0; k < 8; k++)
+            r[k] = px[k].val[c];
+        transpose8x8_neon(r);
+        for (k = 0; k < 8; k++)
+            px[k].val[c] = r[k];
+    }
+    for (k = 0; k < 8; k++)
+        vst3_u8(d + k * dp, px[k]);
+}
+
+static void transpose32_neon(uint8_t* d, ptrdiff_t dp, const uint8_t* s, ptrdiff_t sp)
+{
+    uint32x4x2_t t0 = vtrnq_u32(vld1q_u32((const uint32_t*)s),
+        vld1q_u32((const uint32_t*)(s + sp)));
+    uint32x4x2_t t1 = vtrnq_u32(vld1q_u32((const uint32_t*)(s + 2 * sp)),
+        vld1q_u32((const uint32_t*)(s + 3 * sp)));
+
+    vst1q_u32((uint32_t*)d, vcombine_u32(vget_low_u32(t0.val[0]), vget_low_u32(t1.val[0])));
+    vst1q_u32((uint32_t*)(d + dp), vcombine_u32(vget_low_u32(t0.val[1]), vget_low_u32(t1.val[1])));
+    vst1q_u32((uint32_t*)(d + 2 * dp), vcombine_u32(vget_high_u32(t0.val[0]), vget_high_u32(t1.val[0])));
+    vst1q_u32((uint32_t*)(d + 3 * dp), vcombine_u32(vget_high_u32(t0.val[1]), vget_high_u32(t1.val[1])));
+}
+
+static void reverse8_neon(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16_t v = vrev64q_u8(vld1q_u8(s + n - 16 - i));
+
+        vst1q_u8(d + i, vextq_u8(v, v, 8));
+    }
+    reverse_px(d + i, s, 1, n - i);
+}
+
+static void reverse32_neon(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        uint32x4_t v = vrev64q_u32(vld1q_u32((const uint32_t*)(s + (n - 4 - i) * 4)));
+
+        vst1q_u32((uint32_t*)(d + i * 4), vextq_u32(v, v, 2));
+    }
+    reverse_px(d + i * 4, s, 4, n - i);
+}
+#endif
+
+static const struct rotate_ops ops_scalar = {
+    transpose8_scalar, transpose32_scalar, NULL, reverse8_scalar, reverse32_scalar
+};
+
+#ifdef HAVE_SSE2
+static const struct rotate_ops ops_sse2 = {
+    transpose8_sse2, transpose32_sse2, NULL, reverse8_sse2, reverse32_sse2
+};
+
+/* the sse2 kernel where pshufb can widen 24 bit pixels */
+static const struct rotate_ops ops_ssse3 = {
+    transpose8_sse2, transpose32_sse2, transpose24_ssse3, reverse8_sse2, reverse32_sse2
+};
+#endif
+
+#ifdef HAVE_NEON
+static const struct rotate_ops ops_neon = {
+    transpose8_neon, transpose32_neon, transpose24_neon, reverse8_neon, reverse32_neon
+};
+#endif
+
+static const struct rotate_ops* rotate_kernels[NUM_ROTATE_KERNELS] = {
+    &ops_scalar,
+#ifdef HAVE_SSE2
+    &ops_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    &ops_neon,
+#else
+    NULL,
+#endif
+};
+
+static const struct rotate_ops* ops = NULL;
+
+int rotate_kernel_available(enum rotate_kernel kernel)
+{
+    return kernel >= 0 && kernel < NUM_ROTATE_KERNELS && rotate_kernels[kernel];
+}
+
+const char* rotate_kernel_name(enum rotate_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void rotate_select_kernel(int kernel)
+{
+    ops = rotate_kernels[simd_pick_kernel(kernel, NUM_ROTATE_KERNELS, rotate_kernel_available)];
+#ifdef HAVE_SSE2
+    if (ops == &ops_sse2 && cpu_has_ssse3())
+        ops = &ops_ssse3;
+#endif
+}
+
+int rotate_supported(const struct pix_fmt* f)
+{
+    return f->planes == 1 && (f->bpp == 4 || f->bpp == 8 || f->bpp == 24 || f->bpp == 32);
+}
+
+/*
+ * One w x h block: destination pixel (i, j) is at d + j * dp + i * cpp and
+ * comes from s + i * si + j * sj.
+ */
+static void transform_block(uint8_t* d, ptrdiff_t dp, const uint8_t* s,
+    ptrdiff_t si, ptrdiff_t sj, uint32_t cpp, uint32_t w, uint32_t h)
+{
+    uint32_t i, j, n;
+
+    if (si == (ptrdiff_t)cpp || si == -(ptrdiff_t)cpp) {
+        for (j = 0; j < h; j++, d += dp, s += sj) {
+            if (si > 0)
+                memcpy(d, s, (size_t)w * cpp);
+            else if (cpp == 1)
+                ops->reverse8(d, s - (w - 1), w);
+            else if (cpp == 4)
+                ops->reverse32(d, s - (w - 1) * 4, w);
+            else
+                reverse_px(d, s - (w - 1) * cpp, cpp, w);
+        }
+        return;
+    }
+
+    /* read the source rows forwards, a mirror is a destination walked upwards */
+    if (sj < 0) {
+        s += (ptrdiff_t)(h - 1) * sj;
+        sj = -sj;
+        d += (ptrdiff_t)(h - 1) * dp;
+        dp = -dp;
+    }
+
+    n = cpp == 1 ? 8 : cpp == 4 ? 4 : ops->transpose24 ? 8 : 0;
+    for (j = 0; n && j + n <= h; j += n) {
+        for (i = 0; i + n <= w; i += n) {
+            if (cpp == 1)
+                ops->transpose8(d + j * dp + i, dp, s + i * si + j, si);
+            else if (cpp == 4)
+                ops->transpose32(d + j * dp + i * 4, dp, s + i * si + j * 4, si);
+            else
+                ops->transpose24(d + j * dp + i * 3, dp, s + i * si + j * 3, si);
+        }
+        transpose_px(d + j * dp + i * cpp, dp, s + i * si + j * cpp, si, cpp, w - i, n);
+    }
+    transpose_px(d + j * dp, dp, s + j * cpp, si, cpp, w, h - j);
+}
+
+struct rotate_job {
+    const struct image* dst;
+    const struct image* src;
+    /* size of the destination area written */
+    uint32_t w, h;
+    uint32_t cpp;
+    /* source pixel of destination pixel (0, 0) and the steps, see above */
+    int32_t sx0, sy0, ax, ay, bx, by;
+};
+
+static inline uint32_t get_nibble(const uint8_t* row, uint32_t x)
+{
+    return row[x / 2] >> (x & 1 ? 0 : 4) & 0xf;
+}
+
+/* Y4 goes through an unpacked copy of the tile */
+static void transform_tile_y4(const struct rotate_job* job, uint32_t x0, uint32_t y0,
+    uint32_t w, uint32_t h)
+{
+    uint8_t in[ROTATE_TILE * ROTATE_TILE], out[ROTATE_TILE * ROTATE_TILE];
+    int32_t sx = job->sx0 + (int32_t)x0 * job->ax + (int32_t)y0 * job->bx;
+    int32_t sy = job->sy0 + (int32_t)x0 * job->ay + (int32_t)y0 * job->by;
+    int32_t ex = sx + (int32_t)(w - 1) * job->ax + (int32_t)(h - 1) * job->bx;
+    int32_t ey = sy + (int32_t)(w - 1) * job->ay + (int32_t)(h - 1) * job->by;
+    uint32_t left = sx < ex ? sx : ex, top = sy < ey ? sy : ey;
+    uint32_t rw = (sx < ex ? ex - sx : sx - ex) + 1;
+    uint32_t rh = (sy < ey ? ey - sy : sy - ey) + 1;
+    uint32_t x, y;
+
+    for (y = 0; y < rh; y++) {
+        const uint8_t* row = image_row(job->src, top + y);
+        uint8_t* p = in + y * ROTATE_TILE;
+
+        x = 0;
+        if (left & 1)
+            p[x++] = get_nibble(row, left);
+        for (; x + 2 <= rw; x += 2) {
+            uint8_t v = row[(left + x) / 2];
+
+            p[x] = v >> 4;
+            p[x + 1] = v & 0xf;
+        }
+        if (x < rw)
+            p[x] = get_nibble(row, left + x);
+    }
+
+    transform_block(out, ROTATE_TILE, in + (sy - top) * ROTATE_TILE + (sx - left),
+        job->ax + job->ay * ROTATE_TILE, job->bx + job->by * ROTATE_TILE, 1, w, h);
+
+    /* x0 is a multiple of the tile size, so the rows start on a byte */
+    for (y = 0; y < h; y++) {
+        uint8_t* row = image_row(job->dst, y0 + y) + x0 / 2;
+        const uint8_t* p = out + y * ROTATE_TILE;
+
+        for (x = 0; x + 2 <= w; x += 2)
+            row[x / 2] = p[x] << 4 | p[x + 1];
+        if (x < w)
+            row[x / 2] = (row[x / 2] & 0x0f) | p[x] << 4;
+    }
+}
+
+static void rotate_band(void* arg, uint32_t t0, uint32_t t1)
+{
+    struct rotate_job* job = (struct rotate_job*)arg;
+    const struct image* src = job->src;
+    ptrdiff_t si = job->ax * (ptrdiff_t)job->cpp + job->ay * (ptrdiff_t)src->pitch;
+    ptrdiff_t sj = job->bx * (ptrdiff_t)job->cpp + job->by * (ptrdiff_t)src->pitch;
+    uint32_t x0, y0, w, h;
+
+    for (y0 = t0 * ROTATE_TILE; y0 < t1 * ROTATE_TILE && y0 < job->h; y0 += ROTATE_TILE) {
+        h = job->h - y0 < ROTATE_TILE ? job->h - y0 : ROTATE_TILE;
+        for (x0 = 0; x0 < job->w; x0 += ROTATE_TILE) {
+            w = job->w - x0 < ROTATE_TILE ? job->w - x0 : ROTATE_TILE;
+            if (!job->cpp) {
+                transform_tile_y4(job, x0, y0, w, h);
+                continue;
+            }
+            transform_block(image_row(job->dst, y0) + x0 * job->cpp, job->dst->pitch,
+                image_row(src, job->sy0) + (ptrdiff_t)job->sx0 * job->cpp
+                    + x0 * si + y0 * sj,
+                si, sj, job->cpp, w, h);
+        }
+    }
+}
+
+int rotate_image(const struct image* dst, const struct image* src,
+    int degrees, int hflip, int vflip)
+{
+    struct rotate_job job;
+    int transpose, fx, fy;
+    uint32_t sw, sh;
+
+    if (!rotate_supported(src->fmt) || dst->fmt->bpp != src->fmt->bpp
+        || dst->fmt->planes != 1 || dst->data == src->data)
+        return -EINVAL;
+
+    /* a rotation is a transpose plus mirrors, on top of the requested ones */
+    switch (degrees) {
+    case 0:
+        transpose = 0, fx = 0, fy = 0;
+        break;
+    case 90:
+        transpose = 1, fx = 0, fy = 1;
+        break;
+    case 180:
+        transpose = 0, fx = 1, fy = 1;
+        break;
+    case 270:
+        transpose = 1, fx = 1, fy = 0;
+        break;
+    default:
+        return -EINVAL;
+    }
+    fx ^= !!hflip;
+    fy ^= !!vflip;
+
+    if (!ops)
+        rotate_select_kernel(-1);
+
+    sw = transpose ? src->height : src->width;
+    sh = transpose ? src->width : src->height;
+    job.dst = dst;
+    job.src = src;
+    job.w = dst->width < sw ? dst->width : sw;
+    job.h = dst->height < sh ? dst->height : sh;
+    job.cpp = src->fmt->bpp / 8;
+    job.sx0 = fx ? src->width - 1 : 0;
+    job.sy0 = fy ? src->height - 1 : 0;
+    if (transpose) {
+        job.ax = 0;
+        job.ay = fy ? -1 : 1;
+        job.bx = fx ? -1 : 1;
+        job.by = 0;
+    } else {
+        job.ax = fx ? -1 : 1;
+        job.ay = 0;
+        job.bx = 0;
+        job.by = fy ? -1 : 1;
+    }
+
+    parallel_for((job.h + ROTATE_TILE - 1) / ROTATE_TILE, 1, rotate_band, &job);
+    return 0;
+}
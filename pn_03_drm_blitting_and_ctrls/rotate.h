@@ -0,0 +1,33 @@
+/*
+ * Rotation by multiples of 90 degrees and mirroring on the CPU, what the
+ * RGA does for V4L2_CID_ROTATE, V4L2_CID_HFLIP and V4L2_CID_VFLIP.
+ *
+ * The source is mirrored first and then rotated clockwise. Both images have
+ * the same format, 8, 24 or 32 bpp or packed 4 bpp Y4. For 90 and 270
+ * degrees the destination should be as wide as the source is high and the
+ * other way round, whatever does not fit into it is cut off.
+ */
+
+#ifndef __ROTATE_H_INCLUDED__
+#define __ROTATE_H_INCLUDED__
+
+#include "image.h"
+
+enum rotate_kernel {
+	ROTATE_KERNEL_SCALAR,
+	ROTATE_KERNEL_SSE2,
+	ROTATE_KERNEL_NEON,
+	NUM_ROTATE_KERNELS
+};
+
+int rotate_kernel_available(enum rotate_kernel kernel);
+const char *rotate_kernel_name(enum rotate_kernel kernel);
+void rotate_select_kernel(int kernel);
+
+int rotate_supported(const struct pix_fmt *f);
+
+/* degrees is 0, 90, 180 or 270; src and dst must not overlap */
+int rotate_image(const struct image *dst, const struct image *src,
+		 int degrees, int hflip, int vflip);
+
+#endif /* __ROTATE_H_INCLUDED__ */
@@ -0,0 +1,109 @@
+/*
+ * Real-time profile: prefaulted and locked memory, SCHED_FIFO with a pinned
+ * CPU for the conversion thread, and worst-case frame latency tracking.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rt.h"
+
+struct rt_profile rt_profile = { 0, 0, -1, 0 };
+
+int rt_lock_memory(void)
+{
+    int ret;
+
+    /*
+     * MCL_FUTURE also locks (and thereby populates) everything mapped later
+     * on, e.g. the dumb buffers and any staging memory.
+     */
+    ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (ret) {
+        printf("mlockall failed: %s\n", strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int rt_enter_thread(void)
+{
+    struct sched_param param;
+    cpu_set_t set;
+    int ret = 0;
+
+    if (rt_profile.cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(rt_profile.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            printf("failed to pin to cpu %d: %s\n", rt_profile.cpu,
+                strerror(errno));
+            ret = -errno;
+        }
+    }
+
+    if (rt_profile.prio > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rt_profile.prio;
+        if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+            printf("failed to set SCHED_FIFO prio %d: %s\n", rt_profile.prio,
+                strerror(errno));
+            ret = -errno;
+        }
+    }
+    return ret;
+}
+
+void rt_prefault(void* addr, size_t size)
+{
+    volatile uint8_t* p = (volatile uint8_t*)addr;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t i;
+
+    /* write back what is there, so already filled buffers are kept intact */
+    for (i = 0; i < size; i += page)
+        p[i] = p[i];
+    if (size)
+        p[size - 1] = p[size - 1];
+}
+
+uint64_t rt_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void rt_latency_add(struct rt_latency* lat, uint64_t ns)
+{
+    if (!lat->frames || ns < lat->min_ns)
+        lat->min_ns = ns;
+    if (ns > lat->max_ns) {
+        lat->max_ns = ns;
+        lat->worst_frame = lat->frames;
+    }
+    if (rt_profile.budget_us && ns > rt_profile.budget_us * 1000ULL)
+        lat->overruns++;
+    lat->sum_ns += ns;
+    lat->frames++;
+}
+
+void rt_latency_report(struct rt_latency* lat)
+{
+    if (!lat->frames)
+        return;
+
+    printf("frame latency: min %.3f ms, avg %.3f ms, worst %.3f ms (frame %lu)",
+        lat->min_ns / 1e6, lat->sum_ns / 1e6 / lat->frames, lat->max_ns / 1e6,
+        lat->worst_frame);
+    if (rt_profile.budget_us)
+        printf(", %lu/%lu over %u us budget", lat->overruns, lat->frames,
+            rt_profile.budget_us);
+    printf("\n");
+}
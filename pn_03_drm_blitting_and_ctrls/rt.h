@@ -0,0 +1,41 @@
+/*
+ * Real-time profile: prefaulted and locked memory, SCHED_FIFO with a pinned
+ * CPU for the conversion thread, and worst-case frame latency tracking.
+ */
+
+#ifndef __RT_H_INCLUDED__
+#define __RT_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct rt_profile {
+	int enabled;
+	/* SCHED_FIFO priority of the conversion thread, 0 keeps SCHED_OTHER */
+	int prio;
+	/* CPU the conversion thread is pinned to, -1 for no pinning */
+	int cpu;
+	/* per-frame latency budget in usecs, 0 for none */
+	unsigned int budget_us;
+};
+
+struct rt_latency {
+	unsigned long frames;
+	unsigned long overruns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t sum_ns;
+	unsigned long worst_frame;
+};
+
+extern struct rt_profile rt_profile;
+
+int rt_lock_memory(void);
+int rt_enter_thread(void);
+void rt_prefault(void *addr, size_t size);
+
+uint64_t rt_now_ns(void);
+void rt_latency_add(struct rt_latency *lat, uint64_t ns);
+void rt_latency_report(struct rt_latency *lat);
+
+#endif /* __RT_H_INCLUDED__ */
@@ -0,0 +1,751 @@
+/*
+ * Separable scaling of packed images in fixed point.
+ *
+ * Every destination pixel of an axis is a weighted sum of a run of source
+ * pixels, the taps. Weights are 14 bit fractions summing to exactly 1, so
+ * equal sizes copy the image unchanged. Shrinking weights each source pixel
+ * by how much of it the destination pixel covers, growing interpolates
+ * between the two nearest pixel centers.
+ *
+ * A band of destination rows first scales the source rows it needs
+ * horizontally into 16 bit rows with 8 fraction bits, then sums those
+ * vertically. The vector kernels do both passes: horizontally a pixel at a
+ * time with its channels side by side, summing runs of source pixels when
+ * shrinking by a whole factor, whose taps all weigh the same. Formats that
+ * do not have a byte per channel are unpacked to bytes around this and
+ * packed again.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "scale.h"
+#include "simd.h"
+
+#define SCALE_ONE (1 << 14)
+/* the longest box whose sums of 255 fit 16 bits */
+#define SCALE_BOX_MAX 257
+/* bytes the horizontal kernels may read past the last tap */
+#define SCALE_OVERREAD 8
+
+struct scale_axis;
+
+/* scales destination pixels [0, n) of a row and returns n */
+typedef uint32_t (*horiz_fn)(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax,
+    unsigned int channels);
+
+/* sums taps weighted rows into bytes [0, n) and returns n */
+typedef uint32_t (*vert_fn)(uint8_t* dst, const uint16_t* const* rows,
+    const uint16_t* weights, unsigned int taps, uint32_t n);
+
+static const char* kernel_names[NUM_SCALE_KERNELS] = {
+    "scalar", "sse2", "neon"
+};
+
+/* the taps of one axis, the same number for every destination pixel */
+struct scale_axis {
+    uint32_t src;
+    uint32_t dst;
+    unsigned int taps;
+    /* first source pixel of each destination pixel */
+    uint32_t* start;
+    /* taps weights per destination pixel, unused ones 0 */
+    uint16_t* weights;
+    /* src / dst when shrinking by a whole factor up to SCALE_BOX_MAX, else 0 */
+    uint32_t ratio;
+};
+
+/* a channel of a 16 bpp pixel */
+struct scale_field {
+    uint8_t shift;
+    uint8_t bits;
+};
+
+struct scale_layout {
+    unsigned int channels;
+    int y4;
+    /* for the 16 bpp formats, no bits for those with a byte per channel */
+    struct scale_field fields[4];
+};
+
+typedef void (*horiz_tail_fn)(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax,
+    uint32_t i);
+
+struct scale_job {
+    const struct image* dst;
+    const struct image* src;
+    struct scale_layout layout;
+    int direct;
+    struct scale_axis h;
+    struct scale_axis v;
+    horiz_tail_fn horiz_tail;
+    int error;
+};
+
+static int axis_init(struct scale_axis* ax, uint32_t src, uint32_t dst)
+{
+    uint32_t i, j, j0, j1, sum, big;
+    uint64_t lo, hi, a, b;
+    uint16_t* w;
+
+    ax->src = src;
+    ax->dst = dst;
+    if (dst < src)
+        ax->taps = src / dst + (src % dst ? 2 : 0);
+    else
+        ax->taps = 2;
+    ax->ratio = dst < src && !(src % dst) && src / dst <= SCALE_BOX_MAX ? src / dst : 0;
+    if (ax->taps > src)
+        ax->taps = src;
+    ax->start = (uint32_t*)malloc(dst * sizeof(*ax->start));
+    ax->weights = (uint16_t*)calloc((size_t)dst * ax->taps, sizeof(*ax->weights));
+    if (!ax->start || !ax->weights)
+        return -ENOMEM;
+
+    for (i = 0; i < dst; i++) {
+        w = ax->weights + (size_t)i * ax->taps;
+        if (dst < src) {
+            /* box: destination pixel i covers [lo, hi) in 1/dst source pixels */
+            lo = (uint64_t)i * src;
+            hi = lo + src;
+            j0 = lo / dst;
+            j1 = (hi - 1) / dst;
+            ax->start[i] = j0 + ax->taps > src ? src - ax->taps : j0;
+            sum = 0;
+            big = j0;
+            for (j = j0; j <= j1; j++) {
+                a = lo > (uint64_t)j * dst ? lo : (uint64_t)j * dst;
+                b = hi < (uint64_t)(j + 1) * dst ? hi : (uint64_t)(j + 1) * dst;
+                w[j - ax->start[i]] = (b - a) * SCALE_ONE / src;
+                sum += w[j - ax->start[i]];
+                if (w[j - ax->start[i]] > w[big - ax->start[i]])
+                    big = j;
+            }
+            /* the rounding goes to the largest weight */
+            w[big - ax->start[i]] += SCALE_ONE - sum;
+        } else {
+            /* bilinear between the centers around (i + 0.5) * src / dst - 0.5 */
+            int64_t pos = (int64_t)(2 * i + 1) * src - dst;
+            uint32_t frac;
+
+            if (pos < 0)
+                pos = 0;
+            j = pos / (2 * (uint64_t)dst);
+            frac = (pos % (2 * (uint64_t)dst)) * SCALE_ONE / (2 * (uint64_t)dst);
+            if (j + 1 >= src) {
+                j = src - 1;
+                frac = 0;
+            }
+            ax->start[i] = j + ax->taps > src ? src - ax->taps : j;
+            w[j - ax->start[i]] = SCALE_ONE - frac;
+            if (frac)
+                w[j + 1 - ax->start[i]] = frac;
+        }
+    }
+    return 0;
+}
+
+static void axis_free(struct scale_axis* ax)
+{
+    free(ax->start);
+    free(ax->weights);
+}
+
+static int get_layout(const struct pix_fmt* f, struct scale_layout* l)
+{
+    memset(l, 0, sizeof(*l));
+    if (f->planes != 1)
+        return -EINVAL;
+
+    switch (f->drm) {
+    case DRM_FORMAT_R4:
+        l->channels = 1;
+        l->y4 = 1;
+        return 0;
+    case DRM_FORMAT_RGB565:
+        l->channels = 3;
+        l->fields[0] = { 11, 5 };
+        l->fields[1] = { 5, 6 };
+        l->fields[2] = { 0, 5 };
+        return 0;
+    case DRM_FORMAT_ARGB1555:
+        l->channels = 4;
+        l->fields[0] = { 10, 5 };
+        l->fields[1] = { 5, 5 };
+        l->fields[2] = { 0, 5 };
+        l->fields[3] = { 15, 1 };
+        return 0;
+    case DRM_FORMAT_ARGB4444:
+        l->channels = 4;
+        l->fields[0] = { 8, 4 };
+        l->fields[1] = { 4, 4 };
+        l->fields[2] = { 0, 4 };
+        l->fields[3] = { 12, 4 };
+        return 0;
+    }
+    if (f->bpp != 8 && f->bpp != 24 && f->bpp != 32)
+        return -EINVAL;
+    l->channels = f->bpp / 8;
+    return 0;
+}
+
+/* a row of a format without a byte per channel to bytes */
+static void unpack_row(uint8_t* dst, const uint8_t* src, uint32_t width,
+    const struct scale_layout* l)
+{
+    unsigned int c, max;
+    uint32_t x;
+    uint16_t p;
+
+    if (l->y4) {
+        for (x = 0; x < width; x++)
+            dst[x] = (src[x / 2] >> (x & 1 ? 0 : 4) & 0xf) * 17;
+        return;
+    }
+    for (x = 0; x < width; x++) {
+        p = src[2 * x] | src[2 * x + 1] << 8;
+        for (c = 0; c < l->channels; c++, dst++) {
+            max = (1 << l->fields[c].bits) - 1;
+            *dst = ((p >> l->fields[c].shift & max) * 255 + max / 2) / max;
+        }
+    }
+}
+
+static void pack_row(uint8_t* dst, const uint8_t* src, uint32_t width,
+    const struct scale_layout* l)
+{
+    unsigned int c, max;
+    uint32_t x;
+    uint16_t p;
+
+    if (l->y4) {
+        for (x = 0; x + 2 <= width; x += 2)
+            dst[x / 2] = (src[x] * 15 + 127) / 255 << 4 | (src[x + 1] * 15 + 127) / 255;
+        if (x < width)
+            dst[x / 2] = (dst[x / 2] & 0x0f) | (src[x] * 15 + 127) / 255 << 4;
+        return;
+    }
+    for (x = 0; x < width; x++) {
+        p = 0;
+        for (c = 0; c < l->channels; c++, src++) {
+            max = (1 << l->fields[c].bits) - 1;
+            p |= (*src * max + 127) / 255 << l->fields[c].shift;
+        }
+        dst[2 * x] = p;
+        dst[2 * x + 1] = p >> 8;
+    }
+}
+
+/* any destination pixels from i on */
+template <unsigned int C>
+static void horiz_tail(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax, uint32_t i)
+{
+    uint32_t acc[C];
+    unsigned int k, c;
+
+    for (dst += (size_t)i * C; i < ax->dst; i++, dst += C) {
+        const uint8_t* s = src + (size_t)ax->start[i] * C;
+        const uint16_t* w = ax->weights + (size_t)i * ax->taps;
+
+        for (c = 0; c < C; c++)
+            acc[c] = 32;
+        for (k = 0; k < ax->taps; k++, s += C) {
+            for (c = 0; c < C; c++)
+                acc[c] += w[k] * s[c];
+        }
+        /* 8 fraction bits are kept for the vertical pass */
+        for (c = 0; c < C; c++)
+            dst[c] = acc[c] >> 6;
+    }
+}
+
+/* the vector kernels leave the pixels at the end of the row to horiz_tail() */
+static inline int horiz_overreads(const struct scale_axis* ax, uint32_t i, unsigned int channels)
+{
+    return ((size_t)ax->start[i] + ax->taps) * channels + SCALE_OVERREAD
+        > (size_t)ax->src * channels;
+}
+
+/* the first n bytes set, from byte 8 - n on */
+static const uint8_t box_mask[16] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#ifdef HAVE_SSE2
+/*
+ * The horizontal kernels keep the channels of a pixel in one 64 bit half
+ * of words, those of 3 byte pixels with the next byte in the fourth word.
+ * That word is summed like the others and stored, and the next pixel then
+ * writes over it.
+ */
+static inline __m128i halves_epi16(__m128i w)
+{
+    /* bytes 0..2 and 3..5 of a 3 byte pixel pair to the two halves */
+    return _mm_unpacklo_epi64(w, _mm_srli_si128(w, 6));
+}
+
+template <unsigned int C>
+static inline __m128i pair_epi16(const uint8_t* p)
+{
+    __m128i w = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128());
+
+    return C == 4 ? w : halves_epi16(w);
+}
+
+/* a pixel in the low half */
+template <unsigned int C>
+static inline __m128i pixel_epi16(const uint8_t* p)
+{
+    uint32_t v = p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (C == 4 ? (uint32_t)p[3] << 24 : 0);
+
+    return _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), _mm_setzero_si128());
+}
+
+/* the 32 bit sums of a pixel, rounded, as 4 words with 8 fraction bits */
+static inline void store_epu16(uint16_t* dst, __m128i acc)
+{
+    /* there is no unsigned pack of 32 bit values, so pack them around 0x8000 */
+    __m128i v = _mm_sub_epi32(_mm_srli_epi32(acc, 6), _mm_set1_epi32(0x8000));
+
+    _mm_storel_epi64((__m128i*)dst, _mm_xor_si128(_mm_packs_epi32(v, v), _mm_set1_epi16(-0x8000)));
+}
+
+/* every tap weighs SCALE_ONE / ratio, but for the rounding on the first one */
+template <unsigned int C>
+static uint32_t box_sse2(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax)
+{
+    const unsigned int r = ax->ratio;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi16(SCALE_ONE / r);
+    const __m128i e = _mm_set1_epi16(SCALE_ONE - SCALE_ONE / r * r);
+    const __m128i round = _mm_set1_epi32(32);
+    unsigned int k;
+    uint32_t i;
+
+    for (i = 0; i < ax->dst && !horiz_overreads(ax, i, C); i++, dst += C) {
+        const uint8_t* s = src + (size_t)ax->start[i] * C;
+        __m128i sum = zero, lo, hi, first;
+
+        for (k = 0; k + 4 <= r; k += 4, s += 4 * C) {
+            __m128i v = _mm_loadu_si128((const __m128i*)s);
+
+            if (C == 4)
+                sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_unpacklo_epi8(v, zero),
+                                             _mm_unpackhi_epi8(v, zero)));
+            else
+                sum = _mm_add_epi16(sum, _mm_add_epi16(halves_epi16(_mm_unpacklo_epi8(v, zero)),
+                                             halves_epi16(_mm_unpacklo_epi8(_mm_srli_si128(v, 6), zero))));
+        }
+        for (; k + 2 <= r; k += 2, s += 2 * C)
+            sum = _mm_add_epi16(sum, pair_epi16<C>(s));
+        if (k < r)
+            sum = _mm_add_epi16(sum, pixel_epi16<C>(s));
+        sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+
+        first = _mm_mullo_epi16(pixel_epi16<C>(src + (size_t)ax->start[i] * C), e);
+        lo = _mm_mullo_epi16(sum, w);
+        hi = _mm_mulhi_epu16(sum, w);
+        store_epu16(dst, _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round),
+                             _mm_unpacklo_epi16(first, zero)));
+    }
+    return i;
+}
+
+template <unsigned int C>
+static uint32_t taps_sse2(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax)
+{
+    const __m128i round = _mm_set1_epi32(32);
+    unsigned int k;
+    uint32_t i, wk;
+
+    for (i = 0; i < ax->dst && !horiz_overreads(ax, i, C); i++, dst += C) {
+        const uint8_t* s = src + (size_t)ax->start[i] * C;
+        const uint16_t* w = ax->weights + (size_t)i * ax->taps;
+        __m128i acc = round;
+
+        for (k = 0; k + 2 <= ax->taps; k += 2, s += 2 * C) {
+            __m128i p = pair_epi16<C>(s);
+
+            /* each channel of tap k next to that of tap k + 1, for pmaddwd */
+            p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8));
+            memcpy(&wk, w + k, sizeof(wk));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(p, _mm_set1_epi32(wk)));
+        }
+        if (k < ax->taps)
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(pixel_epi16<C>(s),
+                                                        _mm_setzero_si128()),
+                                         _mm_set1_epi32(w[k])));
+        store_epu16(dst, acc);
+    }
+    return i;
+}
+
+static uint32_t box1_sse2(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax)
+{
+    const unsigned int r = ax->ratio, w = SCALE_ONE / r, e = SCALE_ONE - w * r;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_loadl_epi64((const __m128i*)(box_mask + 8 - r % 8));
+    unsigned int k;
+    uint32_t i;
+
+    for (i = 0; i < ax->dst && !horiz_overreads(ax, i, 1); i++) {
+        const uint8_t* s = src + ax->start[i];
+        __m128i sum = zero;
+
+        for (k = 0; k + 8 <= r; k += 8)
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadl_epi64((const __m128i*)(s + k)), zero));
+        if (k < r)
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(
+                                                     _mm_loadl_epi64((const __m128i*)(s + k)), mask),
+                                         zero));
+        dst[i] = (32 + w * _mm_cvtsi128_si32(sum) + e * s[0]) >> 6;
+    }
+    return i;
+}
+
+static uint32_t horiz_sse2(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax,
+    unsigned int channels)
+{
+    switch (channels) {
+    case 1:
+        /* a pixel of 1 byte at a time is no faster than horiz_tail() */
+        return ax->ratio ? box1_sse2(dst, src, ax) : 0;
+    case 3:
+        return ax->ratio ? box_sse2<3>(dst, src, ax) : taps_sse2<3>(dst, src, ax);
+    default:
+        return ax->ratio ? box_sse2<4>(dst, src, ax) : taps_sse2<4>(dst, src, ax);
+    }
+}
+#endif
+
+#ifdef HAVE_NEON
+static inline uint16x8_t halves_u16(uint16x8_t w)
+{
+    /* bytes 0..2 and 3..5 of a 3 byte pixel pair to the two halves */
+    return vcombine_u16(vget_low_u16(w), vget_low_u16(vextq_u16(w, w, 3)));
+}
+
+template <unsigned int C>
+static inline uint16x8_t pair_u16(const uint8_t* p)
+{
+    uint16x8_t w = vmovl_u8(vld1_u8(p));
+
+    return C == 4 ? w : halves_u16(w);
+}
+
+template <unsigned int C>
+static inline uint16x4_t pixel_u16(const uint8_t* p)
+{
+    uint32_t v = p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (C == 4 ? (uint32_t)p[3] << 24 : 0);
+
+    return vget_low_u16(vmovl_u8(vcreate_u8(v)));
+}
+
+template <unsigned int C>
+static uint32_t box_neon(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax)
+{
+    const unsigned int r = ax->ratio, w = SCALE_ONE / r, e = SCALE_ONE - w * r;
+    unsigned int k;
+    uint32_t i;
+
+    for (i = 0; i < ax->dst && !horiz_overreads(ax, i, C); i++, dst += C) {
+        const uint8_t* s = src + (size_t)ax->start[i] * C;
+        uint16x8_t sum = vdupq_n_u16(0);
+        uint16x4_t total;
+        uint32x4_t acc;
+
+        for (k = 0; k + 4 <= r; k += 4, s += 4 * C) {
+            uint8x16_t v = vld1q_u8(s);
+
+            if (C == 4)
+                sum = vaddq_u16(sum, vaddl_u8(vget_low_u8(v), vget_high_u8(v)));
+            else
+                sum = vaddq_u16(sum, vaddq_u16(halves_u16(vmovl_u8(vget_low_u8(v))),
+                                         halves_u16(vmovl_u8(vget_low_u8(vextq_u8(v, v, 6))))));
+        }
+        for (; k + 2 <= r; k += 2, s += 2 * C)
+            sum = vaddq_u16(sum, pair_u16<C>(s));
+        total = vadd_u16(vget_low_u16(sum), vget_high_u16(sum));
+        if (k < r)
+            total = vadd_u16(total, pixel_u16<C>(s));
+
+        acc = vmlal_n_u16(vmull_n_u16(pixel_u16<C>(src + (size_t)ax->start[i] * C), e), total, w);
+        vst1_u16(dst, vmovn_u32(vshrq_n_u32(vaddq_u32(acc, vdupq_n_u32(32)), 6)));
+    }
+    return i;
+}
+
+template <unsigned int C>
+static uint32_t taps_neon(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax)
+{
+    unsigned int k;
+    uint32_t i;
+
+    for (i = 0; i < ax->dst && !horiz_overreads(ax, i, C); i++, dst += C) {
+        const uint8_t* s = src + (size_t)ax->start[i] * C;
+        const uint16_t* w = ax->weights + (size_t)i * ax->taps;
+        uint32x4_t acc = vdupq_n_u32(32);
+
+        for (k = 0; k + 2 <= ax->taps; k += 2, s += 2 * C) {
+            uint16x8_t p = pair_u16<C>(s);
+
+            acc = vmlal_n_u16(acc, vget_low_u16(p), w[k]);
+            acc = vmlal_n_u16(acc, vget_high_u16(p), w[k + 1]);
+        }
+        if (k < ax->taps)
+            acc = vmlal_n_u16(acc, pixel_u16<C>(s), w[k]);
+        vst1_u16(dst, vmovn_u32(vshrq_n_u32(acc, 6)));
+    }
+    return i;
+}
+
+static uint32_t box1_neon(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax)
+{
+    const unsigned int r = ax->ratio, w = SCALE_ONE / r, e = SCALE_ONE - w * r;
+    const uint8x8_t mask = vld1_u8(box_mask + 8 - r % 8);
+    unsigned int k, sum;
+    uint32_t i;
+
+    for (i = 0; i < ax->dst && !horiz_overreads(ax, i, 1); i++) {
+        const uint8_t* s = src + ax->start[i];
+
+        for (sum = 0, k = 0; k + 8 <= r; k += 8)
+            sum += vaddlv_u8(vld1_u8(s + k));
+        if (k < r)
+            sum += vaddlv_u8(vand_u8(vld1_u8(s + k), mask));
+        dst[i] = (32 + w * sum + e * s[0]) >> 6;
+    }
+    return i;
+}
+
+static uint32_t horiz_neon(uint16_t* dst, const uint8_t* src, const struct scale_axis* ax,
+    unsigned int channels)
+{
+    switch (channels) {
+    case 1:
+        /* a pixel of 1 byte at a time is no faster than horiz_tail() */
+        return ax->ratio ? box1_neon(dst, src, ax) : 0;
+    case 3:
+        return ax->ratio ? box_neon<3>(dst, src, ax) : taps_neon<3>(dst, src, ax);
+    default:
+        return ax->ratio ? box_neon<4>(dst, src, ax) : taps_neon<4>(dst, src, ax);
+    }
+}
+#endif
+
+/* any bytes from x on */
+static void vert_tail(uint8_t* dst, const uint16_t* const* rows,
+    const uint16_t* weights, unsigned int taps, uint32_t x, uint32_t n)
+{
+    unsigned int k;
+    uint32_t acc;
+
+    for (; x < n; x++) {
+        acc = 1 << 21;
+        for (k = 0; k < taps; k++)
+            acc += (uint32_t)weights[k] * rows[k][x];
+        dst[x] = acc >> 22;
+    }
+}
+
+#ifdef HAVE_SSE2
+static uint32_t vert_sse2(uint8_t* dst, const uint16_t* const* rows,
+    const uint16_t* weights, unsigned int taps, uint32_t n)
+{
+    const __m128i round = _mm_set1_epi32(1 << 21);
+    unsigned int k;
+    uint32_t x;
+
+    for (x = 0; x + 8 <= n; x += 8) {
+        __m128i lo = round, hi = round;
+
+        for (k = 0; k < taps; k++) {
+            __m128i r = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+            __m128i w = _mm_set1_epi16(weights[k]);
+            /* the 32 bit products of the unsigned words */
+            __m128i pl = _mm_mullo_epi16(r, w);
+            __m128i ph = _mm_mulhi_epu16(r, w);
+
+            lo = _mm_add_epi32(lo, _mm_unpacklo_epi16(pl, ph));
+            hi = _mm_add_epi32(hi, _mm_unpackhi_epi16(pl, ph));
+        }
+        lo = _mm_packs_epi32(_mm_srli_epi32(lo, 22), _mm_srli_epi32(hi, 22));
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(lo, lo));
+    }
+    return x;
+}
+#endif
+
+#ifdef HAVE_NEON
+static uint32_t vert_neon(uint8_t* dst, const uint16_t* const* rows,
+    const uint16_t* weights, unsigned int taps, uint32_t n)
+{
+    const uint32x4_t round = vdupq_n_u32(1 << 21);
+    unsigned int k;
+    uint32_t x;
+
+    for (x = 0; x + 8 <= n; x += 8) {
+        uint32x4_t lo = round, hi = round;
+
+        for (k = 0; k < taps; k++) {
+            uint16x8_t r = vld1q_u16(rows[k] + x);
+
+            lo = vmlal_n_u16(lo, vget_low_u16(r), weights[k]);
+            hi = vmlal_n_u16(hi, vget_high_u16(r), weights[k]);
+        }
+        vst1_u8(dst + x, vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(lo, 22)),
+                             vmovn_u32(vshrq_n_u32(hi, 22)))));
+    }
+    return x;
+}
+#endif
+
+/* NULL leaves the whole row to horiz_tail() */
+static horiz_fn horiz_kernels[NUM_SCALE_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    horiz_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    horiz_neon,
+#else
+    NULL,
+#endif
+};
+
+/* NULL leaves the whole row to vert_tail() */
+static vert_fn vert_kernels[NUM_SCALE_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    vert_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    vert_neon,
+#else
+    NULL,
+#endif
+};
+
+/* index into the table, -1 until the first frame picks the best one */
+static int selected = -1;
+
+int scale_kernel_available(enum scale_kernel kernel)
+{
+    return kernel >= 0 && kernel < NUM_SCALE_KERNELS
+        && (kernel == SCALE_KERNEL_SCALAR || vert_kernels[kernel]);
+}
+
+const char* scale_kernel_name(enum scale_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void scale_select_kernel(int kernel)
+{
+    selected = simd_pick_kernel(kernel, NUM_SCALE_KERNELS, scale_kernel_available);
+}
+
+int scale_supported(const struct pix_fmt* f)
+{
+    struct scale_layout l;
+
+    return !get_layout(f, &l);
+}
+
+static void scale_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct scale_job* job = (struct scale_job*)arg;
+    const unsigned int channels = job->layout.channels;
+    const size_t hpitch = (size_t)job->h.dst * channels;
+    const horiz_fn horiz = horiz_kernels[selected];
+    const vert_fn vert = vert_kernels[selected];
+    uint32_t ys0 = job->v.start[y0], ys1 = job->v.start[y1 - 1] + job->v.taps;
+    uint32_t y, x;
+    unsigned int k;
+    uint16_t* hrows;
+    const uint16_t** rows;
+    uint8_t *in, *out;
+    void* mem;
+
+    /* the source rows of the band scaled horizontally, and room to unpack */
+    mem = malloc(job->v.taps * sizeof(*rows) + (ys1 - ys0) * hpitch * sizeof(*hrows)
+        + ((size_t)job->h.src + job->h.dst) * channels);
+    if (!mem) {
+        __atomic_store_n(&job->error, -ENOMEM, __ATOMIC_RELAXED);
+        return;
+    }
+    rows = (const uint16_t**)mem;
+    hrows = (uint16_t*)(rows + job->v.taps);
+    in = (uint8_t*)(hrows + (ys1 - ys0) * hpitch);
+    out = in + (size_t)job->h.src * channels;
+
+    for (y = ys0; y < ys1; y++) {
+        const uint8_t* s = image_row(job->src, y);
+
+        if (!job->direct) {
+            unpack_row(in, s, job->h.src, &job->layout);
+            s = in;
+        }
+        x = horiz ? horiz(hrows + (y - ys0) * hpitch, s, &job->h, channels) : 0;
+        job->horiz_tail(hrows + (y - ys0) * hpitch, s, &job->h, x);
+    }
+
+    for (y = y0; y < y1; y++) {
+        const uint16_t* w = job->v.weights + (size_t)y * job->v.taps;
+        uint8_t* d = job->direct ? image_row(job->dst, y) : out;
+
+        for (k = 0; k < job->v.taps; k++)
+            rows[k] = hrows + (job->v.start[y] - ys0 + k) * hpitch;
+        x = vert ? vert(d, rows, w, job->v.taps, hpitch) : 0;
+        vert_tail(d, rows, w, job->v.taps, x, hpitch);
+        if (!job->direct)
+            pack_row(image_row(job->dst, y), out, job->h.dst, &job->layout);
+    }
+    free(mem);
+}
+
+int scale_image(const struct image* dst, const struct image* src)
+{
+    struct scale_job job;
+    int ret;
+
+    memset(&job, 0, sizeof(job));
+    if (dst->fmt != src->fmt || get_layout(src->fmt, &job.layout)
+        || !src->width || !src->height || !dst->width || !dst->height)
+        return -EINVAL;
+    if (selected < 0)
+        scale_select_kernel(-1);
+
+    switch (job.layout.channels) {
+    case 1:
+        job.horiz_tail = horiz_tail<1>;
+        break;
+    case 3:
+        job.horiz_tail = horiz_tail<3>;
+        break;
+    default:
+        job.horiz_tail = horiz_tail<4>;
+        break;
+    }
+    job.dst = dst;
+    job.src = src;
+    job.direct = !job.layout.y4 && !job.layout.fields[0].bits;
+
+    ret = axis_init(&job.h, src->width, dst->width);
+    if (!ret)
+        ret = axis_init(&job.v, src->height, dst->height);
+    if (!ret) {
+        parallel_for(dst->height, 16, scale_band, &job);
+        ret = job.error;
+    }
+
+    axis_free(&job.h);
+    axis_free(&job.v);
+    return ret;
+}
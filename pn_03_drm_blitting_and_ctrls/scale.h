@@ -0,0 +1,31 @@
+/*
+ * Scaling of packed images on the CPU, for sizes the RGA is not asked to
+ * scale between: preview thumbnails and the CPU backend.
+ *
+ * Each axis is scaled on its own, with a box filter that averages all
+ * source pixels a destination pixel covers when shrinking and bilinear
+ * interpolation when growing. Both images have the same format: 8, 24 or
+ * 32 bpp, the 16 bpp RGB formats or Y4.
+ */
+
+#ifndef __SCALE_H_INCLUDED__
+#define __SCALE_H_INCLUDED__
+
+#include "image.h"
+
+enum scale_kernel {
+	SCALE_KERNEL_SCALAR,
+	SCALE_KERNEL_SSE2,
+	SCALE_KERNEL_NEON,
+	NUM_SCALE_KERNELS
+};
+
+int scale_kernel_available(enum scale_kernel kernel);
+const char *scale_kernel_name(enum scale_kernel kernel);
+void scale_select_kernel(int kernel);
+
+int scale_supported(const struct pix_fmt *f);
+/* src to the size of dst; src and dst must not overlap */
+int scale_image(const struct image *dst, const struct image *src);
+
+#endif /* __SCALE_H_INCLUDED__ */
@@ -0,0 +1,338 @@
+/*
+ * Shared-memory output ring for downstream consumers of the converted
+ * frames.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bo.h"
+#include "rt.h"
+#include "shmring.h"
+
+static int ring_sockaddr(struct sockaddr_un* addr, const char* path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        printf("socket path too long: %s\n", path);
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int shm_ring_create(struct shm_ring_producer* p, const char* path,
+    struct buf_binding_table* bufs)
+{
+    struct sockaddr_un addr;
+    struct sp_bo* bo = bufs->slots[0].bo;
+    int ret;
+
+    memset(p, 0, sizeof(*p));
+    p->path = path;
+    p->bufs = bufs;
+    p->listen_fd = -1;
+    p->ring_fd = -1;
+
+    if (!bufs->count)
+        return -EINVAL;
+
+    ret = ring_sockaddr(&addr, path);
+    if (ret)
+        return ret;
+
+    p->ring_fd = memfd_create("rga-v4l2-ring", MFD_CLOEXEC);
+    if (p->ring_fd < 0) {
+        printf("memfd_create failed: %s\n", strerror(errno));
+        return -errno;
+    }
+    if (ftruncate(p->ring_fd, sizeof(*p->ring))) {
+        ret = -errno;
+        goto err;
+    }
+
+    p->ring = (struct shm_ring*)mmap(NULL, sizeof(*p->ring),
+        PROT_READ | PROT_WRITE, MAP_SHARED, p->ring_fd, 0);
+    if (p->ring == MAP_FAILED) {
+        p->ring = NULL;
+        ret = -errno;
+        goto err;
+    }
+
+    p->ring->magic = SHM_RING_MAGIC;
+    p->ring->version = SHM_RING_VERSION;
+    p->ring->width = bo->width;
+    p->ring->height = bo->height;
+    p->ring->drm_format = bo->format;
+    p->ring->pitch = bo->pitch;
+    p->ring->num_bufs = bufs->count;
+    p->ring->num_slots = SHM_RING_SLOTS;
+
+    p->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (p->listen_fd < 0) {
+        ret = -errno;
+        goto err;
+    }
+
+    unlink(path);
+    if (bind(p->listen_fd, (struct sockaddr*)&addr, sizeof(addr))
+        || listen(p->listen_fd, 4)) {
+        ret = -errno;
+        goto err;
+    }
+
+    printf("publishing frames on %s\n", path);
+    return 0;
+
+err:
+    printf("failed to set up output ring on %s: %s\n", path, strerror(-ret));
+    shm_ring_destroy(p);
+    return ret;
+}
+
+void shm_ring_accept(struct shm_ring_producer* p)
+{
+    int fds[1 + BINDING_MAX_BUFS];
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct iovec iov;
+    uint32_t num_fds;
+    unsigned int i;
+    int client;
+
+    if (p->listen_fd < 0)
+        return;
+
+    /* non-blocking, new consumers get the fds on the next frame */
+    while ((client = accept4(p->listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        num_fds = 1 + p->bufs->count;
+        fds[0] = p->ring_fd;
+        for (i = 0; i < p->bufs->count; i++)
+            fds[1 + i] = p->bufs->slots[i].fd;
+
+        memset(&msg, 0, sizeof(msg));
+        memset(cbuf, 0, sizeof(cbuf));
+        iov.iov_base = &num_fds;
+        iov.iov_len = sizeof(num_fds);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+
+        if (sendmsg(client, &msg, MSG_NOSIGNAL) < 0)
+            printf("failed to pass fds to consumer: %s\n", strerror(errno));
+        else
+            p->consumers++;
+        close(client);
+    }
+}
+
+void shm_ring_publish(struct shm_ring_producer* p, uint32_t buf_index,
+    uint32_t bytesused)
+{
+    struct shm_ring* ring = p->ring;
+    struct shm_ring_slot* slot;
+    uint64_t seq;
+
+    if (!ring)
+        return;
+
+    seq = ring->head + 1;
+    slot = &ring->slots[seq % SHM_RING_SLOTS];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->buf_index = buf_index;
+    slot->bytesused = bytesused;
+    slot->timestamp_ns = rt_now_ns();
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, seq, __ATOMIC_RELEASE);
+}
+
+void shm_ring_destroy(struct shm_ring_producer* p)
+{
+    if (p->listen_fd >= 0) {
+        close(p->listen_fd);
+        unlink(p->path);
+    }
+    if (p->ring)
+        munmap(p->ring, sizeof(*p->ring));
+    if (p->ring_fd >= 0)
+        close(p->ring_fd);
+
+    p->listen_fd = -1;
+    p->ring_fd = -1;
+    p->ring = NULL;
+}
+
+static void close_fds(const void* data, unsigned int count)
+{
+    unsigned int i;
+    int fd;
+
+    for (i = 0; i < count; i++) {
+        memcpy(&fd, (const char*)data + i * sizeof(int), sizeof(int));
+        close(fd);
+    }
+}
+
+int shm_ring_attach(struct shm_ring_consumer* c, const char* path)
+{
+    int fds[1 + BINDING_MAX_BUFS];
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct iovec iov;
+    uint32_t num_fds;
+    unsigned int i, n;
+    int sock, ret, bad;
+
+    memset(c, 0, sizeof(*c));
+    c->ring_fd = -1;
+
+    ret = ring_sockaddr(&addr, path);
+    if (ret)
+        return ret;
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -errno;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        ret = -errno;
+        close(sock);
+        return ret;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &num_fds;
+    iov.iov_len = sizeof(num_fds);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    close(sock);
+    if (ret < 0)
+        return -errno;
+
+    /* the fds of a single SCM_RIGHTS message, whatever else came is closed */
+    n = 0;
+    bad = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        unsigned int count;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+            || cmsg->cmsg_len < CMSG_LEN(0)) {
+            bad = 1;
+            continue;
+        }
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (n || count > 1 + BINDING_MAX_BUFS) {
+            close_fds(CMSG_DATA(cmsg), count);
+            bad = 1;
+            continue;
+        }
+        memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+        n = count;
+    }
+    if (bad || (msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) || ret != sizeof(num_fds) || n < 1
+        || num_fds != n) {
+        close_fds(fds, n);
+        return -EPROTO;
+    }
+
+    c->ring_fd = fds[0];
+    c->num_bufs = n - 1;
+    for (i = 0; i < c->num_bufs; i++)
+        c->buf_fds[i] = fds[1 + i];
+
+    c->ring = (struct shm_ring*)mmap(NULL, sizeof(*c->ring), PROT_READ,
+        MAP_SHARED, c->ring_fd, 0);
+    if (c->ring == MAP_FAILED) {
+        c->ring = NULL;
+        ret = -errno;
+        shm_ring_detach(c);
+        return ret;
+    }
+    if (c->ring->magic != SHM_RING_MAGIC || c->ring->version != SHM_RING_VERSION) {
+        shm_ring_detach(c);
+        return -EPROTO;
+    }
+
+    c->last_seq = __atomic_load_n(&c->ring->head, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+/* returns 1 and the oldest frame not seen yet, 0 if there is none */
+int shm_ring_next(struct shm_ring_consumer* c, struct shm_ring_slot* frame)
+{
+    const struct shm_ring_slot* slot;
+    uint64_t head, want, seq;
+
+    for (;;) {
+        head = __atomic_load_n(&c->ring->head, __ATOMIC_ACQUIRE);
+        if (head == c->last_seq)
+            return 0;
+
+        /* frames that already left the ring are dropped */
+        want = c->last_seq + 1;
+        if (head - want >= SHM_RING_SLOTS)
+            want = head - SHM_RING_SLOTS + 1;
+
+        slot = &c->ring->slots[want % SHM_RING_SLOTS];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        frame->buf_index = slot->buf_index;
+        frame->bytesused = slot->bytesused;
+        frame->timestamp_ns = slot->timestamp_ns;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (seq == want && __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == want) {
+            frame->seq = want;
+            c->last_seq = want;
+            return 1;
+        }
+        /* overwritten while reading, start over from the new head */
+        c->last_seq = want;
+    }
+}
+
+/* whether the buffer of a frame has not been reused by the producer yet */
+int shm_ring_still_valid(struct shm_ring_consumer* c,
+    const struct shm_ring_slot* frame)
+{
+    uint64_t head = __atomic_load_n(&c->ring->head, __ATOMIC_ACQUIRE);
+
+    /* the producer may already be converting frame head + 1 into it */
+    return head - frame->seq + 1 < c->num_bufs;
+}
+
+void shm_ring_detach(struct shm_ring_consumer* c)
+{
+    unsigned int i;
+
+    if (c->ring)
+        munmap(c->ring, sizeof(*c->ring));
+    if (c->ring_fd >= 0)
+        close(c->ring_fd);
+    for (i = 0; i < c->num_bufs; i++)
+        close(c->buf_fds[i]);
+
+    memset(c, 0, sizeof(*c));
+    c->ring_fd = -1;
+}
@@ -0,0 +1,83 @@
+/*
+ * Shared-memory output ring for downstream consumers of the converted
+ * frames.
+ *
+ * The producer exports the destination buffers as dma-buf fds and a memfd
+ * holding a struct shm_ring. A consumer connects to the unix socket once and
+ * receives all of them in a single SCM_RIGHTS message: the ring memfd
+ * first, then the dma-buf of buffer index 0..num_bufs-1. After that every
+ * completed frame is announced lock-free through the ring only.
+ *
+ * Each slot is a small seqlock: seq is 0 while the producer rewrites it and
+ * the frame sequence number once it is complete. A buffer index is reused
+ * by the producer num_bufs frames later and may be rewritten as soon as the
+ * frame before that is published, so a consumer that reads the pixel data
+ * in place calls shm_ring_still_valid() after reading it. Reading in place
+ * needs --num-bufs 2 or more on the producer side.
+ */
+
+#ifndef __SHMRING_H_INCLUDED__
+#define __SHMRING_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "binding.h"
+
+#define SHM_RING_MAGIC 0x52474152 /* "RAGR" */
+#define SHM_RING_VERSION 1
+#define SHM_RING_SLOTS 16
+
+struct shm_ring_slot {
+	uint64_t seq;
+	uint32_t buf_index;
+	uint32_t bytesused;
+	uint64_t timestamp_ns;
+};
+
+struct shm_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t drm_format;
+	uint32_t pitch;
+	uint32_t num_bufs;
+	uint32_t num_slots;
+	/* sequence number of the last published frame, 0 before the first */
+	uint64_t head;
+	struct shm_ring_slot slots[SHM_RING_SLOTS];
+};
+
+struct shm_ring_producer {
+	const char *path;
+	int listen_fd;
+	int ring_fd;
+	struct shm_ring *ring;
+	struct buf_binding_table *bufs;
+	unsigned long consumers;
+};
+
+struct shm_ring_consumer {
+	int ring_fd;
+	struct shm_ring *ring;
+	int buf_fds[BINDING_MAX_BUFS];
+	unsigned int num_bufs;
+	uint64_t last_seq;
+};
+
+/* producer side */
+int shm_ring_create(struct shm_ring_producer *p, const char *path,
+		    struct buf_binding_table *bufs);
+void shm_ring_accept(struct shm_ring_producer *p);
+void shm_ring_publish(struct shm_ring_producer *p, uint32_t buf_index,
+		      uint32_t bytesused);
+void shm_ring_destroy(struct shm_ring_producer *p);
+
+/* consumer side */
+int shm_ring_attach(struct shm_ring_consumer *c, const char *path);
+int shm_ring_next(struct shm_ring_consumer *c, struct shm_ring_slot *frame);
+int shm_ring_still_valid(struct shm_ring_consumer *c,
+			 const struct shm_ring_slot *frame);
+void shm_ring_detach(struct shm_ring_consumer *c);
+
+#endif /* __SHMRING_H_INCLUDED__ */
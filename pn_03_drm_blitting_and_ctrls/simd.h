@@ -0,0 +1,52 @@
+/*
+ * SIMD feature selection shared by the CPU image kernels.
+ *
+ * NEON is always there on the RK3566 (aarch64), the kernels use A64 only
+ * intrinsics and 32-bit ARM builds fall back to scalar code. x86 builds are
+ * only used as test hosts: SSE2 is part of the x86-64 baseline, AVX2 kernels
+ * are compiled with a target attribute and picked at runtime if the CPU has
+ * it.
+ */
+
+#ifndef __SIMD_H_INCLUDED__
+#define __SIMD_H_INCLUDED__
+
+#if defined(__aarch64__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_AVX2 1
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define cpu_has_avx2() __builtin_cpu_supports("avx2")
+#define cpu_has_ssse3() __builtin_cpu_supports("ssse3")
+#endif
+
+/*
+ * The kernel a module runs: the requested one if it is available, else the
+ * best available. Kernel enums are ordered by preference, the scalar kernel
+ * at 0 is always there.
+ */
+template <typename E>
+static inline int simd_pick_kernel(int requested, int count, int (*available)(E))
+{
+	int k;
+
+	if (requested >= 0 && requested < count && available((E)requested))
+		return requested;
+	for (k = count - 1; k > 0; k--) {
+		if (available((E)k))
+			break;
+	}
+	return k;
+}
+
+#endif /* __SIMD_H_INCLUDED__ */
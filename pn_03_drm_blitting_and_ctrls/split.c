@@ -0,0 +1,62 @@
+/*
+ * Adaptive split of a frame between the RGA and the CPU.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "split.h"
+
+/* weight of the newest frame in the rate estimates */
+#define SPLIT_EWMA 0.25
+
+static uint32_t clamp_rows(const struct split_tuner* t, double rows)
+{
+    uint32_t r = (uint32_t)(rows / t->align + 0.5) * t->align;
+
+    /* both keep some rows, so both rates stay measured */
+    if (r < t->align)
+        r = t->align;
+    /* the rows need not be a multiple of align, the split has to be */
+    if (r > t->rows - t->align)
+        r = (t->rows - t->align) & ~(t->align - 1);
+    return r;
+}
+
+void split_init(struct split_tuner* t, uint32_t rows, uint32_t align)
+{
+    memset(t, 0, sizeof(*t));
+    t->rows = rows;
+    t->align = align;
+    t->rga_rows = clamp_rows(t, rows / 2.0);
+    t->min_ns = UINT64_MAX;
+}
+
+void split_update(struct split_tuner* t, uint64_t rga_ns, uint64_t cpu_ns,
+    uint64_t frame_ns)
+{
+    double rga = t->rga_rows * 1e9 / (rga_ns ? rga_ns : 1);
+    double cpu = (t->rows - t->rga_rows) * 1e9 / (cpu_ns ? cpu_ns : 1);
+
+    t->rga_rate = t->frames ? t->rga_rate + SPLIT_EWMA * (rga - t->rga_rate) : rga;
+    t->cpu_rate = t->frames ? t->cpu_rate + SPLIT_EWMA * (cpu - t->cpu_rate) : cpu;
+    t->frames++;
+    t->sum_ns += frame_ns;
+    if (frame_ns < t->min_ns)
+        t->min_ns = frame_ns;
+
+    /* both done at once: rga_rows / rga_rate = (rows - rga_rows) / cpu_rate */
+    t->rga_rows = clamp_rows(t, t->rows * t->rga_rate / (t->rga_rate + t->cpu_rate));
+}
+
+void split_report(const struct split_tuner* t, uint32_t width)
+{
+    double px = (double)width * t->rows;
+
+    if (!t->frames)
+        return;
+    printf("split: %lu frames, %u of %u rows on the RGA, RGA %.1f Mpx/s, CPU %.1f Mpx/s,"
+           " together %.1f Mpx/s average, %.1f Mpx/s best\n",
+        t->frames, t->rga_rows, t->rows, t->rga_rate * width / 1e6, t->cpu_rate * width / 1e6,
+        px * t->frames / (t->sum_ns / 1e3), px / (t->min_ns / 1e3));
+}
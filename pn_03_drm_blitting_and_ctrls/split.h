@@ -0,0 +1,41 @@
+/*
+ * Splitting frames between the RGA and the CPU.
+ *
+ * The RGA converts the top rows of a frame, restricted to them with the
+ * selection API, while the CPU converts the rest into the same buffer.
+ * The fastest split has both finish at once, so after every frame the
+ * rows per second each managed are folded into a running estimate and the
+ * next frame is split in proportion to them.
+ */
+
+#ifndef __SPLIT_H_INCLUDED__
+#define __SPLIT_H_INCLUDED__
+
+#include <stdint.h>
+
+struct split_tuner {
+	uint32_t rows;
+	/* split points are a multiple of this power of two, the dither period */
+	uint32_t align;
+	/* rows given to the RGA this frame */
+	uint32_t rga_rows;
+	/* running estimates in rows per second, 0 before the first frame */
+	double rga_rate;
+	double cpu_rate;
+	/* for the report */
+	unsigned long frames;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+};
+
+void split_init(struct split_tuner *t, uint32_t rows, uint32_t align);
+/*
+ * Account a frame split at t->rga_rows: the RGA took rga_ns for its rows,
+ * the CPU cpu_ns for the rest, both started together and the frame was
+ * done after frame_ns. Picks the next t->rga_rows.
+ */
+void split_update(struct split_tuner *t, uint64_t rga_ns, uint64_t cpu_ns,
+		  uint64_t frame_ns);
+void split_report(const struct split_tuner *t, uint32_t width);
+
+#endif /* __SPLIT_H_INCLUDED__ */
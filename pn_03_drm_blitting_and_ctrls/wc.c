@@ -0,0 +1,245 @@
+/*
+ * Burst copies into write-combined memory and the cached shadows of bos.
+ *
+ * The copy kernels store the unaligned head of a span with memcpy, then
+ * whole 64 byte lines from an aligned address, so the write-combining
+ * buffers are flushed full rather than as partial writes. The x86 kernel
+ * uses non-temporal stores, which also keep the destination out of the
+ * caches; arm64 has no non-temporal vector stores as intrinsics, there the
+ * four 16 byte stores of a line are issued back to back.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bo.h"
+#include "memtrack.h"
+#include "pool.h"
+#include "simd.h"
+#include "wc.h"
+
+#define WC_LINE 64
+
+/* bytes of a copy handed to one thread at a time, a multiple of the line */
+#define WC_CHUNK (64 << 10)
+
+typedef void (*copy_fn)(uint8_t* dst, const uint8_t* src, size_t len);
+
+static const char* kernel_names[NUM_WC_KERNELS] = {
+    "scalar", "sse2", "neon"
+};
+
+static void copy_scalar(uint8_t* d, const uint8_t* s, size_t len)
+{
+    memcpy(d, s, len);
+}
+
+#ifdef HAVE_SSE2
+static void copy_sse2(uint8_t* d, const uint8_t* s, size_t len)
+{
+    size_t head = -(uintptr_t)d & (WC_LINE - 1);
+
+    if (head >= len) {
+        memcpy(d, s, len);
+        return;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+
+    for (; len >= WC_LINE; len -= WC_LINE, d += WC_LINE, s += WC_LINE) {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+
+        _mm_stream_si128((__m128i*)d, a);
+        _mm_stream_si128((__m128i*)(d + 16), b);
+        _mm_stream_si128((__m128i*)(d + 32), c);
+        _mm_stream_si128((__m128i*)(d + 48), e);
+    }
+    /* the streamed lines are weakly ordered, have them out before the tail */
+    _mm_sfence();
+    memcpy(d, s, len);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void copy_neon(uint8_t* d, const uint8_t* s, size_t len)
+{
+    size_t head = -(uintptr_t)d & (WC_LINE - 1);
+
+    if (head >= len) {
+        memcpy(d, s, len);
+        return;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+
+    for (; len >= WC_LINE; len -= WC_LINE, d += WC_LINE, s += WC_LINE) {
+        uint8x16_t a = vld1q_u8(s);
+        uint8x16_t b = vld1q_u8(s + 16);
+        uint8x16_t c = vld1q_u8(s + 32);
+        uint8x16_t e = vld1q_u8(s + 48);
+
+        vst1q_u8(d, a);
+        vst1q_u8(d + 16, b);
+        vst1q_u8(d + 32, c);
+        vst1q_u8(d + 48, e);
+    }
+    memcpy(d, s, len);
+}
+#endif
+
+static copy_fn copy_kernels[NUM_WC_KERNELS] = {
+    copy_scalar,
+#ifdef HAVE_SSE2
+    copy_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    copy_neon,
+#else
+    NULL,
+#endif
+};
+
+static copy_fn copy_kernel = NULL;
+
+int wc_kernel_available(enum wc_kernel kernel)
+{
+    return kernel >= 0 && kernel < NUM_WC_KERNELS && copy_kernels[kernel];
+}
+
+const char* wc_kernel_name(enum wc_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void wc_select_kernel(int kernel)
+{
+    copy_kernel = copy_kernels[simd_pick_kernel(kernel, NUM_WC_KERNELS, wc_kernel_available)];
+}
+
+struct wc_job {
+    uint8_t* dst;
+    const uint8_t* src;
+    size_t dst_pitch;
+    size_t src_pitch;
+    size_t row_bytes;
+    size_t len;
+};
+
+/* chunks start at multiples of the line from the aligned start of dst */
+static void span_band(void* arg, uint32_t c0, uint32_t c1)
+{
+    struct wc_job* job = (struct wc_job*)arg;
+    size_t head = -(uintptr_t)job->dst & (WC_LINE - 1);
+    size_t start = c0 ? head + (size_t)c0 * WC_CHUNK : 0;
+    size_t end = head + (size_t)c1 * WC_CHUNK;
+
+    if (end > job->len)
+        end = job->len;
+    if (start < end)
+        copy_kernel(job->dst + start, job->src + start, end - start);
+}
+
+void wc_copy(void* dst, const void* src, size_t len)
+{
+    struct wc_job job;
+
+    if (!copy_kernel)
+        wc_select_kernel(-1);
+
+    job.dst = (uint8_t*)dst;
+    job.src = (const uint8_t*)src;
+    job.len = len;
+    parallel_for((len + WC_CHUNK - 1) / WC_CHUNK, 1, span_band, &job);
+}
+
+static void rows_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct wc_job* job = (struct wc_job*)arg;
+    uint32_t y;
+
+    for (y = y0; y < y1; y++)
+        copy_kernel(job->dst + y * job->dst_pitch, job->src + y * job->src_pitch, job->row_bytes);
+}
+
+void wc_copy_rows(void* dst, uint32_t dst_pitch, const void* src,
+    uint32_t src_pitch, size_t row_bytes, uint32_t height)
+{
+    struct wc_job job;
+
+    if (dst_pitch == row_bytes && src_pitch == row_bytes) {
+        wc_copy(dst, src, row_bytes * height);
+        return;
+    }
+    if (!copy_kernel)
+        wc_select_kernel(-1);
+
+    job.dst = (uint8_t*)dst;
+    job.src = (const uint8_t*)src;
+    job.dst_pitch = dst_pitch;
+    job.src_pitch = src_pitch;
+    job.row_bytes = row_bytes;
+    parallel_for(height, 16, rows_band, &job);
+}
+
+uint8_t* wc_shadow(struct sp_bo* bo)
+{
+    if (bo->shadow)
+        return bo->shadow;
+    if (memtrack_reserve(MEM_ROLE_STAGING, MEM_BACKEND_HEAP, bo->size))
+        return NULL;
+    bo->shadow = (uint8_t*)aligned_alloc(WC_LINE, (bo->size + WC_LINE - 1) & ~(size_t)(WC_LINE - 1));
+    if (!bo->shadow) {
+        memtrack_release(MEM_ROLE_STAGING, MEM_BACKEND_HEAP, bo->size);
+        return NULL;
+    }
+    bo->shadow_current = 0;
+    return bo->shadow;
+}
+
+/*
+ * The one read of the mapping, in one sequential pass: uncached loads are
+ * slow whatever the width, but at least each line is fetched once.
+ */
+uint8_t* wc_shadow_pull(struct sp_bo* bo)
+{
+    if (!wc_shadow(bo))
+        return NULL;
+    if (!bo->shadow_current) {
+        memcpy(bo->shadow, bo->map_addr, bo->size);
+        bo->shadow_current = 1;
+    }
+    return bo->shadow;
+}
+
+void wc_shadow_push(struct sp_bo* bo)
+{
+    if (!bo->shadow)
+        return;
+    wc_copy(bo->map_addr, bo->shadow, bo->size);
+    bo->shadow_current = 1;
+}
+
+void wc_shadow_invalidate(struct sp_bo* bo)
+{
+    bo->shadow_current = 0;
+}
+
+void wc_shadow_free(struct sp_bo* bo)
+{
+    if (!bo->shadow)
+        return;
+    free(bo->shadow);
+    memtrack_release(MEM_ROLE_STAGING, MEM_BACKEND_HEAP, bo->size);
+    bo->shadow = NULL;
+    bo->shadow_current = 0;
+}
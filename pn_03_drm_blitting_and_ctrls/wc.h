@@ -0,0 +1,47 @@
+/*
+ * Access to the write-combined mappings of dumb buffers.
+ *
+ * Stores to a write-combined mapping only go out at full speed as whole
+ * cache line bursts, and loads from it are uncached. wc_copy() writes
+ * full, aligned 64 byte lines, with non-temporal stores where the CPU has
+ * them, and the shadow of a bo is a cached copy the CPU passes read and
+ * write instead of the mapping: it is pulled from the mapping once after
+ * the RGA wrote the bo and pushed to it once after the CPU did.
+ */
+
+#ifndef __WC_H_INCLUDED__
+#define __WC_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct sp_bo;
+
+enum wc_kernel {
+	WC_KERNEL_SCALAR,
+	WC_KERNEL_SSE2,
+	WC_KERNEL_NEON,
+	NUM_WC_KERNELS
+};
+
+int wc_kernel_available(enum wc_kernel kernel);
+const char *wc_kernel_name(enum wc_kernel kernel);
+void wc_select_kernel(int kernel);
+
+/* len bytes into a write-combined mapping, split over the pool */
+void wc_copy(void *dst, const void *src, size_t len);
+/* height rows of row_bytes, for pitches that differ */
+void wc_copy_rows(void *dst, uint32_t dst_pitch, const void *src,
+		  uint32_t src_pitch, size_t row_bytes, uint32_t height);
+
+/* the shadow of bo, allocated on first use, NULL if out of memory */
+uint8_t *wc_shadow(struct sp_bo *bo);
+/* the shadow with the contents of the mapping, copied over unless current */
+uint8_t *wc_shadow_pull(struct sp_bo *bo);
+/* the shadow was written by the CPU, copy it into the mapping */
+void wc_shadow_push(struct sp_bo *bo);
+/* the mapping was written by a device, the shadow is out of date */
+void wc_shadow_invalidate(struct sp_bo *bo);
+void wc_shadow_free(struct sp_bo *bo);
+
+#endif /* __WC_H_INCLUDED__ */
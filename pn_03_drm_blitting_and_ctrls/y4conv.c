@@ -0,0 +1,503 @@
+/*
+ * CPU implementation of the RGA RGB to Y4 conversion.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bluenoise.h"
+#include "pool.h"
+#include "simd.h"
+#include "y4conv.h"
+
+/* don't bother handing out fewer rows to a thread */
+#define Y4CONV_MIN_BAND 16
+
+static const char* kernel_names[NUM_Y4CONV_KERNELS] = {
+    "scalar", "ssse3", "neon"
+};
+
+/* 4x4 ordered dither matrix the dither down offsets are taken from */
+static const uint8_t bayer4[4][4] = {
+    { 0, 8, 2, 10 },
+    { 12, 4, 14, 6 },
+    { 3, 11, 1, 9 },
+    { 15, 7, 13, 5 },
+};
+
+/* bits dropped from r, g and b by each dither down mode */
+static const uint8_t dither_bits[NUM_Y4_DITHER_MODES][3] = {
+    { 2, 2, 2 },
+    { 3, 2, 3 },
+    { 3, 3, 3 },
+    { 4, 4, 4 },
+};
+
+static const uint16_t luma_weights[3] = { 77, 150, 29 };
+
+/*
+ * Everything the row kernels need, set up once per frame. The dither
+ * offsets are stored per row phase (y & 3), repeated over a whole vector so
+ * a kernel can add them to 8 or 16 pixels starting at a multiple of 4.
+ */
+struct y4_ctx {
+    /* bytes per pixel and byte offsets of r, g and b */
+    unsigned int cpp;
+    unsigned int chan[3];
+    uint8_t off8[4][3][16];
+    uint16_t off16[4][3][8];
+    uint8_t mask8[3][16];
+    uint16_t mask16[3][8];
+    /* pshufb masks gathering one channel of 8 pixels into 16 bit lanes */
+    uint8_t shuf_lo[3][16];
+    uint8_t shuf_hi[3][16];
+    unsigned int hi_base;
+    int dither;
+    /* table of the curve, NULL without one */
+    const uint8_t* curve;
+    /* the luma each level starts at, 255 past the highest one used */
+    uint8_t thr[16];
+    uint8_t top[16];
+};
+
+/* converts pixels [0, n) of a row and returns n, a multiple of 2 */
+typedef uint32_t (*row_fn)(uint8_t* dst, const uint8_t* src, uint32_t width,
+    const struct y4_ctx* c, unsigned int phase);
+
+static inline uint8_t y4_pixel(const uint8_t* p, const struct y4_ctx* c,
+    unsigned int phase, uint32_t x)
+{
+    uint32_t sum = 128;
+    unsigned int k;
+
+    for (k = 0; k < 3; k++) {
+        uint32_t v = p[c->chan[k]] + c->off8[phase][k][x & 3];
+
+        if (v > 255)
+            v = 255;
+        sum += (v & c->mask8[k][0]) * luma_weights[k];
+    }
+    return c->curve ? c->curve[sum >> 8] : sum >> 12;
+}
+
+static void row_tail(uint8_t* dst, const uint8_t* src, uint32_t x,
+    uint32_t width, const struct y4_ctx* c, unsigned int phase)
+{
+    const uint8_t* p = src + (size_t)x * c->cpp;
+
+    for (; x + 1 < width; x += 2, p += 2 * c->cpp)
+        dst[x / 2] = y4_pixel(p, c, phase, x) << 4
+            | y4_pixel(p + c->cpp, c, phase, x + 1);
+    if (x < width)
+        dst[x / 2] = (dst[x / 2] & 0x0f) | y4_pixel(p, c, phase, x) << 4;
+}
+
+#ifdef HAVE_SSE2
+/*
+ * The level of 16 luma bytes, a binary search of the thresholds with one
+ * shuffle per bit of the level.
+ */
+TARGET_SSSE3 static inline __m128i curve_ssse3(__m128i v, __m128i thr, __m128i top)
+{
+    __m128i level = _mm_setzero_si128(), bit, next, t;
+    unsigned int b;
+
+    for (b = 8; b; b >>= 1) {
+        bit = _mm_set1_epi8(b);
+        next = _mm_or_si128(level, bit);
+        t = _mm_shuffle_epi8(thr, next);
+        level = _mm_or_si128(level, _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, t), v), bit));
+    }
+    /* 255 reaches the unused levels too */
+    return _mm_min_epu8(level, top);
+}
+
+TARGET_SSSE3 static uint32_t row_ssse3(uint8_t* dst, const uint8_t* src,
+    uint32_t width, const struct y4_ctx* c, unsigned int phase)
+{
+    __m128i shuf_lo[3], shuf_hi[3], off[3], mask[3], weight[3];
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i nibble = _mm_set1_epi16(0x00f0);
+    const __m128i thr = _mm_loadu_si128((const __m128i*)c->thr);
+    const __m128i top = _mm_loadu_si128((const __m128i*)c->top);
+    uint32_t x = 0;
+    unsigned int k, h;
+
+    for (k = 0; k < 3; k++) {
+        shuf_lo[k] = _mm_loadu_si128((const __m128i*)c->shuf_lo[k]);
+        shuf_hi[k] = _mm_loadu_si128((const __m128i*)c->shuf_hi[k]);
+        off[k] = _mm_loadu_si128((const __m128i*)c->off16[phase][k]);
+        mask[k] = _mm_loadu_si128((const __m128i*)c->mask16[k]);
+        weight[k] = _mm_set1_epi16(luma_weights[k]);
+    }
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i y[2], v;
+
+        for (h = 0; h < 2; h++) {
+            const uint8_t* p = src + (size_t)(x + 8 * h) * c->cpp;
+            __m128i lo = _mm_loadu_si128((const __m128i*)p);
+            __m128i hi = _mm_loadu_si128((const __m128i*)(p + c->hi_base));
+            __m128i sum = round;
+
+            for (k = 0; k < 3; k++) {
+                v = _mm_or_si128(_mm_shuffle_epi8(lo, shuf_lo[k]),
+                    _mm_shuffle_epi8(hi, shuf_hi[k]));
+                v = _mm_and_si128(_mm_min_epi16(_mm_add_epi16(v, off[k]), max), mask[k]);
+                /* at most 255 * 256 in total, exact in unsigned 16 bit */
+                sum = _mm_add_epi16(sum, _mm_mullo_epi16(v, weight[k]));
+            }
+            y[h] = c->curve ? _mm_srli_epi16(sum, 8) : _mm_srli_epi16(sum, 12);
+        }
+
+        /* 16 levels, then pixel 2i to the high and 2i+1 to the low nibble */
+        v = _mm_packus_epi16(y[0], y[1]);
+        if (c->curve)
+            v = curve_ssse3(v, thr, top);
+        v = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 4), nibble),
+            _mm_srli_epi16(v, 8));
+        _mm_storel_epi64((__m128i*)(dst + x / 2), _mm_packus_epi16(v, v));
+    }
+    return x;
+}
+#endif
+
+#ifdef HAVE_NEON
+static uint32_t row_neon(uint8_t* dst, const uint8_t* src, uint32_t width,
+    const struct y4_ctx* c, unsigned int phase)
+{
+    const uint8x16_t off_r = vld1q_u8(c->off8[phase][0]);
+    const uint8x16_t off_g = vld1q_u8(c->off8[phase][1]);
+    const uint8x16_t off_b = vld1q_u8(c->off8[phase][2]);
+    const uint8x16_t mask_r = vld1q_u8(c->mask8[0]);
+    const uint8x16_t mask_g = vld1q_u8(c->mask8[1]);
+    const uint8x16_t mask_b = vld1q_u8(c->mask8[2]);
+    const uint16x8_t round = vdupq_n_u16(128);
+    uint8x16x4_t curve[4];
+    uint32_t x = 0;
+    unsigned int k, i;
+
+    /* the 256 byte table as four for tbl/tbx, 64 entries each */
+    if (c->curve) {
+        for (k = 0; k < 4; k++) {
+            for (i = 0; i < 4; i++)
+                curve[k].val[i] = vld1q_u8(c->curve + 64 * k + 16 * i);
+        }
+    }
+
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t* p = src + (size_t)x * c->cpp;
+        uint8x16_t r, g, b, y, even, odd;
+        uint16x8_t lo, hi;
+
+        if (c->cpp == 3) {
+            uint8x16x3_t v = vld3q_u8(p);
+
+            r = v.val[c->chan[0]];
+            g = v.val[c->chan[1]];
+            b = v.val[c->chan[2]];
+        } else {
+            uint8x16x4_t v = vld4q_u8(p);
+
+            r = v.val[c->chan[0]];
+            g = v.val[c->chan[1]];
+            b = v.val[c->chan[2]];
+        }
+
+        r = vandq_u8(vqaddq_u8(r, off_r), mask_r);
+        g = vandq_u8(vqaddq_u8(g, off_g), mask_g);
+        b = vandq_u8(vqaddq_u8(b, off_b), mask_b);
+
+        lo = vmull_u8(vget_low_u8(r), vdup_n_u8(77));
+        lo = vmlal_u8(lo, vget_low_u8(g), vdup_n_u8(150));
+        lo = vmlal_u8(lo, vget_low_u8(b), vdup_n_u8(29));
+        hi = vmull_high_u8(r, vdupq_n_u8(77));
+        hi = vmlal_high_u8(hi, g, vdupq_n_u8(150));
+        hi = vmlal_high_u8(hi, b, vdupq_n_u8(29));
+        if (c->curve) {
+            lo = vshrq_n_u16(vaddq_u16(lo, round), 8);
+            hi = vshrq_n_u16(vaddq_u16(hi, round), 8);
+            r = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+            y = vqtbl4q_u8(curve[0], r);
+            y = vqtbx4q_u8(y, curve[1], vsubq_u8(r, vdupq_n_u8(64)));
+            y = vqtbx4q_u8(y, curve[2], vsubq_u8(r, vdupq_n_u8(128)));
+            y = vqtbx4q_u8(y, curve[3], vsubq_u8(r, vdupq_n_u8(192)));
+        } else {
+            lo = vshrq_n_u16(vaddq_u16(lo, round), 12);
+            hi = vshrq_n_u16(vaddq_u16(hi, round), 12);
+            y = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+        }
+        even = vuzp1q_u8(y, y);
+        odd = vuzp2q_u8(y, y);
+        vst1_u8(dst + x / 2, vget_low_u8(vorrq_u8(vshlq_n_u8(even, 4), odd)));
+    }
+    return x;
+}
+#endif
+
+/*
+ * GREY sources: without dither the luma is the gray value itself, so the
+ * vector kernels only quantize and pack. With dither each pixel is weighed
+ * like r, g and b with their own offsets and masks.
+ */
+#ifdef HAVE_SSE2
+TARGET_SSSE3 static uint32_t gray_ssse3(uint8_t* dst, const uint8_t* src,
+    uint32_t width, const struct y4_ctx* c, unsigned int phase)
+{
+    const __m128i nibble = _mm_set1_epi16(0x00f0);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    const __m128i thr = _mm_loadu_si128((const __m128i*)c->thr);
+    const __m128i top = _mm_loadu_si128((const __m128i*)c->top);
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i off[3], mask[3], weight[3], y[2], g, sum, v;
+    uint32_t x = 0;
+    unsigned int k, h;
+
+    for (k = 0; k < 3; k++) {
+        off[k] = _mm_loadu_si128((const __m128i*)c->off16[phase][k]);
+        mask[k] = _mm_loadu_si128((const __m128i*)c->mask16[k]);
+        weight[k] = _mm_set1_epi16(luma_weights[k]);
+    }
+
+    for (; x + 16 <= width; x += 16) {
+        v = _mm_loadu_si128((const __m128i*)(src + x));
+        if (c->dither) {
+            for (h = 0; h < 2; h++) {
+                g = h ? _mm_unpackhi_epi8(v, _mm_setzero_si128())
+                      : _mm_unpacklo_epi8(v, _mm_setzero_si128());
+                sum = round;
+                for (k = 0; k < 3; k++)
+                    sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_and_si128(
+                        _mm_min_epi16(_mm_add_epi16(g, off[k]), max), mask[k]), weight[k]));
+                y[h] = _mm_srli_epi16(sum, 8);
+            }
+            v = _mm_packus_epi16(y[0], y[1]);
+        }
+        if (c->curve)
+            v = curve_ssse3(v, thr, top);
+        else
+            v = _mm_and_si128(_mm_srli_epi16(v, 4), low);
+        v = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 4), nibble),
+            _mm_srli_epi16(v, 8));
+        _mm_storel_epi64((__m128i*)(dst + x / 2), _mm_packus_epi16(v, v));
+    }
+    return x;
+}
+#endif
+
+#ifdef HAVE_NEON
+static uint32_t gray_neon(uint8_t* dst, const uint8_t* src, uint32_t width,
+    const struct y4_ctx* c, unsigned int phase)
+{
+    const uint8x16_t off_r = vld1q_u8(c->off8[phase][0]);
+    const uint8x16_t off_g = vld1q_u8(c->off8[phase][1]);
+    const uint8x16_t off_b = vld1q_u8(c->off8[phase][2]);
+    const uint8x16_t mask_r = vld1q_u8(c->mask8[0]);
+    const uint8x16_t mask_g = vld1q_u8(c->mask8[1]);
+    const uint8x16_t mask_b = vld1q_u8(c->mask8[2]);
+    uint8x16x4_t curve[4];
+    uint8x16_t v, y, r, g, b;
+    uint16x8_t lo, hi;
+    uint32_t x = 0;
+    unsigned int k, i;
+
+    if (c->curve) {
+        for (k = 0; k < 4; k++) {
+            for (i = 0; i < 4; i++)
+                curve[k].val[i] = vld1q_u8(c->curve + 64 * k + 16 * i);
+        }
+    }
+
+    for (; x + 16 <= width; x += 16) {
+        v = vld1q_u8(src + x);
+        if (c->dither) {
+            r = vandq_u8(vqaddq_u8(v, off_r), mask_r);
+            g = vandq_u8(vqaddq_u8(v, off_g), mask_g);
+            b = vandq_u8(vqaddq_u8(v, off_b), mask_b);
+            lo = vmull_u8(vget_low_u8(r), vdup_n_u8(77));
+            lo = vmlal_u8(lo, vget_low_u8(g), vdup_n_u8(150));
+            lo = vmlal_u8(lo, vget_low_u8(b), vdup_n_u8(29));
+            hi = vmull_high_u8(r, vdupq_n_u8(77));
+            hi = vmlal_high_u8(hi, g, vdupq_n_u8(150));
+            hi = vmlal_high_u8(hi, b, vdupq_n_u8(29));
+            v = vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8));
+        }
+        if (c->curve) {
+            y = vqtbl4q_u8(curve[0], v);
+            y = vqtbx4q_u8(y, curve[1], vsubq_u8(v, vdupq_n_u8(64)));
+            y = vqtbx4q_u8(y, curve[2], vsubq_u8(v, vdupq_n_u8(128)));
+            y = vqtbx4q_u8(y, curve[3], vsubq_u8(v, vdupq_n_u8(192)));
+        } else {
+            y = vshrq_n_u8(v, 4);
+        }
+        vst1_u8(dst + x / 2, vget_low_u8(vorrq_u8(vshlq_n_u8(vuzp1q_u8(y, y), 4),
+            vuzp2q_u8(y, y))));
+    }
+    return x;
+}
+#endif
+
+/* NULL leaves the whole row to row_tail() */
+static row_fn gray_kernels[NUM_Y4CONV_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    gray_ssse3,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    gray_neon,
+#else
+    NULL,
+#endif
+};
+
+static row_fn row_kernels[NUM_Y4CONV_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    row_ssse3,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    row_neon,
+#else
+    NULL,
+#endif
+};
+
+/* index into the tables, -1 until the first frame picks the best one */
+static int selected = -1;
+
+int y4conv_kernel_available(enum y4conv_kernel kernel)
+{
+    if (kernel < 0 || kernel >= NUM_Y4CONV_KERNELS
+        || (kernel != Y4CONV_KERNEL_SCALAR && !row_kernels[kernel]))
+        return 0;
+#ifdef HAVE_SSE2
+    if (kernel == Y4CONV_KERNEL_SSSE3)
+        return cpu_has_ssse3();
+#endif
+    return 1;
+}
+
+const char* y4conv_kernel_name(enum y4conv_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void y4conv_select_kernel(int kernel)
+{
+    selected = simd_pick_kernel(kernel, NUM_Y4CONV_KERNELS, y4conv_kernel_available);
+}
+
+int y4conv_supported(const struct pix_fmt* src)
+{
+    struct y4_ctx c;
+
+    return src->v4l2 == V4L2_PIX_FMT_GREY || !pix_fmt_rgb_layout(src, &c.cpp, c.chan);
+}
+
+static int setup_ctx(struct y4_ctx* c, const struct pix_fmt* src,
+    const struct y4conv_params* params)
+{
+    unsigned int k, i, phase, bits;
+
+    memset(c, 0, sizeof(*c));
+    /* gray is r = g = b, all three read from the one byte */
+    if (src->v4l2 == V4L2_PIX_FMT_GREY)
+        c->cpp = 1;
+    else if (pix_fmt_rgb_layout(src, &c->cpp, c->chan))
+        return -EINVAL;
+    if (params->dither && params->dither_mode >= NUM_Y4_DITHER_MODES)
+        return -EINVAL;
+
+    c->dither = params->dither;
+    c->hi_base = c->cpp == 3 ? 8 : c->cpp == 4 ? 16 : 0;
+
+    if (params->curve) {
+        c->curve = params->curve->table;
+        memset(c->top, c->curve[255], 16);
+        memset(c->thr, 255, 16);
+        for (k = 1, i = 0; k <= c->curve[255]; k++) {
+            while (c->curve[i] < k)
+                i++;
+            c->thr[k] = i;
+        }
+    }
+
+    for (k = 0; k < 3; k++) {
+        bits = params->dither ? dither_bits[params->dither_mode][k] : 0;
+
+        for (i = 0; i < 16; i++) {
+            c->mask8[k][i] = 0xff & ~((1 << bits) - 1);
+            for (phase = 0; phase < 4; phase++)
+                c->off8[phase][k][i] = (bayer4[phase][i & 3] << bits) >> 4;
+        }
+        for (i = 0; i < 8; i++) {
+            c->mask16[k][i] = c->mask8[k][i];
+            for (phase = 0; phase < 4; phase++)
+                c->off16[phase][k][i] = c->off8[phase][k][i];
+        }
+
+        /* pixels 0-3 from the first load, 4-7 from the one at hi_base */
+        for (i = 0; i < 16; i++) {
+            c->shuf_lo[k][i] = 0x80;
+            c->shuf_hi[k][i] = 0x80;
+        }
+        for (i = 0; i < 4; i++) {
+            c->shuf_lo[k][2 * i] = i * c->cpp + c->chan[k];
+            c->shuf_hi[k][8 + 2 * i] = (4 + i) * c->cpp + c->chan[k] - c->hi_base;
+        }
+    }
+    return 0;
+}
+
+struct y4_job {
+    const struct y4_ctx* ctx;
+    const struct image* dst;
+    const struct image* src;
+    uint32_t width;
+};
+
+static void convert_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct y4_job* job = (struct y4_job*)arg;
+    row_fn row = (job->ctx->cpp == 1 ? gray_kernels : row_kernels)[selected];
+    uint32_t x, y;
+
+    for (y = y0; y < y1; y++) {
+        uint8_t* d = image_row(job->dst, y);
+        const uint8_t* s = image_row(job->src, y);
+
+        x = row ? row(d, s, job->width, job->ctx, y & 3) : 0;
+        row_tail(d, s, x, job->width, job->ctx, y & 3);
+    }
+}
+
+int y4conv_frame(const struct image* dst, const struct image* src,
+    const struct y4conv_params* params)
+{
+    struct y4_ctx ctx;
+    struct y4_job job;
+    uint32_t height;
+
+    if (params->dither && params->dither_mode == Y4_DITHER_BLUE_NOISE)
+        return bluenoise_frame(dst, src, params->levels);
+    if (dst->fmt->v4l2 != V4L2_PIX_FMT_Y4 || setup_ctx(&ctx, src->fmt, params))
+        return -EINVAL;
+    if (selected < 0)
+        y4conv_select_kernel(-1);
+
+    job.ctx = &ctx;
+    job.dst = dst;
+    job.src = src;
+    job.width = src->width < dst->width ? src->width : dst->width;
+    height = src->height < dst->height ? src->height : dst->height;
+
+    parallel_for(height, Y4CONV_MIN_BAND, convert_band, &job);
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * CPU implementation of the RGA RGB to Y4 conversion.
+ *
+ * It mirrors what the RGA does with "Enable Y4 conversion" and "Enable
+ * Y400 conversion" set: an optional dither down of the source to a lower
+ * color depth ("Dither down mode"), the Y400 luma of each pixel and the
+ * upper 4 bits of it packed two pixels per byte like DRM_FORMAT_R4. It is
+ * the fallback backend when there is no RGA and the reference to check the
+ * hardware output against.
+ *
+ * Sources are RGB24, XRGB32/ARGB32, XBGR32/ABGR32 with the V4L2 byte
+ * order of the format and GREY, dithered as if r, g and b were the gray.
+ * No scaling is done: the part of the frame covered by both images is
+ * converted.
+ *
+ * With a curve the luma is quantized with its table instead of keeping the
+ * upper 4 bits, in the same pass.
+ */
+
+#ifndef __Y4CONV_H_INCLUDED__
+#define __Y4CONV_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "image.h"
+#include "y4lut.h"
+
+/* values of the "Dither down mode" control, the depth dithered down to */
+enum y4_dither_mode {
+	Y4_DITHER_888_TO_666,
+	Y4_DITHER_888_TO_565,
+	Y4_DITHER_888_TO_555,
+	Y4_DITHER_888_TO_444,
+	NUM_Y4_DITHER_MODES,
+	/* not an RGA mode: blue noise thresholds on the luma, see bluenoise.h */
+	Y4_DITHER_BLUE_NOISE = NUM_Y4_DITHER_MODES
+};
+
+enum y4conv_kernel {
+	Y4CONV_KERNEL_SCALAR,
+	Y4CONV_KERNEL_SSSE3,
+	Y4CONV_KERNEL_NEON,
+	NUM_Y4CONV_KERNELS
+};
+
+struct y4conv_params {
+	int dither;
+	enum y4_dither_mode dither_mode;
+	/* gray levels of Y4_DITHER_BLUE_NOISE: 16, 4 or 2 */
+	unsigned int levels;
+	/* NULL for the upper 4 bits of the luma, not used by blue noise */
+	const struct y4_curve *curve;
+};
+
+int y4conv_kernel_available(enum y4conv_kernel kernel);
+const char *y4conv_kernel_name(enum y4conv_kernel kernel);
+void y4conv_select_kernel(int kernel);
+
+int y4conv_supported(const struct pix_fmt *src);
+int y4conv_frame(const struct image *dst, const struct image *src,
+		 const struct y4conv_params *params);
+
+#endif /* __Y4CONV_H_INCLUDED__ */
@@ -0,0 +1,330 @@
+/*
+ * 16 entry gray level remapping of Y4 frames, the Y4MAP LUT of the RGA.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "simd.h"
+#include "y4lut.h"
+
+/* the table in the shapes the kernels want it */
+struct y4_lut_tables {
+    /* remapped byte, both nibbles at once */
+    uint8_t byte[256];
+    /* level -> level for the low nibble, level -> level << 4 for the high */
+    uint8_t lo[16];
+    uint8_t hi[16];
+};
+
+typedef void (*lut_fn)(uint8_t* p, size_t len, const struct y4_lut_tables* t);
+
+static const char* kernel_names[NUM_Y4LUT_KERNELS] = {
+    "scalar", "ssse3", "avx2", "neon"
+};
+
+static void lut_scalar(uint8_t* p, size_t len, const struct y4_lut_tables* t)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        p[i] = t->byte[p[i]];
+}
+
+#ifdef HAVE_SSE2
+TARGET_SSSE3 static void lut_ssse3(uint8_t* p, size_t len, const struct y4_lut_tables* t)
+{
+    const __m128i lo_tab = _mm_loadu_si128((const __m128i*)t->lo);
+    const __m128i hi_tab = _mm_loadu_si128((const __m128i*)t->hi);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+
+        v = _mm_or_si128(_mm_shuffle_epi8(lo_tab, lo), _mm_shuffle_epi8(hi_tab, hi));
+        _mm_storeu_si128((__m128i*)(p + i), v);
+    }
+    lut_scalar(p + i, len - i, t);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 static void lut_avx2(uint8_t* p, size_t len, const struct y4_lut_tables* t)
+{
+    /* vpshufb looks up within each 128 bit lane, so both get the table */
+    const __m256i lo_tab = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t->lo));
+    const __m256i hi_tab = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t->hi));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i lo = _mm256_and_si256(v, mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+
+        v = _mm256_or_si256(_mm256_shuffle_epi8(lo_tab, lo), _mm256_shuffle_epi8(hi_tab, hi));
+        _mm256_storeu_si256((__m256i*)(p + i), v);
+    }
+    lut_scalar(p + i, len - i, t);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void lut_neon(uint8_t* p, size_t len, const struct y4_lut_tables* t)
+{
+    const uint8x16_t lo_tab = vld1q_u8(t->lo);
+    const uint8x16_t hi_tab = vld1q_u8(t->hi);
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(p + i);
+
+        v = vorrq_u8(vqtbl1q_u8(lo_tab, vandq_u8(v, mask)),
+            vqtbl1q_u8(hi_tab, vshrq_n_u8(v, 4)));
+        vst1q_u8(p + i, v);
+    }
+    lut_scalar(p + i, len - i, t);
+}
+#endif
+
+static lut_fn lut_kernels[NUM_Y4LUT_KERNELS] = {
+    lut_scalar,
+#ifdef HAVE_SSE2
+    lut_ssse3,
+#else
+    NULL,
+#endif
+#ifdef HAVE_AVX2
+    lut_avx2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    lut_neon,
+#else
+    NULL,
+#endif
+};
+
+static lut_fn lut_kernel = NULL;
+
+int y4lut_kernel_available(enum y4lut_kernel kernel)
+{
+    if (kernel < 0 || kernel >= NUM_Y4LUT_KERNELS || !lut_kernels[kernel])
+        return 0;
+#ifdef HAVE_SSE2
+    if (kernel == Y4LUT_KERNEL_SSSE3)
+        return cpu_has_ssse3();
+#endif
+#ifdef HAVE_AVX2
+    if (kernel == Y4LUT_KERNEL_AVX2)
+        return cpu_has_avx2();
+#endif
+    return 1;
+}
+
+const char* y4lut_kernel_name(enum y4lut_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void y4lut_select_kernel(int kernel)
+{
+    lut_kernel = lut_kernels[simd_pick_kernel(kernel, NUM_Y4LUT_KERNELS, y4lut_kernel_available)];
+}
+
+void y4_lut_identity(struct y4_lut* lut)
+{
+    unsigned int i;
+
+    for (i = 0; i < 16; i++)
+        lut->map[i] = i;
+}
+
+void y4_lut_from_regs(struct y4_lut* lut, uint32_t lut0, uint32_t lut1)
+{
+    unsigned int i;
+
+    for (i = 0; i < 8; i++) {
+        lut->map[i] = (lut0 >> (4 * i)) & 0xf;
+        lut->map[8 + i] = (lut1 >> (4 * i)) & 0xf;
+    }
+}
+
+void y4_lut_to_regs(const struct y4_lut* lut, uint32_t* lut0, uint32_t* lut1)
+{
+    unsigned int i;
+
+    *lut0 = 0;
+    *lut1 = 0;
+    for (i = 0; i < 8; i++) {
+        *lut0 |= (uint32_t)(lut->map[i] & 0xf) << (4 * i);
+        *lut1 |= (uint32_t)(lut->map[8 + i] & 0xf) << (4 * i);
+    }
+}
+
+/*
+ * 16 numbers from 0 to max separated by white space or commas, decimal or
+ * 0x prefixed hex, '#' starting a comment.
+ */
+static int load_levels(const char* path, unsigned int max, uint8_t levels[16])
+{
+    char line[256], *p, *end;
+    unsigned int n = 0, lineno = 0;
+    long v;
+    FILE* fp;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        printf("failed to open %s\n", path);
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        p = strchr(line, '#');
+        if (p)
+            *p = '\0';
+
+        for (p = line; *p;) {
+            if (isspace((unsigned char)*p) || *p == ',') {
+                p++;
+                continue;
+            }
+            v = strtol(p, &end, 0);
+            if (end == p || v < 0 || v > (long)max || n >= 16) {
+                printf("%s:%u: expected 16 levels from 0 to %u\n", path, lineno, max);
+                fclose(fp);
+                return -EINVAL;
+            }
+            levels[n++] = v;
+            p = end;
+        }
+    }
+    fclose(fp);
+
+    if (n != 16) {
+        printf("%s: %u levels instead of 16\n", path, n);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int y4_lut_load(struct y4_lut* lut, const char* path)
+{
+    struct y4_lut tmp;
+    int ret;
+
+    ret = load_levels(path, 15, tmp.map);
+    if (ret)
+        return ret;
+    *lut = tmp;
+    return 0;
+}
+
+void y4_curve_linear(struct y4_curve* curve)
+{
+    unsigned int v;
+
+    for (v = 0; v < 256; v++)
+        curve->table[v] = v >> 4;
+}
+
+int y4_curve_from_levels(struct y4_curve* curve, const uint8_t gray[16])
+{
+    unsigned int v, k;
+
+    for (k = 1; k < 16; k++) {
+        if (gray[k] < gray[k - 1])
+            return -EINVAL;
+    }
+
+    /*
+     * The nearest level, the lower one on a tie. With the gray rising the
+     * table does too, which the threshold kernels of y4conv rely on.
+     */
+    for (v = 0, k = 0; v < 256; v++) {
+        while (k < 15 && gray[k + 1] - (int)v < (int)v - gray[k])
+            k++;
+        curve->table[v] = k;
+    }
+    return 0;
+}
+
+int y4_curve_load(struct y4_curve* curve, const char* path)
+{
+    uint8_t gray[16];
+    int ret;
+
+    ret = load_levels(path, 255, gray);
+    if (ret)
+        return ret;
+    ret = y4_curve_from_levels(curve, gray);
+    if (ret)
+        printf("%s: the gray of the levels has to rise from 0 to 15\n", path);
+    return ret;
+}
+
+void y4_curve_fold(const struct y4_curve* curve, struct y4_lut* lut)
+{
+    struct y4_lut tmp;
+    unsigned int i;
+
+    /* the luma in the middle of what each linear level covers */
+    for (i = 0; i < 16; i++)
+        tmp.map[i] = lut->map[curve->table[16 * i + 8]];
+    *lut = tmp;
+}
+
+struct lut_job {
+    const struct image* img;
+    const struct y4_lut_tables* t;
+    size_t len;
+};
+
+static void apply_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct lut_job* job = (struct lut_job*)arg;
+    uint32_t y;
+
+    /* without padding the band is one run */
+    if (job->img->pitch == job->len) {
+        lut_kernel(image_row(job->img, y0), job->len * (y1 - y0), job->t);
+        return;
+    }
+    for (y = y0; y < y1; y++)
+        lut_kernel(image_row(job->img, y), job->len, job->t);
+}
+
+int y4_lut_apply(const struct image* img, const struct y4_lut* lut)
+{
+    struct y4_lut_tables t;
+    struct lut_job job;
+    unsigned int i;
+
+    if (img->fmt->v4l2 != V4L2_PIX_FMT_Y4)
+        return -EINVAL;
+    if (!lut_kernel)
+        y4lut_select_kernel(-1);
+
+    for (i = 0; i < 16; i++) {
+        t.lo[i] = lut->map[i] & 0xf;
+        t.hi[i] = t.lo[i] << 4;
+    }
+    for (i = 0; i < 256; i++)
+        t.byte[i] = t.hi[i >> 4] | t.lo[i & 0xf];
+
+    job.img = img;
+    job.t = &t;
+    job.len = pix_fmt_row_bytes(img->fmt, img->width);
+    parallel_for(img->height, 64, apply_band, &job);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * 16 entry gray level remapping of Y4 frames, the Y4MAP LUT of the RGA.
+ *
+ * The RGA takes the table as two 32 bit controls, "Set Y4MAP LUT0" with
+ * the entries for the levels 0-7 and "Set Y4MAP LUT1" with those for 8-15,
+ * entry i in bits 4 * (i % 8) + 3 .. 4 * (i % 8). The identity is
+ * LUT0 = 0x76543210, LUT1 = 0xfedcba98.
+ *
+ * y4_lut_apply() remaps a packed Y4 frame in place on the CPU with the
+ * same table, for the CPU backend or to change the curve per frame without
+ * going through the driver.
+ */
+
+#ifndef __Y4LUT_H_INCLUDED__
+#define __Y4LUT_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "image.h"
+
+struct y4_lut {
+	uint8_t map[16];
+};
+
+enum y4lut_kernel {
+	Y4LUT_KERNEL_SCALAR,
+	Y4LUT_KERNEL_SSSE3,
+	Y4LUT_KERNEL_AVX2,
+	Y4LUT_KERNEL_NEON,
+	NUM_Y4LUT_KERNELS
+};
+
+int y4lut_kernel_available(enum y4lut_kernel kernel);
+const char *y4lut_kernel_name(enum y4lut_kernel kernel);
+void y4lut_select_kernel(int kernel);
+
+void y4_lut_identity(struct y4_lut *lut);
+void y4_lut_from_regs(struct y4_lut *lut, uint32_t lut0, uint32_t lut1);
+void y4_lut_to_regs(const struct y4_lut *lut, uint32_t *lut0, uint32_t *lut1);
+
+/*
+ * Read a table from a text file: 16 levels from 0 to 15, separated by white
+ * space or commas, decimal or 0x prefixed hex. '#' starts a comment.
+ */
+int y4_lut_load(struct y4_lut *lut, const char *path);
+
+int y4_lut_apply(const struct image *img, const struct y4_lut *lut);
+
+/*
+ * Quantization of 8 bit luma to the gray the panel shows at each of its 16
+ * levels, which is not evenly spaced like the upper 4 bits the RGA takes.
+ * The curve file holds the measured gray of the levels 0 to 15 as 16 luma
+ * values from 0 to 255 in the same format as a table file, and every luma
+ * goes to the level of the nearest gray.
+ */
+struct y4_curve {
+	/* Y4 level of each 8 bit luma, never falling */
+	uint8_t table[256];
+};
+
+void y4_curve_linear(struct y4_curve *curve);
+/* from the gray of the levels 0 to 15, -EINVAL if it falls anywhere */
+int y4_curve_from_levels(struct y4_curve *curve, const uint8_t gray[16]);
+int y4_curve_load(struct y4_curve *curve, const char *path);
+
+/*
+ * What the RGA can do with a curve: quantize linearly and then remap the
+ * levels with the table. Turns lut into that table, lut applied after the
+ * curve.
+ */
+void y4_curve_fold(const struct y4_curve *curve, struct y4_lut *lut);
+
+#endif /* __Y4LUT_H_INCLUDED__ */
@@ -0,0 +1,171 @@
+/*
+ * Nibble order and pitch conversion of Y4 frames.
+ *
+ * Rows are a run of bytes whatever the order, so repacking is a copy of
+ * each row to its new pitch, with both nibbles of every byte exchanged
+ * when the orders differ. An odd width leaves its last pixel alone in a
+ * byte, which the swap moves to the other nibble along with the rest.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "pool.h"
+#include "simd.h"
+#include "y4pack.h"
+
+/* swaps the nibbles of bytes [0, n) of a row and returns n */
+typedef size_t (*swap_fn)(uint8_t* dst, const uint8_t* src, size_t len);
+
+static const char* kernel_names[NUM_Y4PACK_KERNELS] = {
+    "scalar", "sse2", "neon"
+};
+
+static const char* order_names[NUM_Y4_NIBBLE_ORDERS] = {
+    "high", "low"
+};
+
+static void swap_tail(uint8_t* dst, const uint8_t* src, size_t i, size_t len)
+{
+    for (; i < len; i++)
+        dst[i] = (uint8_t)(src[i] << 4 | src[i] >> 4);
+}
+
+#ifdef HAVE_SSE2
+static size_t swap_sse2(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    const __m128i low = _mm_set1_epi8(0x0f);
+    __m128i a, b;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        a = _mm_loadu_si128((const __m128i*)(src + i));
+        b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low), 4),
+            _mm_and_si128(_mm_srli_epi16(a, 4), low));
+        b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low), 4),
+            _mm_and_si128(_mm_srli_epi16(b, 4), low));
+        _mm_storeu_si128((__m128i*)(dst + i), a);
+        _mm_storeu_si128((__m128i*)(dst + i + 16), b);
+    }
+    return i;
+}
+#endif
+
+#ifdef HAVE_NEON
+static size_t swap_neon(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    uint8x16_t a, b;
+    size_t i;
+
+    /* shift right by 4, then insert the byte shifted left above it */
+    for (i = 0; i + 32 <= len; i += 32) {
+        a = vld1q_u8(src + i);
+        b = vld1q_u8(src + i + 16);
+        vst1q_u8(dst + i, vsliq_n_u8(vshrq_n_u8(a, 4), a, 4));
+        vst1q_u8(dst + i + 16, vsliq_n_u8(vshrq_n_u8(b, 4), b, 4));
+    }
+    return i;
+}
+#endif
+
+/* NULL leaves the whole row to swap_tail() */
+static swap_fn swap_kernels[NUM_Y4PACK_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    swap_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    swap_neon,
+#else
+    NULL,
+#endif
+};
+
+/* index into the table, -1 until the first frame picks the best one */
+static int selected = -1;
+
+int y4pack_kernel_available(enum y4pack_kernel kernel)
+{
+    return kernel >= 0 && kernel < NUM_Y4PACK_KERNELS
+        && (kernel == Y4PACK_KERNEL_SCALAR || swap_kernels[kernel]);
+}
+
+const char* y4pack_kernel_name(enum y4pack_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void y4pack_select_kernel(int kernel)
+{
+    selected = simd_pick_kernel(kernel, NUM_Y4PACK_KERNELS, y4pack_kernel_available);
+}
+
+const char* y4_nibble_order_name(enum y4_nibble_order order)
+{
+    return order_names[order];
+}
+
+int y4_nibble_order_by_name(const char* name)
+{
+    int i;
+
+    for (i = 0; i < NUM_Y4_NIBBLE_ORDERS; i++) {
+        if (!strcmp(name, order_names[i]))
+            return i;
+    }
+    return -EINVAL;
+}
+
+struct y4pack_job {
+    const struct image* dst;
+    const struct image* src;
+    size_t len;
+    int swap;
+};
+
+static void repack_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct y4pack_job* job = (struct y4pack_job*)arg;
+    const swap_fn swap = swap_kernels[selected];
+    uint32_t y;
+    size_t i;
+
+    for (y = y0; y < y1; y++) {
+        uint8_t* d = image_row(job->dst, y);
+        const uint8_t* s = image_row(job->src, y);
+
+        if (!job->swap) {
+            if (d != s)
+                memcpy(d, s, job->len);
+            continue;
+        }
+        i = swap ? swap(d, s, job->len) : 0;
+        swap_tail(d, s, i, job->len);
+    }
+}
+
+int y4_repack(const struct image* dst, enum y4_nibble_order dst_order,
+    const struct image* src, enum y4_nibble_order src_order)
+{
+    struct y4pack_job job;
+    uint32_t width, height;
+
+    if (dst->fmt->v4l2 != V4L2_PIX_FMT_Y4 || src->fmt->v4l2 != V4L2_PIX_FMT_Y4
+        || dst_order >= NUM_Y4_NIBBLE_ORDERS || src_order >= NUM_Y4_NIBBLE_ORDERS)
+        return -EINVAL;
+    if (selected < 0)
+        y4pack_select_kernel(-1);
+
+    width = src->width < dst->width ? src->width : dst->width;
+    height = src->height < dst->height ? src->height : dst->height;
+    job.dst = dst;
+    job.src = src;
+    job.len = pix_fmt_row_bytes(dst->fmt, width);
+    job.swap = dst_order != src_order;
+
+    parallel_for(height, 64, repack_band, &job);
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Repacking of Y4 frames for display controllers that do not read them the
+ * way DRM_FORMAT_R4 is specified.
+ *
+ * R4 has pixel 0 in the high nibble of a byte, what the RGA and the CPU
+ * conversions write. Some controllers take pixel 0 from the low nibble,
+ * and some want rows at a pitch other than the one the buffer was
+ * allocated with. y4_repack() copies a frame to another pitch, swapping
+ * the nibbles of every byte on the way if the orders differ. The rows are
+ * written in whole vectors, so the destination can be a write-combined
+ * mapping.
+ */
+
+#ifndef __Y4PACK_H_INCLUDED__
+#define __Y4PACK_H_INCLUDED__
+
+#include "image.h"
+
+enum y4pack_kernel {
+	Y4PACK_KERNEL_SCALAR,
+	Y4PACK_KERNEL_SSE2,
+	Y4PACK_KERNEL_NEON,
+	NUM_Y4PACK_KERNELS
+};
+
+int y4pack_kernel_available(enum y4pack_kernel kernel);
+const char *y4pack_kernel_name(enum y4pack_kernel kernel);
+void y4pack_select_kernel(int kernel);
+
+enum y4_nibble_order {
+	/* pixel 0 in bits 7:4, DRM_FORMAT_R4 */
+	Y4_HIGH_FIRST,
+	/* pixel 0 in bits 3:0 */
+	Y4_LOW_FIRST,
+	NUM_Y4_NIBBLE_ORDERS
+};
+
+const char *y4_nibble_order_name(enum y4_nibble_order order);
+int y4_nibble_order_by_name(const char *name);
+
+/*
+ * The overlapping part of the Y4 frame src, in order src_order, to dst in
+ * order dst_order. dst and src may be the same image, but must not
+ * overlap otherwise.
+ */
+int y4_repack(const struct image *dst, enum y4_nibble_order dst_order,
+	      const struct image *src, enum y4_nibble_order src_order);
+
+#endif /* __Y4PACK_H_INCLUDED__ */
@@ -0,0 +1,285 @@
+/*
+ * Packing of 8 bit luma to 1 and 2 bpp gray.
+ *
+ * A pixel of luma y becomes level (y * (2^bpp - 1) + t) / 255, with t the
+ * blue noise threshold of its position or 127 to round to the nearest
+ * level, the same rule bluenoise.c uses for Y4. At 1 bpp that is
+ * y + t >= 255, a saturating add and a compare; at 2 bpp the division by
+ * 255 is done as (n + 1 + (n >> 8)) >> 8.
+ *
+ * The vector kernels turn the levels of 8 or 4 pixels into a byte with a
+ * weighted horizontal sum, pixel 0 getting the highest weight.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "bluenoise.h"
+#include "pool.h"
+#include "simd.h"
+#include "ypack.h"
+
+/* pixels of an RGB or Y4 row converted to luma at a time */
+#define YPACK_CHUNK 256
+
+/* packs pixels [0, n) of a row and returns n, a multiple of 16 */
+typedef uint32_t (*row_fn)(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* t, unsigned int bpp);
+
+static const char* kernel_names[NUM_YPACK_KERNELS] = {
+    "scalar", "sse2", "neon"
+};
+
+/* the thresholds without dither, one texture row of rounding */
+static const uint8_t __attribute__((aligned(64))) mid_gray[BLUENOISE_SIZE] = {
+#define MID8 127, 127, 127, 127, 127, 127, 127, 127
+    MID8, MID8, MID8, MID8, MID8, MID8, MID8, MID8
+#undef MID8
+};
+
+/* any pixels from x on, x a multiple of 8, unused low bits are cleared */
+static void row_tail(uint8_t* dst, const uint8_t* luma, uint32_t x, uint32_t width,
+    const uint8_t* t, unsigned int bpp)
+{
+    unsigned int steps = (1 << bpp) - 1, per_byte = 8 / bpp, i, q;
+    uint8_t b;
+
+    for (; x < width; x += per_byte) {
+        b = 0;
+        for (i = 0; i < per_byte && x + i < width; i++) {
+            q = (luma[x + i] * steps + t[(x + i) % BLUENOISE_SIZE]) / 255;
+            b |= q << (8 - bpp * (i + 1));
+        }
+        dst[x / per_byte] = b;
+    }
+}
+
+#ifdef HAVE_SSE2
+/* 2 bpp levels of 8 pixels in words, packed into bytes 0 and 8 */
+static inline __m128i pack2_epi16(__m128i y, __m128i t)
+{
+    __m128i n = _mm_add_epi16(_mm_mullo_epi16(y, _mm_set1_epi16(3)), t);
+    __m128i q = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(n, _mm_set1_epi16(1)),
+                                   _mm_srli_epi16(n, 8)),
+        8);
+
+    q = _mm_madd_epi16(q, _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1));
+    return _mm_add_epi32(q, _mm_srli_epi64(q, 32));
+}
+
+static uint32_t row_sse2(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* t, unsigned int bpp)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(-1);
+    const __m128i bits = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1,
+        -128, 64, 32, 16, 8, 4, 2, 1);
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i y = _mm_loadu_si128((const __m128i*)(luma + x));
+        __m128i th = _mm_load_si128((const __m128i*)(t + x % BLUENOISE_SIZE));
+
+        if (bpp == 1) {
+            /* y + t >= 255 saturates, the set bits of 8 pixels summed */
+            __m128i m = _mm_cmpeq_epi8(_mm_adds_epu8(y, th), ones);
+            __m128i s = _mm_sad_epu8(_mm_and_si128(m, bits), zero);
+
+            dst[x / 8] = _mm_cvtsi128_si32(s);
+            dst[x / 8 + 1] = _mm_extract_epi16(s, 4);
+        } else {
+            __m128i lo = pack2_epi16(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi8(th, zero));
+            __m128i hi = pack2_epi16(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(th, zero));
+
+            dst[x / 4] = _mm_cvtsi128_si32(lo);
+            dst[x / 4 + 1] = _mm_extract_epi16(lo, 4);
+            dst[x / 4 + 2] = _mm_cvtsi128_si32(hi);
+            dst[x / 4 + 3] = _mm_extract_epi16(hi, 4);
+        }
+    }
+    return x;
+}
+#endif
+
+#ifdef HAVE_NEON
+/* 2 bpp levels of 8 pixels, packed into the low bytes of the two lanes */
+static inline uint64x2_t pack2_u16(uint8x8_t y, uint8x8_t t, uint16x8_t weights)
+{
+    uint16x8_t n = vaddw_u8(vmull_u8(y, vdup_n_u8(3)), t);
+
+    n = vshrq_n_u16(vaddq_u16(vaddq_u16(n, vdupq_n_u16(1)), vshrq_n_u16(n, 8)), 8);
+    return vpaddlq_u32(vpaddlq_u16(vmulq_u16(n, weights)));
+}
+
+static uint32_t row_neon(uint8_t* dst, const uint8_t* luma, uint32_t width,
+    const uint8_t* t, unsigned int bpp)
+{
+    static const uint8_t bit_weights[16] = {
+        128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1
+    };
+    static const uint16_t level_weights[8] = { 64, 16, 4, 1, 64, 16, 4, 1 };
+    const uint8x16_t bits = vld1q_u8(bit_weights);
+    const uint16x8_t weights = vld1q_u16(level_weights);
+    uint32_t x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x16_t y = vld1q_u8(luma + x);
+        uint8x16_t th = vld1q_u8(t + x % BLUENOISE_SIZE);
+
+        if (bpp == 1) {
+            /* y + t >= 255 saturates, the set bits of 8 pixels summed */
+            uint8x16_t m = vceqq_u8(vqaddq_u8(y, th), vdupq_n_u8(255));
+            uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(m, bits))));
+
+            dst[x / 8] = vgetq_lane_u64(s, 0);
+            dst[x / 8 + 1] = vgetq_lane_u64(s, 1);
+        } else {
+            uint64x2_t lo = pack2_u16(vget_low_u8(y), vget_low_u8(th), weights);
+            uint64x2_t hi = pack2_u16(vget_high_u8(y), vget_high_u8(th), weights);
+
+            dst[x / 4] = vgetq_lane_u64(lo, 0);
+            dst[x / 4 + 1] = vgetq_lane_u64(lo, 1);
+            dst[x / 4 + 2] = vgetq_lane_u64(hi, 0);
+            dst[x / 4 + 3] = vgetq_lane_u64(hi, 1);
+        }
+    }
+    return x;
+}
+#endif
+
+/* NULL leaves the whole row to row_tail() */
+static row_fn row_kernels[NUM_YPACK_KERNELS] = {
+    NULL,
+#ifdef HAVE_SSE2
+    row_sse2,
+#else
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    row_neon,
+#else
+    NULL,
+#endif
+};
+
+/* index into the table, -1 until the first frame picks the best one */
+static int selected = -1;
+
+int ypack_kernel_available(enum ypack_kernel kernel)
+{
+    return kernel >= 0 && kernel < NUM_YPACK_KERNELS
+        && (kernel == YPACK_KERNEL_SCALAR || row_kernels[kernel]);
+}
+
+const char* ypack_kernel_name(enum ypack_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+void ypack_select_kernel(int kernel)
+{
+    selected = simd_pick_kernel(kernel, NUM_YPACK_KERNELS, ypack_kernel_available);
+}
+
+const struct pix_fmt* ypack_fmt(unsigned int bpp)
+{
+    switch (bpp) {
+    case 1:
+        return &pix_fmt_y1;
+    case 2:
+        return &pix_fmt_y2;
+    }
+    return NULL;
+}
+
+int ypack_supported(const struct pix_fmt* src)
+{
+    unsigned int cpp, chan[3];
+
+    return src->bpp == 8 || src->v4l2 == V4L2_PIX_FMT_Y4
+        || !pix_fmt_rgb_layout(src, &cpp, chan);
+}
+
+enum ypack_source {
+    YPACK_LUMA,
+    YPACK_Y4,
+    YPACK_RGB,
+};
+
+struct ypack_job {
+    const struct image* dst;
+    const struct image* src;
+    uint32_t width;
+    unsigned int bpp;
+    int dither;
+    enum ypack_source source;
+    unsigned int cpp;
+    unsigned int chan[3];
+};
+
+static void pack(uint8_t* d, const uint8_t* luma, uint32_t width,
+    const uint8_t* t, unsigned int bpp)
+{
+    row_fn row = row_kernels[selected];
+    uint32_t x = row ? row(d, luma, width, t, bpp) : 0;
+
+    row_tail(d, luma, x, width, t, bpp);
+}
+
+static void ypack_band(void* arg, uint32_t y0, uint32_t y1)
+{
+    struct ypack_job* job = (struct ypack_job*)arg;
+    uint8_t luma[YPACK_CHUNK];
+    uint32_t x, y, i, n;
+
+    for (y = y0; y < y1; y++) {
+        const uint8_t* s = image_row(job->src, y);
+        uint8_t* d = image_row(job->dst, y);
+        const uint8_t* t = job->dither ? bluenoise_row(y) : mid_gray;
+
+        if (job->source == YPACK_LUMA) {
+            pack(d, s, job->width, t, job->bpp);
+            continue;
+        }
+        /* chunks are a multiple of the texture size, so t lines up */
+        for (x = 0; x < job->width; x += YPACK_CHUNK) {
+            n = job->width - x < YPACK_CHUNK ? job->width - x : YPACK_CHUNK;
+            if (job->source == YPACK_Y4) {
+                for (i = 0; i < n; i += 2, s++) {
+                    luma[i] = (*s >> 4) * 17;
+                    luma[i + 1] = (*s & 0xf) * 17;
+                }
+            } else {
+                for (i = 0; i < n; i++, s += job->cpp)
+                    luma[i] = rgb_to_luma(s[job->chan[0]], s[job->chan[1]], s[job->chan[2]]);
+            }
+            pack(d + x * job->bpp / 8, luma, n, t, job->bpp);
+        }
+    }
+}
+
+int ypack_frame(const struct image* dst, const struct image* src, int dither)
+{
+    struct ypack_job job;
+    uint32_t height;
+
+    memset(&job, 0, sizeof(job));
+    if ((dst->fmt != &pix_fmt_y1 && dst->fmt != &pix_fmt_y2) || !ypack_supported(src->fmt))
+        return -EINVAL;
+    if (src->fmt->v4l2 == V4L2_PIX_FMT_Y4)
+        job.source = YPACK_Y4;
+    else if (src->fmt->bpp != 8 && !pix_fmt_rgb_layout(src->fmt, &job.cpp, job.chan))
+        job.source = YPACK_RGB;
+    if (selected < 0)
+        ypack_select_kernel(-1);
+
+    job.dst = dst;
+    job.src = src;
+    job.bpp = dst->fmt->bpp;
+    job.dither = dither;
+    job.width = src->width < dst->width ? src->width : dst->width;
+    height = src->height < dst->height ? src->height : dst->height;
+
+    parallel_for(height, 16, ypack_band, &job);
+    return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * Packing of gray to the 1 and 2 bpp formats Y1 and Y2 the fast waveforms
+ * of the panel take.
+ *
+ * Pen strokes and scrolling only use black and white, or 4 levels, and at
+ * 1 bpp a frame is a quarter of the Y4 bytes. Pixels are thresholded at
+ * mid gray, or ordered dithered with the blue noise texture of
+ * bluenoise.h.
+ *
+ * The source is the luma of an RGB frame or of a YUV plane, packed by the
+ * CPU instead of converting to Y4, or a Y4 frame the RGA wrote, packed as a
+ * post-pass after it.
+ */
+
+#ifndef __YPACK_H_INCLUDED__
+#define __YPACK_H_INCLUDED__
+
+#include "image.h"
+
+enum ypack_kernel {
+	YPACK_KERNEL_SCALAR,
+	YPACK_KERNEL_SSE2,
+	YPACK_KERNEL_NEON,
+	NUM_YPACK_KERNELS
+};
+
+int ypack_kernel_available(enum ypack_kernel kernel);
+const char *ypack_kernel_name(enum ypack_kernel kernel);
+void ypack_select_kernel(int kernel);
+
+/* pix_fmt_y1 or pix_fmt_y2 for 1 or 2 bpp, NULL for anything else */
+const struct pix_fmt *ypack_fmt(unsigned int bpp);
+
+int ypack_supported(const struct pix_fmt *src);
+/* dst is Y1 or Y2, dither with blue noise instead of a threshold */
+int ypack_frame(const struct image *dst, const struct image *src, int dither);
+
+#endif /* __YPACK_H_INCLUDED__ */
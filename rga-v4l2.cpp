@@ -14,6 +14,7 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <malloc.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -78,6 +79,8 @@ static size_t DST_CROP_H = 0;
 
 static int src_format = V4L2_PIX_FMT_NV12;
 static int dst_format = V4L2_PIX_FMT_NV12;
+/* row stride of the source as the driver reported it, 0 = width */
+static unsigned int src_bytesperline = 0;
 
 static struct timespec start, end;
 static unsigned long long time_consumed;
@@ -126,38 +129,256 @@ static unsigned int get_drm_format(unsigned int v4l2_format)
     }
     return DRM_FORMAT_NV12;
 }
-void fillbuffer(unsigned int v4l2_format, struct sp_bo* bo)
+
+/* planar YUV formats, all planes back to back in one buffer */
+struct yuv_layout {
+    unsigned int hsub;
+    unsigned int vsub;
+    /* one interleaved chroma plane instead of U and V planes */
+    int semiplanar;
+    /* V before U */
+    int swap_uv;
+};
+
+static const struct {
+    unsigned int v4l2_format;
+    struct yuv_layout l;
+} yuv_layouts[] = {
+    { V4L2_PIX_FMT_NV12, { 2, 2, 1, 0 } },
+    { V4L2_PIX_FMT_NV16, { 2, 1, 1, 0 } },
+    { V4L2_PIX_FMT_NV61, { 2, 1, 1, 1 } },
+    { V4L2_PIX_FMT_YUV420, { 2, 2, 0, 0 } },
+    { V4L2_PIX_FMT_YUV422P, { 2, 1, 0, 0 } },
+};
+
+static int get_yuv_layout(unsigned int v4l2_format, struct yuv_layout* l)
 {
-    if (v4l2_format == V4L2_PIX_FMT_NV12) {
-        int i, j;
-        unsigned char* y = (unsigned char*)bo->map_addr;
-        unsigned char* u = (unsigned char*)bo->map_addr + bo->height * bo->width;
-        unsigned char* v = (unsigned char*)bo->map_addr + bo->height * bo->width + 1;
-        int cs = 2;
-        int width = bo->width;
-        int height = bo->height;
-        int stride = width;
-
-        for (j = 0; j < height; j += 2) {
-            unsigned char* y1p = y + j * stride;
-            unsigned char* y2p = y1p + stride;
-            unsigned char* up = u + (j / 2) * stride * cs / 2;
-            unsigned char* vp = v + (j / 2) * stride * cs / 2;
-
-            for (i = 0; i < width; i += 2) {
-                uint32_t rgb = (((j / 16 + i / 16) & 0x3) << 6) + (((j / 16 + i / 16) & 0xc) << 12) + (((j / 16 + i / 16) & 0x30) << 18);
-                unsigned char* rgbp = (unsigned char*)&rgb;
-                unsigned char y = (0.299 * rgbp[2]) + (0.587 * rgbp[1]) + (0.114 * rgbp[0]);
+    unsigned int i;
+
+    for (i = 0; i < sizeof(yuv_layouts) / sizeof(yuv_layouts[0]); i++) {
+        if (yuv_layouts[i].v4l2_format == v4l2_format) {
+            *l = yuv_layouts[i].l;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+/*
+ * The test pattern is a diagonal of 16x16 tiles in 64 colors, tile (x, y)
+ * has color (x + y) & 63. The colors are converted once, so generating a
+ * frame is only stores, and all rows of a tile row are the same.
+ */
+#define PATTERN_TILE 16
+
+struct yuv_color {
+    uint8_t y, u, v;
+};
+
+static struct yuv_color pattern_yuv[64];
+
+static inline uint8_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
 
-                *(y2p++) = *(y1p++) = y;
-                *(y2p++) = *(y1p++) = y;
+static void init_pattern_colors()
+{
+    int idx, r, g, b, y;
+
+    for (idx = 0; idx < 64; idx++) {
+        r = (idx & 0x30) << 2;
+        g = (idx & 0xc) << 4;
+        b = (idx & 0x3) << 6;
+
+        /* BT.601 full range in 8 bit fixed point: 0.299, 0.587, 0.114, 0.565, 0.713 */
+        y = (77 * r + 150 * g + 29 * b + 128) >> 8;
+        pattern_yuv[idx].y = y;
+        pattern_yuv[idx].u = clamp_u8(((b - y) * 145 + (128 << 8) + 128) >> 8);
+        pattern_yuv[idx].v = clamp_u8(((r - y) * 183 + (128 << 8) + 128) >> 8);
+    }
+}
 
-                *up = (rgbp[0] - y) * 0.565 + 128;
-                *vp = (rgbp[2] - y) * 0.713 + 128;
-                up += cs;
-                vp += cs;
+struct yuv_gen_job {
+    const struct yuv_layout* l;
+    uint8_t* planes[3];
+    unsigned int strides[3];
+    unsigned int width;
+    /* luma rows y0 to y1, multiples of PATTERN_TILE */
+    unsigned int y0, y1;
+};
+
+/* one luma row and the chroma rows of tile row ty, copied over the rest */
+static void gen_yuv_rows(const struct yuv_gen_job* job)
+{
+    const struct yuv_layout* l = job->l;
+    unsigned int cw = job->width / l->hsub;
+    unsigned int ty, x, k, n, rows;
+    uint8_t *row, *urow, *vrow;
+
+    for (ty = job->y0 / PATTERN_TILE; ty * PATTERN_TILE < job->y1; ty++) {
+        unsigned int y = ty * PATTERN_TILE;
+
+        rows = job->y1 - y < PATTERN_TILE ? job->y1 - y : PATTERN_TILE;
+
+        row = job->planes[0] + (size_t)y * job->strides[0];
+        for (x = 0; x < job->width; x += PATTERN_TILE) {
+            n = job->width - x < PATTERN_TILE ? job->width - x : PATTERN_TILE;
+            memset(row + x, pattern_yuv[(ty + x / PATTERN_TILE) & 63].y, n);
+        }
+        for (k = 1; k < rows; k++)
+            memcpy(row + k * job->strides[0], row, job->width);
+
+        rows = (y + rows) / l->vsub - y / l->vsub;
+        y /= l->vsub;
+        if (l->semiplanar) {
+            row = job->planes[1] + (size_t)y * job->strides[1];
+            for (k = 0; k < cw; k++) {
+                const struct yuv_color* c = &pattern_yuv[(ty + k * l->hsub / PATTERN_TILE) & 63];
+
+                row[2 * k + l->swap_uv] = c->u;
+                row[2 * k + !l->swap_uv] = c->v;
             }
+            for (k = 1; k < rows; k++)
+                memcpy(row + k * job->strides[1], row, 2 * cw);
+        } else {
+            urow = job->planes[1] + (size_t)y * job->strides[1];
+            vrow = job->planes[2] + (size_t)y * job->strides[2];
+            for (x = 0; x < cw; x += PATTERN_TILE / l->hsub) {
+                const struct yuv_color* c = &pattern_yuv[(ty + x * l->hsub / PATTERN_TILE) & 63];
+
+                n = cw - x < PATTERN_TILE / l->hsub ? cw - x : PATTERN_TILE / l->hsub;
+                memset(urow + x, c->u, n);
+                memset(vrow + x, c->v, n);
+            }
+            for (k = 1; k < rows; k++) {
+                memcpy(urow + k * job->strides[1], urow, cw);
+                memcpy(vrow + k * job->strides[2], vrow, cw);
+            }
+        }
+    }
+}
+
+#define GEN_MAX_BANDS 8
+
+/*
+ * Threads for the bands of a frame, started by the first fillbuffer() and
+ * kept, as it runs for every source buffer. Worker n generates band n of
+ * each new generation of jobs, the caller band 0.
+ */
+struct gen_workers {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    unsigned int workers;
+    int started;
+    unsigned long generation;
+    const struct yuv_gen_job* jobs;
+    unsigned int bands;
+    unsigned int pending;
+};
+
+static struct gen_workers gen;
+
+static void* gen_worker(void* arg)
+{
+    unsigned int n = (uintptr_t)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&gen.lock);
+    for (;;) {
+        while (gen.generation == seen)
+            pthread_cond_wait(&gen.work, &gen.lock);
+        seen = gen.generation;
+        if (n >= gen.bands)
+            continue;
+
+        pthread_mutex_unlock(&gen.lock);
+        gen_yuv_rows(&gen.jobs[n]);
+        pthread_mutex_lock(&gen.lock);
+        if (!--gen.pending)
+            pthread_cond_signal(&gen.done);
+    }
+    return NULL;
+}
+
+static void gen_start_workers()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int n = cpus < 1 ? 1 : cpus > GEN_MAX_BANDS ? GEN_MAX_BANDS : cpus;
+    pthread_t thread;
+
+    pthread_mutex_init(&gen.lock, NULL);
+    pthread_cond_init(&gen.work, NULL);
+    pthread_cond_init(&gen.done, NULL);
+    for (gen.workers = 0; gen.workers + 1 < n; gen.workers++) {
+        if (pthread_create(&thread, NULL, gen_worker, (void*)(uintptr_t)(gen.workers + 1)))
+            break;
+        pthread_detach(thread);
+    }
+    gen.started = 1;
+}
+
+/* bands of whole tile rows, generated in parallel */
+static void gen_yuv_frame(const struct yuv_gen_job* jobs, unsigned int n)
+{
+    pthread_mutex_lock(&gen.lock);
+    gen.jobs = jobs;
+    gen.bands = n;
+    gen.pending = n - 1;
+    gen.generation++;
+    pthread_cond_broadcast(&gen.work);
+    pthread_mutex_unlock(&gen.lock);
+
+    gen_yuv_rows(&jobs[0]);
+
+    pthread_mutex_lock(&gen.lock);
+    while (gen.pending)
+        pthread_cond_wait(&gen.done, &gen.lock);
+    pthread_mutex_unlock(&gen.lock);
+}
+
+void fillbuffer(unsigned int v4l2_format, struct sp_bo* bo, unsigned int stride)
+{
+    struct yuv_layout l;
+
+    if (!get_yuv_layout(v4l2_format, &l)) {
+        struct yuv_gen_job jobs[GEN_MAX_BANDS];
+        unsigned int tiles = (bo->height + PATTERN_TILE - 1) / PATTERN_TILE;
+        unsigned int n, i;
+        size_t luma, chroma;
+
+        if (!stride)
+            stride = bo->width;
+        luma = (size_t)stride * bo->height;
+        chroma = (size_t)(l.semiplanar ? stride : stride / l.hsub) * (bo->height / l.vsub);
+        if (luma + chroma * (l.semiplanar ? 1 : 2) > bo->size) {
+            printf("buffer too small for a %ux%u frame with stride %u\n",
+                bo->width, bo->height, stride);
+            return;
+        }
+
+        if (!gen.started)
+            gen_start_workers();
+        n = gen.workers + 1;
+        if (n > tiles)
+            n = tiles;
+
+        for (i = 0; i < n; i++) {
+            jobs[i].l = &l;
+            jobs[i].planes[0] = (uint8_t*)bo->map_addr;
+            jobs[i].planes[1] = jobs[i].planes[0] + luma;
+            jobs[i].planes[2] = jobs[i].planes[1] + chroma;
+            jobs[i].strides[0] = stride;
+            jobs[i].strides[1] = l.semiplanar ? stride : stride / l.hsub;
+            jobs[i].strides[2] = stride / l.hsub;
+            jobs[i].width = bo->width;
+            jobs[i].y0 = tiles * i / n * PATTERN_TILE;
+            jobs[i].y1 = tiles * (i + 1) / n * PATTERN_TILE;
+            if (jobs[i].y1 > bo->height)
+                jobs[i].y1 = bo->height;
         }
+        gen_yuv_frame(jobs, n);
     } else if (v4l2_format == V4L2_PIX_FMT_ARGB32) {
         uint32_t* buf = (uint32_t*)bo->map_addr;
         int i, j;
@@ -289,6 +510,7 @@ static void init_mem2mem_dev()
         perror("ioctl");
         return;
     }
+    src_bytesperline = fmt.fmt.pix.bytesperline;
 
     /* Set format for capture */
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -483,7 +705,7 @@ static void start_mem2mem()
 
         drmPrimeHandleToFD(dev_sp->fd, bo->handle, 0, &src_buf_fd[i]);
         src_buf_bo[i] = bo;
-        fillbuffer(src_format, src_buf_bo[i]);
+        fillbuffer(src_format, src_buf_bo[i], src_bytesperline);
     }
 
     for (i = 0; i < num_dst_bufs; ++i) {
@@ -648,6 +870,7 @@ int main(int argc, char** argv)
 {
     int i;
     mem2mem_dev_name = (char*)"/dev/video0";
+    init_pattern_colors();
 
     for (;;) {
         int index;